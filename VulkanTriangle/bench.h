@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+/// \brief Result of one timed loop, printed by printBenchResult()
+struct BenchResult {
+	std::string name;
+	size_t iterations = 0;
+	double seconds = 0.0;
+
+	double opsPerSecond() const { return seconds > 0.0 ? iterations / seconds : 0.0; }
+	double nsPerOp() const { return iterations > 0 ? seconds * 1e9 / iterations : 0.0; }
+};
+
+inline void printBenchResult( const BenchResult & result )
+{
+	std::printf( "%-40s %10zu iters %10.3f ms %12.1f ns/op %14.0f op/s\n",
+				 result.name.c_str(),
+				 result.iterations,
+				 result.seconds * 1e3,
+				 result.nsPerOp(),
+				 result.opsPerSecond() );
+}
+
+/// \brief Time fn( i ) for i in [0, iterations) and print the result
+template <typename Fn>
+BenchResult runBenchmark( const std::string & name, size_t iterations, Fn && fn )
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for ( size_t i = 0; i < iterations; ++i )
+	{
+		fn( i );
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	BenchResult result;
+	result.name = name;
+	result.iterations = iterations;
+	result.seconds = std::chrono::duration<double>( end - start ).count();
+	printBenchResult( result );
+	return result;
+}
@@ -0,0 +1,712 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "thread_pool.h"
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define BLOCK_COMPRESS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC emits any intrinsic without /arch, the caller checks cpuid first
+#define BLOCK_COMPRESS_AVX2
+#else
+#define BLOCK_COMPRESS_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+#endif
+
+/// \brief Widest instruction set the block kernels may use
+enum class SimdLevel {
+	kScalar,
+	kSSE2,
+	kAVX2
+};
+
+inline const char * simdLevelName( SimdLevel level )
+{
+	switch ( level )
+	{
+	case SimdLevel::kSSE2: return "SSE2";
+	case SimdLevel::kAVX2: return "AVX2";
+	default: return "scalar";
+	}
+}
+
+/// \brief Best level this CPU supports, checked once
+inline SimdLevel detectSimdLevel()
+{
+	static const SimdLevel level = []() {
+#if defined( BLOCK_COMPRESS_X86 ) && defined( _MSC_VER )
+		int info[4];
+		__cpuid( info, 0 );
+		int max_leaf = info[0];
+		__cpuid( info, 1 );
+		bool sse2 = ( info[3] & ( 1 << 26 ) ) != 0;
+		bool os_saves_ymm = ( info[2] & ( 1 << 27 ) ) != 0 && ( _xgetbv( 0 ) & 6 ) == 6;
+		bool avx2 = false;
+		if ( max_leaf >= 7 && os_saves_ymm )
+		{
+			__cpuidex( info, 7, 0 );
+			avx2 = ( info[1] & ( 1 << 5 ) ) != 0;
+		}
+		return avx2 ? SimdLevel::kAVX2 : sse2 ? SimdLevel::kSSE2 : SimdLevel::kScalar;
+#elif defined( BLOCK_COMPRESS_X86 )
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports( "avx2" ) )
+			return SimdLevel::kAVX2;
+		if ( __builtin_cpu_supports( "sse2" ) )
+			return SimdLevel::kSSE2;
+		return SimdLevel::kScalar;
+#else
+		return SimdLevel::kScalar;
+#endif
+	}();
+	return level;
+}
+
+inline bool isBlockFormat( VkFormat format )
+{
+	switch ( format )
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/// \brief Bytes per 4x4 block, or per texel for RGBA8
+inline uint32_t formatBlockBytes( VkFormat format )
+{
+	switch ( format )
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+inline const char * formatName( VkFormat format )
+{
+	switch ( format )
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return "BC1";
+	case VK_FORMAT_BC3_UNORM_BLOCK: return "BC3";
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK: return "ETC2";
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK: return "ETC2A";
+	case VK_FORMAT_R8G8B8A8_UNORM: return "RGBA8";
+	default: return "unknown";
+	}
+}
+
+/// \brief Size of a width x height image in format
+inline size_t imageByteSize( VkFormat format, uint32_t width, uint32_t height )
+{
+	if ( !isBlockFormat( format ) )
+	{
+		return size_t( width ) * height * formatBlockBytes( format );
+	}
+	return size_t( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * formatBlockBytes( format );
+}
+
+/// \brief Block format to transcode RGBA8 textures to on this device,
+/// VK_FORMAT_R8G8B8A8_UNORM when it samples none of them
+inline VkFormat chooseTranscodeFormat( VkPhysicalDevice physical_device, bool needs_alpha )
+{
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures( physical_device, &features );
+
+	auto can_sample = [&]( VkFormat format ) {
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties( physical_device, format, &properties );
+		return ( properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT ) != 0;
+	};
+
+	if ( features.textureCompressionBC )
+	{
+		VkFormat format = needs_alpha ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		if ( can_sample( format ) )
+			return format;
+	}
+	if ( features.textureCompressionETC2 )
+	{
+		VkFormat format = needs_alpha ? VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK : VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK;
+		if ( can_sample( format ) )
+			return format;
+	}
+	return VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+namespace block_compress {
+
+/// 4x4 RGBA8 texels, row major
+using Block = uint8_t[64];
+
+/// \brief Copy a 4x4 block out of the image, clamping at the right and bottom edges
+inline void loadBlock( const uint8_t * rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, Block & block )
+{
+	uint32_t x0 = bx * 4, y0 = by * 4;
+	for ( uint32_t y = 0; y < 4; ++y )
+	{
+		const uint8_t * row = rgba + size_t( std::min( y0 + y, height - 1 ) ) * width * 4;
+		if ( x0 + 4 <= width )
+		{
+			memcpy( block + y * 16, row + size_t( x0 ) * 4, 16 );
+			continue;
+		}
+		for ( uint32_t x = 0; x < 4; ++x )
+		{
+			memcpy( block + y * 16 + x * 4, row + size_t( std::min( x0 + x, width - 1 ) ) * 4, 4 );
+		}
+	}
+}
+
+inline uint16_t to565( int r, int g, int b )
+{
+	return static_cast<uint16_t>( ( ( r * 31 + 127 ) / 255 ) << 11
+								  | ( ( g * 63 + 127 ) / 255 ) << 5
+								  | ( ( b * 31 + 127 ) / 255 ) );
+}
+
+inline void from565( uint16_t c, int rgb[3] )
+{
+	int r = c >> 11, g = ( c >> 5 ) & 63, b = c & 31;
+	rgb[0] = ( r << 3 ) | ( r >> 2 );
+	rgb[1] = ( g << 2 ) | ( g >> 4 );
+	rgb[2] = ( b << 3 ) | ( b >> 2 );
+}
+
+/// \brief Endpoints of a BC1 colour block from the per channel range,
+/// inset by 1/16 so the extremes land on the palette. Fills the
+/// dequantized endpoints the selectors are measured against.
+/// Returns false when both endpoints quantize to the same colour.
+inline bool colorEndpoints( const uint8_t min_rgba[4], const uint8_t max_rgba[4],
+							uint8_t out[8], int e0[3], int e1[3] )
+{
+	int lo[3], hi[3];
+	for ( int c = 0; c < 3; ++c )
+	{
+		int inset = ( max_rgba[c] - min_rgba[c] ) >> 4;
+		lo[c] = min_rgba[c] + inset;
+		hi[c] = max_rgba[c] - inset;
+	}
+
+	uint16_t c0 = to565( hi[0], hi[1], hi[2] );
+	uint16_t c1 = to565( lo[0], lo[1], lo[2] );
+	if ( c0 < c1 )
+	{
+		std::swap( c0, c1 );
+	}
+	// c0 > c1 selects the four colour palette
+	out[0] = static_cast<uint8_t>( c0 );
+	out[1] = static_cast<uint8_t>( c0 >> 8 );
+	out[2] = static_cast<uint8_t>( c1 );
+	out[3] = static_cast<uint8_t>( c1 >> 8 );
+	from565( c0, e0 );
+	from565( c1, e1 );
+	return c0 != c1;
+}
+
+/// Palette index for a texel at level 0 (c1) .. 3 (c0) along the line,
+/// BC1 orders the palette c0, c1, 2/3 c0, 1/3 c0
+constexpr uint32_t kLevelToIndex = 0x2D;
+
+inline void packSelectors( const int32_t levels[16], uint8_t out[8] )
+{
+	uint32_t selectors = 0;
+	for ( int i = 0; i < 16; ++i )
+	{
+		selectors |= ( ( kLevelToIndex >> ( levels[i] * 2 ) ) & 3 ) << ( i * 2 );
+	}
+	memcpy( out + 4, &selectors, 4 );
+}
+
+inline void encodeColorScalar( const Block & block, uint8_t out[8] )
+{
+	uint8_t mn[4] = { 255, 255, 255, 255 }, mx[4] = { 0, 0, 0, 0 };
+	for ( int i = 0; i < 16; ++i )
+	{
+		for ( int c = 0; c < 4; ++c )
+		{
+			mn[c] = std::min( mn[c], block[i * 4 + c] );
+			mx[c] = std::max( mx[c], block[i * 4 + c] );
+		}
+	}
+
+	int e0[3], e1[3];
+	if ( !colorEndpoints( mn, mx, out, e0, e1 ) )
+	{
+		memset( out + 4, 0, 4 );
+		return;
+	}
+
+	int dir[3] = { e0[0] - e1[0], e0[1] - e1[1], e0[2] - e1[2] };
+	int len2 = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+	int32_t levels[16];
+	for ( int i = 0; i < 16; ++i )
+	{
+		int dot = ( block[i * 4] - e1[0] ) * dir[0]
+			+ ( block[i * 4 + 1] - e1[1] ) * dir[1]
+			+ ( block[i * 4 + 2] - e1[2] ) * dir[2];
+		int dot6 = dot * 6;
+		levels[i] = ( dot6 > len2 ) + ( dot6 > 3 * len2 ) + ( dot6 > 5 * len2 );
+	}
+	packSelectors( levels, out );
+}
+
+#ifdef BLOCK_COMPRESS_X86
+inline void encodeColorSSE2( const Block & block, uint8_t out[8] )
+{
+	__m128i rows[4];
+	for ( int i = 0; i < 4; ++i )
+	{
+		rows[i] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + i * 16 ) );
+	}
+
+	// channel min / max over the 16 texels
+	__m128i mn = _mm_min_epu8( _mm_min_epu8( rows[0], rows[1] ), _mm_min_epu8( rows[2], rows[3] ) );
+	__m128i mx = _mm_max_epu8( _mm_max_epu8( rows[0], rows[1] ), _mm_max_epu8( rows[2], rows[3] ) );
+	mn = _mm_min_epu8( mn, _mm_shuffle_epi32( mn, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	mx = _mm_max_epu8( mx, _mm_shuffle_epi32( mx, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	mn = _mm_min_epu8( mn, _mm_shuffle_epi32( mn, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	mx = _mm_max_epu8( mx, _mm_shuffle_epi32( mx, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+
+	uint8_t mn_rgba[4], mx_rgba[4];
+	int32_t packed = _mm_cvtsi128_si32( mn );
+	memcpy( mn_rgba, &packed, 4 );
+	packed = _mm_cvtsi128_si32( mx );
+	memcpy( mx_rgba, &packed, 4 );
+
+	int e0[3], e1[3];
+	if ( !colorEndpoints( mn_rgba, mx_rgba, out, e0, e1 ) )
+	{
+		memset( out + 4, 0, 4 );
+		return;
+	}
+
+	int dir[3] = { e0[0] - e1[0], e0[1] - e1[1], e0[2] - e1[2] };
+	int len2 = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+	__m128i origin = _mm_setr_epi16( short( e1[0] ), short( e1[1] ), short( e1[2] ), 0,
+									 short( e1[0] ), short( e1[1] ), short( e1[2] ), 0 );
+	__m128i axis = _mm_setr_epi16( short( dir[0] ), short( dir[1] ), short( dir[2] ), 0,
+								   short( dir[0] ), short( dir[1] ), short( dir[2] ), 0 );
+	__m128i t1 = _mm_set1_epi32( len2 ), t3 = _mm_set1_epi32( 3 * len2 ), t5 = _mm_set1_epi32( 5 * len2 );
+	__m128i zero = _mm_setzero_si128();
+
+	alignas( 16 ) int32_t levels[16];
+	for ( int i = 0; i < 4; ++i )
+	{
+		// two texels per register as 16 bit rgba, madd leaves rg and ba partial dots
+		__m128i lo = _mm_madd_epi16( _mm_sub_epi16( _mm_unpacklo_epi8( rows[i], zero ), origin ), axis );
+		__m128i hi = _mm_madd_epi16( _mm_sub_epi16( _mm_unpackhi_epi8( rows[i], zero ), origin ), axis );
+		__m128i even = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( lo ), _mm_castsi128_ps( hi ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+		__m128i odd = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( lo ), _mm_castsi128_ps( hi ), _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+		__m128i dot = _mm_add_epi32( even, odd );
+		__m128i dot6 = _mm_add_epi32( _mm_slli_epi32( dot, 1 ), _mm_slli_epi32( dot, 2 ) );
+
+		// compares give -1 per threshold passed
+		__m128i level = _mm_add_epi32( _mm_add_epi32( _mm_cmpgt_epi32( dot6, t1 ), _mm_cmpgt_epi32( dot6, t3 ) ),
+									   _mm_cmpgt_epi32( dot6, t5 ) );
+		_mm_store_si128( reinterpret_cast<__m128i*>( levels + i * 4 ), _mm_sub_epi32( zero, level ) );
+	}
+	packSelectors( levels, out );
+}
+
+BLOCK_COMPRESS_AVX2 inline void encodeColorAVX2( const Block & block, uint8_t out[8] )
+{
+	__m256i top = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( block ) );
+	__m256i bottom = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( block + 32 ) );
+
+	__m256i mn256 = _mm256_min_epu8( top, bottom );
+	__m256i mx256 = _mm256_max_epu8( top, bottom );
+	__m128i mn = _mm_min_epu8( _mm256_castsi256_si128( mn256 ), _mm256_extracti128_si256( mn256, 1 ) );
+	__m128i mx = _mm_max_epu8( _mm256_castsi256_si128( mx256 ), _mm256_extracti128_si256( mx256, 1 ) );
+	mn = _mm_min_epu8( mn, _mm_shuffle_epi32( mn, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	mx = _mm_max_epu8( mx, _mm_shuffle_epi32( mx, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	mn = _mm_min_epu8( mn, _mm_shuffle_epi32( mn, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	mx = _mm_max_epu8( mx, _mm_shuffle_epi32( mx, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+
+	uint8_t mn_rgba[4], mx_rgba[4];
+	int32_t packed = _mm_cvtsi128_si32( mn );
+	memcpy( mn_rgba, &packed, 4 );
+	packed = _mm_cvtsi128_si32( mx );
+	memcpy( mx_rgba, &packed, 4 );
+
+	int e0[3], e1[3];
+	if ( !colorEndpoints( mn_rgba, mx_rgba, out, e0, e1 ) )
+	{
+		memset( out + 4, 0, 4 );
+		return;
+	}
+
+	int dir[3] = { e0[0] - e1[0], e0[1] - e1[1], e0[2] - e1[2] };
+	int len2 = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+	__m256i origin = _mm256_setr_epi16( short( e1[0] ), short( e1[1] ), short( e1[2] ), 0,
+										short( e1[0] ), short( e1[1] ), short( e1[2] ), 0,
+										short( e1[0] ), short( e1[1] ), short( e1[2] ), 0,
+										short( e1[0] ), short( e1[1] ), short( e1[2] ), 0 );
+	__m256i axis = _mm256_setr_epi16( short( dir[0] ), short( dir[1] ), short( dir[2] ), 0,
+									  short( dir[0] ), short( dir[1] ), short( dir[2] ), 0,
+									  short( dir[0] ), short( dir[1] ), short( dir[2] ), 0,
+									  short( dir[0] ), short( dir[1] ), short( dir[2] ), 0 );
+	__m256i t1 = _mm256_set1_epi32( len2 ), t3 = _mm256_set1_epi32( 3 * len2 ), t5 = _mm256_set1_epi32( 5 * len2 );
+
+	alignas( 32 ) int32_t levels[16];
+	for ( int half = 0; half < 2; ++half )
+	{
+		// eight texels, four per widened row
+		const uint8_t * texels = block + half * 32;
+		__m256i a = _mm256_cvtepu8_epi16( _mm_loadu_si128( reinterpret_cast<const __m128i*>( texels ) ) );
+		__m256i b = _mm256_cvtepu8_epi16( _mm_loadu_si128( reinterpret_cast<const __m128i*>( texels + 16 ) ) );
+		a = _mm256_madd_epi16( _mm256_sub_epi16( a, origin ), axis );
+		b = _mm256_madd_epi16( _mm256_sub_epi16( b, origin ), axis );
+
+		// hadd works per 128 bit lane, the permute puts the texels back in order
+		__m256i dot = _mm256_permute4x64_epi64( _mm256_hadd_epi32( a, b ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+		__m256i dot6 = _mm256_add_epi32( _mm256_slli_epi32( dot, 1 ), _mm256_slli_epi32( dot, 2 ) );
+		__m256i level = _mm256_add_epi32( _mm256_add_epi32( _mm256_cmpgt_epi32( dot6, t1 ), _mm256_cmpgt_epi32( dot6, t3 ) ),
+										  _mm256_cmpgt_epi32( dot6, t5 ) );
+		_mm256_store_si256( reinterpret_cast<__m256i*>( levels + half * 8 ), _mm256_sub_epi32( _mm256_setzero_si256(), level ) );
+	}
+	packSelectors( levels, out );
+}
+#endif
+
+inline void encodeColor( const Block & block, uint8_t out[8], SimdLevel level )
+{
+#ifdef BLOCK_COMPRESS_X86
+	if ( level == SimdLevel::kAVX2 )
+		return encodeColorAVX2( block, out );
+	if ( level == SimdLevel::kSSE2 )
+		return encodeColorSSE2( block, out );
+#endif
+	encodeColorScalar( block, out );
+}
+
+/// \brief BC3 alpha block, eight level mode between the alpha extremes
+inline void encodeAlpha( const Block & block, uint8_t out[8] )
+{
+	int a0 = 0, a1 = 255;
+	for ( int i = 0; i < 16; ++i )
+	{
+		a0 = std::max<int>( a0, block[i * 4 + 3] );
+		a1 = std::min<int>( a1, block[i * 4 + 3] );
+	}
+	out[0] = static_cast<uint8_t>( a0 );
+	out[1] = static_cast<uint8_t>( a1 );
+
+	uint64_t selectors = 0;
+	int range = a0 - a1;
+	if ( range > 0 )
+	{
+		for ( int i = 0; i < 16; ++i )
+		{
+			// level 0 is a1, 7 is a0, the palette stores a0, a1 then a0 -> a1
+			int level = ( ( block[i * 4 + 3] - a1 ) * 14 + range ) / ( range * 2 );
+			uint64_t index = level == 7 ? 0 : level == 0 ? 1 : 8 - level;
+			selectors |= index << ( i * 3 );
+		}
+	}
+	for ( int i = 0; i < 6; ++i )
+	{
+		out[2 + i] = static_cast<uint8_t>( selectors >> ( i * 8 ) );
+	}
+}
+
+/// ETC1 intensity modifier tables, the small and large step of each
+constexpr int kEtcModifiers[8][2] = {
+	{ 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+/// \brief Best modifier table and per texel indices for one sub-block
+inline int fitEtcSubBlock( const Block & block, const int texels[8], const int base[3], int & table, int indices[8] )
+{
+	int best_error = std::numeric_limits<int>::max();
+	for ( int t = 0; t < 8; ++t )
+	{
+		const int deltas[4] = { kEtcModifiers[t][0], kEtcModifiers[t][1], -kEtcModifiers[t][0], -kEtcModifiers[t][1] };
+		int error = 0;
+		int candidate[8];
+		for ( int i = 0; i < 8; ++i )
+		{
+			const uint8_t * texel = block + texels[i] * 4;
+			int texel_best = std::numeric_limits<int>::max();
+			for ( int m = 0; m < 4; ++m )
+			{
+				int e = 0;
+				for ( int c = 0; c < 3; ++c )
+				{
+					int d = std::clamp( base[c] + deltas[m], 0, 255 ) - texel[c];
+					e += d * d;
+				}
+				if ( e < texel_best )
+				{
+					texel_best = e;
+					candidate[i] = m;
+				}
+			}
+			error += texel_best;
+		}
+		if ( error < best_error )
+		{
+			best_error = error;
+			table = t;
+			std::copy( candidate, candidate + 8, indices );
+		}
+	}
+	return best_error;
+}
+
+/// \brief ETC2 RGB block using only the ETC1 individual and differential
+/// modes, which ETC2 decoders read unchanged. Tries both sub-block splits.
+inline void encodeEtc( const Block & block, uint8_t out[8] )
+{
+	uint64_t best_bits = 0;
+	int best_error = std::numeric_limits<int>::max();
+
+	for ( int flip = 0; flip < 2; ++flip )
+	{
+		// texel numbers (row major) of each half
+		int texels[2][8];
+		for ( int i = 0, n0 = 0, n1 = 0; i < 16; ++i )
+		{
+			int x = i % 4, y = i / 4;
+			bool second = flip ? y >= 2 : x >= 2;
+			if ( second )
+				texels[1][n1++] = i;
+			else
+				texels[0][n0++] = i;
+		}
+
+		int average[2][3];
+		for ( int s = 0; s < 2; ++s )
+		{
+			for ( int c = 0; c < 3; ++c )
+			{
+				int sum = 0;
+				for ( int i = 0; i < 8; ++i )
+					sum += block[texels[s][i] * 4 + c];
+				average[s][c] = ( sum + 4 ) / 8;
+			}
+		}
+
+		int q[2][3];
+		bool differential = true;
+		for ( int c = 0; c < 3; ++c )
+		{
+			q[0][c] = ( average[0][c] * 31 + 127 ) / 255;
+			q[1][c] = ( average[1][c] * 31 + 127 ) / 255;
+			int delta = q[1][c] - q[0][c];
+			differential = differential && delta >= -4 && delta <= 3;
+		}
+
+		int base[2][3];
+		uint64_t bits = 0;
+		for ( int c = 0; c < 3; ++c )
+		{
+			int shift = 59 - c * 8;
+			if ( differential )
+			{
+				base[0][c] = ( q[0][c] << 3 ) | ( q[0][c] >> 2 );
+				base[1][c] = ( q[1][c] << 3 ) | ( q[1][c] >> 2 );
+				bits |= uint64_t( q[0][c] ) << shift;
+				bits |= uint64_t( ( q[1][c] - q[0][c] ) & 7 ) << ( shift - 3 );
+			}
+			else
+			{
+				int i0 = ( average[0][c] * 15 + 127 ) / 255;
+				int i1 = ( average[1][c] * 15 + 127 ) / 255;
+				base[0][c] = ( i0 << 4 ) | i0;
+				base[1][c] = ( i1 << 4 ) | i1;
+				bits |= uint64_t( i0 ) << ( shift + 1 );
+				bits |= uint64_t( i1 ) << ( shift - 3 );
+			}
+		}
+
+		int error = 0;
+		for ( int s = 0; s < 2; ++s )
+		{
+			int table = 0, indices[8];
+			error += fitEtcSubBlock( block, texels[s], base[s], table, indices );
+			bits |= uint64_t( table ) << ( s ? 34 : 37 );
+			for ( int i = 0; i < 8; ++i )
+			{
+				// indices are stored column major, msb and lsb planes
+				int x = texels[s][i] % 4, y = texels[s][i] / 4;
+				int bit = x * 4 + y;
+				bits |= uint64_t( indices[i] >> 1 ) << ( 16 + bit );
+				bits |= uint64_t( indices[i] & 1 ) << bit;
+			}
+		}
+		bits |= uint64_t( differential ) << 33;
+		bits |= uint64_t( flip ) << 32;
+
+		if ( error < best_error )
+		{
+			best_error = error;
+			best_bits = bits;
+		}
+	}
+
+	for ( int i = 0; i < 8; ++i )
+	{
+		out[i] = static_cast<uint8_t>( best_bits >> ( 56 - i * 8 ) );
+	}
+}
+
+/// EAC alpha modifier tables
+constexpr int kEacModifiers[16][8] = {
+	{ -3, -6, -9, -15, 2, 5, 8, 14 },
+	{ -3, -7, -10, -13, 2, 6, 9, 12 },
+	{ -2, -5, -8, -13, 1, 4, 7, 12 },
+	{ -2, -4, -6, -13, 1, 3, 5, 12 },
+	{ -3, -6, -8, -12, 2, 5, 7, 11 },
+	{ -3, -7, -9, -11, 2, 6, 8, 10 },
+	{ -4, -7, -8, -11, 3, 6, 7, 10 },
+	{ -3, -5, -8, -11, 2, 4, 7, 10 },
+	{ -2, -6, -8, -10, 1, 5, 7, 9 },
+	{ -2, -5, -8, -10, 1, 4, 7, 9 },
+	{ -2, -4, -8, -10, 1, 3, 7, 9 },
+	{ -2, -5, -7, -10, 1, 4, 6, 9 },
+	{ -3, -4, -7, -10, 2, 3, 6, 9 },
+	{ -1, -2, -3, -10, 0, 1, 2, 9 },
+	{ -4, -6, -8, -9, 3, 5, 7, 8 },
+	{ -3, -5, -7, -9, 2, 4, 6, 8 }
+};
+
+/// \brief ETC2 EAC alpha block. Every table is tried with the multiplier
+/// that spans the block's alpha range, base centred between the extremes.
+inline void encodeEacAlpha( const Block & block, uint8_t out[8] )
+{
+	int lo = 255, hi = 0;
+	for ( int i = 0; i < 16; ++i )
+	{
+		lo = std::min<int>( lo, block[i * 4 + 3] );
+		hi = std::max<int>( hi, block[i * 4 + 3] );
+	}
+
+	// multiplier 0 decodes every texel to the base
+	uint64_t best_bits = uint64_t( lo ) << 56;
+	if ( lo != hi )
+	{
+		int best_error = std::numeric_limits<int>::max();
+		for ( int t = 0; t < 16; ++t )
+		{
+			const int * modifiers = kEacModifiers[t];
+			int span = modifiers[7] - modifiers[3];
+			int multiplier = std::clamp( ( hi - lo + span - 1 ) / span, 1, 15 );
+			int base = std::clamp( ( lo + hi - multiplier * ( modifiers[7] + modifiers[3] ) + 1 ) / 2, 0, 255 );
+
+			uint64_t bits = uint64_t( base ) << 56 | uint64_t( multiplier ) << 52 | uint64_t( t ) << 48;
+			int error = 0;
+			for ( int i = 0; i < 16; ++i )
+			{
+				int alpha = block[i * 4 + 3];
+				int texel_best = std::numeric_limits<int>::max(), index = 0;
+				for ( int m = 0; m < 8; ++m )
+				{
+					int d = std::clamp( base + modifiers[m] * multiplier, 0, 255 ) - alpha;
+					if ( d * d < texel_best )
+					{
+						texel_best = d * d;
+						index = m;
+					}
+				}
+				error += texel_best;
+				// indices are stored column major, first texel in the top bits
+				int x = i % 4, y = i / 4;
+				bits |= uint64_t( index ) << ( 45 - ( x * 4 + y ) * 3 );
+			}
+			if ( error < best_error )
+			{
+				best_error = error;
+				best_bits = bits;
+			}
+		}
+	}
+
+	for ( int i = 0; i < 8; ++i )
+	{
+		out[i] = static_cast<uint8_t>( best_bits >> ( 56 - i * 8 ) );
+	}
+}
+
+inline void encodeBlock( VkFormat format, const Block & block, uint8_t * out, SimdLevel level )
+{
+	switch ( format )
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		encodeColor( block, out, level );
+		break;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		encodeAlpha( block, out );
+		encodeColor( block, out + 8, level );
+		break;
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+		encodeEtc( block, out );
+		break;
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+		encodeEacAlpha( block, out );
+		encodeEtc( block, out + 8 );
+		break;
+	default:
+		break;
+	}
+}
+
+inline void encodeBlockRow( const uint8_t * rgba, uint32_t width, uint32_t height, uint32_t by,
+							VkFormat format, uint8_t * dst, SimdLevel level )
+{
+	uint32_t blocks_x = ( width + 3 ) / 4;
+	uint32_t block_bytes = formatBlockBytes( format );
+	uint8_t * row_out = dst + size_t( by ) * blocks_x * block_bytes;
+
+	alignas( 32 ) Block block;
+	for ( uint32_t bx = 0; bx < blocks_x; ++bx )
+	{
+		loadBlock( rgba, width, height, bx, by, block );
+		encodeBlock( format, block, row_out + size_t( bx ) * block_bytes, level );
+	}
+}
+
+} // namespace block_compress
+
+/// \brief Transcode an RGBA8 image into format, writing imageByteSize() bytes to dst.
+///
+/// Each row of blocks is one parallelFor() item, so the calling thread
+/// works alongside pool and a busy pool only costs parallelism.
+inline void transcodeRgba8( const uint8_t * rgba,
+							uint32_t width,
+							uint32_t height,
+							VkFormat format,
+							uint8_t * dst,
+							ThreadPool * pool = nullptr,
+							SimdLevel level = detectSimdLevel() )
+{
+	if ( !isBlockFormat( format ) )
+	{
+		memcpy( dst, rgba, imageByteSize( format, width, height ) );
+		return;
+	}
+
+	// rows go to parallelFor, too few aren't worth handing out
+	uint32_t block_rows = ( height + 3 ) / 4;
+	parallelFor( block_rows < 4 ? nullptr : pool, block_rows, [&]( size_t by ) {
+		block_compress::encodeBlockRow( rgba, width, height, static_cast<uint32_t>( by ), format, dst, level );
+	} );
+}
@@ -1,3 +1,18 @@
-C:\VulkanSDK\1.1.85.0\Bin32\glslangValidator.exe -V tri.vert
-C:\VulkanSDK\1.1.85.0\Bin32\glslangValidator.exe -V tri.frag
-pause
\ No newline at end of file
+@echo off
+rem Compiles the shaders into generated\*.inc, included by shaders.h.
+rem Runs as the pre-build step, set SHADER_OPT=0 to skip optimization.
+setlocal
+if "%VULKAN_SDK%"=="" set VULKAN_SDK=C:\VulkanSDK\1.1.85.0
+set OPT=-O
+if "%SHADER_OPT%"=="0" set OPT=-O0
+if not exist generated mkdir generated
+
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c tri.vert -o generated\tri_vert.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c tri_ubo.vert -o generated\tri_ubo_vert.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c tri.frag -o generated\tri_frag.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c spd.comp -o generated\spd_comp.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c particles.comp -o generated\particles_comp.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c particle.vert -o generated\particle_vert.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c particle.frag -o generated\particle_frag.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c hud.vert -o generated\hud_vert.inc || exit /b 1
+"%VULKAN_SDK%\Bin32\glslc.exe" %OPT% -mfmt=c hud.frag -o generated\hud_frag.inc || exit /b 1
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Compiles the shaders into generated/*.inc, included by shaders.h.
+# Run before building on Linux, set SHADER_OPT=0 to skip optimization.
+set -e
+cd "$(dirname "$0")"
+
+OPT=-O
+if [ "$SHADER_OPT" = "0" ]; then
+	OPT=-O0
+fi
+mkdir -p generated
+
+glslc $OPT -mfmt=c tri.vert -o generated/tri_vert.inc
+glslc $OPT -mfmt=c tri_ubo.vert -o generated/tri_ubo_vert.inc
+glslc $OPT -mfmt=c tri.frag -o generated/tri_frag.inc
+glslc $OPT -mfmt=c spd.comp -o generated/spd_comp.inc
+glslc $OPT -mfmt=c particles.comp -o generated/particles_comp.inc
+glslc $OPT -mfmt=c particle.vert -o generated/particle_vert.inc
+glslc $OPT -mfmt=c particle.frag -o generated/particle_frag.inc
+glslc $OPT -mfmt=c hud.vert -o generated/hud_vert.inc
+glslc $OPT -mfmt=c hud.frag -o generated/hud_frag.inc
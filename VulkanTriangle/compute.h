@@ -0,0 +1,287 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "descriptor_allocator.h"
+#include "frame_sync.h"
+#include "pipeline_manager.h"
+#include "spirv_reflect.h"
+#include "vk_handle.h"
+
+/// \brief A compute pipeline with its layout derived from the SPIR-V
+struct ComputeKernel {
+	std::string name;
+	UniquePipeline pipeline;
+	VkPipelineLayout layout = VK_NULL_HANDLE; // owned by the PipelineLayoutCache
+	std::vector<VkDescriptorSetLayout> set_layouts;
+	uint32_t push_constant_size = 0;
+};
+
+/// \brief Commands for one submission to the compute queue. Descriptor
+/// sets from bindings() and anything handed to keep() stay alive until
+/// the GPU has finished the batch.
+class ComputeBatch {
+public:
+	VkCommandBuffer commandBuffer() const { return command_buffer_; }
+
+	/// \brief Builder for a transient set, pass VK_SHADER_STAGE_COMPUTE_BIT
+	/// so the layout matches the kernel's reflected one
+	DescriptorBuilder bindings()
+	{
+		return DescriptorBuilder( *layout_cache_, descriptors_ );
+	}
+
+	void dispatch( const ComputeKernel & kernel,
+				   VkDescriptorSet set,
+				   const void * push_constants,
+				   uint32_t push_constant_size,
+				   uint32_t group_count_x,
+				   uint32_t group_count_y,
+				   uint32_t group_count_z = 1 )
+	{
+		if ( push_constant_size != kernel.push_constant_size )
+		{
+			throw std::runtime_error( "Push constants don't match kernel " + kernel.name );
+		}
+
+		vkCmdBindPipeline( command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline );
+		if ( set != VK_NULL_HANDLE )
+		{
+			vkCmdBindDescriptorSets( command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout,
+									 0, 1, &set, 0, nullptr );
+		}
+		if ( push_constant_size > 0 )
+		{
+			vkCmdPushConstants( command_buffer_, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT,
+								0, push_constant_size, push_constants );
+		}
+		vkCmdDispatch( command_buffer_, group_count_x, group_count_y, group_count_z );
+	}
+
+	void keep( UniqueImageView view )
+	{
+		views_.push_back( std::move( view ) );
+	}
+
+private:
+	friend class ComputeContext;
+
+	VkCommandBuffer command_buffer_ = VK_NULL_HANDLE;
+	DescriptorLayoutCache * layout_cache_ = nullptr;
+	DescriptorAllocator descriptors_;
+	std::vector<UniqueImageView> views_;
+	SyncPoint point_;
+	bool recording_ = false;
+};
+
+/// \brief Compute queue, kernels and batches.
+///
+/// Uses a dedicated compute queue family when the device has one, so
+/// batches run alongside the graphics queue. Otherwise batches go to the
+/// graphics queue. Either way they are tracked on QueueTrack::kCompute.
+/// Images written by batches must be owned by queueFamily().
+class ComputeContext {
+public:
+	/// Storage images a batch's pools reserve per set, MipGenerator binds
+	/// one per mip level
+	static constexpr uint32_t kStorageImagesPerSet = 13;
+
+	void init( VkDevice device,
+			   VkQueue queue,
+			   uint32_t queue_family,
+			   bool async,
+			   FrameSync * frame_sync,
+			   DescriptorLayoutCache * layout_cache,
+			   PipelineLayoutCache * pipeline_layout_cache,
+			   DescriptorStats * stats )
+	{
+		device_ = device;
+		queue_ = queue;
+		queue_family_ = queue_family;
+		async_ = async;
+		frame_sync_ = frame_sync;
+		layout_cache_ = layout_cache;
+		pipeline_layout_cache_ = pipeline_layout_cache;
+		stats_ = stats;
+
+		VkCommandPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.queueFamilyIndex = queue_family;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		if ( auto status = vkCreateCommandPool( device_, &pool_info, nullptr, &command_pool_ );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create compute command pool! Status: " + std::to_string( status ) );
+		}
+	}
+
+	/// \brief Create a kernel, set and push constant layout come from reflection
+	const ComputeKernel & createKernel( const std::string & name,
+										const ShaderCode & code,
+										const SpecializationConstants & constants = {} )
+	{
+		const auto & reflection = reflection_cache_.get( code.hash, code.words, code.word_count );
+		if ( reflection.stage != VK_SHADER_STAGE_COMPUTE_BIT )
+		{
+			throw std::runtime_error( "Not a compute shader! " + name );
+		}
+		auto layout_desc = mergeReflections( { &reflection } );
+
+		ComputeKernel kernel;
+		kernel.name = name;
+		for ( const auto & bindings : layout_desc.sets )
+		{
+			VkDescriptorSetLayoutCreateInfo layout_info = {};
+			layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layout_info.bindingCount = static_cast<uint32_t>( bindings.size() );
+			layout_info.pBindings = bindings.data();
+			kernel.set_layouts.push_back( layout_cache_->createDescriptorLayout( layout_info ) );
+		}
+		kernel.layout = pipeline_layout_cache_->createPipelineLayout( kernel.set_layouts, layout_desc.push_constants );
+		if ( !layout_desc.push_constants.empty() )
+		{
+			kernel.push_constant_size = layout_desc.push_constants[0].size;
+		}
+
+		VkShaderModuleCreateInfo module_info = {};
+		module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		module_info.codeSize = code.word_count * sizeof( uint32_t );
+		module_info.pCode = code.words;
+
+		UniqueShaderModule shader_module;
+		if ( auto status = vkCreateShaderModule( device_, &module_info, nullptr, shader_module.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create shader module! Status: " + std::to_string( status ) );
+		}
+
+		VkSpecializationInfo specialization;
+		VkComputePipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_info.stage.module = shader_module;
+		pipeline_info.stage.pName = "main";
+		pipeline_info.stage.pSpecializationInfo = constants.info( specialization );
+		pipeline_info.layout = kernel.layout;
+
+		if ( auto status = vkCreateComputePipelines( device_, VK_NULL_HANDLE, 1, &pipeline_info, nullptr,
+													 kernel.pipeline.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create compute pipeline " + name + "! Status: " + std::to_string( status ) );
+		}
+
+		kernels_.push_back( std::move( kernel ) );
+		return kernels_.back();
+	}
+
+	/// \brief Start recording a batch, reusing one the GPU has finished
+	ComputeBatch & begin()
+	{
+		ComputeBatch * batch = nullptr;
+		for ( auto & candidate : batches_ )
+		{
+			if ( !candidate->recording_ && frame_sync_->isComplete( candidate->point_ ) )
+			{
+				batch = candidate.get();
+				break;
+			}
+		}
+
+		if ( batch == nullptr )
+		{
+			auto created = std::make_unique<ComputeBatch>();
+			created->layout_cache_ = layout_cache_;
+			DescriptorAllocator::PoolSizes pool_sizes;
+			for ( auto & [type, ratio] : pool_sizes.sizes )
+			{
+				if ( type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE )
+					ratio = static_cast<float>( kStorageImagesPerSet );
+			}
+			created->descriptors_.init( device_, stats_, 16 );
+			created->descriptors_.setPoolSizes( std::move( pool_sizes ) );
+
+			VkCommandBufferAllocateInfo alloc_info = {};
+			alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			alloc_info.commandPool = command_pool_;
+			alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			alloc_info.commandBufferCount = 1;
+			if ( auto status = vkAllocateCommandBuffers( device_, &alloc_info, &created->command_buffer_ );
+				 status != VK_SUCCESS )
+			{
+				throw std::runtime_error( "Failed to allocate compute command buffer! Status: " + std::to_string( status ) );
+			}
+
+			batches_.push_back( std::move( created ) );
+			batch = batches_.back().get();
+		}
+
+		batch->descriptors_.resetPools();
+		batch->views_.clear();
+		batch->recording_ = true;
+
+		vkResetCommandBuffer( batch->command_buffer_, 0 );
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer( batch->command_buffer_, &begin_info );
+		return *batch;
+	}
+
+	/// \brief gpu_waitable as for FrameSync::submit(), needed when another
+	/// queue waits on the batch
+	SyncPoint submit( ComputeBatch & batch, const std::vector<SyncWait> & waits = {}, bool gpu_waitable = false )
+	{
+		if ( auto status = vkEndCommandBuffer( batch.command_buffer_ );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to record compute batch! Status: " + std::to_string( status ) );
+		}
+
+		batch.point_ = frame_sync_->submit( queue_, QueueTrack::kCompute, { batch.command_buffer_ }, waits,
+											 {}, {}, gpu_waitable );
+		batch.recording_ = false;
+		return batch.point_;
+	}
+
+	bool isAsync() const { return async_; }
+	uint32_t queueFamily() const { return queue_family_; }
+	VkQueue queue() const { return queue_; }
+	FrameSync & frameSync() const { return *frame_sync_; }
+	const ReflectionCache & reflectionCache() const { return reflection_cache_; }
+
+	/// \brief Destroy everything, the device must be idle
+	void cleanup()
+	{
+		for ( auto & batch : batches_ )
+		{
+			batch->descriptors_.cleanup();
+		}
+		batches_.clear();
+		kernels_.clear();
+		vkDestroyCommandPool( device_, command_pool_, nullptr );
+	}
+
+private:
+	VkDevice device_ = VK_NULL_HANDLE;
+	VkQueue queue_ = VK_NULL_HANDLE;
+	uint32_t queue_family_ = 0;
+	bool async_ = false;
+	FrameSync * frame_sync_ = nullptr;
+	DescriptorLayoutCache * layout_cache_ = nullptr;
+	PipelineLayoutCache * pipeline_layout_cache_ = nullptr;
+	DescriptorStats * stats_ = nullptr;
+
+	VkCommandPool command_pool_ = VK_NULL_HANDLE;
+	ReflectionCache reflection_cache_;
+	std::deque<ComputeKernel> kernels_;
+	std::deque<std::unique_ptr<ComputeBatch>> batches_;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+/// \brief What changed on screen since the last presented frame, for
+/// --idle rendering. Nothing damaged means the frame can be skipped.
+///
+/// Damage is either the full extent (resize, expose, camera) or a few
+/// rectangles, the old and new screen bounds of objects that changed.
+/// The rectangles go to VK_KHR_incremental_present as a hint, every
+/// frame is still rendered in full so the hint is always safe.
+///
+/// States are compared byte for byte, so they must be trivially
+/// copyable and have no padding, whose bytes are indeterminate.
+class DamageTracker {
+public:
+	static constexpr size_t kMaxRects = 8; // beyond this they merge into their bounds
+
+	/// \brief New extent, damages all of it
+	void resize( VkExtent2D extent )
+	{
+		extent_ = extent;
+		invalidate();
+	}
+
+	void invalidate()
+	{
+		full_ = true;
+		rects_.clear();
+	}
+
+	/// \brief Clipped to the extent, overlapping rectangles are merged
+	void add( VkRect2D rect )
+	{
+		if ( full_ || !clip( rect ) )
+		{
+			return;
+		}
+
+		for ( size_t i = 0; i < rects_.size(); )
+		{
+			if ( overlaps( rects_[i], rect ) )
+			{
+				rect = merge( rects_[i], rect );
+				rects_.erase( rects_.begin() + i );
+				i = 0;
+			}
+			else
+			{
+				++i;
+			}
+		}
+		rects_.push_back( rect );
+
+		if ( rects_.size() > kMaxRects )
+		{
+			VkRect2D bounds = rects_[0];
+			for ( const auto & r : rects_ )
+			{
+				bounds = merge( bounds, r );
+			}
+			rects_.assign( 1, bounds );
+		}
+	}
+
+	/// \brief Full damage when state differs from the last call, for
+	/// things that affect the whole view such as the camera
+	template <typename State>
+	void watch( const State & state )
+	{
+		static_assert( std::is_trivially_copyable_v<State>, "Damage state is compared byte for byte" );
+		if ( changed( watched_, &state, sizeof( state ) ) )
+		{
+			invalidate();
+		}
+	}
+
+	/// \brief Damage the old and new bounds of object id when its state
+	/// (anything that changes how it looks) or its bounds changed
+	template <typename State>
+	void object( uint32_t id, const State & state, VkRect2D bounds )
+	{
+		static_assert( std::is_trivially_copyable_v<State>, "Damage state is compared byte for byte" );
+		if ( id >= objects_.size() )
+		{
+			objects_.resize( id + 1 );
+		}
+
+		auto & tracked = objects_[id];
+		bool moved = !tracked.seen
+			|| memcmp( &tracked.bounds, &bounds, sizeof( bounds ) ) != 0;
+		if ( changed( tracked.state, &state, sizeof( state ) ) || moved )
+		{
+			if ( tracked.seen )
+			{
+				add( tracked.bounds );
+			}
+			add( bounds );
+		}
+		tracked.bounds = bounds;
+		tracked.seen = true;
+	}
+
+	bool damaged() const { return full_ || !rects_.empty(); }
+	bool full() const { return full_; }
+
+	/// \brief Chain onto VkPresentInfoKHR::pNext, next alone for full damage
+	/// or without incremental present
+	const void * presentRegions( const void * next, bool incremental_present )
+	{
+		if ( !incremental_present || full_ || rects_.empty() )
+		{
+			return next;
+		}
+
+		layers_.clear();
+		for ( const auto & rect : rects_ )
+		{
+			layers_.push_back( { rect.offset, rect.extent, 0 } );
+		}
+		region_.rectangleCount = static_cast<uint32_t>( layers_.size() );
+		region_.pRectangles = layers_.data();
+
+		regions_ = {};
+		regions_.sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR;
+		regions_.pNext = next;
+		regions_.swapchainCount = 1;
+		regions_.pRegions = &region_;
+		return &regions_;
+	}
+
+	/// \brief The damage has been drawn
+	void drawn()
+	{
+		if ( full_ )
+		{
+			full_frames_++;
+		}
+		else
+		{
+			uint64_t area = 0;
+			for ( const auto & rect : rects_ )
+			{
+				area += uint64_t( rect.extent.width ) * rect.extent.height;
+			}
+			partial_frames_++;
+			partial_coverage_ += double( area ) / std::max<uint64_t>( 1, uint64_t( extent_.width ) * extent_.height );
+		}
+		full_ = false;
+		rects_.clear();
+	}
+
+	/// \brief Nothing to draw, the caller is about to block
+	void idled() { idle_waits_++; }
+
+	void printStats() const
+	{
+		std::cout << "Idle rendering: " << full_frames_ << " full frames, "
+			<< partial_frames_ << " partial";
+		if ( partial_frames_ > 0 )
+		{
+			std::cout << " (" << 100.0 * partial_coverage_ / partial_frames_ << "% of the extent on average)";
+		}
+		std::cout << ", " << idle_waits_ << " idle waits" << std::endl;
+	}
+
+private:
+	struct TrackedObject {
+		std::vector<uint8_t> state;
+		VkRect2D bounds = {};
+		bool seen = false;
+	};
+
+	static bool changed( std::vector<uint8_t> & last, const void * state, size_t size )
+	{
+		auto bytes = static_cast<const uint8_t *>( state );
+		if ( last.size() == size && memcmp( last.data(), bytes, size ) == 0 )
+		{
+			return false;
+		}
+		last.assign( bytes, bytes + size );
+		return true;
+	}
+
+	bool clip( VkRect2D & rect ) const
+	{
+		int32_t x0 = std::max( rect.offset.x, 0 );
+		int32_t y0 = std::max( rect.offset.y, 0 );
+		int32_t x1 = std::min<int64_t>( int64_t( rect.offset.x ) + rect.extent.width, extent_.width );
+		int32_t y1 = std::min<int64_t>( int64_t( rect.offset.y ) + rect.extent.height, extent_.height );
+		if ( x1 <= x0 || y1 <= y0 )
+		{
+			return false;
+		}
+		rect = { { x0, y0 }, { uint32_t( x1 - x0 ), uint32_t( y1 - y0 ) } };
+		return true;
+	}
+
+	static bool overlaps( const VkRect2D & a, const VkRect2D & b )
+	{
+		return a.offset.x < b.offset.x + int32_t( b.extent.width )
+			&& b.offset.x < a.offset.x + int32_t( a.extent.width )
+			&& a.offset.y < b.offset.y + int32_t( b.extent.height )
+			&& b.offset.y < a.offset.y + int32_t( a.extent.height );
+	}
+
+	static VkRect2D merge( const VkRect2D & a, const VkRect2D & b )
+	{
+		int32_t x0 = std::min( a.offset.x, b.offset.x );
+		int32_t y0 = std::min( a.offset.y, b.offset.y );
+		int32_t x1 = std::max( a.offset.x + int32_t( a.extent.width ), b.offset.x + int32_t( b.extent.width ) );
+		int32_t y1 = std::max( a.offset.y + int32_t( a.extent.height ), b.offset.y + int32_t( b.extent.height ) );
+		return { { x0, y0 }, { uint32_t( x1 - x0 ), uint32_t( y1 - y0 ) } };
+	}
+
+	VkExtent2D extent_ = {};
+	bool full_ = true;
+	std::vector<VkRect2D> rects_;
+	std::vector<uint8_t> watched_;
+	std::vector<TrackedObject> objects_;
+
+	std::vector<VkRectLayerKHR> layers_;
+	VkPresentRegionKHR region_ = {};
+	VkPresentRegionsKHR regions_ = {};
+
+	uint64_t full_frames_ = 0;
+	uint64_t partial_frames_ = 0;
+	double partial_coverage_ = 0.0;
+	uint64_t idle_waits_ = 0;
+};
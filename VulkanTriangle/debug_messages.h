@@ -0,0 +1,424 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "hash_util.h"
+
+/// \brief A message as copied out of the debug callback, fixed size so
+/// the callback never allocates
+struct DebugMessage {
+	static constexpr size_t kMaxName = 64;
+	static constexpr size_t kMaxText = 2048;
+
+	uint64_t key = 0;
+	uint64_t count = 0; // occurrences of key when it was pushed
+	VkDebugUtilsMessageSeverityFlagBitsEXT severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+	VkDebugUtilsMessageTypeFlagsEXT type = 0;
+	char name[kMaxName] = {};
+	char text[kMaxText] = {};
+};
+
+/// \brief Bounded lock-free ring, any number of producers and a single
+/// consumer (Vyukov). push() fails rather than waits when it is full.
+template <size_t Capacity>
+class MessageRing {
+	static_assert( ( Capacity & ( Capacity - 1 ) ) == 0, "Capacity must be a power of two" );
+
+public:
+	MessageRing()
+	{
+		for ( size_t i = 0; i < Capacity; ++i )
+		{
+			slots_[i].sequence.store( i, std::memory_order_relaxed );
+		}
+	}
+
+	/// \brief fill writes the claimed slot's message
+	template <typename Fill>
+	bool push( Fill && fill )
+	{
+		uint64_t position = tail_.load( std::memory_order_relaxed );
+		Slot * slot;
+		for ( ;; )
+		{
+			slot = &slots_[position & ( Capacity - 1 )];
+			uint64_t sequence = slot->sequence.load( std::memory_order_acquire );
+			int64_t diff = static_cast<int64_t>( sequence ) - static_cast<int64_t>( position );
+			if ( diff == 0 )
+			{
+				if ( tail_.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+					break;
+			}
+			else if ( diff < 0 )
+			{
+				return false;
+			}
+			else
+			{
+				position = tail_.load( std::memory_order_relaxed );
+			}
+		}
+
+		fill( slot->message );
+		slot->sequence.store( position + 1, std::memory_order_release );
+		return true;
+	}
+
+	/// \brief Consumer thread only
+	bool pop( DebugMessage & message )
+	{
+		auto & slot = slots_[head_ & ( Capacity - 1 )];
+		if ( slot.sequence.load( std::memory_order_acquire ) != head_ + 1 )
+		{
+			return false;
+		}
+		message = slot.message;
+		slot.sequence.store( head_ + Capacity, std::memory_order_release );
+		head_++;
+		return true;
+	}
+
+private:
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		DebugMessage message;
+	};
+
+	std::array<Slot, Capacity> slots_;
+	alignas( 64 ) std::atomic<uint64_t> tail_{ 0 };
+	alignas( 64 ) uint64_t head_ = 0;
+};
+
+/// \brief Validation and debug messages without stalling the threads
+/// that trigger them.
+///
+/// The callback counts the message in a lock-free table keyed by message
+/// id and only copies it into the ring the first time, and again at 10,
+/// 100, 1000... occurrences, so a message repeated every draw costs an
+/// atomic increment. A background thread drains the ring and prints, at
+/// most kLinesPerSecond lines with a short burst allowance. Performance
+/// messages are counted per id and can be queried at any time. Verbose
+/// and info messages are only counted unless print_verbose is set.
+class DebugMessenger {
+public:
+	static constexpr size_t kRingCapacity = 512;
+	static constexpr size_t kTableSize = 1024;
+	static constexpr double kLinesPerSecond = 20.0;
+	static constexpr double kBurstLines = 50.0;
+
+	struct Counter {
+		uint64_t key;
+		std::string name;
+		uint64_t count;
+		bool performance;
+	};
+
+	struct Stats {
+		uint64_t errors = 0;
+		uint64_t warnings = 0;
+		uint64_t info = 0;
+		uint64_t verbose = 0;
+		uint64_t performance = 0;
+		uint64_t dropped = 0;      // ring full, text lost but still counted
+		uint64_t rate_limited = 0; // drained but not printed
+	};
+
+	DebugMessenger() : ring_( std::make_unique<MessageRing<kRingCapacity>>() ) {}
+
+	~DebugMessenger()
+	{
+		stop();
+	}
+
+	DebugMessenger( const DebugMessenger & ) = delete;
+	DebugMessenger & operator=( const DebugMessenger & ) = delete;
+
+	void start( bool print_verbose )
+	{
+		print_verbose_ = print_verbose;
+		running_ = true;
+		drain_thread_ = std::thread( [this]() { drainLoop(); } );
+	}
+
+	/// \brief Drains what is left, call after the messenger is destroyed
+	void stop()
+	{
+		if ( !drain_thread_.joinable() )
+		{
+			return;
+		}
+		running_ = false;
+		drain_thread_.join();
+		drain();
+	}
+
+	/// \brief pfnUserCallback, with this as pUserData
+	static VKAPI_ATTR VkBool32 VKAPI_CALL callback( VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+													 VkDebugUtilsMessageTypeFlagsEXT type,
+													 const VkDebugUtilsMessengerCallbackDataEXT * data,
+													 void * user_data )
+	{
+		static_cast<DebugMessenger *>( user_data )->onMessage( severity, type, data );
+		return VK_FALSE;
+	}
+
+	Stats stats() const
+	{
+		Stats stats;
+		stats.errors = errors_.load( std::memory_order_relaxed );
+		stats.warnings = warnings_.load( std::memory_order_relaxed );
+		stats.info = info_.load( std::memory_order_relaxed );
+		stats.verbose = verbose_.load( std::memory_order_relaxed );
+		stats.performance = performance_.load( std::memory_order_relaxed );
+		stats.dropped = dropped_.load( std::memory_order_relaxed );
+		stats.rate_limited = rate_limited_.load( std::memory_order_relaxed );
+		return stats;
+	}
+
+	/// \brief Per id counts, most frequent first
+	std::vector<Counter> counters( bool performance_only ) const
+	{
+		std::vector<Counter> counters;
+		std::lock_guard<std::mutex> lock( names_mutex_ );
+		for ( const auto & entry : table_ )
+		{
+			uint64_t key = entry.key.load( std::memory_order_acquire );
+			bool performance = entry.performance.load( std::memory_order_relaxed );
+			if ( key == 0 || ( performance_only && !performance ) )
+				continue;
+
+			auto name = names_.find( key );
+			counters.push_back( { key,
+								  name != names_.end() ? name->second : std::string( "(pending)" ),
+								  entry.count.load( std::memory_order_relaxed ),
+								  performance } );
+		}
+		std::sort( counters.begin(), counters.end(), []( const Counter & a, const Counter & b ) { return a.count > b.count; } );
+		return counters;
+	}
+
+	void printStats( size_t top = 5 ) const
+	{
+		auto s = stats();
+		std::cout << "Validation: " << s.errors << " errors, " << s.warnings << " warnings, "
+			<< s.performance << " performance, " << s.info << " info, " << s.verbose << " verbose, "
+			<< s.dropped << " dropped, " << s.rate_limited << " rate limited" << std::endl;
+
+		auto all = counters( false );
+		for ( size_t i = 0; i < std::min( top, all.size() ); ++i )
+		{
+			std::cout << "\t" << all[i].count << "x " << all[i].name
+				<< ( all[i].performance ? " (performance)" : "" ) << std::endl;
+		}
+	}
+
+private:
+	struct TableEntry {
+		std::atomic<uint64_t> key{ 0 };
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<bool> performance{ false };
+	};
+
+	void onMessage( VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+					VkDebugUtilsMessageTypeFlagsEXT type,
+					const VkDebugUtilsMessengerCallbackDataEXT * data )
+	{
+		if ( severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT )
+			errors_.fetch_add( 1, std::memory_order_relaxed );
+		else if ( severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT )
+			warnings_.fetch_add( 1, std::memory_order_relaxed );
+		else if ( severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT )
+			info_.fetch_add( 1, std::memory_order_relaxed );
+		else
+			verbose_.fetch_add( 1, std::memory_order_relaxed );
+
+		bool performance = ( type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT ) != 0;
+		if ( performance )
+		{
+			performance_.fetch_add( 1, std::memory_order_relaxed );
+		}
+
+		// Loader and driver messages often have no id, their name or
+		// text tells them apart
+		uint64_t key = data->messageIdNumber != 0
+			? static_cast<uint32_t>( data->messageIdNumber )
+			: data->pMessageIdName != nullptr
+				? hashBytes( data->pMessageIdName, strlen( data->pMessageIdName ) )
+				: hashBytes( data->pMessage, std::min<size_t>( strlen( data->pMessage ), 64 ) );
+		key = key != 0 ? key : 1; // 0 marks a free table entry
+
+		uint64_t count = 1;
+		if ( auto * entry = findEntry( key ) )
+		{
+			count = entry->count.fetch_add( 1, std::memory_order_relaxed ) + 1;
+			if ( performance )
+				entry->performance.store( true, std::memory_order_relaxed );
+		}
+
+		bool printable = print_verbose_
+			|| ( severity & ( VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT ) );
+		if ( !isReportedCount( count ) || ( !printable && count > 1 ) )
+		{
+			return;
+		}
+
+		// the first one is always pushed, so the name is known for counters()
+		bool pushed = ring_->push( [&]( DebugMessage & message ) {
+			message.key = key;
+			message.count = printable ? count : 0;
+			message.severity = severity;
+			message.type = type;
+			copyTruncated( message.name, DebugMessage::kMaxName, data->pMessageIdName );
+			copyTruncated( message.text, DebugMessage::kMaxText, printable ? data->pMessage : nullptr );
+		} );
+		if ( !pushed )
+		{
+			dropped_.fetch_add( 1, std::memory_order_relaxed );
+		}
+	}
+
+	/// \brief 1, 10, 100...
+	static bool isReportedCount( uint64_t count )
+	{
+		while ( count % 10 == 0 )
+		{
+			count /= 10;
+		}
+		return count == 1;
+	}
+
+	/// \brief Open addressing, entries are never removed. Null when the
+	/// table is full, the message is then still printed but not counted.
+	TableEntry * findEntry( uint64_t key )
+	{
+		for ( size_t probe = 0; probe < kTableSize; ++probe )
+		{
+			auto & entry = table_[( key + probe ) & ( kTableSize - 1 )];
+			uint64_t existing = entry.key.load( std::memory_order_acquire );
+			if ( existing == key )
+				return &entry;
+			if ( existing == 0 )
+			{
+				if ( entry.key.compare_exchange_strong( existing, key, std::memory_order_acq_rel ) || existing == key )
+					return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	static void copyTruncated( char * dst, size_t size, const char * src )
+	{
+		if ( src == nullptr )
+		{
+			dst[0] = '\0';
+			return;
+		}
+		size_t length = strlen( src );
+		if ( length < size )
+		{
+			memcpy( dst, src, length + 1 );
+			return;
+		}
+		memcpy( dst, src, size - 4 );
+		memcpy( dst + size - 4, "...", 4 );
+	}
+
+	void drainLoop()
+	{
+		while ( running_ )
+		{
+			drain();
+			std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+		}
+	}
+
+	void drain()
+	{
+		DebugMessage message;
+		while ( ring_->pop( message ) )
+		{
+			{
+				std::lock_guard<std::mutex> lock( names_mutex_ );
+				if ( !names_.count( message.key ) )
+				{
+					names_[message.key] = message.name[0] != '\0' ? message.name : "(unnamed)";
+				}
+			}
+
+			if ( message.count == 0 )
+			{
+				continue;
+			}
+			if ( !takeToken() )
+			{
+				rate_limited_.fetch_add( 1, std::memory_order_relaxed );
+				continue;
+			}
+
+			if ( message.count == 1 )
+			{
+				std::cerr << "validation layer: " << message.text << std::endl;
+			}
+			else
+			{
+				std::cerr << "validation layer: " << message.name << " repeated " << message.count << " times" << std::endl;
+			}
+		}
+	}
+
+	/// \brief Token bucket for printed lines
+	bool takeToken()
+	{
+		auto now = std::chrono::steady_clock::now();
+		if ( last_refill_ != std::chrono::steady_clock::time_point() )
+		{
+			tokens_ += std::chrono::duration<double>( now - last_refill_ ).count() * kLinesPerSecond;
+			tokens_ = std::min( tokens_, kBurstLines );
+		}
+		last_refill_ = now;
+
+		if ( tokens_ < 1.0 )
+		{
+			return false;
+		}
+		tokens_ -= 1.0;
+		return true;
+	}
+
+	std::unique_ptr<MessageRing<kRingCapacity>> ring_;
+	std::array<TableEntry, kTableSize> table_;
+	bool print_verbose_ = false;
+
+	std::atomic<uint64_t> errors_{ 0 };
+	std::atomic<uint64_t> warnings_{ 0 };
+	std::atomic<uint64_t> info_{ 0 };
+	std::atomic<uint64_t> verbose_{ 0 };
+	std::atomic<uint64_t> performance_{ 0 };
+	std::atomic<uint64_t> dropped_{ 0 };
+	std::atomic<uint64_t> rate_limited_{ 0 };
+
+	// drain thread only
+	double tokens_ = kBurstLines;
+	std::chrono::steady_clock::time_point last_refill_;
+
+	mutable std::mutex names_mutex_;
+	std::unordered_map<uint64_t, std::string> names_;
+
+	std::atomic<bool> running_{ false };
+	std::thread drain_thread_;
+};
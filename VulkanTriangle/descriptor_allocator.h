@@ -0,0 +1,651 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash_util.h"
+
+/// \brief Counters shared by the descriptor allocator and caches
+struct DescriptorStats {
+	uint64_t allocations = 0;
+	uint64_t pools_created = 0;
+	uint64_t pool_resets = 0;
+	uint64_t layout_cache_hits = 0;
+	uint64_t layout_cache_misses = 0;
+	uint64_t set_cache_hits = 0;
+	uint64_t set_cache_misses = 0;
+	uint64_t pipeline_layout_cache_hits = 0;
+	uint64_t pipeline_layout_cache_misses = 0;
+	std::chrono::nanoseconds alloc_time{ 0 };
+
+	double allocationsPerSecond() const
+	{
+		auto seconds = std::chrono::duration<double>( alloc_time ).count();
+		return seconds > 0.0 ? allocations / seconds : 0.0;
+	}
+};
+
+/// \brief Hands out descriptor sets from a chain of pools.
+///
+/// A new pool is grabbed whenever the current one reports
+/// VK_ERROR_OUT_OF_POOL_MEMORY / VK_ERROR_FRAGMENTED_POOL. resetPools()
+/// returns every set in one vkResetDescriptorPool per pool, so one
+/// allocator per frame in flight gives cheap transient sets.
+class DescriptorAllocator {
+public:
+	/// Descriptors of each type reserved per set in a new pool
+	struct PoolSizes {
+		std::vector<std::pair<VkDescriptorType, float>> sizes = {
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+		};
+	};
+
+	void init( VkDevice device, DescriptorStats * stats, uint32_t sets_per_pool = 64 )
+	{
+		device_ = device;
+		stats_ = stats;
+		sets_per_pool_ = sets_per_pool;
+	}
+
+	/// \brief Applies to pools created from here on
+	void setPoolSizes( PoolSizes pool_sizes )
+	{
+		pool_sizes_ = std::move( pool_sizes );
+	}
+
+	bool allocate( VkDescriptorSet * set, VkDescriptorSetLayout layout )
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		if ( current_pool_ == VK_NULL_HANDLE )
+		{
+			current_pool_ = grabPool();
+			used_pools_.push_back( current_pool_ );
+		}
+
+		VkDescriptorSetAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.descriptorPool = current_pool_;
+		alloc_info.descriptorSetCount = 1;
+		alloc_info.pSetLayouts = &layout;
+
+		auto status = vkAllocateDescriptorSets( device_, &alloc_info, set );
+		if ( status == VK_ERROR_FRAGMENTED_POOL || status == VK_ERROR_OUT_OF_POOL_MEMORY )
+		{
+			current_pool_ = grabPool();
+			used_pools_.push_back( current_pool_ );
+			alloc_info.descriptorPool = current_pool_;
+			status = vkAllocateDescriptorSets( device_, &alloc_info, set );
+		}
+
+		if ( stats_ )
+		{
+			stats_->alloc_time += std::chrono::high_resolution_clock::now() - start;
+			if ( status == VK_SUCCESS )
+				stats_->allocations++;
+		}
+
+		return status == VK_SUCCESS;
+	}
+
+	/// \brief Return every set handed out so far; pools are kept for reuse
+	void resetPools()
+	{
+		for ( auto pool : used_pools_ )
+		{
+			vkResetDescriptorPool( device_, pool, 0 );
+			free_pools_.push_back( pool );
+		}
+
+		if ( stats_ )
+			stats_->pool_resets += used_pools_.size();
+
+		used_pools_.clear();
+		current_pool_ = VK_NULL_HANDLE;
+	}
+
+	void cleanup()
+	{
+		for ( auto pool : free_pools_ )
+		{
+			vkDestroyDescriptorPool( device_, pool, nullptr );
+		}
+		for ( auto pool : used_pools_ )
+		{
+			vkDestroyDescriptorPool( device_, pool, nullptr );
+		}
+		free_pools_.clear();
+		used_pools_.clear();
+		current_pool_ = VK_NULL_HANDLE;
+	}
+
+	VkDevice device() const { return device_; }
+	size_t poolCount() const { return free_pools_.size() + used_pools_.size(); }
+
+private:
+	VkDescriptorPool grabPool()
+	{
+		if ( !free_pools_.empty() )
+		{
+			auto pool = free_pools_.back();
+			free_pools_.pop_back();
+			return pool;
+		}
+
+		return createPool();
+	}
+
+	VkDescriptorPool createPool()
+	{
+		std::vector<VkDescriptorPoolSize> pool_sizes;
+		pool_sizes.reserve( pool_sizes_.sizes.size() );
+		for ( const auto & [type, ratio] : pool_sizes_.sizes )
+		{
+			pool_sizes.push_back( { type, static_cast<uint32_t>( ratio * sets_per_pool_ ) } );
+		}
+
+		VkDescriptorPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_info.flags = 0;
+		pool_info.maxSets = sets_per_pool_;
+		pool_info.poolSizeCount = static_cast<uint32_t>( pool_sizes.size() );
+		pool_info.pPoolSizes = pool_sizes.data();
+
+		VkDescriptorPool pool;
+		if ( auto status = vkCreateDescriptorPool( device_, &pool_info, nullptr, &pool );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create descriptor pool!" );
+		}
+
+		if ( stats_ )
+			stats_->pools_created++;
+
+		return pool;
+	}
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	DescriptorStats * stats_ = nullptr;
+	uint32_t sets_per_pool_ = 64;
+	PoolSizes pool_sizes_;
+
+	VkDescriptorPool current_pool_ = VK_NULL_HANDLE;
+	std::vector<VkDescriptorPool> used_pools_;
+	std::vector<VkDescriptorPool> free_pools_;
+};
+
+/// \brief Deduplicates VkDescriptorSetLayouts with identical bindings
+class DescriptorLayoutCache {
+public:
+	void init( VkDevice device, DescriptorStats * stats )
+	{
+		device_ = device;
+		stats_ = stats;
+	}
+
+	VkDescriptorSetLayout createDescriptorLayout( const VkDescriptorSetLayoutCreateInfo & info )
+	{
+		LayoutInfo layout_info;
+		layout_info.bindings.assign( info.pBindings, info.pBindings + info.bindingCount );
+		std::sort( layout_info.bindings.begin(), layout_info.bindings.end(),
+				   []( const auto & a, const auto & b ) { return a.binding < b.binding; } );
+
+		if ( auto it = layout_cache_.find( layout_info ); it != layout_cache_.end() )
+		{
+			if ( stats_ )
+				stats_->layout_cache_hits++;
+			return it->second;
+		}
+
+		VkDescriptorSetLayout layout;
+		if ( auto status = vkCreateDescriptorSetLayout( device_, &info, nullptr, &layout );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create descriptor set layout!" );
+		}
+
+		if ( stats_ )
+			stats_->layout_cache_misses++;
+
+		layout_cache_[layout_info] = layout;
+		return layout;
+	}
+
+	void cleanup()
+	{
+		for ( const auto & [info, layout] : layout_cache_ )
+		{
+			vkDestroyDescriptorSetLayout( device_, layout, nullptr );
+		}
+		layout_cache_.clear();
+	}
+
+	size_t size() const { return layout_cache_.size(); }
+
+private:
+	struct LayoutInfo {
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+		bool operator==( const LayoutInfo & other ) const
+		{
+			if ( bindings.size() != other.bindings.size() )
+				return false;
+
+			for ( size_t i = 0; i < bindings.size(); ++i )
+			{
+				const auto & a = bindings[i];
+				const auto & b = other.bindings[i];
+				if ( a.binding != b.binding
+					 || a.descriptorType != b.descriptorType
+					 || a.descriptorCount != b.descriptorCount
+					 || a.stageFlags != b.stageFlags )
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	struct LayoutHash {
+		size_t operator()( const LayoutInfo & info ) const
+		{
+			size_t seed = info.bindings.size();
+			for ( const auto & b : info.bindings )
+			{
+				// pack the binding into one word, counts rarely exceed 16 bits
+				uint64_t packed = b.binding
+					| ( static_cast<uint64_t>( b.descriptorType ) << 8 )
+					| ( static_cast<uint64_t>( b.descriptorCount ) << 16 )
+					| ( static_cast<uint64_t>( b.stageFlags ) << 32 );
+				hashCombine( seed, packed );
+			}
+			return seed;
+		}
+	};
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	DescriptorStats * stats_ = nullptr;
+	std::unordered_map<LayoutInfo, VkDescriptorSetLayout, LayoutHash> layout_cache_;
+};
+
+/// \brief Deduplicates VkPipelineLayouts with identical set layouts and
+/// push constant ranges. Set layouts come from DescriptorLayoutCache, so
+/// equal handles mean equal layouts.
+class PipelineLayoutCache {
+public:
+	void init( VkDevice device, DescriptorStats * stats )
+	{
+		device_ = device;
+		stats_ = stats;
+	}
+
+	VkPipelineLayout createPipelineLayout( const std::vector<VkDescriptorSetLayout> & set_layouts,
+										   const std::vector<VkPushConstantRange> & push_constants )
+	{
+		LayoutKey key = { set_layouts, push_constants };
+		if ( auto it = layout_cache_.find( key ); it != layout_cache_.end() )
+		{
+			if ( stats_ )
+				stats_->pipeline_layout_cache_hits++;
+			return it->second;
+		}
+
+		VkPipelineLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		layout_info.setLayoutCount = static_cast<uint32_t>( set_layouts.size() );
+		layout_info.pSetLayouts = set_layouts.data();
+		layout_info.pushConstantRangeCount = static_cast<uint32_t>( push_constants.size() );
+		layout_info.pPushConstantRanges = push_constants.data();
+
+		VkPipelineLayout layout;
+		if ( auto status = vkCreatePipelineLayout( device_, &layout_info, nullptr, &layout );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create pipeline layout!" );
+		}
+
+		if ( stats_ )
+			stats_->pipeline_layout_cache_misses++;
+
+		layout_cache_[std::move( key )] = layout;
+		return layout;
+	}
+
+	void cleanup()
+	{
+		for ( const auto & [key, layout] : layout_cache_ )
+		{
+			vkDestroyPipelineLayout( device_, layout, nullptr );
+		}
+		layout_cache_.clear();
+	}
+
+	size_t size() const { return layout_cache_.size(); }
+
+private:
+	struct LayoutKey {
+		std::vector<VkDescriptorSetLayout> set_layouts;
+		std::vector<VkPushConstantRange> push_constants;
+
+		bool operator==( const LayoutKey & other ) const
+		{
+			if ( set_layouts != other.set_layouts || push_constants.size() != other.push_constants.size() )
+				return false;
+
+			for ( size_t i = 0; i < push_constants.size(); ++i )
+			{
+				const auto & a = push_constants[i];
+				const auto & b = other.push_constants[i];
+				if ( a.stageFlags != b.stageFlags || a.offset != b.offset || a.size != b.size )
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	struct LayoutKeyHash {
+		size_t operator()( const LayoutKey & key ) const
+		{
+			size_t seed = key.set_layouts.size();
+			for ( auto layout : key.set_layouts )
+			{
+				hashCombine( seed, reinterpret_cast<uintptr_t>( layout ) );
+			}
+			for ( const auto & range : key.push_constants )
+			{
+				hashCombine( seed, range.stageFlags );
+				hashCombine( seed, range.offset );
+				hashCombine( seed, range.size );
+			}
+			return seed;
+		}
+	};
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	DescriptorStats * stats_ = nullptr;
+	std::unordered_map<LayoutKey, VkPipelineLayout, LayoutKeyHash> layout_cache_;
+};
+
+/// \brief Everything a set was written with: its layout, the number of
+/// buffer writes, then binding, element, handles, offsets and ranges of
+/// each write in order. Lookups compare it in full, the hash only picks
+/// the bucket.
+struct DescriptorSetKey {
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	std::vector<uint64_t> writes;
+	std::vector<uint64_t> resources; // buffers, samplers and views in writes, for forget()
+
+	bool operator==( const DescriptorSetKey & other ) const
+	{
+		return layout == other.layout && writes == other.writes;
+	}
+};
+
+struct DescriptorSetKeyHash {
+	size_t operator()( const DescriptorSetKey & key ) const
+	{
+		size_t seed = key.writes.size();
+		hashCombine( seed, reinterpret_cast<uintptr_t>( key.layout ) );
+		for ( auto word : key.writes )
+		{
+			hashCombine( seed, word );
+		}
+		return seed;
+	}
+};
+
+/// \brief Maps (layout, writes) to an already written descriptor set.
+///
+/// Keys hold raw handles, and Vulkan may hand a destroyed handle's value
+/// to a new object. Call forget() before destroying a buffer, sampler or
+/// view a cached set was written with, or clear() when several die.
+class DescriptorSetCache {
+public:
+	void init( DescriptorStats * stats )
+	{
+		stats_ = stats;
+	}
+
+	VkDescriptorSet find( const DescriptorSetKey & key ) const
+	{
+		auto it = sets_.find( key );
+		if ( it == sets_.end() )
+		{
+			if ( stats_ )
+				stats_->set_cache_misses++;
+			return VK_NULL_HANDLE;
+		}
+
+		if ( stats_ )
+			stats_->set_cache_hits++;
+		return it->second;
+	}
+
+	void insert( DescriptorSetKey key, VkDescriptorSet set )
+	{
+		sets_[std::move( key )] = set;
+	}
+
+	/// \brief Drop the sets written with handle, a buffer, sampler or
+	/// view as reinterpret_cast<uintptr_t>. The sets themselves stay
+	/// allocated until their allocator is reset.
+	void forget( uint64_t handle )
+	{
+		for ( auto it = sets_.begin(); it != sets_.end(); )
+		{
+			const auto & resources = it->first.resources;
+			if ( std::find( resources.begin(), resources.end(), handle ) != resources.end() )
+				it = sets_.erase( it );
+			else
+				++it;
+		}
+	}
+
+	/// \brief Forget every set, call when the backing allocator is reset
+	void clear()
+	{
+		sets_.clear();
+	}
+
+	size_t size() const { return sets_.size(); }
+
+private:
+	DescriptorStats * stats_ = nullptr;
+	std::unordered_map<DescriptorSetKey, VkDescriptorSet, DescriptorSetKeyHash> sets_;
+};
+
+/// \brief Builds descriptor sets, reusing an existing set when the
+/// layout and every write are identical to one built before.
+///
+/// Pass a long-lived allocator when caching; sets from a per-frame
+/// allocator die at the next resetPools() and must not be cached.
+class DescriptorBuilder {
+public:
+	DescriptorBuilder( DescriptorLayoutCache & layout_cache,
+					   DescriptorAllocator & allocator,
+					   DescriptorSetCache * set_cache = nullptr )
+		: layout_cache_( layout_cache ), allocator_( allocator ), set_cache_( set_cache )
+	{
+	}
+
+	DescriptorBuilder & bindBuffer( uint32_t binding,
+									const VkDescriptorBufferInfo & buffer_info,
+									VkDescriptorType type,
+									VkShaderStageFlags stages )
+	{
+		addBinding( binding, type, stages );
+		buffer_infos_.push_back( { binding, buffer_info } );
+		return *this;
+	}
+
+	DescriptorBuilder & bindImage( uint32_t binding,
+								   const VkDescriptorImageInfo & image_info,
+								   VkDescriptorType type,
+								   VkShaderStageFlags stages )
+	{
+		addBinding( binding, type, stages );
+		image_infos_.push_back( { binding, 0, image_info } );
+		return *this;
+	}
+
+	/// \brief Array binding, one element per image_infos entry
+	DescriptorBuilder & bindImages( uint32_t binding,
+									const std::vector<VkDescriptorImageInfo> & image_infos,
+									VkDescriptorType type,
+									VkShaderStageFlags stages )
+	{
+		addBinding( binding, type, stages, static_cast<uint32_t>( image_infos.size() ) );
+		for ( uint32_t i = 0; i < image_infos.size(); ++i )
+		{
+			image_infos_.push_back( { binding, i, image_infos[i] } );
+		}
+		return *this;
+	}
+
+	VkDescriptorSetLayout buildLayout();
+	bool build( VkDescriptorSet & set, VkDescriptorSetLayout & layout );
+	bool build( VkDescriptorSet & set )
+	{
+		VkDescriptorSetLayout layout;
+		return build( set, layout );
+	}
+
+private:
+	void addBinding( uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages, uint32_t count = 1 )
+	{
+		VkDescriptorSetLayoutBinding layout_binding = {};
+		layout_binding.binding = binding;
+		layout_binding.descriptorType = type;
+		layout_binding.descriptorCount = count;
+		layout_binding.stageFlags = stages;
+		layout_binding.pImmutableSamplers = nullptr;
+		bindings_.push_back( layout_binding );
+	}
+
+	DescriptorSetKey writeKey( VkDescriptorSetLayout layout ) const;
+
+	DescriptorLayoutCache & layout_cache_;
+	DescriptorAllocator & allocator_;
+	DescriptorSetCache * set_cache_;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings_;
+	std::vector<std::pair<uint32_t, VkDescriptorBufferInfo>> buffer_infos_;
+	struct ImageWrite {
+		uint32_t binding;
+		uint32_t element;
+		VkDescriptorImageInfo info;
+	};
+	std::vector<ImageWrite> image_infos_;
+};
+
+inline VkDescriptorSetLayout DescriptorBuilder::buildLayout()
+{
+	VkDescriptorSetLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount = static_cast<uint32_t>( bindings_.size() );
+	layout_info.pBindings = bindings_.data();
+
+	return layout_cache_.createDescriptorLayout( layout_info );
+}
+
+inline DescriptorSetKey DescriptorBuilder::writeKey( VkDescriptorSetLayout layout ) const
+{
+	DescriptorSetKey key;
+	key.layout = layout;
+	key.writes.reserve( 1 + buffer_infos_.size() * 4 + image_infos_.size() * 5 );
+	key.writes.push_back( buffer_infos_.size() ); // where the image writes start
+	for ( const auto & [binding, info] : buffer_infos_ )
+	{
+		key.resources.push_back( reinterpret_cast<uintptr_t>( info.buffer ) );
+		key.writes.push_back( binding );
+		key.writes.push_back( reinterpret_cast<uintptr_t>( info.buffer ) );
+		key.writes.push_back( info.offset );
+		key.writes.push_back( info.range );
+	}
+	for ( const auto & [binding, element, info] : image_infos_ )
+	{
+		key.resources.push_back( reinterpret_cast<uintptr_t>( info.sampler ) );
+		key.resources.push_back( reinterpret_cast<uintptr_t>( info.imageView ) );
+		key.writes.push_back( binding );
+		key.writes.push_back( element );
+		key.writes.push_back( reinterpret_cast<uintptr_t>( info.sampler ) );
+		key.writes.push_back( reinterpret_cast<uintptr_t>( info.imageView ) );
+		key.writes.push_back( static_cast<uint32_t>( info.imageLayout ) );
+	}
+	return key;
+}
+
+inline bool DescriptorBuilder::build( VkDescriptorSet & set, VkDescriptorSetLayout & layout )
+{
+	layout = buildLayout();
+
+	DescriptorSetKey key;
+	if ( set_cache_ )
+	{
+		key = writeKey( layout );
+		if ( auto cached = set_cache_->find( key ); cached != VK_NULL_HANDLE )
+		{
+			set = cached;
+			return true;
+		}
+	}
+
+	if ( !allocator_.allocate( &set, layout ) )
+	{
+		return false;
+	}
+
+	auto findBinding = [this]( uint32_t binding ) {
+		return *std::find_if( bindings_.begin(), bindings_.end(),
+							  [binding]( const auto & b ) { return b.binding == binding; } );
+	};
+
+	std::vector<VkWriteDescriptorSet> writes;
+	writes.reserve( buffer_infos_.size() + image_infos_.size() );
+	for ( const auto & [binding, info] : buffer_infos_ )
+	{
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = binding;
+		write.dstArrayElement = 0;
+		write.descriptorType = findBinding( binding ).descriptorType;
+		write.descriptorCount = 1;
+		write.pBufferInfo = &info;
+		writes.push_back( write );
+	}
+	for ( const auto & [binding, element, info] : image_infos_ )
+	{
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = binding;
+		write.dstArrayElement = element;
+		write.descriptorType = findBinding( binding ).descriptorType;
+		write.descriptorCount = 1;
+		write.pImageInfo = &info;
+		writes.push_back( write );
+	}
+
+	vkUpdateDescriptorSets( allocator_.device(), static_cast<uint32_t>( writes.size() ), writes.data(), 0, nullptr );
+
+	if ( set_cache_ )
+		set_cache_->insert( std::move( key ), set );
+
+	return true;
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/// \brief What the app reads about a physical device, probed once. Later
+/// code reads this instead of asking the driver again.
+///
+/// Nothing surface dependent lives here: present support and swapchain
+/// formats change with the window, the rest only with the driver.
+struct DeviceCaps {
+	VkPhysicalDeviceProperties properties = {};
+	VkPhysicalDeviceFeatures features = {};
+	VkPhysicalDeviceMemoryProperties memory = {};
+	std::vector<VkQueueFamilyProperties> queue_families;
+	std::set<std::string> extensions;
+
+	// from vkGetPhysicalDeviceFeatures2, false below Vulkan 1.1
+	bool timeline_semaphore = false;
+	bool present_id = false;
+	bool present_wait = false;
+	bool dynamic_rendering = false;
+
+	bool hasExtension( const char * name ) const { return extensions.count( name ) > 0; }
+
+	/// \brief Largest device local heap, the VRAM on discrete parts
+	VkDeviceSize deviceLocalBytes() const
+	{
+		VkDeviceSize largest = 0;
+		for ( uint32_t i = 0; i < memory.memoryHeapCount; ++i )
+		{
+			if ( memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT )
+				largest = std::max( largest, memory.memoryHeaps[i].size );
+		}
+		return largest;
+	}
+
+	/// \brief A compute family without graphics, for async compute
+	bool hasDedicatedCompute() const
+	{
+		return std::any_of( queue_families.begin(), queue_families.end(), []( const VkQueueFamilyProperties & family ) {
+			return family.queueCount > 0
+				&& ( family.queueFlags & VK_QUEUE_COMPUTE_BIT )
+				&& !( family.queueFlags & VK_QUEUE_GRAPHICS_BIT );
+		} );
+	}
+};
+
+inline DeviceCaps probeDeviceCaps( VkPhysicalDevice device )
+{
+	DeviceCaps caps;
+	vkGetPhysicalDeviceProperties( device, &caps.properties );
+	vkGetPhysicalDeviceFeatures( device, &caps.features );
+	vkGetPhysicalDeviceMemoryProperties( device, &caps.memory );
+
+	uint32_t family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties( device, &family_count, nullptr );
+	caps.queue_families.resize( family_count );
+	vkGetPhysicalDeviceQueueFamilyProperties( device, &family_count, caps.queue_families.data() );
+
+	uint32_t extension_count = 0;
+	vkEnumerateDeviceExtensionProperties( device, nullptr, &extension_count, nullptr );
+	std::vector<VkExtensionProperties> extensions( extension_count );
+	vkEnumerateDeviceExtensionProperties( device, nullptr, &extension_count, extensions.data() );
+	for ( const auto & extension : extensions )
+	{
+		caps.extensions.insert( extension.extensionName );
+	}
+
+	if ( caps.properties.apiVersion >= VK_API_VERSION_1_1 )
+	{
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+		timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {};
+		present_id_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+		VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {};
+		present_wait_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = {};
+		dynamic_rendering_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+		// Only chain structs the device knows about
+		void * chain = nullptr;
+		if ( caps.hasExtension( VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME ) )
+		{
+			timeline_features.pNext = chain;
+			chain = &timeline_features;
+		}
+		if ( caps.hasExtension( VK_KHR_PRESENT_ID_EXTENSION_NAME ) )
+		{
+			present_id_features.pNext = chain;
+			chain = &present_id_features;
+		}
+		if ( caps.hasExtension( VK_KHR_PRESENT_WAIT_EXTENSION_NAME ) )
+		{
+			present_wait_features.pNext = chain;
+			chain = &present_wait_features;
+		}
+		if ( caps.hasExtension( VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME ) )
+		{
+			dynamic_rendering_features.pNext = chain;
+			chain = &dynamic_rendering_features;
+		}
+
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = chain;
+		vkGetPhysicalDeviceFeatures2( device, &features2 );
+
+		caps.timeline_semaphore = timeline_features.timelineSemaphore == VK_TRUE;
+		caps.present_id = present_id_features.presentId == VK_TRUE;
+		caps.present_wait = present_wait_features.presentWait == VK_TRUE;
+		caps.dynamic_rendering = dynamic_rendering_features.dynamicRendering == VK_TRUE;
+	}
+	return caps;
+}
+
+/// \brief What the enabled modes would use, each adds to a device's score
+struct DevicePreferences {
+	bool async_compute = false;      // particles
+	bool timeline_semaphore = false; // FrameSync, fences otherwise
+	bool present_wait = false;       // low latency pacing
+	bool incremental_present = false; // --idle
+	bool texture_compression = false; // transcoded textures
+};
+
+inline const char * deviceTypeName( VkPhysicalDeviceType type )
+{
+	switch ( type )
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+	default: return "other";
+	}
+}
+
+/// \brief Higher is better, for devices that already meet the hard
+/// requirements. Device type dominates, VRAM breaks ties between parts of
+/// the same type, queue topology and optional features come after.
+/// shared_present is true when the graphics family can also present.
+inline int64_t scoreDevice( const DeviceCaps & caps, const DevicePreferences & prefs, bool shared_present )
+{
+	int64_t score = 0;
+	switch ( caps.properties.deviceType )
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 10000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 5000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 2000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: score += 500; break;
+	default: break;
+	}
+
+	// 1 point per 64 MB, capped well below a device type step
+	score += std::min<int64_t>( caps.deviceLocalBytes() >> 26, 1000 );
+
+	if ( shared_present )
+		score += 200; // no concurrent sharing or ownership transfers for present
+	if ( prefs.async_compute && caps.hasDedicatedCompute() )
+		score += 300;
+	if ( prefs.timeline_semaphore && caps.timeline_semaphore )
+		score += 200;
+	if ( prefs.present_wait && caps.present_id && caps.present_wait )
+		score += 100;
+	if ( prefs.incremental_present && caps.hasExtension( VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME ) )
+		score += 50;
+	if ( prefs.texture_compression && ( caps.features.textureCompressionBC || caps.features.textureCompressionETC2 ) )
+		score += 100;
+	return score;
+}
+
+/// \brief DeviceCaps on disk, keyed by the driver, so startup skips the
+/// probe on machines it has seen.
+///
+/// Layout: "VDCC", u32 version, the sizes of the raw structs (a cache
+/// from another build is ignored), u32 entry count, then per entry the
+/// key, the raw property, feature and memory structs, the queue families,
+/// the extension names and the feature flags. Delete the file to reprobe,
+/// e.g. after installing a layer that adds device extensions.
+class DeviceCapsCache {
+public:
+	static constexpr uint32_t kVersion = 2; // 2: dynamic rendering flag
+
+	void load( const std::string & path )
+	{
+		path_ = path;
+		entries_.clear();
+		try
+		{
+			MappedFile file( path );
+			Reader reader{ file.data(), file.data() + file.size() };
+			if ( !readEntries( reader ) )
+			{
+				entries_.clear();
+			}
+		}
+		catch ( const std::exception & )
+		{
+			// missing or unreadable, probe everything
+		}
+	}
+
+	/// \brief Cached caps for the device with these properties, matched on
+	/// vendor, device, driver version and pipeline cache UUID
+	bool find( const VkPhysicalDeviceProperties & properties, DeviceCaps & caps ) const
+	{
+		for ( const auto & entry : entries_ )
+		{
+			if ( sameDriver( entry.properties, properties ) )
+			{
+				caps = entry;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void store( const DeviceCaps & caps )
+	{
+		entries_.erase( std::remove_if( entries_.begin(), entries_.end(), [&]( const DeviceCaps & entry ) {
+			return sameDriver( entry.properties, caps.properties );
+		} ), entries_.end() );
+		entries_.push_back( caps );
+		dirty_ = true;
+	}
+
+	/// \brief Write back if anything was probed, failures are ignored
+	void save()
+	{
+		if ( !dirty_ || path_.empty() )
+		{
+			return;
+		}
+
+		std::vector<uint8_t> out( 4 );
+		memcpy( out.data(), "VDCC", 4 );
+		append( out, kVersion );
+		append( out, uint32_t( sizeof( VkPhysicalDeviceProperties ) ) );
+		append( out, uint32_t( sizeof( VkPhysicalDeviceFeatures ) ) );
+		append( out, uint32_t( sizeof( VkPhysicalDeviceMemoryProperties ) ) );
+		append( out, uint32_t( entries_.size() ) );
+		for ( const auto & entry : entries_ )
+		{
+			appendBytes( out, &entry.properties, sizeof( entry.properties ) );
+			appendBytes( out, &entry.features, sizeof( entry.features ) );
+			appendBytes( out, &entry.memory, sizeof( entry.memory ) );
+			append( out, uint32_t( entry.queue_families.size() ) );
+			appendBytes( out, entry.queue_families.data(), entry.queue_families.size() * sizeof( VkQueueFamilyProperties ) );
+			append( out, uint32_t( entry.extensions.size() ) );
+			for ( const auto & name : entry.extensions )
+			{
+				append( out, uint32_t( name.size() ) );
+				appendBytes( out, name.data(), name.size() );
+			}
+			uint8_t flags = ( entry.timeline_semaphore ? 1 : 0 )
+				| ( entry.present_id ? 2 : 0 )
+				| ( entry.present_wait ? 4 : 0 )
+				| ( entry.dynamic_rendering ? 8 : 0 );
+			out.push_back( flags );
+		}
+
+		std::ofstream file( path_, std::ios::binary | std::ios::trunc );
+		file.write( reinterpret_cast<const char *>( out.data() ), out.size() );
+		dirty_ = false;
+	}
+
+	size_t size() const { return entries_.size(); }
+
+private:
+	struct Reader {
+		const uint8_t * cursor;
+		const uint8_t * end;
+
+		bool bytes( void * dst, size_t size )
+		{
+			if ( size_t( end - cursor ) < size )
+				return false;
+			memcpy( dst, cursor, size );
+			cursor += size;
+			return true;
+		}
+
+		bool u32( uint32_t & value ) { return bytes( &value, sizeof( value ) ); }
+	};
+
+	static bool sameDriver( const VkPhysicalDeviceProperties & a, const VkPhysicalDeviceProperties & b )
+	{
+		return a.vendorID == b.vendorID
+			&& a.deviceID == b.deviceID
+			&& a.driverVersion == b.driverVersion
+			&& memcmp( a.pipelineCacheUUID, b.pipelineCacheUUID, VK_UUID_SIZE ) == 0;
+	}
+
+	bool readEntries( Reader & reader )
+	{
+		char magic[4];
+		uint32_t version, properties_size, features_size, memory_size, count;
+		if ( !reader.bytes( magic, 4 ) || memcmp( magic, "VDCC", 4 ) != 0
+			 || !reader.u32( version ) || version != kVersion
+			 || !reader.u32( properties_size ) || properties_size != sizeof( VkPhysicalDeviceProperties )
+			 || !reader.u32( features_size ) || features_size != sizeof( VkPhysicalDeviceFeatures )
+			 || !reader.u32( memory_size ) || memory_size != sizeof( VkPhysicalDeviceMemoryProperties )
+			 || !reader.u32( count ) )
+		{
+			return false;
+		}
+
+		for ( uint32_t i = 0; i < count; ++i )
+		{
+			DeviceCaps caps;
+			uint32_t family_count, extension_count;
+			if ( !reader.bytes( &caps.properties, sizeof( caps.properties ) )
+				 || !reader.bytes( &caps.features, sizeof( caps.features ) )
+				 || !reader.bytes( &caps.memory, sizeof( caps.memory ) )
+				 || !reader.u32( family_count ) || family_count > 64 )
+			{
+				return false;
+			}
+			caps.queue_families.resize( family_count );
+			if ( !reader.bytes( caps.queue_families.data(), family_count * sizeof( VkQueueFamilyProperties ) )
+				 || !reader.u32( extension_count ) )
+			{
+				return false;
+			}
+			for ( uint32_t e = 0; e < extension_count; ++e )
+			{
+				uint32_t length;
+				if ( !reader.u32( length ) || length > VK_MAX_EXTENSION_NAME_SIZE )
+					return false;
+				std::string name( length, '\0' );
+				if ( !reader.bytes( &name[0], length ) )
+					return false;
+				caps.extensions.insert( std::move( name ) );
+			}
+			uint8_t flags;
+			if ( !reader.bytes( &flags, 1 ) )
+			{
+				return false;
+			}
+			caps.timeline_semaphore = flags & 1;
+			caps.present_id = flags & 2;
+			caps.present_wait = flags & 4;
+			caps.dynamic_rendering = flags & 8;
+			entries_.push_back( std::move( caps ) );
+		}
+		return true;
+	}
+
+	static void appendBytes( std::vector<uint8_t> & out, const void * data, size_t size )
+	{
+		auto bytes = static_cast<const uint8_t *>( data );
+		out.insert( out.end(), bytes, bytes + size );
+	}
+
+	static void append( std::vector<uint8_t> & out, uint32_t value )
+	{
+		appendBytes( out, &value, sizeof( value ) );
+	}
+
+	std::string path_;
+	std::vector<DeviceCaps> entries_;
+	bool dirty_ = false;
+};
@@ -0,0 +1,278 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.h"
+
+/// \brief One draw the application submits. Ids index tables the renderer
+/// owns, the mesh is a geometry pool id.
+struct DrawPacket {
+	glm::mat4 transform; // per instance, applied before the PerDraw transform
+	uint32_t mesh = 0;
+	uint32_t lod = 0;
+	uint32_t material = 0;
+	uint32_t pipeline = 0;
+	float depth = 0.0f; // distance from the camera
+};
+
+/// \brief A run of packets sharing pipeline, material, mesh and lod, drawn
+/// as one instanced draw of their transforms
+struct DrawBatch {
+	uint32_t pipeline;
+	uint32_t material;
+	uint32_t mesh;
+	uint32_t lod;
+	uint32_t first_instance;
+	uint32_t instance_count;
+};
+
+/// \brief What recording a frame's batches took
+struct DrawStats {
+	uint64_t packets = 0;
+	uint64_t draws = 0;
+	uint64_t pipeline_binds = 0;
+	uint64_t material_binds = 0;
+	uint64_t buffer_binds = 0;
+
+	DrawStats & operator+=( const DrawStats & other )
+	{
+		packets += other.packets;
+		draws += other.draws;
+		pipeline_binds += other.pipeline_binds;
+		material_binds += other.material_binds;
+		buffer_binds += other.buffer_binds;
+		return *this;
+	}
+};
+
+/// \brief LSD radix sort of 64 bit keys carrying a 32 bit value, a byte
+/// per pass. Bytes every key has in common are skipped, so keys that only
+/// differ in a few fields take a few passes. Each pass histograms and
+/// scatters its chunks of keys on the pool, chunk order keeps it stable.
+class RadixSorter {
+public:
+	void init( ThreadPool * pool )
+	{
+		pool_ = pool;
+	}
+
+	/// \brief Sorts keys ascending, values take the same permutation
+	void sort( std::vector<uint64_t> & keys, std::vector<uint32_t> & values )
+	{
+		size_t count = keys.size();
+		if ( count < 2 )
+		{
+			return;
+		}
+
+		size_t chunks = 1;
+		if ( pool_ )
+		{
+			chunks = std::min( pool_->threadCount() + 1, std::max<size_t>( 1, count / kMinChunkKeys ) );
+		}
+		auto chunk_begin = [&]( size_t chunk ) { return count * chunk / chunks; };
+		counts_.resize( chunks );
+		scratch_keys_.resize( count );
+		scratch_values_.resize( count );
+
+		// bits that differ from the first key anywhere
+		std::vector<uint64_t> differing( chunks, 0 );
+		parallelFor( pool_, chunks, [&]( size_t chunk ) {
+			uint64_t bits = 0;
+			for ( size_t i = chunk_begin( chunk ); i < chunk_begin( chunk + 1 ); ++i )
+			{
+				bits |= keys[i] ^ keys[0];
+			}
+			differing[chunk] = bits;
+		} );
+		uint64_t pass_bits = 0;
+		for ( auto bits : differing )
+		{
+			pass_bits |= bits;
+		}
+
+		for ( uint32_t shift = 0; shift < 64; shift += 8 )
+		{
+			if ( ( ( pass_bits >> shift ) & 0xff ) == 0 )
+			{
+				continue;
+			}
+
+			parallelFor( pool_, chunks, [&]( size_t chunk ) {
+				auto & counts = counts_[chunk];
+				counts.fill( 0 );
+				for ( size_t i = chunk_begin( chunk ); i < chunk_begin( chunk + 1 ); ++i )
+				{
+					counts[( keys[i] >> shift ) & 0xff]++;
+				}
+			} );
+
+			// Digit major, chunk minor: a chunk's keys land after the same
+			// digit's keys from earlier chunks
+			uint32_t offset = 0;
+			for ( size_t digit = 0; digit < 256; ++digit )
+			{
+				for ( auto & counts : counts_ )
+				{
+					uint32_t digit_count = counts[digit];
+					counts[digit] = offset;
+					offset += digit_count;
+				}
+			}
+
+			parallelFor( pool_, chunks, [&]( size_t chunk ) {
+				auto & offsets = counts_[chunk];
+				for ( size_t i = chunk_begin( chunk ); i < chunk_begin( chunk + 1 ); ++i )
+				{
+					uint32_t position = offsets[( keys[i] >> shift ) & 0xff]++;
+					scratch_keys_[position] = keys[i];
+					scratch_values_[position] = values[i];
+				}
+			} );
+			keys.swap( scratch_keys_ );
+			values.swap( scratch_values_ );
+			passes_++;
+		}
+	}
+
+	/// \brief Byte passes run so far, at most 8 a sort
+	uint64_t passes() const { return passes_; }
+
+private:
+	/// Below this a chunk isn't worth a worker
+	static constexpr size_t kMinChunkKeys = 16384;
+
+	ThreadPool * pool_ = nullptr;
+	std::vector<std::array<uint32_t, 256>> counts_;
+	std::vector<uint64_t> scratch_keys_;
+	std::vector<uint32_t> scratch_values_;
+	uint64_t passes_ = 0;
+};
+
+/// \brief Collects a frame's draw packets, sorts them by state and merges
+/// runs of the same mesh and material into instanced draws.
+///
+/// Sort key, most significant field first, so state that is most
+/// expensive to change changes least often and each run draws front to
+/// back:
+///
+///     63..56 pipeline | 55..42 material | 41..26 mesh | 25..22 lod | 21..0 depth
+class DrawQueue {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr uint32_t kDepthBits = 22;
+	static constexpr uint32_t kLodBits = 4;
+	static constexpr uint32_t kMeshBits = 16;
+	static constexpr uint32_t kMaterialBits = 14;
+	static constexpr uint32_t kPipelineBits = 8;
+
+	/// \brief Depth is quantized over 0..max_depth, further sorts as max_depth
+	void init( ThreadPool * pool, float max_depth )
+	{
+		sorter_.init( pool );
+		max_depth_ = max_depth;
+	}
+
+	void clear()
+	{
+		packets_.clear();
+		keys_.clear();
+		order_.clear();
+	}
+
+	void submit( const DrawPacket & packet )
+	{
+		if ( packet.pipeline >> kPipelineBits
+			 || packet.material >> kMaterialBits
+			 || packet.mesh >> kMeshBits
+			 || packet.lod >> kLodBits )
+		{
+			throw std::runtime_error( "Draw packet id doesn't fit its sort key field!" );
+		}
+
+		keys_.push_back( sortKey( packet ) );
+		order_.push_back( static_cast<uint32_t>( packets_.size() ) );
+		packets_.push_back( packet );
+	}
+
+	/// \brief Sort, then merge consecutive packets with the same state into
+	/// batches. sort false merges in submission order, to compare against.
+	void build( bool sort = true )
+	{
+		auto start = Clock::now();
+		if ( sort )
+		{
+			sorter_.sort( keys_, order_ );
+		}
+		sort_seconds_ = std::chrono::duration<double>( Clock::now() - start ).count();
+
+		batches_.clear();
+		instances_.resize( packets_.size() );
+		uint64_t previous = 0;
+		for ( size_t i = 0; i < order_.size(); ++i )
+		{
+			const auto & packet = packets_[order_[i]];
+			uint64_t state = keys_[i] >> kDepthBits;
+			if ( i == 0 || state != previous )
+			{
+				batches_.push_back( { packet.pipeline, packet.material, packet.mesh, packet.lod, static_cast<uint32_t>( i ), 0 } );
+				previous = state;
+			}
+			batches_.back().instance_count++;
+			instances_[i] = packet.transform;
+		}
+	}
+
+	/// \brief In draw order after build(), instance i of the frame
+	const std::vector<glm::mat4> & instances() const { return instances_; }
+	const std::vector<DrawBatch> & batches() const { return batches_; }
+	size_t packetCount() const { return packets_.size(); }
+	double sortSeconds() const { return sort_seconds_; }
+
+	/// \brief Binds the batches need recorded in order, material sets
+	/// stay bound across pipelines with a compatible layout
+	DrawStats stateChanges() const
+	{
+		DrawStats stats;
+		stats.packets = packets_.size();
+		stats.draws = batches_.size();
+		for ( size_t i = 0; i < batches_.size(); ++i )
+		{
+			stats.pipeline_binds += i == 0 || batches_[i].pipeline != batches_[i - 1].pipeline;
+			stats.material_binds += i == 0 || batches_[i].material != batches_[i - 1].material;
+		}
+		return stats;
+	}
+
+private:
+	uint64_t sortKey( const DrawPacket & packet ) const
+	{
+		constexpr uint32_t kMaxDepth = ( 1u << kDepthBits ) - 1;
+		float depth = std::min( std::max( packet.depth / max_depth_, 0.0f ), 1.0f );
+
+		uint64_t key = packet.pipeline;
+		key = ( key << kMaterialBits ) | packet.material;
+		key = ( key << kMeshBits ) | packet.mesh;
+		key = ( key << kLodBits ) | packet.lod;
+		key = ( key << kDepthBits ) | static_cast<uint32_t>( depth * kMaxDepth );
+		return key;
+	}
+
+	RadixSorter sorter_;
+	float max_depth_ = 1.0f;
+	std::vector<DrawPacket> packets_;
+	std::vector<uint64_t> keys_;
+	std::vector<uint32_t> order_; // packet index of each key
+	std::vector<DrawBatch> batches_;
+	std::vector<glm::mat4> instances_;
+	double sort_seconds_ = 0.0;
+};
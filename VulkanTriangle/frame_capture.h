@@ -0,0 +1,420 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "frame_sync.h"
+#include "image_writer.h"
+#include "thread_pool.h"
+#include "vk_handle.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+enum class CaptureFormat {
+	kRaw,  // <target>_000000.rgba, tightly packed RGBA8
+	kPpm,  // <target>_000000.ppm
+	kPng,  // <target>_000000.png, stored deflate
+	kPipe  // raw RGBA8 frames written to the stdin of the command in target
+};
+
+inline CaptureFormat parseCaptureFormat( const std::string & name )
+{
+	if ( name == "raw" ) return CaptureFormat::kRaw;
+	if ( name == "ppm" ) return CaptureFormat::kPpm;
+	if ( name == "png" ) return CaptureFormat::kPng;
+	if ( name == "pipe" ) return CaptureFormat::kPipe;
+	throw std::runtime_error( "Unknown capture format: " + name );
+}
+
+struct CaptureConfig {
+	CaptureFormat format = CaptureFormat::kPng;
+	std::string target = "capture"; // file prefix, or the command for kPipe
+	uint32_t slots = 4; // readback buffers, frames in flight to the GPU or the encoder
+};
+
+struct CaptureStats {
+	uint64_t captured = 0; // copies recorded
+	uint64_t dropped = 0;  // frames with no free slot, the encoder is behind
+	uint64_t written = 0;
+	uint64_t failed = 0;   // writes that failed
+	double encode_time = 0.0;
+};
+
+/// \brief Copies rendered frames into host visible buffers and writes them
+/// out on a background thread, without stalling the frame.
+///
+/// Each captured frame takes a readback slot until the encoder is done
+/// with it. A slot is handed to the encoder once its copy's sync point
+/// has passed, found by polling in collect(), so frames arrive a few
+/// frames late and the render thread never waits on the GPU for them.
+/// When every slot is busy the frame isn't captured and is counted as
+/// dropped, that is the backpressure from a slow encoder or disk.
+class FrameCapture {
+public:
+	void init( VkPhysicalDevice physical_device,
+			   VkDevice device,
+			   FrameSync * frame_sync,
+			   VkExtent2D extent,
+			   VkFormat format,
+			   const CaptureConfig & config )
+	{
+		physical_device_ = physical_device;
+		device_ = device;
+		frame_sync_ = frame_sync;
+		config_ = config;
+		vkGetPhysicalDeviceMemoryProperties( physical_device_, &memory_properties_ );
+
+		if ( config_.format == CaptureFormat::kPipe )
+		{
+			pipe_ = popen( config_.target.c_str(), "w" );
+			if ( pipe_ == nullptr )
+			{
+				throw std::runtime_error( "Failed to start capture encoder: " + config_.target );
+			}
+		}
+
+		encoder_ = std::make_unique<ThreadPool>( 1 ); // one thread keeps frames in order
+		resize( extent, format );
+	}
+
+	/// \brief Reallocate the slots for a new source size, flushes first.
+	/// A pipe sees the new size from the next frame on.
+	void resize( VkExtent2D extent, VkFormat format )
+	{
+		flush();
+
+		bool bgra = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+		bool rgba = format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+		if ( !bgra && !rgba )
+		{
+			throw std::runtime_error( "Capture only supports 8 bit RGBA or BGRA images!" );
+		}
+		swizzle_ = bgra;
+		extent_ = extent;
+
+		slots_.clear();
+		VkDeviceSize size = VkDeviceSize( extent.width ) * extent.height * 4;
+		for ( uint32_t i = 0; i < config_.slots; ++i )
+		{
+			slots_.push_back( createSlot( size ) );
+		}
+	}
+
+	/// \brief Record a copy of image into a free slot, after the render
+	/// pass. The image is in layout before and after. Returns false if the
+	/// frame was dropped.
+	bool record( VkCommandBuffer cmd, VkImage image, VkImageLayout layout )
+	{
+		recorded_ = nullptr;
+		for ( auto & slot : slots_ )
+		{
+			if ( slot->state == SlotState::kFree )
+			{
+				recorded_ = slot.get();
+				break;
+			}
+		}
+		if ( recorded_ == nullptr )
+		{
+			stats_.dropped++;
+			frame_++;
+			return false;
+		}
+
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		barrier.oldLayout = layout;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier( cmd,
+							  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+							  0, 0, nullptr, 0, nullptr, 1, &barrier );
+
+		VkBufferImageCopy region = {};
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = { extent_.width, extent_.height, 1 };
+		vkCmdCopyImageToBuffer( cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+								recorded_->buffer.buffer, 1, &region );
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = layout;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier( cmd,
+							  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+							  0, 0, nullptr, 0, nullptr, 1, &barrier );
+
+		VkBufferMemoryBarrier host_barrier = {};
+		host_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		host_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		host_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		host_barrier.buffer = recorded_->buffer.buffer;
+		host_barrier.offset = 0;
+		host_barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier( cmd,
+							  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+							  0, 0, nullptr, 1, &host_barrier, 0, nullptr );
+
+		recorded_->state = SlotState::kCopying;
+		recorded_->frame = frame_++;
+		stats_.captured++;
+		return true;
+	}
+
+	/// \brief The submit carrying the last record(), before the next one
+	void submitted( const SyncPoint & point )
+	{
+		if ( recorded_ != nullptr )
+		{
+			recorded_->point = point;
+			recorded_ = nullptr;
+		}
+	}
+
+	/// \brief Hand finished copies to the encoder, never blocks
+	void collect()
+	{
+		for ( auto & slot : slots_ )
+		{
+			if ( slot->state == SlotState::kCopying
+				 && slot.get() != recorded_
+				 && frame_sync_->isComplete( slot->point ) )
+			{
+				encode( *slot );
+			}
+		}
+	}
+
+	/// \brief Wait for every captured frame to be written
+	void flush()
+	{
+		for ( auto & slot : slots_ )
+		{
+			if ( slot->state == SlotState::kCopying && slot.get() != recorded_ )
+			{
+				frame_sync_->wait( slot->point );
+			}
+		}
+		collect();
+		if ( encoder_ )
+		{
+			encoder_->waitIdle();
+		}
+	}
+
+	bool enabled() const { return encoder_ != nullptr; }
+	const CaptureStats & stats() const { return stats_; }
+
+	void printStats() const
+	{
+		std::cout << "Capture: " << stats_.written << " written, "
+			<< stats_.dropped << " dropped, "
+			<< stats_.failed << " failed, "
+			<< ( stats_.written > 0 ? stats_.encode_time * 1000.0 / stats_.written : 0.0 ) << " ms/frame encode"
+			<< std::endl;
+	}
+
+	/// \brief Flushes, the device must still be alive
+	void cleanup()
+	{
+		flush();
+		encoder_.reset();
+		slots_.clear();
+		if ( pipe_ != nullptr )
+		{
+			pclose( pipe_ );
+			pipe_ = nullptr;
+		}
+	}
+
+private:
+	enum class SlotState {
+		kFree,
+		kCopying,  // recorded, the GPU may still be writing
+		kEncoding  // owned by the encoder thread
+	};
+
+	struct Slot {
+		BufferAllocation buffer;
+		const uint8_t * mapped = nullptr;
+		bool coherent = true;
+		std::atomic<SlotState> state{ SlotState::kFree };
+		SyncPoint point;
+		uint64_t frame = 0;
+	};
+
+	std::unique_ptr<Slot> createSlot( VkDeviceSize size )
+	{
+		auto slot = std::make_unique<Slot>();
+
+		VkBufferCreateInfo buffer_info = {};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.size = size;
+		buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if ( auto status = vkCreateBuffer( device_, &buffer_info, nullptr, slot->buffer.buffer.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create readback buffer! Status: " + std::to_string( status ) );
+		}
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements( device_, slot->buffer.buffer, &requirements );
+
+		// Cached reads are far faster for the encoder, coherent is the fallback
+		uint32_t type = findMemoryType( requirements.memoryTypeBits,
+										VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT );
+		if ( type == kNoMemoryType )
+		{
+			type = findMemoryType( requirements.memoryTypeBits,
+								   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+		}
+		if ( type == kNoMemoryType )
+		{
+			throw std::runtime_error( "No host visible memory for capture readback!" );
+		}
+		slot->coherent = ( memory_properties_.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT ) != 0;
+
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = type;
+		if ( auto status = vkAllocateMemory( device_, &alloc_info, nullptr, slot->buffer.memory.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to allocate readback memory! Status: " + std::to_string( status ) );
+		}
+		vkBindBufferMemory( device_, slot->buffer.buffer, slot->buffer.memory, 0 );
+		slot->buffer.size = size;
+
+		// Mapped for the slot's lifetime, unmapped by vkFreeMemory
+		void * data;
+		vkMapMemory( device_, slot->buffer.memory, 0, VK_WHOLE_SIZE, 0, &data );
+		slot->mapped = static_cast<const uint8_t *>( data );
+		return slot;
+	}
+
+	void encode( Slot & slot )
+	{
+		if ( !slot.coherent )
+		{
+			VkMappedMemoryRange range = {};
+			range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			range.memory = slot.buffer.memory;
+			range.offset = 0;
+			range.size = VK_WHOLE_SIZE;
+			vkInvalidateMappedMemoryRanges( device_, 1, &range );
+		}
+
+		slot.state = SlotState::kEncoding;
+		encoder_->submit( [this, &slot, extent = extent_, swizzle = swizzle_]() {
+			auto start = std::chrono::high_resolution_clock::now();
+			bool ok = write( slot, extent, swizzle );
+			auto end = std::chrono::high_resolution_clock::now();
+
+			// stats are only read on the render thread after flush()
+			stats_.encode_time += std::chrono::duration<double>( end - start ).count();
+			( ok ? stats_.written : stats_.failed )++;
+			slot.state = SlotState::kFree;
+		} );
+	}
+
+	/// \brief Runs on the encoder thread
+	bool write( const Slot & slot, VkExtent2D extent, bool swizzle )
+	{
+		size_t pixels = size_t( extent.width ) * extent.height;
+		char index[16];
+		std::snprintf( index, sizeof( index ), "_%06llu", static_cast<unsigned long long>( slot.frame ) );
+		std::string path = config_.target + index;
+
+		if ( config_.format == CaptureFormat::kRaw || config_.format == CaptureFormat::kPipe )
+		{
+			const uint8_t * rgba = slot.mapped;
+			if ( swizzle )
+			{
+				scratch_.resize( pixels * 4 );
+				for ( size_t i = 0; i < pixels; ++i )
+				{
+					scratch_[i * 4 + 0] = slot.mapped[i * 4 + 2];
+					scratch_[i * 4 + 1] = slot.mapped[i * 4 + 1];
+					scratch_[i * 4 + 2] = slot.mapped[i * 4 + 0];
+					scratch_[i * 4 + 3] = slot.mapped[i * 4 + 3];
+				}
+				rgba = scratch_.data();
+			}
+
+			if ( config_.format == CaptureFormat::kPipe )
+			{
+				return std::fwrite( rgba, 1, pixels * 4, pipe_ ) == pixels * 4;
+			}
+			return image_writer::writeFile( path + ".rgba", rgba, pixels * 4 );
+		}
+
+		scratch_.resize( pixels * 3 );
+		int r = swizzle ? 2 : 0;
+		int b = swizzle ? 0 : 2;
+		for ( size_t i = 0; i < pixels; ++i )
+		{
+			scratch_[i * 3 + 0] = slot.mapped[i * 4 + r];
+			scratch_[i * 3 + 1] = slot.mapped[i * 4 + 1];
+			scratch_[i * 3 + 2] = slot.mapped[i * 4 + b];
+		}
+
+		if ( config_.format == CaptureFormat::kPpm )
+		{
+			return image_writer::writePpm( path + ".ppm", scratch_.data(), extent.width, extent.height );
+		}
+		return image_writer::writePng( path + ".png", scratch_.data(), extent.width, extent.height );
+	}
+
+	static constexpr uint32_t kNoMemoryType = ~0u;
+
+	uint32_t findMemoryType( uint32_t type_filter, VkMemoryPropertyFlags props ) const
+	{
+		for ( uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i )
+		{
+			if ( ( type_filter & ( 1 << i ) )
+				 && ( memory_properties_.memoryTypes[i].propertyFlags & props ) == props )
+			{
+				return i;
+			}
+		}
+		return kNoMemoryType;
+	}
+
+	VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
+	VkDevice device_ = VK_NULL_HANDLE;
+	FrameSync * frame_sync_ = nullptr;
+	VkPhysicalDeviceMemoryProperties memory_properties_ = {};
+	CaptureConfig config_;
+
+	std::vector<std::unique_ptr<Slot>> slots_;
+	Slot * recorded_ = nullptr;
+	VkExtent2D extent_ = {};
+	bool swizzle_ = false;
+	uint64_t frame_ = 0;
+	CaptureStats stats_;
+
+	std::unique_ptr<ThreadPool> encoder_;
+	std::vector<uint8_t> scratch_; // encoder thread only
+	FILE * pipe_ = nullptr;
+};
@@ -0,0 +1,247 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency_histogram.h"
+
+enum class PacingPolicy {
+	kLowLatency, // MAILBOX or IMMEDIATE, at most one frame queued for present
+	kVsync,      // FIFO, the display sets the rate
+	kCapped      // FIFO plus a frame limiter, for stable low power
+};
+
+inline PacingPolicy parsePacingPolicy( const std::string & name )
+{
+	if ( name == "latency" ) return PacingPolicy::kLowLatency;
+	if ( name == "vsync" ) return PacingPolicy::kVsync;
+	if ( name == "capped" ) return PacingPolicy::kCapped;
+	throw std::runtime_error( "Unknown pacing policy: " + name );
+}
+
+/// \brief Sleep-then-spin limiter. The OS sleep overshoots by up to a
+/// scheduler tick, so it sleeps until a margin before the deadline and
+/// spins the rest. The margin follows the overshoot actually seen.
+class FrameLimiter {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	void setRate( double fps )
+	{
+		period_ = fps > 0.0
+			? std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( 1.0 / fps ) )
+			: Clock::duration::zero();
+		next_ = Clock::time_point();
+	}
+
+	/// \brief Block until the next frame is due
+	void wait()
+	{
+		if ( period_ == Clock::duration::zero() )
+		{
+			return;
+		}
+
+		auto now = Clock::now();
+		// first frame, or more than a frame behind: restart the cadence
+		// rather than rushing frames out to catch up
+		if ( next_ == Clock::time_point() || now - next_ > period_ )
+		{
+			next_ = now + period_;
+			return;
+		}
+
+		auto sleep_until = next_ - spin_margin_;
+		if ( now < sleep_until )
+		{
+			std::this_thread::sleep_until( sleep_until );
+			auto overshoot = Clock::now() - sleep_until;
+			spin_margin_ = std::clamp( std::max( spin_margin_ * 15 / 16, overshoot + overshoot / 2 ),
+									   kMinSpinMargin, kMaxSpinMargin );
+		}
+		while ( Clock::now() < next_ )
+		{
+			std::this_thread::yield();
+		}
+		next_ += period_;
+	}
+
+	Clock::duration spinMargin() const { return spin_margin_; }
+
+private:
+	static constexpr Clock::duration kMinSpinMargin = std::chrono::microseconds( 200 );
+	static constexpr Clock::duration kMaxSpinMargin = std::chrono::milliseconds( 4 );
+
+	Clock::duration period_ = Clock::duration::zero();
+	Clock::time_point next_;
+	Clock::duration spin_margin_ = std::chrono::milliseconds( 1 );
+};
+
+/// \brief Present mode choice, frame limiting and input to present latency.
+///
+/// With VK_KHR_present_id and VK_KHR_present_wait every present gets an
+/// id, the low latency policy waits for the previous frame to reach the
+/// display before sampling input for the next, and latency is measured
+/// to when a completed present is next seen, at the start of a frame.
+/// Without them latency is measured to vkQueuePresentKHR returning, which
+/// leaves out the time queued for the display.
+class FramePacer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	void init( VkDevice device, PacingPolicy policy, double fps_cap, bool present_wait )
+	{
+		device_ = device;
+		policy_ = policy;
+		if ( present_wait )
+		{
+			wait_for_present_ = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr( device_, "vkWaitForPresentKHR" );
+		}
+		limiter_.setRate( policy_ == PacingPolicy::kCapped ? fps_cap : 0.0 );
+	}
+
+	VkPresentModeKHR choosePresentMode( const std::vector<VkPresentModeKHR> & available ) const
+	{
+		auto has = [&]( VkPresentModeKHR mode ) {
+			return std::find( available.begin(), available.end(), mode ) != available.end();
+		};
+
+		if ( policy_ == PacingPolicy::kLowLatency )
+		{
+			if ( has( VK_PRESENT_MODE_MAILBOX_KHR ) )
+				return VK_PRESENT_MODE_MAILBOX_KHR;
+			if ( has( VK_PRESENT_MODE_IMMEDIATE_KHR ) )
+				return VK_PRESENT_MODE_IMMEDIATE_KHR;
+		}
+		// the only mode every device has
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+
+	/// \brief Call before polling input for a frame
+	void beginFrame( VkSwapchainKHR swap_chain )
+	{
+		limiter_.wait();
+
+		if ( wait_for_present_ != nullptr && swap_chain != VK_NULL_HANDLE )
+		{
+			// Leaves one frame queued behind the one on screen
+			if ( policy_ == PacingPolicy::kLowLatency && last_id_ > 1 )
+			{
+				waitPresent( swap_chain, last_id_ - 1, kPresentTimeout );
+			}
+			collectPresents( swap_chain );
+		}
+	}
+
+	/// \brief An input event arrived, timed from the first one per frame
+	void inputEvent()
+	{
+		if ( !input_pending_ )
+		{
+			input_time_ = Clock::now();
+			input_pending_ = true;
+		}
+	}
+
+	/// \brief Chain onto VkPresentInfoKHR::pNext, null without present id
+	const void * presentChain( const void * next )
+	{
+		if ( wait_for_present_ == nullptr )
+		{
+			return next;
+		}
+
+		present_id_value_ = ++last_id_;
+		present_id_ = {};
+		present_id_.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+		present_id_.pNext = next;
+		present_id_.swapchainCount = 1;
+		present_id_.pPresentIds = &present_id_value_;
+		return &present_id_;
+	}
+
+	/// \brief After vkQueuePresentKHR
+	void presented()
+	{
+		frames_++;
+		if ( !input_pending_ )
+		{
+			return;
+		}
+		input_pending_ = false;
+
+		if ( wait_for_present_ != nullptr )
+		{
+			pending_.push_back( { last_id_, input_time_ } );
+		}
+		else
+		{
+			latency_.record( Clock::now() - input_time_ );
+		}
+	}
+
+	/// \brief Present ids restart with a new swapchain
+	void swapchainRecreated()
+	{
+		pending_.clear();
+		last_id_ = 0;
+	}
+
+	void printStats() const
+	{
+		static const char * kPolicyNames[] = { "lowest latency", "vsync", "capped" };
+		std::cout << "Frame pacing: " << kPolicyNames[static_cast<int>( policy_ )]
+			<< ", " << frames_ << " frames, limiter spin margin "
+			<< std::chrono::duration<double, std::micro>( limiter_.spinMargin() ).count() << " us" << std::endl;
+		latency_.print( wait_for_present_ != nullptr ? "input to present (present wait)"
+													 : "input to vkQueuePresentKHR" );
+	}
+
+private:
+	static constexpr uint64_t kPresentTimeout = 100000000; // 100 ms, ns
+
+	struct PendingPresent {
+		uint64_t id;
+		Clock::time_point input_time;
+	};
+
+	bool waitPresent( VkSwapchainKHR swap_chain, uint64_t id, uint64_t timeout )
+	{
+		// OUT_OF_DATE and friends are handled by the acquire that follows
+		return wait_for_present_( device_, swap_chain, id, timeout ) == VK_SUCCESS;
+	}
+
+	/// \brief Latency for every present that has completed, never blocks
+	void collectPresents( VkSwapchainKHR swap_chain )
+	{
+		while ( !pending_.empty() && waitPresent( swap_chain, pending_.front().id, 0 ) )
+		{
+			latency_.record( Clock::now() - pending_.front().input_time );
+			pending_.pop_front();
+		}
+	}
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	PacingPolicy policy_ = PacingPolicy::kLowLatency;
+	PFN_vkWaitForPresentKHR wait_for_present_ = nullptr;
+	FrameLimiter limiter_;
+
+	VkPresentIdKHR present_id_ = {};
+	uint64_t present_id_value_ = 0;
+	uint64_t last_id_ = 0;
+	std::deque<PendingPresent> pending_;
+
+	bool input_pending_ = false;
+	Clock::time_point input_time_;
+	LatencyHistogram latency_;
+	uint64_t frames_ = 0;
+};
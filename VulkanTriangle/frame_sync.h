@@ -0,0 +1,437 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// \brief Queue a submission runs on, each track has its own timeline
+enum class QueueTrack {
+	kGraphics,
+	kCompute,
+	kTransfer,
+	kCount
+};
+
+/// \brief A point on a track's timeline, reached once the GPU has
+/// finished the submission that signalled it. Value 0 is always reached.
+struct SyncPoint {
+	QueueTrack track = QueueTrack::kGraphics;
+	uint64_t value = 0;
+};
+
+/// \brief GPU side wait on another track before stage_mask
+struct SyncWait {
+	SyncPoint point;
+	VkPipelineStageFlags stage_mask;
+};
+
+/// \brief Submission bookkeeping built on VK_KHR_timeline_semaphore.
+///
+/// Every submit() signals the next value on its track's timeline so
+/// one integer per track says how far the GPU has got. Frame pacing is a
+/// single vkWaitSemaphores on the value the frame slot last signalled,
+/// with no fences to reset. Without the extension each submission gets
+/// a pooled fence instead, and cross-track waits use a binary semaphore
+/// that may be waited on once.
+class FrameSync {
+public:
+	void init( VkDevice device, bool use_timeline )
+	{
+		device_ = device;
+		use_timeline_ = use_timeline;
+
+		if ( !use_timeline_ )
+		{
+			return;
+		}
+
+		wait_semaphores_ = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr( device_, "vkWaitSemaphoresKHR" );
+		get_counter_value_ = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr( device_, "vkGetSemaphoreCounterValueKHR" );
+		if ( wait_semaphores_ == nullptr || get_counter_value_ == nullptr )
+		{
+			throw std::runtime_error( "Failed to load VK_KHR_timeline_semaphore entry points!" );
+		}
+
+		VkSemaphoreTypeCreateInfoKHR type_info = {};
+		type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		type_info.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphore_info = {};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_info.pNext = &type_info;
+
+		for ( auto & track : tracks_ )
+		{
+			if ( auto status = vkCreateSemaphore( device_, &semaphore_info, nullptr, &track.timeline );
+				 status != VK_SUCCESS )
+			{
+				throw std::runtime_error( "Failed to create timeline semaphore!" );
+			}
+		}
+	}
+
+	/// \brief Submit command buffers on queue as the next point of track.
+	///
+	/// binary_waits / binary_signals are for the swapchain, which only
+	/// speaks binary semaphores.
+	SyncPoint submit( VkQueue queue,
+					  QueueTrack track,
+					  const std::vector<VkCommandBuffer> & command_buffers,
+					  const std::vector<SyncWait> & waits,
+					  const std::vector<std::pair<VkSemaphore, VkPipelineStageFlags>> & binary_waits = {},
+					  const std::vector<VkSemaphore> & binary_signals = {},
+					  bool gpu_waitable = false )
+	{
+		auto & state = tracks_[static_cast<size_t>( track )];
+		SyncPoint point = { track, ++state.last_submitted };
+
+		std::vector<VkSemaphore> wait_semaphores;
+		std::vector<VkPipelineStageFlags> wait_stages;
+		std::vector<uint64_t> wait_values;
+		std::vector<VkSemaphore> signal_semaphores( binary_signals );
+		std::vector<uint64_t> signal_values( binary_signals.size(), 0 );
+		std::vector<VkSemaphore> consumed;
+
+		for ( const auto & [semaphore, stage] : binary_waits )
+		{
+			wait_semaphores.push_back( semaphore );
+			wait_stages.push_back( stage );
+			wait_values.push_back( 0 );
+		}
+
+		for ( const auto & wait : waits )
+		{
+			if ( wait.point.value == 0 || isComplete( wait.point ) )
+			{
+				continue;
+			}
+
+			if ( use_timeline_ )
+			{
+				wait_semaphores.push_back( tracks_[static_cast<size_t>( wait.point.track )].timeline );
+			}
+			else
+			{
+				consumed.push_back( takeBinarySemaphore( wait.point ) );
+				wait_semaphores.push_back( consumed.back() );
+			}
+			wait_stages.push_back( wait.stage_mask );
+			wait_values.push_back( wait.point.value );
+		}
+
+		VkFence fence = VK_NULL_HANDLE;
+		if ( use_timeline_ )
+		{
+			signal_semaphores.push_back( state.timeline );
+			signal_values.push_back( point.value );
+		}
+		else
+		{
+			fence = acquireFence();
+			state.pending.push_back( { point.value, fence, VK_NULL_HANDLE, std::move( consumed ) } );
+			if ( gpu_waitable )
+			{
+				state.pending.back().semaphore = acquireSemaphore();
+				signal_semaphores.push_back( state.pending.back().semaphore );
+				signal_values.push_back( 0 );
+			}
+		}
+
+		VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>( wait_values.size() );
+		timeline_info.pWaitSemaphoreValues = wait_values.data();
+		timeline_info.signalSemaphoreValueCount = static_cast<uint32_t>( signal_values.size() );
+		timeline_info.pSignalSemaphoreValues = signal_values.data();
+
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = use_timeline_ ? &timeline_info : nullptr;
+		submit_info.waitSemaphoreCount = static_cast<uint32_t>( wait_semaphores.size() );
+		submit_info.pWaitSemaphores = wait_semaphores.data();
+		submit_info.pWaitDstStageMask = wait_stages.data();
+		submit_info.commandBufferCount = static_cast<uint32_t>( command_buffers.size() );
+		submit_info.pCommandBuffers = command_buffers.data();
+		submit_info.signalSemaphoreCount = static_cast<uint32_t>( signal_semaphores.size() );
+		submit_info.pSignalSemaphores = signal_semaphores.data();
+
+		if ( auto status = vkQueueSubmit( queue, 1, &submit_info, fence );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to submit command buffer! Status: " + std::to_string( status ) );
+		}
+
+		return point;
+	}
+
+	/// \brief Non-blocking check whether the GPU has reached point
+	bool isComplete( const SyncPoint & point )
+	{
+		return completedValue( point.track ) >= point.value;
+	}
+
+	/// \brief Highest value on track the GPU has finished
+	uint64_t completedValue( QueueTrack track )
+	{
+		auto & state = tracks_[static_cast<size_t>( track )];
+		if ( use_timeline_ )
+		{
+			uint64_t value = 0;
+			get_counter_value_( device_, state.timeline, &value );
+			state.last_completed = std::max( state.last_completed, value );
+			return state.last_completed;
+		}
+
+		retireFences( state, false );
+		return state.last_completed;
+	}
+
+	/// \brief Block the host until the GPU has reached point
+	void wait( const SyncPoint & point )
+	{
+		if ( point.value == 0 || isComplete( point ) )
+		{
+			return;
+		}
+
+		host_waits_++;
+		auto & state = tracks_[static_cast<size_t>( point.track )];
+		if ( use_timeline_ )
+		{
+			VkSemaphoreWaitInfoKHR wait_info = {};
+			wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+			wait_info.semaphoreCount = 1;
+			wait_info.pSemaphores = &state.timeline;
+			wait_info.pValues = &point.value;
+			wait_semaphores_( device_, &wait_info, std::numeric_limits<uint64_t>::max() );
+			state.last_completed = std::max( state.last_completed, point.value );
+			return;
+		}
+
+		for ( const auto & pending : state.pending )
+		{
+			if ( pending.value >= point.value )
+			{
+				vkWaitForFences( device_, 1, &pending.fence, VK_TRUE, std::numeric_limits<uint64_t>::max() );
+				break;
+			}
+		}
+		retireFences( state, false );
+	}
+
+	/// \brief Point the next submit() on track will signal
+	SyncPoint nextPoint( QueueTrack track ) const
+	{
+		return { track, tracks_[static_cast<size_t>( track )].last_submitted + 1 };
+	}
+
+	/// \brief Latest point submitted on track
+	SyncPoint lastSubmitted( QueueTrack track ) const
+	{
+		return { track, tracks_[static_cast<size_t>( track )].last_submitted };
+	}
+
+	bool usesTimeline() const { return use_timeline_; }
+	uint64_t hostWaits() const { return host_waits_; }
+
+	/// \brief Sync objects currently owned, for comparing the two modes
+	size_t objectCount() const
+	{
+		size_t count = free_fences_.size() + free_semaphores_.size();
+		for ( const auto & track : tracks_ )
+		{
+			count += track.timeline != VK_NULL_HANDLE ? 1 : 0;
+			count += track.pending.size();
+		}
+		return count;
+	}
+
+	/// \brief Call after vkDeviceWaitIdle
+	void cleanup()
+	{
+		for ( auto & track : tracks_ )
+		{
+			retireFences( track, true );
+			vkDestroySemaphore( device_, track.timeline, nullptr );
+			track.timeline = VK_NULL_HANDLE;
+		}
+		for ( auto fence : free_fences_ )
+		{
+			vkDestroyFence( device_, fence, nullptr );
+		}
+		for ( auto semaphore : free_semaphores_ )
+		{
+			vkDestroySemaphore( device_, semaphore, nullptr );
+		}
+		free_fences_.clear();
+		free_semaphores_.clear();
+	}
+
+private:
+	struct PendingSubmit {
+		uint64_t value;
+		VkFence fence;
+		VkSemaphore semaphore; // fallback GPU wait handle, may be null
+		std::vector<VkSemaphore> consumed; // binary semaphores this submit waited on
+	};
+
+	struct TrackState {
+		VkSemaphore timeline = VK_NULL_HANDLE;
+		uint64_t last_submitted = 0;
+		uint64_t last_completed = 0;
+		std::deque<PendingSubmit> pending;
+	};
+
+	void retireFences( TrackState & state, bool device_idle )
+	{
+		while ( !state.pending.empty() )
+		{
+			auto & front = state.pending.front();
+			if ( !device_idle && vkGetFenceStatus( device_, front.fence ) != VK_SUCCESS )
+			{
+				break;
+			}
+
+			vkResetFences( device_, 1, &front.fence );
+			free_fences_.push_back( front.fence );
+			if ( front.semaphore != VK_NULL_HANDLE )
+			{
+				// Never waited on by the GPU, still signalled, so it can't be recycled
+				vkDestroySemaphore( device_, front.semaphore, nullptr );
+			}
+			// The waits have executed, so these are unsignalled again
+			free_semaphores_.insert( free_semaphores_.end(), front.consumed.begin(), front.consumed.end() );
+			state.last_completed = front.value;
+			state.pending.pop_front();
+		}
+	}
+
+	VkSemaphore takeBinarySemaphore( const SyncPoint & point )
+	{
+		auto & state = tracks_[static_cast<size_t>( point.track )];
+		for ( auto & pending : state.pending )
+		{
+			if ( pending.value == point.value && pending.semaphore != VK_NULL_HANDLE )
+			{
+				// Ownership moves to the waiting submission, which
+				// recycles it once its own fence signals
+				auto semaphore = pending.semaphore;
+				pending.semaphore = VK_NULL_HANDLE;
+				return semaphore;
+			}
+		}
+
+		throw std::runtime_error( "Sync point was not submitted as GPU waitable!" );
+	}
+
+	VkFence acquireFence()
+	{
+		if ( !free_fences_.empty() )
+		{
+			auto fence = free_fences_.back();
+			free_fences_.pop_back();
+			return fence;
+		}
+
+		VkFenceCreateInfo fence_info = {};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		VkFence fence;
+		if ( auto status = vkCreateFence( device_, &fence_info, nullptr, &fence );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create fence!" );
+		}
+		return fence;
+	}
+
+	VkSemaphore acquireSemaphore()
+	{
+		if ( !free_semaphores_.empty() )
+		{
+			auto semaphore = free_semaphores_.back();
+			free_semaphores_.pop_back();
+			return semaphore;
+		}
+
+		VkSemaphoreCreateInfo semaphore_info = {};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		VkSemaphore semaphore;
+		if ( auto status = vkCreateSemaphore( device_, &semaphore_info, nullptr, &semaphore );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create semaphore" );
+		}
+		return semaphore;
+	}
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	bool use_timeline_ = false;
+	PFN_vkWaitSemaphoresKHR wait_semaphores_ = nullptr;
+	PFN_vkGetSemaphoreCounterValueKHR get_counter_value_ = nullptr;
+
+	std::array<TrackState, static_cast<size_t>( QueueTrack::kCount )> tracks_;
+	std::vector<VkFence> free_fences_;
+	std::vector<VkSemaphore> free_semaphores_;
+	uint64_t host_waits_ = 0;
+};
+
+/// \brief Destroy callbacks held until the GPU passes a sync point
+class DeletionQueue {
+public:
+	void push( const SyncPoint & point, std::function<void()> deleter )
+	{
+		entries_.push_back( { point, std::move( deleter ) } );
+	}
+
+	/// \brief Run every deleter whose sync point the GPU has reached
+	size_t collect( FrameSync & sync )
+	{
+		size_t count = 0;
+		for ( auto it = entries_.begin(); it != entries_.end(); )
+		{
+			if ( sync.isComplete( it->point ) )
+			{
+				it->deleter();
+				it = entries_.erase( it );
+				count++;
+			}
+			else
+			{
+				++it;
+			}
+		}
+		return count;
+	}
+
+	/// \brief Run everything, call after vkDeviceWaitIdle
+	void flush()
+	{
+		for ( auto & entry : entries_ )
+		{
+			entry.deleter();
+		}
+		entries_.clear();
+	}
+
+	size_t size() const { return entries_.size(); }
+
+private:
+	struct Entry {
+		SyncPoint point;
+		std::function<void()> deleter;
+	};
+
+	std::deque<Entry> entries_;
+};
@@ -0,0 +1,467 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "mesh_lod.h"
+#include "vk_handle.h"
+
+/// \brief Free-list over a range of elements. Allocation takes the
+/// smallest block that fits, freeing merges with the free neighbours.
+class RangeAllocator {
+public:
+	static constexpr uint32_t kInvalid = UINT32_MAX;
+
+	void init( uint32_t capacity )
+	{
+		capacity_ = capacity;
+		used_ = 0;
+		by_offset_.clear();
+		by_size_.clear();
+		if ( capacity > 0 )
+		{
+			insertFree( 0, capacity );
+		}
+	}
+
+	/// \brief First element of count free ones, kInvalid when no block fits
+	uint32_t allocate( uint32_t count )
+	{
+		auto fit = by_size_.lower_bound( count );
+		if ( count == 0 || fit == by_size_.end() )
+		{
+			return kInvalid;
+		}
+
+		uint32_t size = fit->first;
+		uint32_t offset = fit->second;
+		by_size_.erase( fit );
+		by_offset_.erase( offset );
+		if ( size > count )
+		{
+			insertFree( offset + count, size - count );
+		}
+		used_ += count;
+		return offset;
+	}
+
+	/// \brief Lowest free block of count elements starting below limit,
+	/// kInvalid when there is none. Compaction moves ranges down with it.
+	uint32_t allocateLowest( uint32_t count, uint32_t limit )
+	{
+		for ( auto it = by_offset_.begin(); it != by_offset_.end() && it->first < limit; ++it )
+		{
+			if ( count > 0 && it->second >= count )
+			{
+				uint32_t offset = it->first;
+				uint32_t size = it->second;
+				eraseFree( it );
+				if ( size > count )
+				{
+					insertFree( offset + count, size - count );
+				}
+				used_ += count;
+				return offset;
+			}
+		}
+		return kInvalid;
+	}
+
+	void free( uint32_t offset, uint32_t count )
+	{
+		used_ -= count;
+
+		auto next = by_offset_.lower_bound( offset );
+		if ( next != by_offset_.end() && next->first == offset + count )
+		{
+			count += next->second;
+			next = eraseFree( next );
+		}
+		if ( next != by_offset_.begin() )
+		{
+			auto prev = std::prev( next );
+			if ( prev->first + prev->second == offset )
+			{
+				offset = prev->first;
+				count += prev->second;
+				eraseFree( prev );
+			}
+		}
+		insertFree( offset, count );
+	}
+
+	/// \brief Grow, or shrink to no less than usedEnd()
+	void setCapacity( uint32_t capacity )
+	{
+		if ( capacity >= capacity_ )
+		{
+			uint32_t added = capacity - capacity_;
+			uint32_t end = capacity_;
+			capacity_ = capacity;
+			if ( added > 0 )
+			{
+				used_ += added;
+				free( end, added );
+			}
+			return;
+		}
+
+		if ( capacity < usedEnd() )
+		{
+			throw std::runtime_error( "Range allocator can't shrink below its last allocation!" );
+		}
+		auto last = std::prev( by_offset_.end() );
+		uint32_t offset = last->first;
+		eraseFree( last );
+		if ( offset < capacity )
+		{
+			insertFree( offset, capacity - offset );
+		}
+		capacity_ = capacity;
+	}
+
+	/// \brief One past the last allocated element
+	uint32_t usedEnd() const
+	{
+		if ( by_offset_.empty() )
+		{
+			return capacity_;
+		}
+		auto last = std::prev( by_offset_.end() );
+		return last->first + last->second == capacity_ ? last->first : capacity_;
+	}
+
+	uint32_t capacity() const { return capacity_; }
+	uint32_t used() const { return used_; }
+	size_t freeBlocks() const { return by_offset_.size(); }
+	uint32_t largestFree() const { return by_size_.empty() ? 0 : by_size_.rbegin()->first; }
+
+	/// \brief Share of the free elements outside the largest block, 0 when
+	/// all of it could go to one allocation
+	double fragmentation() const
+	{
+		uint32_t free = capacity_ - used_;
+		return free == 0 ? 0.0 : 1.0 - double( largestFree() ) / free;
+	}
+
+private:
+	void insertFree( uint32_t offset, uint32_t count )
+	{
+		by_offset_.emplace( offset, count );
+		by_size_.emplace( count, offset );
+	}
+
+	std::map<uint32_t, uint32_t>::iterator eraseFree( std::map<uint32_t, uint32_t>::iterator it )
+	{
+		auto range = by_size_.equal_range( it->second );
+		for ( auto sized = range.first; sized != range.second; ++sized )
+		{
+			if ( sized->second == it->first )
+			{
+				by_size_.erase( sized );
+				break;
+			}
+		}
+		return by_offset_.erase( it );
+	}
+
+	uint32_t capacity_ = 0;
+	uint32_t used_ = 0;
+	std::map<uint32_t, uint32_t> by_offset_; // offset -> count
+	std::multimap<uint32_t, uint32_t> by_size_; // count -> offset
+};
+
+/// \brief Where a mesh lives in the pool. Its indices are local to the
+/// mesh, vertex_offset goes in as the draw's vertexOffset.
+struct PooledMesh {
+	int32_t vertex_offset = 0;
+	uint32_t vertex_count = 0;
+	uint32_t first_index = 0;
+	uint32_t index_count = 0;
+	std::vector<MeshLod> lods; // first_index into the pool's index buffer
+};
+
+/// \brief One vertex and one index buffer every mesh is sub-allocated
+/// from. Both are bound once per command buffer and a mesh is only a
+/// vertexOffset and a firstIndex, so any number of them draw without
+/// rebinding and consecutive draws merge into one indirect draw.
+///
+/// Indices stay 16 bit: vertexOffset is added after the index is read, so
+/// only a single mesh is limited to 65536 vertices, not the pool.
+class GeometryPool {
+public:
+	using Index = uint16_t;
+	static constexpr VkIndexType kIndexType = VK_INDEX_TYPE_UINT16;
+	static constexpr uint32_t kInvalid = UINT32_MAX;
+
+	/// \brief Takes over the buffers, their sizes set the capacities
+	void init( BufferAllocation vertices, BufferAllocation indices, uint32_t vertex_stride )
+	{
+		vertex_stride_ = vertex_stride;
+		vertices_ = std::move( vertices );
+		indices_ = std::move( indices );
+		vertex_ranges_.init( static_cast<uint32_t>( vertices_.size / vertex_stride ) );
+		index_ranges_.init( static_cast<uint32_t>( indices_.size / sizeof( Index ) ) );
+		meshes_.clear();
+		free_ids_.clear();
+	}
+
+	/// \brief Swap in buffers of another size, every range has to fit
+	/// them. Returns the old buffers, the caller copies them over and
+	/// retires them.
+	std::pair<BufferAllocation, BufferAllocation> resize( BufferAllocation vertices, BufferAllocation indices )
+	{
+		vertex_ranges_.setCapacity( static_cast<uint32_t>( vertices.size / vertex_stride_ ) );
+		index_ranges_.setCapacity( static_cast<uint32_t>( indices.size / sizeof( Index ) ) );
+		std::swap( vertices_, vertices );
+		std::swap( indices_, indices );
+		settled_ = false;
+		return { std::move( vertices ), std::move( indices ) };
+	}
+
+	void cleanup()
+	{
+		vertices_.reset();
+		indices_.reset();
+		meshes_.clear();
+		free_ids_.clear();
+	}
+
+	/// \brief Reserve room for a mesh whose lods index from its own first
+	/// index. kInvalid when the pool has no block big enough, the caller
+	/// uploads to vertexByteOffset() and indexByteOffset().
+	uint32_t add( uint32_t vertex_count, uint32_t index_count, const std::vector<MeshLod> & lods )
+	{
+		if ( vertex_count > 65536 )
+		{
+			throw std::runtime_error( "Mesh has more vertices than 16 bit indices reach!" );
+		}
+
+		uint32_t vertex_offset = vertex_ranges_.allocate( vertex_count );
+		if ( vertex_offset == RangeAllocator::kInvalid )
+		{
+			return kInvalid;
+		}
+		uint32_t first_index = index_ranges_.allocate( index_count );
+		if ( first_index == RangeAllocator::kInvalid )
+		{
+			vertex_ranges_.free( vertex_offset, vertex_count );
+			return kInvalid;
+		}
+
+		PooledMesh mesh;
+		mesh.vertex_offset = static_cast<int32_t>( vertex_offset );
+		mesh.vertex_count = vertex_count;
+		mesh.first_index = first_index;
+		mesh.index_count = index_count;
+		mesh.lods = lods;
+		for ( auto & lod : mesh.lods )
+		{
+			lod.first_index += first_index;
+		}
+
+		if ( free_ids_.empty() )
+		{
+			meshes_.push_back( std::move( mesh ) );
+			return static_cast<uint32_t>( meshes_.size() - 1 );
+		}
+		uint32_t id = free_ids_.back();
+		free_ids_.pop_back();
+		meshes_[id] = std::move( mesh );
+		return id;
+	}
+
+	/// \brief A range compaction moved, the old one stays allocated until
+	/// release() as frames in flight may still read it
+	struct Move {
+		bool indices;
+		uint32_t old_offset;
+		uint32_t count;
+		VkBufferCopy copy; // within the vertex or index buffer
+	};
+
+	/// \brief A compaction step: move the highest ranges down into the
+	/// lowest holes that fit and patch their meshes, until max_bytes are
+	/// moved or the deadline passes. The caller records the copies ahead of
+	/// any draw using the new offsets.
+	std::vector<Move> compact( VkDeviceSize max_bytes, std::chrono::steady_clock::time_point deadline )
+	{
+		std::vector<Move> moves;
+		if ( settled_ )
+		{
+			return moves;
+		}
+
+		VkDeviceSize moved = 0;
+		std::vector<uint32_t> ids;
+		for ( bool indices : { false, true } )
+		{
+			auto & ranges = indices ? index_ranges_ : vertex_ranges_;
+			if ( ranges.fragmentation() == 0.0 )
+			{
+				continue;
+			}
+
+			VkDeviceSize element = indices ? sizeof( Index ) : vertex_stride_;
+			auto offset_of = [&]( uint32_t id ) {
+				return indices ? meshes_[id].first_index : static_cast<uint32_t>( meshes_[id].vertex_offset );
+			};
+
+			ids.clear();
+			for ( uint32_t id = 0; id < meshes_.size(); ++id )
+			{
+				if ( meshes_[id].vertex_count > 0 )
+				{
+					ids.push_back( id );
+				}
+			}
+			std::sort( ids.begin(), ids.end(), [&]( uint32_t a, uint32_t b ) { return offset_of( a ) > offset_of( b ); } );
+
+			for ( auto id : ids )
+			{
+				if ( moved >= max_bytes || std::chrono::steady_clock::now() > deadline )
+				{
+					return moves;
+				}
+
+				auto & mesh = meshes_[id];
+				uint32_t offset = offset_of( id );
+				uint32_t count = indices ? mesh.index_count : mesh.vertex_count;
+				uint32_t target = ranges.allocateLowest( count, offset );
+				if ( target == RangeAllocator::kInvalid )
+				{
+					continue;
+				}
+
+				Move move;
+				move.indices = indices;
+				move.old_offset = offset;
+				move.count = count;
+				move.copy.srcOffset = offset * element;
+				move.copy.dstOffset = target * element;
+				move.copy.size = count * element;
+				moves.push_back( move );
+				moved += move.copy.size;
+
+				if ( indices )
+				{
+					mesh.first_index = target;
+					for ( auto & lod : mesh.lods )
+					{
+						lod.first_index = lod.first_index - offset + target;
+					}
+				}
+				else
+				{
+					mesh.vertex_offset = static_cast<int32_t>( target );
+				}
+			}
+		}
+
+		// Nothing left that a hole below could take
+		settled_ = moves.empty();
+		return moves;
+	}
+
+	/// \brief Hand a moved range's old place back
+	void release( const Move & move )
+	{
+		( move.indices ? index_ranges_ : vertex_ranges_ ).free( move.old_offset, move.count );
+		settled_ = false;
+	}
+
+	/// \brief True once compact() found nothing to move and nothing was
+	/// freed since
+	bool settled() const { return settled_; }
+
+	/// \brief Only once no frame in flight draws the mesh anymore
+	void remove( uint32_t id )
+	{
+		auto & mesh = meshes_[id];
+		vertex_ranges_.free( static_cast<uint32_t>( mesh.vertex_offset ), mesh.vertex_count );
+		index_ranges_.free( mesh.first_index, mesh.index_count );
+		mesh = {};
+		free_ids_.push_back( id );
+		settled_ = false;
+	}
+
+	const PooledMesh & mesh( uint32_t id ) const { return meshes_[id]; }
+	size_t meshCount() const { return meshes_.size() - free_ids_.size(); }
+
+	uint32_t vertexStride() const { return vertex_stride_; }
+	VkBuffer vertexBuffer() const { return vertices_.buffer; }
+	VkBuffer indexBuffer() const { return indices_.buffer; }
+	VkDeviceSize vertexByteOffset( uint32_t id ) const { return VkDeviceSize( meshes_[id].vertex_offset ) * vertex_stride_; }
+	VkDeviceSize indexByteOffset( uint32_t id ) const { return VkDeviceSize( meshes_[id].first_index ) * sizeof( Index ); }
+
+	const RangeAllocator & vertexRanges() const { return vertex_ranges_; }
+	const RangeAllocator & indexRanges() const { return index_ranges_; }
+
+	/// \brief The only binds any pooled draw needs
+	void bind( VkCommandBuffer command_buffer ) const
+	{
+		VkBuffer buffers[] = { vertices_.buffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers( command_buffer, 0, 1, buffers, offsets );
+		vkCmdBindIndexBuffer( command_buffer, indices_.buffer, 0, kIndexType );
+	}
+
+	void draw( VkCommandBuffer command_buffer, uint32_t id, uint32_t lod ) const
+	{
+		const auto & mesh = meshes_[id];
+		vkCmdDrawIndexed( command_buffer, mesh.lods[lod].index_count, 1, mesh.lods[lod].first_index, mesh.vertex_offset, 0 );
+	}
+
+	/// \brief The same draw for an indirect buffer
+	VkDrawIndexedIndirectCommand drawCommand( uint32_t id, uint32_t lod, uint32_t first_instance = 0 ) const
+	{
+		const auto & mesh = meshes_[id];
+		VkDrawIndexedIndirectCommand command = {};
+		command.indexCount = mesh.lods[lod].index_count;
+		command.instanceCount = 1;
+		command.firstIndex = mesh.lods[lod].first_index;
+		command.vertexOffset = mesh.vertex_offset;
+		command.firstInstance = first_instance;
+		return command;
+	}
+
+	/// \brief Bytes the meshes' ranges take
+	VkDeviceSize usedBytes() const
+	{
+		return VkDeviceSize( vertex_ranges_.used() ) * vertex_stride_ + VkDeviceSize( index_ranges_.used() ) * sizeof( Index );
+	}
+
+	/// \brief Bytes of the pool buffers, used or not
+	VkDeviceSize allocatedBytes() const { return vertices_.size + indices_.size; }
+
+	void printStats( const char * label ) const
+	{
+		auto mb = []( VkDeviceSize bytes ) { return bytes / ( 1024.0 * 1024.0 ); };
+		std::cout << label << meshCount() << " meshes, vertices "
+			<< mb( VkDeviceSize( vertex_ranges_.used() ) * vertex_stride_ ) << " of " << mb( vertices_.size ) << " MB, indices "
+			<< mb( VkDeviceSize( index_ranges_.used() ) * sizeof( Index ) ) << " of " << mb( indices_.size ) << " MB, "
+			<< vertex_ranges_.freeBlocks() + index_ranges_.freeBlocks() << " free blocks, "
+			<< 100.0 * vertex_ranges_.fragmentation() << "% / " << 100.0 * index_ranges_.fragmentation()
+			<< "% fragmented" << std::endl;
+	}
+
+private:
+	uint32_t vertex_stride_ = 0;
+	BufferAllocation vertices_;
+	BufferAllocation indices_;
+	RangeAllocator vertex_ranges_;
+	RangeAllocator index_ranges_;
+	std::vector<PooledMesh> meshes_;
+	std::vector<uint32_t> free_ids_;
+	bool settled_ = false;
+};
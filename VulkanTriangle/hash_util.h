@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/// \brief Mix the hash of value into seed (boost::hash_combine)
+template <typename T>
+inline void hashCombine( size_t & seed, const T & value )
+{
+	seed ^= std::hash<T>{}( value ) + 0x9e3779b9 + ( seed << 6 ) + ( seed >> 2 );
+}
+
+/// \brief FNV-1a over a raw byte range
+inline uint64_t hashBytes( const void * data, size_t size, uint64_t seed = 14695981039346656037ull )
+{
+	auto bytes = static_cast<const uint8_t*>( data );
+	uint64_t hash = seed;
+	for ( size_t i = 0; i < size; ++i )
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location=0) in vec4 fragColor;
+layout(location=1) in vec2 fragCell;
+layout(location=2) flat in uvec2 fragMask;
+
+layout(location=0) out vec4 outColor;
+
+const int kGlyphWidth = 5;
+const int kGlyphHeight = 7;
+
+void main()
+{
+	// Bit row * 5 + column of the 5x7 glyph, solid quads only set bit 0
+	ivec2 cell = clamp(ivec2(fragCell), ivec2(0), ivec2(kGlyphWidth - 1, kGlyphHeight - 1));
+	uint bit = uint(cell.y * kGlyphWidth + cell.x);
+	uint word = bit < 32u ? fragMask.x : fragMask.y;
+	float lit = float((word >> (bit & 31u)) & 1u);
+	outColor = vec4(fragColor.rgb, fragColor.a * lit);
+}
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// See HudVertex, position is already in NDC
+layout(location=0) in vec2 inPosition;
+layout(location=1) in vec2 inCell;
+layout(location=2) in vec4 inColor;
+layout(location=3) in uvec2 inMask;
+
+layout(location=0) out vec4 fragColor;
+layout(location=1) out vec2 fragCell;
+layout(location=2) flat out uvec2 fragMask;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main()
+{
+	gl_Position = vec4(inPosition, 0.0, 1.0);
+	fragColor = inColor;
+	fragCell = inCell;
+	fragMask = inMask;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/// \brief Minimal image file writers for captured frames, no dependencies.
+///
+/// Pixels are tightly packed 8 bit RGB. PNGs use stored (uncompressed)
+/// deflate blocks, which is fast to write and keeps the encoder thread
+/// off the critical path, at the cost of raw sized files.
+namespace image_writer {
+
+inline uint32_t crc32( uint32_t crc, const uint8_t * data, size_t size )
+{
+	static const auto table = [] {
+		std::array<uint32_t, 256> entries;
+		for ( uint32_t n = 0; n < 256; ++n )
+		{
+			uint32_t c = n;
+			for ( int k = 0; k < 8; ++k )
+			{
+				c = ( c & 1 ) ? 0xEDB88320u ^ ( c >> 1 ) : c >> 1;
+			}
+			entries[n] = c;
+		}
+		return entries;
+	}();
+
+	crc = ~crc;
+	for ( size_t i = 0; i < size; ++i )
+	{
+		crc = table[( crc ^ data[i] ) & 0xFF] ^ ( crc >> 8 );
+	}
+	return ~crc;
+}
+
+inline void appendBigEndian( std::vector<uint8_t> & out, uint32_t value )
+{
+	out.push_back( static_cast<uint8_t>( value >> 24 ) );
+	out.push_back( static_cast<uint8_t>( value >> 16 ) );
+	out.push_back( static_cast<uint8_t>( value >> 8 ) );
+	out.push_back( static_cast<uint8_t>( value ) );
+}
+
+inline void appendPngChunk( std::vector<uint8_t> & out, const char type[4], const std::vector<uint8_t> & data )
+{
+	appendBigEndian( out, static_cast<uint32_t>( data.size() ) );
+	size_t type_start = out.size();
+	out.insert( out.end(), type, type + 4 );
+	out.insert( out.end(), data.begin(), data.end() );
+	appendBigEndian( out, crc32( 0, out.data() + type_start, out.size() - type_start ) );
+}
+
+/// \brief Whole file in memory, so the write is a single fwrite
+inline std::vector<uint8_t> encodePng( const uint8_t * rgb, uint32_t width, uint32_t height )
+{
+	constexpr size_t kMaxStoredBlock = 65535;
+
+	std::vector<uint8_t> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	std::vector<uint8_t> header;
+	appendBigEndian( header, width );
+	appendBigEndian( header, height );
+	header.insert( header.end(), { 8, 2, 0, 0, 0 } ); // 8 bit RGB, no interlace
+	appendPngChunk( out, "IHDR", header );
+
+	// Scanlines with filter type 0 in front of each
+	size_t stride = size_t( width ) * 3;
+	std::vector<uint8_t> scanlines;
+	scanlines.reserve( ( stride + 1 ) * height );
+	for ( uint32_t y = 0; y < height; ++y )
+	{
+		scanlines.push_back( 0 );
+		scanlines.insert( scanlines.end(), rgb + y * stride, rgb + ( y + 1 ) * stride );
+	}
+
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	zlib.reserve( scanlines.size() + scanlines.size() / kMaxStoredBlock * 5 + 16 );
+	uint32_t adler_a = 1, adler_b = 0;
+	for ( size_t offset = 0; ; offset += kMaxStoredBlock )
+	{
+		size_t size = std::min( kMaxStoredBlock, scanlines.size() - offset );
+		bool last = offset + size >= scanlines.size();
+		zlib.push_back( last ? 1 : 0 );
+		zlib.push_back( static_cast<uint8_t>( size ) );
+		zlib.push_back( static_cast<uint8_t>( size >> 8 ) );
+		zlib.push_back( static_cast<uint8_t>( ~size ) );
+		zlib.push_back( static_cast<uint8_t>( ~size >> 8 ) );
+		zlib.insert( zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + size );
+
+		for ( size_t i = offset; i < offset + size; ++i )
+		{
+			adler_a = ( adler_a + scanlines[i] ) % 65521;
+			adler_b = ( adler_b + adler_a ) % 65521;
+		}
+		if ( last )
+		{
+			break;
+		}
+	}
+	appendBigEndian( zlib, ( adler_b << 16 ) | adler_a );
+	appendPngChunk( out, "IDAT", zlib );
+	appendPngChunk( out, "IEND", {} );
+	return out;
+}
+
+inline bool writeFile( const std::string & path, const void * data, size_t size )
+{
+	FILE * file = std::fopen( path.c_str(), "wb" );
+	if ( file == nullptr )
+	{
+		return false;
+	}
+	bool ok = std::fwrite( data, 1, size, file ) == size;
+	return std::fclose( file ) == 0 && ok;
+}
+
+inline bool writePng( const std::string & path, const uint8_t * rgb, uint32_t width, uint32_t height )
+{
+	auto png = encodePng( rgb, width, height );
+	return writeFile( path, png.data(), png.size() );
+}
+
+inline bool writePpm( const std::string & path, const uint8_t * rgb, uint32_t width, uint32_t height )
+{
+	std::string header = "P6\n" + std::to_string( width ) + " " + std::to_string( height ) + "\n255\n";
+	std::vector<uint8_t> ppm( header.begin(), header.end() );
+	ppm.insert( ppm.end(), rgb, rgb + size_t( width ) * height * 3 );
+	return writeFile( path, ppm.data(), ppm.size() );
+}
+
+} // namespace image_writer
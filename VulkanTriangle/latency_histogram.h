@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+/// \brief Lock-free histogram of durations in power of two microsecond
+/// buckets, bucket i holds samples in [2^(i-1), 2^i) us.
+class LatencyHistogram {
+public:
+	static constexpr size_t kBucketCount = 32;
+
+	void record( std::chrono::nanoseconds duration )
+	{
+		uint64_t us = static_cast<uint64_t>( duration.count() / 1000 );
+		size_t bucket = 0;
+		while ( us > 0 && bucket < kBucketCount - 1 )
+		{
+			us >>= 1;
+			bucket++;
+		}
+
+		buckets_[bucket].fetch_add( 1, std::memory_order_relaxed );
+		count_.fetch_add( 1, std::memory_order_relaxed );
+		total_ns_.fetch_add( duration.count(), std::memory_order_relaxed );
+
+		uint64_t ns = duration.count();
+		uint64_t prev = max_ns_.load( std::memory_order_relaxed );
+		while ( ns > prev && !max_ns_.compare_exchange_weak( prev, ns, std::memory_order_relaxed ) )
+		{
+		}
+	}
+
+	uint64_t count() const { return count_.load(); }
+
+	double meanMs() const
+	{
+		auto n = count();
+		return n ? total_ns_.load() / 1e6 / n : 0.0;
+	}
+
+	double maxMs() const { return max_ns_.load() / 1e6; }
+
+	/// \brief Upper bound of the bucket holding the given percentile
+	double percentileMs( double percentile ) const
+	{
+		auto n = count();
+		if ( n == 0 )
+			return 0.0;
+
+		uint64_t target = static_cast<uint64_t>( percentile / 100.0 * n );
+		uint64_t seen = 0;
+		for ( size_t i = 0; i < kBucketCount; ++i )
+		{
+			seen += buckets_[i].load();
+			if ( seen > target )
+				return ( 1ull << i ) / 1e3;
+		}
+		return maxMs();
+	}
+
+	void print( const std::string & name ) const
+	{
+		std::cout << name << ": " << count() << " samples"
+			<< ", mean " << meanMs() << " ms"
+			<< ", p50 <" << percentileMs( 50.0 ) << " ms"
+			<< ", p95 <" << percentileMs( 95.0 ) << " ms"
+			<< ", max " << maxMs() << " ms" << std::endl;
+
+		for ( size_t i = 0; i < kBucketCount; ++i )
+		{
+			auto samples = buckets_[i].load();
+			if ( samples == 0 )
+				continue;
+
+			std::cout << "\t<" << ( ( 1ull << i ) / 1e3 ) << " ms\t"
+				<< std::string( std::min<uint64_t>( samples, 60 ), '#' )
+				<< " " << samples << std::endl;
+		}
+	}
+
+private:
+	std::array<std::atomic<uint64_t>, kBucketCount> buckets_ = {};
+	std::atomic<uint64_t> count_{ 0 };
+	std::atomic<uint64_t> total_ns_{ 0 };
+	std::atomic<uint64_t> max_ns_{ 0 };
+};
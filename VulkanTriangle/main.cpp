@@ -3,6 +3,7 @@
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <chrono>
@@ -11,14 +12,42 @@
 #include <stdexcept>
 #include <functional>
 #include <cstdlib>
+#include <cstdio>
 #include <optional>
 #include <set>
 #include <algorithm>
 #include <array>
 
+#include "bench.h"
+#include "compute.h"
+#include "damage.h"
+#include "debug_messages.h"
+#include "device_caps.h"
+#include "descriptor_allocator.h"
+#include "draw_queue.h"
+#include "frame_capture.h"
+#include "frame_pacer.h"
+#include "frame_sync.h"
+#include "geometry_pool.h"
+#include "mesh_lod.h"
+#include "mip_generator.h"
+#include "particles.h"
+#include "perf_hud.h"
+#include "per_draw.h"
+#include "pipeline_manager.h"
+#include "render_targets.h"
+#include "shaders.h"
+#include "spirv_reflect.h"
+#include "startup.h"
+#include "texture_streamer.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "vk_handle.h"
+
 constexpr int kWidth = 800;
 constexpr int kHeight = 600;
 constexpr int kMaxFramesInFlight = 2;
+constexpr VkDeviceSize kPerDrawRingSize = 256 * 1024;
 
 const std::vector<const char*> kValidationLayers = {
 	"VK_LAYER_LUNARG_standard_validation"
@@ -34,6 +63,46 @@ const std::vector<const char*> kDeviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+/// Probed device caps, keyed by driver, see DeviceCapsCache
+const char * const kDeviceCapsCachePath = "device_caps.bin";
+
+/// Enabled when the device has them, code checks isDeviceExtensionEnabled()
+const std::vector<const char*> kOptionalDeviceExtensions = {
+	VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+	VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+	VK_KHR_PRESENT_ID_EXTENSION_NAME,
+	VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+	VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME,
+	VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME, // dynamic rendering depends on these two
+	VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+	VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+};
+
+/// Command line switches
+struct AppOptions {
+	bool benchmark = false; // --bench: run micro benchmarks instead of the main loop
+	VkDeviceSize texture_budget = 64ull * 1024 * 1024; // --texture-budget <MB>
+	uint32_t particle_count = 1u << 20; // --particles <count>, 0 disables them
+	bool headless = false; // --headless: no window, render to offscreen images
+	uint32_t frames = 0; // --frames <count>: exit after this many frames, 0 runs until closed
+	bool verbose_validation = false; // --verbose-validation: print verbose messages too, not just count them
+	bool device_cache = true; // --no-device-cache: probe every device on startup
+	bool idle = false; // --idle: only draw frames that change something, windowed only
+	std::string capture; // --capture <prefix or command>: write out every frame
+	CaptureFormat capture_format = CaptureFormat::kPng; // --capture-format raw|ppm|png|pipe
+	std::string record_trace; // --record-trace <path>: write the renderer calls to a trace
+	std::string replay_trace; // --replay-trace <path>: replay a trace headless on a fixed timestep
+	PacingPolicy pacing = PacingPolicy::kLowLatency; // --pacing latency|vsync|capped
+	double fps_cap = 60.0; // --fps <rate>, implies --pacing capped
+	bool dynamic_rendering = true; // --render-pass: use VkRenderPass and VkFramebuffer even with VK_KHR_dynamic_rendering
+	uint32_t msaa = 1; // --msaa <samples>: 1, 2, 4 or 8, lowered to what the device supports
+	float lod_error = 1.0f; // --lod-error <pixels>: screen space error a LOD may add, 0 always draws full detail
+	uint32_t instances = 1; // --instances <count>: copies of the demo mesh in a grid
+	double defrag_budget = 0.25; // --defrag-budget <ms>: CPU time geometry pool defragmentation may take a frame, 0 disables it
+	bool hud = false; // --hud: start with the performance overlay shown, F1 toggles it
+	PerDrawPath per_draw = PerDrawPath::kPushConstants; // --per-draw push|ubo: ubo forces the dynamic uniform fallback
+};
+
 VkResult CreateDebugUtilsMessengerEXT( VkInstance instance,
 									   const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo,
 									   const VkAllocationCallbacks* pAllocator,
@@ -59,8 +128,9 @@ void DestroyDebugUtilsMessengerEXT( VkInstance instance,
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphics_family;
 	std::optional<uint32_t> present_family;
+	std::optional<uint32_t> compute_family; // without graphics when the device has one
 
-	bool isComplete()
+	bool isComplete() const
 	{
 		return graphics_family.has_value() && present_family.has_value();
 	}
@@ -72,57 +142,142 @@ struct SwapChainSupportDetails {
 	std::vector<VkPresentModeKHR> present_modes;
 };
 
+/// Interleaved in tri.vert input location order, checked against
+/// reflection in basePipelineState()
 struct Vertex {
 	glm::vec2 pos;
 	glm::vec3 color;
-
-	static VkVertexInputBindingDescription getBindingDescription() {
-		VkVertexInputBindingDescription binding_desc = {};
-		binding_desc.binding = 0;
-		binding_desc.stride = sizeof( Vertex );
-		binding_desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-		return binding_desc;
-	}
-	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions()
-	{
-		std::array<VkVertexInputAttributeDescription, 2> attr_desc = {};
-		attr_desc[0].binding = 0;
-		attr_desc[0].location = 0;
-		attr_desc[0].format = VK_FORMAT_R32G32_SFLOAT; // vec2
-		attr_desc[0].offset = offsetof( Vertex, pos );
-
-		attr_desc[1].binding = 0;
-		attr_desc[1].location = 1;
-		attr_desc[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attr_desc[1].offset = offsetof( Vertex, color );
-		return attr_desc;
-	}
+	glm::vec2 uv;
 };
 
-const std::vector<Vertex> vertices = {
-    {{-0.5f, -0.5f}, {1.0f, 0.0f, 1.0f}},
-    {{0.5f, -0.5f}, {0.0f, 1.0f, 1.0f}},
-    {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
-    {{-0.5f, 0.5f}, {1.0f, 1.0f, 0.0f}}
+/// tri.vert inputs from here on are the per instance transform, a column
+/// each, in a binding of their own
+constexpr uint32_t kInstanceLocation = 3;
+
+/// GPU work the overlay times, in recording order. Each scope ends where
+/// the next begins, the last takes in the overlay and the resolve.
+enum class GpuScope : uint32_t {
+	kDefragmentation = 0,
+	kScene,
+	kParticles,
+	kOverlay,
+	kCount
 };
 
-const std::vector<uint16_t> indices = {
-	0, 1, 2, 2, 3, 0
+const char * const kGpuScopeNames[] = { "defrag", "scene", "particles", "hud+resolve" };
+
+struct GridMesh {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
 };
 
+/// \brief The demo mesh, resolution x resolution quads over -0.5..0.5.
+/// The corner colours blend as they did on the single quad, with rings
+/// on top so there is detail for the simplifier to keep.
+GridMesh makeGridMesh( uint32_t resolution )
+{
+	const glm::vec3 corners[4] = { { 1.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, { 1.0f, 1.0f, 0.0f } };
+
+	GridMesh mesh;
+	for ( uint32_t y = 0; y <= resolution; ++y )
+	{
+		for ( uint32_t x = 0; x <= resolution; ++x )
+		{
+			float u = float( x ) / resolution;
+			float v = float( y ) / resolution;
+			glm::vec2 pos( u - 0.5f, v - 0.5f );
+			float ring = 0.75f + 0.25f * std::cos( 6.0f * glm::pi<float>() * std::sqrt( pos.x * pos.x + pos.y * pos.y ) );
+			glm::vec3 color = ( corners[0] * ( ( 1.0f - u ) * ( 1.0f - v ) ) + corners[1] * ( u * ( 1.0f - v ) )
+								+ corners[2] * ( u * v ) + corners[3] * ( ( 1.0f - u ) * v ) ) * ring;
+			mesh.vertices.push_back( { pos, color, glm::vec2( 4.0f * u, 4.0f * v ) } );
+		}
+	}
+
+	for ( uint32_t y = 0; y < resolution; ++y )
+	{
+		for ( uint32_t x = 0; x < resolution; ++x )
+		{
+			uint32_t i = y * ( resolution + 1 ) + x;
+			uint32_t row = resolution + 1;
+			mesh.indices.insert( mesh.indices.end(), { i, i + 1, i + row + 1, i + row + 1, i + row, i } );
+		}
+	}
+	return mesh;
+}
+
+/// \brief Colour counts like position, the uv repeats four times over the
+/// mesh so it is scaled back to about the same range
+SimplifyVertices simplifyVertices( const std::vector<Vertex> & vertices )
+{
+	static_assert( sizeof( Vertex ) == 7 * sizeof( float ), "Vertex is not tightly packed floats" );
+
+	SimplifyVertices input;
+	input.data = &vertices[0].pos.x;
+	input.count = vertices.size();
+	input.stride = sizeof( Vertex ) / sizeof( float );
+	input.position_components = 2;
+	input.attribute_weights = { 1.0f, 1.0f, 1.0f, 0.125f, 0.125f };
+	return input;
+}
+
+/// Per frame data, per object data lives in PerDrawData
 struct UniformBufferObject {
-	glm::mat4 model;
 	glm::mat4 view;
 	glm::mat4 proj;
 };
 
+/// What an instance looks like for --idle damage tracking, compared
+/// byte for byte so the tail is padded explicitly
+struct InstanceDamageState {
+	glm::mat4 model;
+	VkImageView texture;
+	uint32_t lod;
+	uint32_t padding;
+};
+static_assert( sizeof( InstanceDamageState ) == sizeof( glm::mat4 ) + sizeof( VkImageView ) + 2 * sizeof( uint32_t ),
+			   "InstanceDamageState must have no implicit padding" );
+static_assert( sizeof( UniformBufferObject ) == 2 * sizeof( glm::mat4 ),
+			   "UniformBufferObject must have no implicit padding" );
+
 
 class HelloTriangleApplication {
 public:
+	explicit HelloTriangleApplication( const AppOptions & options )
+		: options_( options )
+	{
+	}
+
 	void run() {
-		initWindow();
+		startup_.run( "window", [this]() { initWindow(); } );
+
+		// Started before init so the resource creation is traced too
+		if ( !options_.record_trace.empty() )
+		{
+			trace_.startRecording( options_.record_trace );
+		}
+		else if ( !options_.replay_trace.empty() )
+		{
+			trace_.startReplay( options_.replay_trace );
+		}
+
 		initVulkan();
-		mainLoop();
+
+		if ( options_.benchmark )
+		{
+			startup_.finish();
+			runBenchmarks();
+		}
+		else if ( trace_.replaying() )
+		{
+			replayTrace();
+		}
+		else
+		{
+			mainLoop();
+		}
+		// closed before the first frame, cleanup expects the deferred steps
+		startup_.finish();
+		trace_.finish();
 		cleanup();
 	}
 
@@ -141,7 +296,7 @@ private:
 		app_info.applicationVersion = VK_MAKE_VERSION( 1, 0, 0 );
 		app_info.pEngineName = "No Engine";
 		app_info.engineVersion = VK_MAKE_VERSION( 1, 0, 0 );
-		app_info.apiVersion = VK_API_VERSION_1_0; // TODO: 1_1?
+		app_info.apiVersion = VK_API_VERSION_1_1; // vkGetPhysicalDeviceFeatures2
 
 		VkInstanceCreateInfo create_info = {};
 		create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -208,11 +363,13 @@ private:
 
 	std::vector<const char*> getRequiredExtensions()
 	{
-		uint32_t glfw_extension_count = 0;
-		auto glfw_extensions = glfwGetRequiredInstanceExtensions( &glfw_extension_count );
-
-		std::vector<const char*> extensions( glfw_extensions,
-											 glfw_extensions + glfw_extension_count );
+		std::vector<const char*> extensions;
+		if ( !options_.headless )
+		{
+			uint32_t glfw_extension_count = 0;
+			auto glfw_extensions = glfwGetRequiredInstanceExtensions( &glfw_extension_count );
+			extensions.assign( glfw_extensions, glfw_extensions + glfw_extension_count );
+		}
 		if ( kEnableValidationLayers )
 		{
 			extensions.push_back( VK_EXT_DEBUG_UTILS_EXTENSION_NAME );
@@ -222,17 +379,6 @@ private:
 	}
 
 	/// \brief Debug callback
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-		VkDebugUtilsMessageTypeFlagsEXT messageType,
-		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-		void* pUserData ) {
-
-		std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
-
-		return VK_FALSE;
-	}
-
 	void setupDebugCallback()
 	{
 		if ( !kEnableValidationLayers )
@@ -248,9 +394,11 @@ private:
 		create_info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
 			VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
 			VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-		create_info.pfnUserCallback = debugCallback;
-		create_info.pUserData = nullptr;
+		// Copied into a ring and printed from a background thread
+		create_info.pfnUserCallback = DebugMessenger::callback;
+		create_info.pUserData = &debug_messenger_;
 		create_info.flags = 0;
+		debug_messenger_.start( options_.verbose_validation );
 
 		if ( auto status = CreateDebugUtilsMessengerEXT( instance_, &create_info, nullptr, &callback_ );
 			 status != VK_SUCCESS )
@@ -262,6 +410,11 @@ private:
 
 	void createSurface()
 	{
+		if ( options_.headless )
+		{
+			return;
+		}
+
 		if ( auto status = glfwCreateWindowSurface( instance_, window_, nullptr, &surface_ );
 			 status != VK_SUCCESS)
 		{
@@ -270,91 +423,108 @@ private:
 		
 	}
 
-	QueueFamilyIndices findQueueFamilies( VkPhysicalDevice device )
+	/// \brief From the probed families, present support is asked of the
+	/// surface since it changes with the window
+	QueueFamilyIndices findQueueFamilies( VkPhysicalDevice device, const DeviceCaps & caps )
 	{
 		QueueFamilyIndices indices;
-		uint32_t queue_family_count = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties( device, &queue_family_count, nullptr );
-		std::vector<VkQueueFamilyProperties> queue_families( queue_family_count );
-		vkGetPhysicalDeviceQueueFamilyProperties( device,
-												  &queue_family_count,
-												  queue_families.data() );;
-
-		int i = 0;
-		for ( const auto& queue_family : queue_families )
+		uint32_t i = 0;
+		for ( const auto& queue_family : caps.queue_families )
 		{
 
-			VkBool32 present_support = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR( device,
-												  i,
-												  surface_,
-												  &present_support );
+			// headless frames are only read back, any graphics family will do
+			VkBool32 present_support = options_.headless && ( queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT );
+			if ( !options_.headless )
+			{
+				vkGetPhysicalDeviceSurfaceSupportKHR( device,
+													  i,
+													  surface_,
+													  &present_support );
+			}
 			if ( queue_family.queueCount > 0 )
 			{
-				if ( queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT )
+				if ( ( queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT ) && !indices.graphics_family )
 					indices.graphics_family = i;
-				if ( present_support )
+				if ( present_support && !indices.present_family )
 					indices.present_family = i;
-			}
-
-			if ( indices.isComplete() )
-			{
-				break;
+				// async compute: a family that can't do graphics runs beside it
+				if ( ( queue_family.queueFlags & VK_QUEUE_COMPUTE_BIT )
+					 && !( queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT )
+					 && !indices.compute_family )
+					indices.compute_family = i;
 			}
 			
 			i++;
 		}
 
+		// graphics families always support compute
+		if ( !indices.compute_family )
+		{
+			indices.compute_family = indices.graphics_family;
+		}
+
 		return indices;
 	}
 
-	bool isDeviceSuitable( VkPhysicalDevice device )
+	/// \brief Hard requirements, scoreDevice() ranks the devices that pass
+	bool isDeviceSuitable( VkPhysicalDevice device, const DeviceCaps & caps, const QueueFamilyIndices & indices )
 	{
-		VkPhysicalDeviceProperties device_properties;
-		VkPhysicalDeviceFeatures device_features;
-		vkGetPhysicalDeviceProperties( device, &device_properties );
-		vkGetPhysicalDeviceFeatures( device, &device_features );
-		std::cout << "Device: \t" << device_properties.deviceName << std::endl;
+		bool extensions_supported = checkDeviceExtensionSupport( caps );
 
-		auto indices = findQueueFamilies( device );
-
-		bool extensions_supported = checkDeviceExtensionSupport( device );
-
-		bool swap_chain_adequate = false;
-		if ( extensions_supported )
+		bool swap_chain_adequate = options_.headless;
+		if ( extensions_supported && !options_.headless )
 		{
 			auto details = querySwapChainSupport( device );
 			swap_chain_adequate = !details.formats.empty() && !details.present_modes.empty();
 		}
 
 		return indices.isComplete() && extensions_supported && swap_chain_adequate;
+	}
+
+	bool checkDeviceExtensionSupport( const DeviceCaps & caps )
+	{
+		for ( const auto extension : requiredDeviceExtensions() )
+		{
+			if ( !caps.hasExtension( extension ) )
+				return false;
+		}
 
-		// TODO
-		//return device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU
-		//	&& device_features.geometryShader;
+		return true;
 	}
 
-	bool checkDeviceExtensionSupport( VkPhysicalDevice device )
+	/// \brief What the enabled modes would make use of
+	DevicePreferences devicePreferences() const
 	{
-		uint32_t extension_count = 0;
-		vkEnumerateDeviceExtensionProperties( device,
-											  nullptr,
-											  &extension_count,
-											  nullptr );
-		std::vector<VkExtensionProperties> available_extensions( extension_count );
-		vkEnumerateDeviceExtensionProperties( device,
-											  nullptr,
-											  &extension_count,
-											  available_extensions.data() );
-		std::set<std::string> required_extensions( kDeviceExtensions.begin(), kDeviceExtensions.end() );
-		for ( const auto & extension : available_extensions )
+		DevicePreferences prefs;
+		prefs.async_compute = options_.particle_count > 0;
+		prefs.timeline_semaphore = true;
+		prefs.present_wait = !options_.headless && options_.pacing == PacingPolicy::kLowLatency;
+		prefs.incremental_present = options_.idle;
+		prefs.texture_compression = true;
+		return prefs;
+	}
+
+	/// \brief kDeviceExtensions, less the swapchain when headless
+	std::vector<const char*> requiredDeviceExtensions() const
+	{
+		std::vector<const char*> extensions;
+		for ( const auto extension : kDeviceExtensions )
 		{
-			required_extensions.erase( extension.extensionName );
+			if ( !options_.headless || strcmp( extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME ) != 0 )
+				extensions.push_back( extension );
 		}
+		return extensions;
+	}
 
-		return required_extensions.empty();
+	bool isDeviceExtensionEnabled( const char * name ) const
+	{
+		return std::any_of( enabled_device_extensions_.begin(),
+							enabled_device_extensions_.end(),
+							[name]( const char * enabled ) { return strcmp( enabled, name ) == 0; } );
 	}
 	
+	/// \brief Highest scoring suitable device. Caps come from the on-disk
+	/// cache when the driver has been seen before, probed otherwise.
 	void pickPhysicalDevice()
 	{
 		uint32_t device_count = 0;
@@ -368,28 +538,72 @@ private:
 		std::vector<VkPhysicalDevice> devices( device_count );
 		vkEnumeratePhysicalDevices( instance_, &device_count, devices.data() );
 
+		DeviceCapsCache cache;
+		if ( options_.device_cache )
+		{
+			cache.load( kDeviceCapsCachePath );
+		}
+
+		auto prefs = devicePreferences();
+		int64_t best_score = -1;
+		size_t probed = 0;
 		for ( const auto& device : devices )
 		{
-			if ( isDeviceSuitable( device ) )
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties( device, &properties );
+			DeviceCaps caps;
+			if ( !options_.device_cache || !cache.find( properties, caps ) )
+			{
+				caps = probeDeviceCaps( device );
+				cache.store( caps );
+				probed++;
+			}
+
+			auto indices = findQueueFamilies( device, caps );
+			bool suitable = isDeviceSuitable( device, caps, indices );
+			int64_t score = suitable ? scoreDevice( caps, prefs, indices.graphics_family == indices.present_family ) : -1;
+
+			std::cout << "Device: \t" << caps.properties.deviceName
+				<< " (" << deviceTypeName( caps.properties.deviceType ) << ", "
+				<< ( caps.deviceLocalBytes() >> 20 ) << " MB) ";
+			if ( suitable )
+				std::cout << "score " << score << std::endl;
+			else
+				std::cout << "unsuitable" << std::endl;
+
+			if ( score > best_score )
 			{
+				best_score = score;
 				physical_device_ = device;
-				break;
+				device_caps_ = std::move( caps );
+				queue_indices_ = indices;
 			}
 		}
 
+		if ( options_.device_cache )
+		{
+			cache.save();
+		}
+
 		if ( physical_device_ == VK_NULL_HANDLE )
 		{
 			throw std::runtime_error( "failed to find suitable GPU!" );
 		}
 
+		std::cout << "Using: \t" << device_caps_.properties.deviceName
+			<< " (" << probed << " of " << devices.size() << " probed, the rest cached)" << std::endl;
+		per_draw_path_ = choosePerDrawPath( device_caps_.properties.limits, sizeof( PerDrawData ), options_.per_draw );
+		std::cout << "Per draw data: " << perDrawPathName( per_draw_path_ ) << std::endl;
 	}
 
 	void createLogicalDevice()
 	{
-		auto indices = findQueueFamilies( physical_device_ );
-		
+		const auto & indices = queue_indices_;
+
 		std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
-		std::set<uint32_t> unique_queue_families = { indices.graphics_family.value(), indices.present_family.value() };
+		std::set<uint32_t> unique_queue_families = { indices.graphics_family.value(),
+													  indices.present_family.value(),
+													  indices.compute_family.value() };
 
 		float queue_priority = 1.0f;
 		for ( auto queue_family : unique_queue_families )
@@ -404,15 +618,81 @@ private:
 
 		VkPhysicalDeviceFeatures device_features = {};
 
+		// Needed to sample the formats chooseTranscodeFormat() picks
+		device_features.textureCompressionBC = device_caps_.features.textureCompressionBC;
+		device_features.textureCompressionETC2 = device_caps_.features.textureCompressionETC2;
+
+		// Without it an indirect draw takes one command per call
+		device_features.multiDrawIndirect = device_caps_.features.multiDrawIndirect;
+		multi_draw_indirect_ = device_caps_.features.multiDrawIndirect == VK_TRUE;
+
+		enabled_device_extensions_ = requiredDeviceExtensions();
+		for ( const auto extension : kOptionalDeviceExtensions )
+		{
+			// present id, wait and regions depend on the swapchain extension
+			bool needs_swapchain = strcmp( extension, VK_KHR_PRESENT_ID_EXTENSION_NAME ) == 0
+				|| strcmp( extension, VK_KHR_PRESENT_WAIT_EXTENSION_NAME ) == 0
+				|| strcmp( extension, VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME ) == 0;
+			if ( device_caps_.hasExtension( extension ) && !( needs_swapchain && options_.headless ) )
+			{
+				enabled_device_extensions_.push_back( extension );
+			}
+		}
+
+		// Optional features hang off pNext, only chained when supported
+		void * feature_chain = nullptr;
+
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+		timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		timeline_semaphores_ = isDeviceExtensionEnabled( VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME )
+			&& device_caps_.timeline_semaphore;
+		if ( timeline_semaphores_ )
+		{
+			timeline_features.timelineSemaphore = VK_TRUE;
+			timeline_features.pNext = feature_chain;
+			feature_chain = &timeline_features;
+		}
+
+		// FramePacer needs both, present wait takes the ids from present id
+		VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {};
+		present_id_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+		VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {};
+		present_wait_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+		present_wait_ = isDeviceExtensionEnabled( VK_KHR_PRESENT_ID_EXTENSION_NAME )
+			&& isDeviceExtensionEnabled( VK_KHR_PRESENT_WAIT_EXTENSION_NAME )
+			&& device_caps_.present_id
+			&& device_caps_.present_wait;
+		if ( present_wait_ )
+		{
+			present_id_features.presentId = VK_TRUE;
+			present_wait_features.presentWait = VK_TRUE;
+			present_id_features.pNext = &present_wait_features;
+			present_wait_features.pNext = feature_chain;
+			feature_chain = &present_id_features;
+		}
+
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = {};
+		dynamic_rendering_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+		dynamic_rendering_ = options_.dynamic_rendering
+			&& isDeviceExtensionEnabled( VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME )
+			&& device_caps_.dynamic_rendering;
+		if ( dynamic_rendering_ )
+		{
+			dynamic_rendering_features.dynamicRendering = VK_TRUE;
+			dynamic_rendering_features.pNext = feature_chain;
+			feature_chain = &dynamic_rendering_features;
+		}
+
 		VkDeviceCreateInfo create_info = {};
 		create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		create_info.pNext = feature_chain;
 		create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
 		create_info.pQueueCreateInfos = queue_create_infos.data();
 
 		create_info.pEnabledFeatures = &device_features;
 
-		create_info.enabledExtensionCount = static_cast<uint32_t>(kDeviceExtensions.size());
-		create_info.ppEnabledExtensionNames = kDeviceExtensions.data();
+		create_info.enabledExtensionCount = static_cast<uint32_t>(enabled_device_extensions_.size());
+		create_info.ppEnabledExtensionNames = enabled_device_extensions_.data();
 
 		create_info.enabledLayerCount = 0;
 
@@ -430,6 +710,13 @@ private:
 
 		vkGetDeviceQueue( device_, indices.graphics_family.value(), 0, &graphics_queue_ );
 		vkGetDeviceQueue( device_, indices.present_family.value(), 0, &present_queue_ );
+		vkGetDeviceQueue( device_, indices.compute_family.value(), 0, &compute_queue_ );
+
+		if ( dynamic_rendering_ )
+		{
+			cmd_begin_rendering_ = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr( device_, "vkCmdBeginRenderingKHR" );
+			cmd_end_rendering_ = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr( device_, "vkCmdEndRenderingKHR" );
+		}
 	}
 
 	/// Swap chain settings
@@ -486,26 +773,10 @@ private:
 		return available_formats[0];
 	}
 
+	/// \brief Up to the --pacing policy, see FramePacer
 	VkPresentModeKHR chooseSwapPresentMode( const std::vector<VkPresentModeKHR> & available_present_modes )
 	{
-		VkPresentModeKHR best_mode = VK_PRESENT_MODE_FIFO_KHR;
-
-		for ( const auto& mode : available_present_modes )
-		{
-			// Use nice triple buffering mode 
-			// (update latest tex in queue for present)
-			if ( mode == VK_PRESENT_MODE_MAILBOX_KHR )
-			{
-				return mode;
-			}
-			// prefer immediate (maybe fifo not implemented)
-			else if ( mode == VK_PRESENT_MODE_IMMEDIATE_KHR )
-			{
-				best_mode = mode;
-			}
-		}
-
-		return best_mode;
+		return frame_pacer_.choosePresentMode( available_present_modes );
 	}
 	
 	VkExtent2D chooseSwapExtent( const VkSurfaceCapabilitiesKHR & capabilities )
@@ -528,8 +799,39 @@ private:
 		}
 	}
 
+	/// \brief Stand in for the swapchain with --headless, one image per
+	/// frame in flight, read back by FrameCapture
+	void createOffscreenTargets()
+	{
+		swap_chain_image_format_ = VK_FORMAT_R8G8B8A8_UNORM; // what createImage() makes
+		swap_chain_extent_ = offscreen_extent_;
+
+		offscreen_images_.resize( kMaxFramesInFlight );
+		offscreen_memory_.resize( kMaxFramesInFlight );
+		swap_chain_images_.clear();
+		for ( int i = 0; i < kMaxFramesInFlight; ++i )
+		{
+			createImage( offscreen_extent_.width, offscreen_extent_.height, 1,
+						 VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+						 offscreen_images_[i], offscreen_memory_[i] );
+			swap_chain_images_.push_back( offscreen_images_[i] );
+		}
+	}
+
+	/// \brief Layout frames are left in by the render pass
+	VkImageLayout presentLayout() const
+	{
+		return options_.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	}
+
 	void createSwapChain()
 	{
+		if ( options_.headless )
+		{
+			createOffscreenTargets();
+			return;
+		}
+
 		auto swap_chain_support = querySwapChainSupport( physical_device_ );
 		auto surface_format = chooseSwapSurfaceFormat( swap_chain_support.formats );
 		auto present_mode = chooseSwapPresentMode( swap_chain_support.present_modes );
@@ -550,8 +852,16 @@ private:
 		create_info.imageExtent = extent;
 		create_info.imageArrayLayers = 1;
 		create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		if ( !options_.capture.empty() )
+		{
+			if ( !( swap_chain_support.capabilites.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT ) )
+			{
+				throw std::runtime_error( "Swapchain images can't be read back, capture with --headless!" );
+			}
+			create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		}
 
-		QueueFamilyIndices indices = findQueueFamilies( physical_device_ );
+		const auto & indices = queue_indices_;
 		uint32_t queue_family_indices[ ] = { indices.graphics_family.value(), indices.present_family.value() };
 
 		if ( indices.graphics_family != indices.present_family )
@@ -584,9 +894,15 @@ private:
 
 		swap_chain_image_format_ = surface_format.format;
 		swap_chain_extent_ = extent;
+		damage_.resize( swap_chain_extent_ );
 	}
 
 	void initWindow() {
+		if ( options_.headless )
+		{
+			return;
+		}
+
 		glfwInit();
 
 		glfwWindowHint( GLFW_CLIENT_API, GLFW_NO_API );
@@ -594,6 +910,43 @@ private:
 		window_ = glfwCreateWindow( kWidth, kHeight, "Vulkan", nullptr, nullptr );
 		glfwSetWindowUserPointer( window_, this );
 		glfwSetFramebufferSizeCallback( window_, frameBufferResizeCallback );
+
+		// Timestamps for the input to present latency
+		glfwSetKeyCallback( window_, keyCallback );
+		glfwSetMouseButtonCallback( window_, []( GLFWwindow * window, int, int, int ) { inputCallback( window ); } );
+		glfwSetCursorPosCallback( window_, []( GLFWwindow * window, double, double ) { inputCallback( window ); } );
+		glfwSetScrollCallback( window_, []( GLFWwindow * window, double, double ) { inputCallback( window ); } );
+
+		// Exposed or uncovered, the compositor may want the whole window
+		glfwSetWindowRefreshCallback( window_, []( GLFWwindow * window ) {
+			auto app = reinterpret_cast<HelloTriangleApplication*>( glfwGetWindowUserPointer( window ) );
+			app->damage_.invalidate();
+		} );
+	}
+
+	static void keyCallback( GLFWwindow * window, int key, int, int action, int )
+	{
+		inputCallback( window );
+
+		// Space pauses the animation, a paused scene goes idle with --idle
+		auto app = reinterpret_cast<HelloTriangleApplication*>( glfwGetWindowUserPointer( window ) );
+		if ( key == GLFW_KEY_SPACE && action == GLFW_PRESS )
+		{
+			app->animation_paused_ = !app->animation_paused_;
+		}
+
+		// F1 shows and hides the overlay, what was under it needs a redraw
+		if ( key == GLFW_KEY_F1 && action == GLFW_PRESS )
+		{
+			app->hud_.toggle();
+			app->damage_.add( app->hud_.bounds() );
+		}
+	}
+
+	static void inputCallback( GLFWwindow * window )
+	{
+		auto app = reinterpret_cast<HelloTriangleApplication*>( glfwGetWindowUserPointer( window ) );
+		app->frame_pacer_.inputEvent();
 	}
 
 	static void frameBufferResizeCallback( GLFWwindow * window, int width, int height )
@@ -632,289 +985,352 @@ private:
 		}
 	}
 
+	/// \brief Depth format and sample count, fixed for the run since the
+	/// pipelines are built against them
+	void configureRenderTargets()
+	{
+		depth_format_ = chooseDepthFormat( physical_device_ );
+		msaa_samples_ = chooseSampleCount( device_caps_.properties.limits, options_.msaa );
+		if ( msaa_samples_ != options_.msaa )
+		{
+			std::cout << "MSAA: " << options_.msaa << "x isn't supported, using " << msaa_samples_ << "x" << std::endl;
+		}
+		render_targets_.init( device_, device_caps_.memory );
+		std::cout << "Rendering: " << ( dynamic_rendering_ ? "dynamic rendering" : "render pass" ) << std::endl;
+	}
+
+	void createRenderTargets()
+	{
+		render_targets_.create( swap_chain_extent_, swap_chain_image_format_, depth_format_, msaa_samples_ );
+	}
+
+	/// \brief None with dynamic rendering, the attachments are given when
+	/// recording instead
 	void createRenderPass()
 	{
+		render_pass_ = dynamic_rendering_ ? VK_NULL_HANDLE : makeRenderPass();
+	}
+
+	/// \brief Attachments are colour, depth and, with MSAA, the swapchain
+	/// image the subpass resolves into. Only the swapchain image is stored,
+	/// the multisampled colour and depth never leave tile memory where the
+	/// GPU has it.
+	VkRenderPass makeRenderPass() const
+	{
+		bool msaa = msaa_samples_ != VK_SAMPLE_COUNT_1_BIT;
+
 		VkAttachmentDescription color_attachment = {};
 		color_attachment.format = swap_chain_image_format_;
-		color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		color_attachment.samples = msaa_samples_;
 		color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		color_attachment.storeOp = msaa ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 		color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		color_attachment.finalLayout = msaa ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : presentLayout();
+
+		VkAttachmentDescription depth_attachment = {};
+		depth_attachment.format = depth_format_;
+		depth_attachment.samples = msaa_samples_;
+		depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentDescription resolve_attachment = {};
+		resolve_attachment.format = swap_chain_image_format_;
+		resolve_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		resolve_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		resolve_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		resolve_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		resolve_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		resolve_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		resolve_attachment.finalLayout = presentLayout();
+
+		VkAttachmentDescription attachments[ ] = { color_attachment, depth_attachment, resolve_attachment };
 
 		VkAttachmentReference color_attachment_ref = {};
 		color_attachment_ref.attachment = 0;
 		color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+		VkAttachmentReference depth_attachment_ref = {};
+		depth_attachment_ref.attachment = 1;
+		depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference resolve_attachment_ref = {};
+		resolve_attachment_ref.attachment = 2;
+		resolve_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
 		VkSubpassDescription subpass = {};
 		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 		subpass.colorAttachmentCount = 1;
 		subpass.pColorAttachments = &color_attachment_ref;
+		subpass.pDepthStencilAttachment = &depth_attachment_ref;
+		// resolved at the end of the subpass, while the samples are still on chip
+		subpass.pResolveAttachments = msaa ? &resolve_attachment_ref : nullptr;
 
 		VkRenderPassCreateInfo render_pass_info = {};
 		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		render_pass_info.attachmentCount = 1;
-		render_pass_info.pAttachments = &color_attachment;
+		render_pass_info.attachmentCount = msaa ? 3 : 2;
+		render_pass_info.pAttachments = attachments;
 		render_pass_info.subpassCount = 1;
 		render_pass_info.pSubpasses = &subpass;
 
+		// The transient attachments are shared by the frames in flight, the
+		// last frame's depth tests and colour writes finish before these start
 		VkSubpassDependency dep = {};
 		dep.srcSubpass = VK_SUBPASS_EXTERNAL;
 		dep.dstSubpass = 0;
-		dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dep.srcAccessMask = 0;
-		dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dep.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+			| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+			| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
 		render_pass_info.dependencyCount = 1;
 		render_pass_info.pDependencies = &dep;
 
-		if ( auto status = vkCreateRenderPass( device_, &render_pass_info, nullptr, &render_pass_ );
+		VkRenderPass render_pass;
+		if ( auto status = vkCreateRenderPass( device_, &render_pass_info, nullptr, &render_pass );
 			 status != VK_SUCCESS )
 		{
 			throw std::runtime_error( "Failed to create render pass! Status: " + status );
 		}
+		return render_pass;
 	}
 
-	static std::vector<char> readFile( const std::string & filename )
+	void loadShaders()
 	{
-		std::ifstream file( filename, std::ios::ate | std::ios::binary );
-		if ( !file.is_open() )
-		{
-			throw std::runtime_error( "failed to open file! " + filename );
-		}
-		size_t file_size = (size_t)file.tellg();
-		std::vector<char> buffer( file_size );
-		file.seekg( 0 );
-		file.read( buffer.data(), file_size );
-		file.close();
-		return buffer;
+		vert_shader_ = per_draw_path_ == PerDrawPath::kPushConstants
+			? ShaderCode::fromWords( kTriVertSpv )
+			: ShaderCode::fromWords( kTriUboVertSpv );
+		frag_shader_ = ShaderCode::fromWords( kTriFragSpv );
+
+		vert_reflection_ = &reflection_cache_.get( vert_shader_.hash, vert_shader_.words, vert_shader_.word_count );
+		frag_reflection_ = &reflection_cache_.get( frag_shader_.hash, frag_shader_.words, frag_shader_.word_count );
+
+		particle_vert_shader_ = ShaderCode::fromWords( kParticleVertSpv );
+		particle_frag_shader_ = ShaderCode::fromWords( kParticleFragSpv );
+		particle_vert_reflection_ = &reflection_cache_.get( particle_vert_shader_.hash,
+															particle_vert_shader_.words,
+															particle_vert_shader_.word_count );
+		particle_frag_reflection_ = &reflection_cache_.get( particle_frag_shader_.hash,
+															particle_frag_shader_.words,
+															particle_frag_shader_.word_count );
+
+		hud_vert_shader_ = ShaderCode::fromWords( kHudVertSpv );
+		hud_frag_shader_ = ShaderCode::fromWords( kHudFragSpv );
+		hud_vert_reflection_ = &reflection_cache_.get( hud_vert_shader_.hash, hud_vert_shader_.words, hud_vert_shader_.word_count );
 	}
 
-	VkShaderModule createShaderModule( const std::vector<char>& code )
+	/// \brief Set layouts for every set the shaders declare, from reflection
+	void createDescriptorSetLayout()
 	{
-		VkShaderModuleCreateInfo create_info = {};
-		create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		create_info.codeSize = code.size();
-		create_info.pCode = reinterpret_cast<const uint32_t*>( code.data() );
+		auto layout_desc = mergeReflections( { vert_reflection_, frag_reflection_ } );
 
-		VkShaderModule shader_module;
-		if ( auto status = vkCreateShaderModule( device_, &create_info, nullptr, &shader_module );
-			status != VK_SUCCESS)
+		// SPIR-V can't say which buffers get a dynamic offset, PerDraw does
+		if ( per_draw_path_ == PerDrawPath::kDynamicUniform )
+		{
+			if ( layout_desc.sets.size() < 2 || layout_desc.sets[1].empty() )
+			{
+				throw std::runtime_error( "tri_ubo.vert is missing PerDraw at set 1!" );
+			}
+			layout_desc.sets[1][0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		}
+		else if ( layout_desc.push_constants.empty()
+				  || layout_desc.push_constants[0].size < sizeof( PerDrawData ) )
 		{
-			throw std::runtime_error( "Failed to create shader module! Status: " + status );
+			throw std::runtime_error( "tri.vert push constants don't match PerDrawData!" );
 		}
 
-		return shader_module;
-	}
+		descriptor_layout_cache_.init( device_, &descriptor_stats_ );
+		descriptor_set_cache_.init( &descriptor_stats_ );
 
-	void createDescriptorSetLayout()
-	{
-		VkDescriptorSetLayoutBinding ubo_layout_binding = {};
-		ubo_layout_binding.binding = 0;
-		ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		ubo_layout_binding.descriptorCount = 1;
-		ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-		ubo_layout_binding.pImmutableSamplers = nullptr;
+		set_layouts_.clear();
+		for ( const auto & bindings : layout_desc.sets )
+		{
+			VkDescriptorSetLayoutCreateInfo layout_info = {};
+			layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layout_info.bindingCount = static_cast<uint32_t>( bindings.size() );
+			layout_info.pBindings = bindings.data();
+			set_layouts_.push_back( descriptor_layout_cache_.createDescriptorLayout( layout_info ) );
+		}
+		push_constant_ranges_ = layout_desc.push_constants;
 
-		VkDescriptorSetLayoutCreateInfo layout_info = {};
-		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layout_info.bindingCount = 1;
-		layout_info.pBindings = &ubo_layout_binding;
+		descriptor_set_layout_ = set_layouts_.at( 0 );
+		if ( per_draw_path_ == PerDrawPath::kDynamicUniform )
+		{
+			per_draw_set_layout_ = set_layouts_.at( 1 );
+		}
 
-		if ( auto status = vkCreateDescriptorSetLayout( device_, &layout_info, nullptr, &descriptor_set_layout_ );
-			 status != VK_SUCCESS )
+		auto particle_desc = mergeReflections( { particle_vert_reflection_, particle_frag_reflection_ } );
+		particle_set_layouts_.clear();
+		for ( const auto & bindings : particle_desc.sets )
 		{
-			throw std::runtime_error( "Failed to creat descriptor set layout!" );
+			VkDescriptorSetLayoutCreateInfo layout_info = {};
+			layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layout_info.bindingCount = static_cast<uint32_t>( bindings.size() );
+			layout_info.pBindings = bindings.data();
+			particle_set_layouts_.push_back( descriptor_layout_cache_.createDescriptorLayout( layout_info ) );
 		}
 	}
 
-	void createGraphicsPipeline()
+	void createPipelineLayout()
 	{
-		auto vert_shader_code = readFile( "vert.spv" );
-		auto frag_shader_code = readFile( "frag.spv" );
-
-		vert_shader_module_ = createShaderModule( vert_shader_code );
-		frag_shader_module_ = createShaderModule( frag_shader_code );
-
-		VkPipelineShaderStageCreateInfo vert_shader_stage_info = {};
-		vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vert_shader_stage_info.module = vert_shader_module_;
-		vert_shader_stage_info.pName = "main";
+		pipeline_layout_cache_.init( device_, &descriptor_stats_ );
+		pipeline_layout_ = pipeline_layout_cache_.createPipelineLayout( set_layouts_, push_constant_ranges_ );
+		particle_pipeline_layout_ = pipeline_layout_cache_.createPipelineLayout( particle_set_layouts_, {} );
+		hud_pipeline_layout_ = pipeline_layout_cache_.createPipelineLayout( {}, {} );
+	}
 
-		VkPipelineShaderStageCreateInfo frag_shader_stage_info = {};
-		frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		frag_shader_stage_info.module = frag_shader_module_;
-		frag_shader_stage_info.pName = "main";
+	void createPipelineManager()
+	{
+		pipeline_manager_.init( device_, &worker_pool_, "pipeline_cache.bin" );
+	}
 
-		VkPipelineShaderStageCreateInfo shader_stages[ ] = { vert_shader_stage_info, frag_shader_stage_info };
+	/// \brief State of the default pipeline, variants start from this
+	PipelineState basePipelineState()
+	{
+		VkVertexInputBindingDescription binding_desc, instance_desc;
+		PipelineState state;
+		reflectedVertexInput( *vert_reflection_, 0, binding_desc, state.attributes, 0, kInstanceLocation );
+		if ( binding_desc.stride != sizeof( Vertex ) )
+		{
+			throw std::runtime_error( "Vertex doesn't match the tri.vert inputs!" );
+		}
+		reflectedVertexInput( *vert_reflection_, 1, instance_desc, state.attributes,
+							  kInstanceLocation, UINT32_MAX, VK_VERTEX_INPUT_RATE_INSTANCE );
+		if ( instance_desc.stride != sizeof( glm::mat4 ) )
+		{
+			throw std::runtime_error( "Instance transform doesn't match the tri.vert inputs!" );
+		}
 
-		auto binding_desc = Vertex::getBindingDescription();
-		auto attr_desc = Vertex::getAttributeDescriptions();
-		VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
-		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertex_input_info.vertexBindingDescriptionCount = 1;
-		vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attr_desc.size());
-		vertex_input_info.pVertexBindingDescriptions = &binding_desc;
-		vertex_input_info.pVertexAttributeDescriptions = attr_desc.data();
+		state.vert = vert_shader_;
+		state.frag = frag_shader_;
+		state.bindings = { binding_desc, instance_desc };
+		state.layout = pipeline_layout_;
+		state.render_pass = render_pass_;
+		state.color_formats = { swap_chain_image_format_ };
+		state.depth_format = depth_format_;
+		state.render_pass_key = renderPassKey( { swap_chain_image_format_ }, depth_format_, msaa_samples_ );
+		state.samples = msaa_samples_;
+		return state;
+	}
 
-		VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
-		input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		input_assembly.primitiveRestartEnable = VK_FALSE;
+	/// \brief Camera facing quads, one instance per particle
+	PipelineState particlePipelineState()
+	{
+		VkVertexInputBindingDescription binding_desc;
+		PipelineState state;
+		ParticleSystem::vertexInput( *particle_vert_reflection_, 0, binding_desc, state.attributes );
+
+		state.vert = particle_vert_shader_;
+		state.frag = particle_frag_shader_;
+		state.bindings = { binding_desc };
+		state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+		state.cull_mode = VK_CULL_MODE_NONE;
+		state.blend_enable = true;
+		state.depth_write = false; // blended, tested against the mesh only
+		state.layout = particle_pipeline_layout_;
+		state.render_pass = render_pass_;
+		state.color_formats = { swap_chain_image_format_ };
+		state.depth_format = depth_format_;
+		state.render_pass_key = renderPassKey( { swap_chain_image_format_ }, depth_format_, msaa_samples_ );
+		state.samples = msaa_samples_;
+		return state;
+	}
 
-		VkViewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)swap_chain_extent_.width;
-		viewport.height = (float)swap_chain_extent_.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
+	/// \brief Overlay quads, blended over everything without depth
+	PipelineState hudPipelineState()
+	{
+		VkVertexInputBindingDescription binding_desc;
+		PipelineState state;
+		PerfHud::vertexInput( *hud_vert_reflection_, 0, binding_desc, state.attributes );
+
+		state.vert = hud_vert_shader_;
+		state.frag = hud_frag_shader_;
+		state.bindings = { binding_desc };
+		state.cull_mode = VK_CULL_MODE_NONE;
+		state.blend_enable = true;
+		state.depth_test = false;
+		state.depth_write = false;
+		state.layout = hud_pipeline_layout_;
+		state.render_pass = render_pass_;
+		state.color_formats = { swap_chain_image_format_ };
+		state.depth_format = depth_format_;
+		state.render_pass_key = renderPassKey( { swap_chain_image_format_ }, depth_format_, msaa_samples_ );
+		state.samples = msaa_samples_;
+		return state;
+	}
 
-		VkRect2D scissor = {};
-		scissor.offset = { 0,0 };
-		scissor.extent = swap_chain_extent_;
+	void createGraphicsPipeline()
+	{
+		// Everything else draws with a fallback while its variant builds,
+		// the default pipeline is what they fall back to
+		graphics_pipeline_ = pipeline_manager_.getBlocking( basePipelineState() );
+		particle_pipeline_ = pipeline_manager_.getBlocking( particlePipelineState() );
+		hud_pipeline_ = pipeline_manager_.getBlocking( hudPipelineState() );
+	}
 
-		VkPipelineViewportStateCreateInfo viewport_state = {};
-		viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewport_state.viewportCount = 1;
-		viewport_state.pViewports = &viewport;
-		viewport_state.scissorCount = 1;
-		viewport_state.pScissors = &scissor;
-
-		VkPipelineRasterizationStateCreateInfo rasterizer = {};
-		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rasterizer.depthClampEnable = VK_FALSE;
-		rasterizer.rasterizerDiscardEnable = VK_FALSE;
-		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-		rasterizer.lineWidth = 1.0f;
-		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-		rasterizer.depthBiasEnable = VK_FALSE;
-		//rasterizer.depthBiasConstantFactor = 0.0f;
-		//rasterizer.depthBiasClamp = 0.0f;
-		//rasterizer.depthBiasSlopeFactor = 1.0f;
-
-		VkPipelineMultisampleStateCreateInfo multisampling = {};
-		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisampling.minSampleShading = 1.0f;
-		multisampling.pSampleMask = nullptr;
-		multisampling.alphaToCoverageEnable = VK_FALSE;
-		multisampling.alphaToOneEnable = VK_FALSE;
-
-		// If depth and stencil testing do something here
-
-		VkPipelineColorBlendAttachmentState color_blend_attachment = {};
-		color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		color_blend_attachment.blendEnable = VK_FALSE;
-		color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-		color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-		color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
-		color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-		color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-		VkPipelineColorBlendStateCreateInfo color_blending;
-		color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		color_blending.logicOpEnable = VK_FALSE;
-		color_blending.logicOp = VK_LOGIC_OP_COPY;
-		color_blending.attachmentCount = 1;
-		color_blending.pAttachments = &color_blend_attachment;
-		color_blending.blendConstants[0] = 0.0f;
-		color_blending.blendConstants[1] = 0.0f;
-		color_blending.blendConstants[2] = 0.0f;
-		color_blending.blendConstants[3] = 0.0f;
-		color_blending.pNext = nullptr;
-		color_blending.flags = 0;
-		
-		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
-		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipeline_layout_info.setLayoutCount = 1;
-		pipeline_layout_info.pSetLayouts = &descriptor_set_layout_;
-		pipeline_layout_info.pushConstantRangeCount = 0;
-		pipeline_layout_info.pPushConstantRanges = nullptr;
-
-		if ( auto status = vkCreatePipelineLayout( device_, &pipeline_layout_info, nullptr, &pipeline_layout_ );
-			 status != VK_SUCCESS )
-		{
-			throw std::runtime_error( "Failed to create pipeline layout! Status: " + status);
-		}
-
-		VkGraphicsPipelineCreateInfo pipeline_info = {};
-		pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipeline_info.stageCount = 2;
-		pipeline_info.pStages = shader_stages;
-
-		pipeline_info.pVertexInputState = &vertex_input_info;
-		pipeline_info.pInputAssemblyState = &input_assembly;
-		pipeline_info.pViewportState = &viewport_state;
-		pipeline_info.pRasterizationState = &rasterizer;
-		pipeline_info.pMultisampleState = &multisampling;
-		pipeline_info.pDepthStencilState = nullptr;
-		pipeline_info.pColorBlendState = &color_blending;
-		pipeline_info.pDynamicState = nullptr;
-		pipeline_info.layout = pipeline_layout_;
-		pipeline_info.renderPass = render_pass_;
-		pipeline_info.subpass = 0;
-		// derive from other pipeline
-		pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
-		pipeline_info.basePipelineIndex = -1;
-		
-		if ( auto status = vkCreateGraphicsPipelines( device_,
-													  VK_NULL_HANDLE,
-													  1,
-													  &pipeline_info,
-													  nullptr,
-													  &graphics_pipeline_ );
-			 status != VK_SUCCESS )
+	/// \brief One per swapchain image, none with dynamic rendering
+	void createFramebuffers()
+	{
+		swap_chain_framebuffers_.clear();
+		if ( dynamic_rendering_ )
 		{
-			throw std::runtime_error( "Failed to create graphics pipeline! Status: " + status );
+			return;
 		}
 
-		vkDestroyShaderModule( device_, frag_shader_module_, nullptr );
-		vkDestroyShaderModule( device_, vert_shader_module_, nullptr );
+		for ( auto image_view : swap_chain_image_views_ )
+		{
+			swap_chain_framebuffers_.push_back( makeFramebuffer( render_pass_, render_targets_, image_view, swap_chain_extent_ ) );
+		}
 	}
 
-	void createFramebuffers()
+	VkFramebuffer makeFramebuffer( VkRenderPass render_pass,
+								   const RenderTargets & targets,
+								   VkImageView image_view,
+								   VkExtent2D extent ) const
 	{
-		swap_chain_framebuffers_.resize(swap_chain_image_views_.size());
-		for ( int i = 0; i < swap_chain_image_views_.size(); ++i )
+		// in makeRenderPass() order, the swapchain image is the resolve
+		// target with MSAA
+		std::vector<VkImageView> attachments;
+		if ( targets.multisampled() )
 		{
-			VkImageView attachments[ ] = {
-				swap_chain_image_views_[i]
-			};
-			VkFramebufferCreateInfo framebuffer_info = {};
-			framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebuffer_info.renderPass = render_pass_;
-			framebuffer_info.attachmentCount = 1;
-			framebuffer_info.pAttachments = attachments;
-			framebuffer_info.width = swap_chain_extent_.width;
-			framebuffer_info.height = swap_chain_extent_.height;
-			framebuffer_info.layers = 1;
-			if ( auto status = vkCreateFramebuffer( device_,
-													&framebuffer_info,
-													nullptr,
-													&swap_chain_framebuffers_[i] );
-				 status != VK_SUCCESS )
-			{
-				throw std::runtime_error( "Failed to create framebuffer! Status: " + status );
-			}
+			attachments = { targets.colorView(), targets.depthView(), image_view };
+		}
+		else
+		{
+			attachments = { image_view, targets.depthView() };
 		}
+		VkFramebufferCreateInfo framebuffer_info = {};
+		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_info.renderPass = render_pass;
+		framebuffer_info.attachmentCount = static_cast<uint32_t>( attachments.size() );
+		framebuffer_info.pAttachments = attachments.data();
+		framebuffer_info.width = extent.width;
+		framebuffer_info.height = extent.height;
+		framebuffer_info.layers = 1;
+
+		VkFramebuffer framebuffer;
+		if ( auto status = vkCreateFramebuffer( device_, &framebuffer_info, nullptr, &framebuffer );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create framebuffer! Status: " + status );
+		}
+		return framebuffer;
 	}
 
 	void createCommandPool()
 	{
-		QueueFamilyIndices queue_indices = findQueueFamilies( physical_device_ );
 		VkCommandPoolCreateInfo pool_info = {};
 		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		pool_info.queueFamilyIndex = queue_indices.graphics_family.value();
-		pool_info.flags = 0;
+		pool_info.queueFamilyIndex = queue_indices_.graphics_family.value();
+		// command buffers are re-recorded every frame
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 		if ( auto status = vkCreateCommandPool( device_, &pool_info, nullptr, &command_pool_ );
 			 status != VK_SUCCESS )
@@ -925,7 +1341,9 @@ private:
 
 	void createCommandBuffers()
 	{
-		command_buffers_.resize( swap_chain_framebuffers_.size() );
+		trace_.check( TraceOp::kCreateCommandBuffers, { kMaxFramesInFlight } );
+
+		command_buffers_.resize( kMaxFramesInFlight );
 		VkCommandBufferAllocateInfo alloc_info = {};
 		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		alloc_info.commandPool = command_pool_;
@@ -937,71 +1355,481 @@ private:
 		{
 			throw std::runtime_error( "Failed to allocate command buffers! Status: " + status );
 		}
+	}
 
-		for ( size_t i = 0; i < command_buffers_.size(); ++i )
+	/// \brief Bind the per draw data for the next draw, push constants
+	/// when they fit, otherwise a dynamic offset into this frame's ring
+	void bindPerDraw( VkCommandBuffer command_buffer, const PerDrawData & data )
+	{
+		if ( per_draw_path_ == PerDrawPath::kPushConstants )
 		{
-			VkCommandBufferBeginInfo begin_info = {};
-			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-			begin_info.pInheritanceInfo = nullptr;
+			vkCmdPushConstants( command_buffer,
+								pipeline_layout_,
+								VK_SHADER_STAGE_VERTEX_BIT,
+								0, sizeof( PerDrawData ),
+								&data );
+			return;
+		}
 
-			if ( auto status = vkBeginCommandBuffer( command_buffers_[i], &begin_info );
-				 status != VK_SUCCESS )
-			{
-				throw std::runtime_error( "Failed to begin recording command buffer! Status: " + status );
-			}
+		uint32_t dynamic_offset = per_draw_rings_[current_frame_].push( &data, sizeof( data ) );
+		vkCmdBindDescriptorSets( command_buffer,
+								 VK_PIPELINE_BIND_POINT_GRAPHICS,
+								 pipeline_layout_,
+								 1, 1,
+								 &per_draw_sets_[current_frame_],
+								 1, &dynamic_offset );
+	}
 
+	void beginMainPass( VkCommandBuffer command_buffer, uint32_t image_index )
+	{
+		VkClearValue clear_color = {};
+		clear_color.color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		VkClearValue clear_depth = {};
+		clear_depth.depthStencil = { 1.0f, 0 };
+
+		if ( !dynamic_rendering_ )
+		{
 			VkRenderPassBeginInfo render_pass_info = {};
 			render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 			render_pass_info.renderPass = render_pass_;
-			render_pass_info.framebuffer = swap_chain_framebuffers_[i];
+			render_pass_info.framebuffer = swap_chain_framebuffers_[image_index];
 			render_pass_info.renderArea.offset = { 0,0 };
 			render_pass_info.renderArea.extent = swap_chain_extent_;
 
-			VkClearValue clear_color = { 0.0f, 0.0f, 0.0f, 1.0f };
-			render_pass_info.clearValueCount = 1;
-			render_pass_info.pClearValues = &clear_color;
+			// indexed by attachment, the resolve target isn't cleared
+			VkClearValue clear_values[ ] = { clear_color, clear_depth };
+			render_pass_info.clearValueCount = 2;
+			render_pass_info.pClearValues = clear_values;
+
+			vkCmdBeginRenderPass( command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE );
+			return;
+		}
+
+		// What the render pass did implicitly: every attachment starts out
+		// UNDEFINED, after the previous frame's writes to the shared ones
+		std::vector<VkImageMemoryBarrier> barriers;
+		auto to_attachment = [&]( VkImage image, VkImageLayout layout, VkImageAspectFlags aspect, VkAccessFlags access ) {
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = access;
+			barrier.dstAccessMask = access;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange = { aspect, 0, 1, 0, 1 };
+			barriers.push_back( barrier );
+		};
+		to_attachment( swap_chain_images_[image_index], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+					   VK_IMAGE_ASPECT_COLOR_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT );
+		to_attachment( render_targets_.depthImage(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+					   VK_IMAGE_ASPECT_DEPTH_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT );
+		if ( render_targets_.multisampled() )
+		{
+			to_attachment( render_targets_.colorImage(), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+						   VK_IMAGE_ASPECT_COLOR_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT );
+		}
+		VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+			| VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		vkCmdPipelineBarrier( command_buffer, stages, stages, 0, 0, nullptr, 0, nullptr,
+							  static_cast<uint32_t>( barriers.size() ), barriers.data() );
+
+		VkRenderingAttachmentInfoKHR color_attachment = {};
+		color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+		color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		color_attachment.clearValue = clear_color;
+		if ( render_targets_.multisampled() )
+		{
+			color_attachment.imageView = render_targets_.colorView();
+			color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			color_attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT_KHR;
+			color_attachment.resolveImageView = swap_chain_image_views_[image_index];
+			color_attachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		}
+		else
+		{
+			color_attachment.imageView = swap_chain_image_views_[image_index];
+			color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		}
+
+		VkRenderingAttachmentInfoKHR depth_attachment = {};
+		depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+		depth_attachment.imageView = render_targets_.depthView();
+		depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depth_attachment.clearValue = clear_depth;
+
+		VkRenderingInfoKHR rendering_info = {};
+		rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+		rendering_info.renderArea.offset = { 0, 0 };
+		rendering_info.renderArea.extent = swap_chain_extent_;
+		rendering_info.layerCount = 1;
+		rendering_info.colorAttachmentCount = 1;
+		rendering_info.pColorAttachments = &color_attachment;
+		rendering_info.pDepthAttachment = &depth_attachment;
+		cmd_begin_rendering_( command_buffer, &rendering_info );
+	}
+
+	void endMainPass( VkCommandBuffer command_buffer, uint32_t image_index )
+	{
+		if ( !dynamic_rendering_ )
+		{
+			vkCmdEndRenderPass( command_buffer );
+			return;
+		}
+		cmd_end_rendering_( command_buffer );
+
+		// the render pass's final layout, for present or the capture copy
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		barrier.dstAccessMask = options_.headless ? VK_ACCESS_TRANSFER_READ_BIT : 0;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		barrier.newLayout = presentLayout();
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = swap_chain_images_[image_index];
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		vkCmdPipelineBarrier( command_buffer,
+							  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+							  options_.headless ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+							  0, 0, nullptr, 0, nullptr, 1, &barrier );
+	}
+
+	/// \brief Dynamic state and the buffers every scene draw shares: the
+	/// geometry pool and this frame's instance transforms
+	void bindSceneState( VkCommandBuffer command_buffer )
+	{
+		VkViewport viewport = {};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float)swap_chain_extent_.width;
+		viewport.height = (float)swap_chain_extent_.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport( command_buffer, 0, 1, &viewport );
+
+		VkRect2D scissor = {};
+		scissor.offset = { 0,0 };
+		scissor.extent = swap_chain_extent_;
+		vkCmdSetScissor( command_buffer, 0, 1, &scissor );
+
+		geometry_pool_.bind( command_buffer );
+
+		VkBuffer instance_buffers[] = { instance_buffers_[current_frame_].buffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers( command_buffer, 1, 1, instance_buffers, offsets );
+	}
+
+	/// \brief Pipelines draw packets refer to by id, the scene only uses the
+	/// default one so far
+	VkPipeline scenePipeline( uint32_t id ) const
+	{
+		const VkPipeline pipelines[] = { graphics_pipeline_ };
+		return pipelines[id];
+	}
+
+	/// \brief Set 0 for a material: the camera and the material's texture.
+	/// Transient, the streamed texture's view changes with its residency.
+	void bindMaterial( VkCommandBuffer command_buffer, uint32_t material )
+	{
+		VkDescriptorBufferInfo buffer_info = {};
+		buffer_info.buffer = uniform_buffers_[current_frame_].buffer;
+		buffer_info.offset = 0;
+		buffer_info.range = sizeof( UniformBufferObject );
+
+		VkDescriptorImageInfo image_info = {};
+		image_info.sampler = texture_streamer_.sampler();
+		image_info.imageView = texture_streamer_.view( materials_[material] );
+		image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkDescriptorSet material_set;
+		bool built = DescriptorBuilder( descriptor_layout_cache_, frame_descriptor_allocators_[current_frame_] )
+			.bindBuffer( 0, buffer_info, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT )
+			.bindImage( 1, image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT )
+			.build( material_set );
+		if ( !built )
+		{
+			throw std::runtime_error( "Failed to allocate material descriptor set!" );
+		}
+
+		vkCmdBindDescriptorSets( command_buffer,
+								 VK_PIPELINE_BIND_POINT_GRAPHICS,
+								 pipeline_layout_,
+								 0, 1,
+								 &material_set,
+								 0, nullptr );
+	}
+
+	/// \brief Queue the scene's draw packets, sort them into batches and
+	/// write their transforms into this frame's instance buffer
+	void submitScene()
+	{
+		draw_queue_.clear();
+		for ( const auto & instance : scene_instances_ )
+		{
+			glm::mat4 model = scene_root_.model * instance;
+			DrawPacket packet;
+			packet.transform = instance;
+			packet.mesh = demo_mesh_;
+			packet.lod = selectDrawLod( model );
+			packet.depth = glm::length( glm::vec3( model[3].x, model[3].y, model[3].z ) - kCameraEye );
+			draw_queue_.submit( packet );
+		}
+		draw_queue_.build();
+		sort_seconds_ += draw_queue_.sortSeconds();
+
+		const auto & instances = draw_queue_.instances();
+		VkDeviceSize size = instances.size() * sizeof( glm::mat4 );
+		auto & buffer = instance_buffers_[current_frame_];
+		if ( size > buffer.size )
+		{
+			VkDeviceSize grown = std::max( size, 2 * buffer.size );
+			retire( buffer );
+			buffer = createBuffer( grown,
+								   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+								   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+								   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+		}
+
+		void * data;
+		vkMapMemory( device_, buffer.memory, 0, size, 0, &data );
+		memcpy( data, instances.data(), (size_t)size );
+		vkUnmapMemory( device_, buffer.memory );
+	}
+
+	/// \brief One instanced draw per batch, pipeline and material only
+	/// bound when they change from the batch before
+	void recordDrawQueue( VkCommandBuffer command_buffer )
+	{
+		DrawStats stats;
+		stats.packets = draw_queue_.packetCount();
+		stats.buffer_binds = 3; // pool vertices, pool indices, instances
+		uint64_t frame_triangles = 0;
+
+		bindPerDraw( command_buffer, scene_root_ );
+
+		const DrawBatch * previous = nullptr;
+		for ( const auto & batch : draw_queue_.batches() )
+		{
+			if ( !previous || batch.pipeline != previous->pipeline )
+			{
+				vkCmdBindPipeline( command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scenePipeline( batch.pipeline ) );
+				stats.pipeline_binds++;
+			}
+			if ( !previous || batch.material != previous->material )
+			{
+				bindMaterial( command_buffer, batch.material );
+				stats.material_binds++;
+			}
+			previous = &batch;
+
+			const auto & mesh = geometry_pool_.mesh( batch.mesh );
+			vkCmdDrawIndexed( command_buffer,
+							  mesh.lods[batch.lod].index_count,
+							  batch.instance_count,
+							  mesh.lods[batch.lod].first_index,
+							  mesh.vertex_offset,
+							  batch.first_instance );
+			stats.draws++;
+
+			frame_triangles += uint64_t( mesh.lods[batch.lod].index_count / 3 ) * batch.instance_count;
+			lod_full_triangles_ += uint64_t( mesh.lods[0].index_count / 3 ) * batch.instance_count;
+		}
+		lod_triangles_ += frame_triangles;
+		draw_stats_ += stats;
+		draw_frames_++;
+		frame_draw_stats_ = stats;
+		frame_triangles_ = frame_triangles;
+	}
+
+	/// \brief Overlay vertex buffers, one per frame in flight, and the
+	/// timestamp queries behind its GPU timings
+	void createOverlay()
+	{
+		for ( auto & buffer : hud_vertex_buffers_ )
+		{
+			buffer = createBuffer( PerfHud::kMaxVertices * sizeof( HudVertex ),
+								   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+								   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+								   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+		}
+
+		gpu_timer_.init( device_,
+						 device_caps_.properties.limits.timestampPeriod,
+						 device_caps_.queue_families[queue_indices_.graphics_family.value()].timestampValidBits,
+						 uint32_t( GpuScope::kCount ),
+						 kMaxFramesInFlight );
+		if ( options_.hud )
+		{
+			hud_.setVisible( true );
+		}
+	}
+
+	/// \brief Overlay text and graph: frame times, the last GPU timings
+	/// collected, this frame's draws and what the big allocations hold
+	void buildHud()
+	{
+		auto mb = []( VkDeviceSize bytes ) { return bytes / ( 1024.0 * 1024.0 ); };
+		double frame_ms = hud_.averageFrameMilliseconds();
+		char line[64];
+
+		hud_.begin( swap_chain_extent_ );
+		std::snprintf( line, sizeof( line ), "FRAME %6.2f MS  MAX %6.2f  %5.0f FPS",
+					   frame_ms, hud_.maxFrameMilliseconds(), frame_ms > 0.0 ? 1000.0 / frame_ms : 0.0 );
+		hud_.text( line );
+		std::snprintf( line, sizeof( line ), "CPU HUD %6.3f MS", hud_last_ms_ );
+		hud_.text( line );
+		if ( gpu_timer_.supported() )
+		{
+			for ( uint32_t scope = 0; scope < uint32_t( GpuScope::kCount ); ++scope )
+			{
+				std::snprintf( line, sizeof( line ), "GPU %-11s %6.3f MS", kGpuScopeNames[scope], gpu_timer_.milliseconds( scope ) );
+				hud_.text( line );
+			}
+		}
+		else
+		{
+			hud_.text( "GPU TIMESTAMPS UNSUPPORTED" );
+		}
+		std::snprintf( line, sizeof( line ), "DRAWS %llu  INSTANCES %llu  TRIS %.3fM",
+					   static_cast<unsigned long long>( frame_draw_stats_.draws ),
+					   static_cast<unsigned long long>( frame_draw_stats_.packets ),
+					   frame_triangles_ / 1e6 );
+		hud_.text( line );
+		std::snprintf( line, sizeof( line ), "MB GEO %.1f/%.1f TEX %.1f/%.1f RT %.1f",
+					   mb( geometry_pool_.usedBytes() ), mb( geometry_pool_.allocatedBytes() ),
+					   mb( texture_streamer_.residentBytes() ), mb( texture_streamer_.budget() ),
+					   mb( render_targets_.requiredBytes() ) );
+		hud_.text( line );
+		hud_.graph( 1000.0 / ( options_.pacing == PacingPolicy::kCapped ? options_.fps_cap : 60.0 ) );
+		hud_.end();
+	}
+
+	/// \brief The overlay, last in the main pass so it blends over the
+	/// scene and resolves with it: one vertex buffer, one draw, no
+	/// descriptors. Nothing is recorded while it is hidden.
+	void recordHud( VkCommandBuffer command_buffer )
+	{
+		auto & buffer = hud_vertex_buffers_[current_frame_];
+		if ( !hud_.visible() || buffer.size == 0 )
+		{
+			return;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		buildHud();
+
+		const auto & vertices = hud_.vertices();
+		VkDeviceSize size = vertices.size() * sizeof( HudVertex );
+		void * data;
+		vkMapMemory( device_, buffer.memory, 0, size, 0, &data );
+		memcpy( data, vertices.data(), (size_t)size );
+		vkUnmapMemory( device_, buffer.memory );
+
+		vkCmdBindPipeline( command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, hud_pipeline_ );
+		VkBuffer buffers[] = { buffer.buffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers( command_buffer, 0, 1, buffers, offsets );
+		vkCmdDraw( command_buffer, static_cast<uint32_t>( vertices.size() ), 1, 0, 0 );
+
+		double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+		hud_seconds_ += seconds;
+		hud_last_ms_ = seconds * 1e3;
+		hud_frames_++;
+	}
+
+	void recordCommandBuffer( VkCommandBuffer command_buffer, uint32_t image_index )
+	{
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		begin_info.pInheritanceInfo = nullptr;
+
+		if ( auto status = vkBeginCommandBuffer( command_buffer, &begin_info );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to begin recording command buffer! Status: " + status );
+		}
+
+		// The buffer churn benchmark's buffer, a real GPU use for the
+		// deletion queue to wait out
+		if ( churn_buffer_ != VK_NULL_HANDLE )
+		{
+			vkCmdFillBuffer( command_buffer, churn_buffer_, 0, VK_WHOLE_SIZE, static_cast<uint32_t>( current_frame_ ) );
+		}
+
+		// Timed only while the overlay shows the timings
+		if ( hud_.visible() )
+		{
+			gpu_timer_.begin( command_buffer, current_frame_ );
+		}
+
+		recordDefragmentation( command_buffer );
+		gpu_timer_.mark( command_buffer, uint32_t( GpuScope::kDefragmentation ) );
+		submitScene();
+
+		beginMainPass( command_buffer, image_index );
+		bindSceneState( command_buffer );
+		recordDrawQueue( command_buffer );
+		gpu_timer_.mark( command_buffer, uint32_t( GpuScope::kScene ) );
+
+		if ( particles_.enabled() )
+		{
+			VkDescriptorBufferInfo buffer_info = {};
+			buffer_info.buffer = uniform_buffers_[current_frame_].buffer;
+			buffer_info.offset = 0;
+			buffer_info.range = sizeof( UniformBufferObject );
 
-			vkCmdBeginRenderPass( command_buffers_[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE );
-			vkCmdBindPipeline( command_buffers_[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline_ );
+			VkDescriptorSet particle_set;
+			bool particle_built = DescriptorBuilder( descriptor_layout_cache_, frame_descriptor_allocators_[current_frame_] )
+				.bindBuffer( 0, buffer_info, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT )
+				.build( particle_set );
+			if ( !particle_built )
+			{
+				throw std::runtime_error( "Failed to allocate particle descriptor set!" );
+			}
 
-			VkBuffer vertex_buffers[ ] = { vertex_buffer_ };
-			VkDeviceSize offsets[ ] = { 0 };
-			vkCmdBindVertexBuffers( command_buffers_[i], 0, 1, vertex_buffers, offsets );
-			vkCmdBindIndexBuffer( command_buffers_[i], index_buffer_, 0, VK_INDEX_TYPE_UINT16 );
-			vkCmdBindDescriptorSets( command_buffers_[i],
+			vkCmdBindPipeline( command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particle_pipeline_ );
+			vkCmdBindDescriptorSets( command_buffer,
 									 VK_PIPELINE_BIND_POINT_GRAPHICS,
-									 pipeline_layout_,
+									 particle_pipeline_layout_,
 									 0, 1,
-									 &descriptor_sets_[i],
+									 &particle_set,
 									 0, nullptr );
-			vkCmdDrawIndexed( command_buffers_[i],
-							  static_cast<uint32_t>( indices.size() ),
-							  1, 0, 0, 0 );
-			vkCmdEndRenderPass( command_buffers_[i] );
-			
-			if ( auto status = vkEndCommandBuffer( command_buffers_[i] );
-				 status != VK_SUCCESS )
-			{
-				throw std::runtime_error( "Failed to record command buffer! Status" + status );
-			}
+			particles_.draw( command_buffer );
+		}
+		gpu_timer_.mark( command_buffer, uint32_t( GpuScope::kParticles ) );
+
+		recordHud( command_buffer );
+		endMainPass( command_buffer, image_index );
+		gpu_timer_.mark( command_buffer, uint32_t( GpuScope::kOverlay ) );
+
+		if ( capture_.enabled() )
+		{
+			capture_.record( command_buffer, swap_chain_images_[image_index], presentLayout() );
+		}
+
+		if ( auto status = vkEndCommandBuffer( command_buffer );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to record command buffer! Status" + status );
 		}
-		
 	}
 
 	void createSyncObjects()
 	{
+		// The swapchain only takes binary semaphores, everything else
+		// is tracked on the timeline (or pooled fences without it)
 		image_available_semaphores_.resize( kMaxFramesInFlight );
 		render_finished_semaphores_.resize( kMaxFramesInFlight );
-		in_flight_fences_.resize( kMaxFramesInFlight );
 
 		VkSemaphoreCreateInfo semaphore_info = {};
 		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-		VkFenceCreateInfo fence_info = {};
-		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
 		for ( int i = 0; i < kMaxFramesInFlight; ++i )
 		{
 			auto status = vkCreateSemaphore( device_,
@@ -1017,39 +1845,46 @@ private:
 										&render_finished_semaphores_[i] );
 			if ( status != VK_SUCCESS )
 				throw std::runtime_error( "Failed to create semaphore" );
-
-			status = vkCreateFence( device_, &fence_info, nullptr, &in_flight_fences_[i] );
-			if ( status != VK_SUCCESS )
-				throw std::runtime_error( "Failed to create fence!" );
-
 		}
+
+		frame_sync_.init( device_, timeline_semaphores_ );
+		std::cout << "Frame sync: " << ( frame_sync_.usesTimeline() ? "timeline semaphores" : "fences" ) << std::endl;
 	}
 
 	void recreateSwapChain()
 	{
 		int width = 0, height = 0;
-		while ( width == 0 || height == 0 )
+		while ( !options_.headless && ( width == 0 || height == 0 ) )
 		{
 			glfwGetFramebufferSize( window_, &width, &height );
 			glfwWaitEvents();
 		}
 
 		vkDeviceWaitIdle( device_ );
+		// queued variants may still reference the old render pass
+		pipeline_manager_.waitIdle();
 
 		cleanupSwapChain();
 
 		createSwapChain();
+		frame_pacer_.swapchainRecreated();
+		trace_.record( TraceOp::kResize, { swap_chain_extent_.width, swap_chain_extent_.height } );
 		createImageViews();
 		createRenderPass();
+		createRenderTargets();
 		createGraphicsPipeline();
 		createFramebuffers();
 		createCommandBuffers();
+
+		if ( capture_.enabled() )
+		{
+			capture_.resize( swap_chain_extent_, swap_chain_image_format_ );
+		}
 	}
 
 	uint32_t findMemoryType( uint32_t type_filter, VkMemoryPropertyFlags props )
 	{
-		VkPhysicalDeviceMemoryProperties mem_props;
-		vkGetPhysicalDeviceMemoryProperties( physical_device_, &mem_props );
+		const auto & mem_props = device_caps_.memory;
 		for ( uint32_t i = 0; i < mem_props.memoryTypeCount; ++i )
 		{
 			if ( type_filter & ( 1 << i ) 
@@ -1066,8 +1901,11 @@ private:
 					   VkBufferUsageFlags usage,
 					   VkMemoryPropertyFlags props,
 					   VkBuffer& buffer,
-					   VkDeviceMemory & buffer_memory)
+					   VkDeviceMemory & buffer_memory,
+					   const std::vector<uint32_t> & queue_families = {} )
 	{
+		trace_.check( TraceOp::kCreateBuffer, { size, usage, props } );
+
 		VkBufferCreateInfo buffer_info = {};
 		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		buffer_info.size = size;
@@ -1075,6 +1913,14 @@ private:
 		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		buffer_info.flags = 0;
 
+		// Used from several queue families without ownership transfers
+		if ( queue_families.size() > 1 )
+		{
+			buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			buffer_info.queueFamilyIndexCount = static_cast<uint32_t>( queue_families.size() );
+			buffer_info.pQueueFamilyIndices = queue_families.data();
+		}
+
 		if ( auto status = vkCreateBuffer( device_,
 										   &buffer_info,
 										   nullptr,
@@ -1105,8 +1951,10 @@ private:
 		vkBindBufferMemory( device_, buffer, buffer_memory, 0 );
 	}
 
-	void copyBuffer( VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size )
+	void copyBuffer( VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize dst_offset = 0 )
 	{
+		trace_.check( TraceOp::kCopyBuffer, { size } );
+
 		VkCommandBufferAllocateInfo alloc_info = {};
 		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -1123,7 +1971,7 @@ private:
 		vkBeginCommandBuffer( command_buffer, &begin );
 		VkBufferCopy copy_region = {};
 		copy_region.srcOffset = 0;
-		copy_region.dstOffset = 0;
+		copy_region.dstOffset = dst_offset;
 		copy_region.size = size;
 		vkCmdCopyBuffer( command_buffer,
 						 src_buffer,
@@ -1142,218 +1990,843 @@ private:
 		vkFreeCommandBuffers(device_, command_pool_, 1, &command_buffer );
 	}
 
-	void createVertexBuffer()
+	BufferAllocation createBuffer( VkDeviceSize size,
+								   VkBufferUsageFlags usage,
+								   VkMemoryPropertyFlags props,
+								   const std::vector<uint32_t> & queue_families = {} )
 	{
-		VkDeviceSize buffer_size = sizeof( vertices[0] ) * vertices.size();
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		createBuffer( size, usage, props, buffer, memory, queue_families );
+
+		BufferAllocation allocation;
+		allocation.buffer = UniqueBuffer( device_, buffer );
+		allocation.memory = UniqueDeviceMemory( device_, memory );
+		allocation.size = size;
+		return allocation;
+	}
 
-		VkBuffer staging_buffer;
-		VkDeviceMemory staging_memory;
-		createBuffer( buffer_size,
-					  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-					  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					  staging_buffer,
-					  staging_memory );
+	/// \brief Write into part of a device local buffer through staging
+	void uploadToBuffer( VkBuffer dst_buffer, VkDeviceSize dst_offset, const void * src, VkDeviceSize size )
+	{
+		auto staging = createBuffer( size,
+									 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+									 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+									 | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
 
 		void * data;
-		vkMapMemory( device_, staging_memory, 0, buffer_size, 0, &data );
-		memcpy( data, vertices.data(), (size_t)buffer_size );
-		vkUnmapMemory( device_, staging_memory);
+		vkMapMemory( device_, staging.memory, 0, size, 0, &data );
+		memcpy( data, src, (size_t)size );
+		vkUnmapMemory( device_, staging.memory );
+
+		copyBuffer( staging.buffer, dst_buffer, size, dst_offset );
+	}
+
+	BufferAllocation createDeviceLocalBuffer( const void * src,
+											  VkDeviceSize buffer_size,
+											  VkBufferUsageFlags usage )
+	{
+		auto staging = createBuffer( buffer_size,
+									 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+									 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+									 | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
 
-		createBuffer( buffer_size,
-					  VK_BUFFER_USAGE_TRANSFER_DST_BIT
-					  | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-					  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					  vertex_buffer_,
-					  vertex_buffer_memory_ );
+		void * data;
+		vkMapMemory( device_, staging.memory, 0, buffer_size, 0, &data );
+		memcpy( data, src, (size_t)buffer_size );
+		vkUnmapMemory( device_, staging.memory );
 
-		copyBuffer( staging_buffer, vertex_buffer_, buffer_size );
+		auto buffer = createBuffer( buffer_size,
+									VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+									VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
 
-		vkDestroyBuffer( device_, staging_buffer, nullptr );
-		vkFreeMemory( device_, staging_memory, nullptr );
+		copyBuffer( staging.buffer, buffer.buffer, buffer_size );
+		return buffer;
 	}
 
-	void createIndexBuffer()
+	/// \brief Vertex and index buffers straight from the mapped mesh, the
+	/// index buffer holds every LOD
+	void createMeshBuffers()
 	{
-		VkDeviceSize buffer_size = sizeof( indices[0] ) * indices.size();
+		const std::string path = besideExecutable( kDemoMeshPath );
+		MeshContainer mesh( path );
+		if ( mesh.vertexStride() != sizeof( Vertex ) )
+		{
+			throw std::runtime_error( "Mesh vertex layout doesn't match! " + path );
+		}
 
-		VkBuffer staging_buffer;
-		VkDeviceMemory staging_memory;
-		createBuffer( buffer_size,
-					  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-					  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					  staging_buffer,
-					  staging_memory );
+		geometry_pool_.init( createGeometryBuffer( false, kGeometryPoolVertices ),
+							 createGeometryBuffer( true, kGeometryPoolIndices ),
+							 sizeof( Vertex ) );
 
-		void * data;
-		vkMapMemory( device_, staging_memory, 0, buffer_size, 0, &data );
-		memcpy( data, indices.data(), (size_t)buffer_size );
-		vkUnmapMemory( device_, staging_memory );
+		demo_mesh_ = addMesh( mesh );
+		mesh_lods_ = mesh.lods();
+		mesh_corners_.clear();
+		for ( uint32_t corner = 0; corner < 8; ++corner )
+		{
+			mesh_corners_.push_back( glm::vec3( ( corner & 1 ) ? mesh.boundsMax()[0] : mesh.boundsMin()[0],
+												( corner & 2 ) ? mesh.boundsMax()[1] : mesh.boundsMin()[1],
+												( corner & 4 ) ? mesh.boundsMax()[2] : mesh.boundsMin()[2] ) );
+		}
+	}
 
-		createBuffer( buffer_size,
-					  VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-					  VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-					  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					  index_buffer_,
-					  index_buffer_memory_ );
+	/// \brief LOD by projected error from the camera to the object's origin.
+	/// The models only rotate, a scale would have to scale the error too.
+	uint32_t selectDrawLod( const glm::mat4 & model ) const
+	{
+		if ( options_.lod_error <= 0.0f )
+		{
+			return 0;
+		}
 
-		copyBuffer( staging_buffer, index_buffer_, buffer_size );
-		vkDestroyBuffer( device_, staging_buffer, nullptr );
-		vkFreeMemory( device_, staging_memory, nullptr );
+		glm::vec3 offset = glm::vec3( model[3].x, model[3].y, model[3].z ) - kCameraEye;
+		float pixels_per_unit = swap_chain_extent_.height / ( 2.0f * std::tan( glm::radians( kCameraFov ) * 0.5f ) );
+		return selectLod( mesh_lods_, glm::length( offset ), pixels_per_unit, options_.lod_error );
 	}
 
-	
+	/// \brief One per frame in flight, not per swapchain image: waiting on
+	/// the frame slot is what makes rewriting its buffer safe
 	void createUniformBuffer()
 	{
 		VkDeviceSize buffer_size = sizeof( UniformBufferObject );
-		uniform_buffers_.resize( swap_chain_images_.size() );
-		uniform_buffers_memory_.resize( swap_chain_images_.size() );
+		uniform_buffers_.resize( kMaxFramesInFlight );
 
-		for ( size_t i = 0; i < swap_chain_images_.size(); ++i )
+		for ( size_t i = 0; i < kMaxFramesInFlight; ++i )
 		{
-			createBuffer( buffer_size,
-						  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-						  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-						  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-						  uniform_buffers_[i],
-						  uniform_buffers_memory_[i] );
+			uniform_buffers_[i] = createBuffer( buffer_size,
+												VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+												VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+												| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
 		}
 	}
 
-	void createDescriptorPool()
+	/// \brief Destroy once the GPU is past the frame being recorded now,
+	/// without a device wide stall
+	void retire( BufferAllocation & allocation )
 	{
-		VkDescriptorPoolSize pool_size = {};
-		pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		pool_size.descriptorCount = static_cast<uint32_t>( swap_chain_images_.size() );
+		allocation.retire( deletion_queue_, frame_sync_.nextPoint( QueueTrack::kGraphics ) );
+	}
 
-		VkDescriptorPoolCreateInfo pool_info = {};
-		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		pool_info.poolSizeCount = 1;
-		pool_info.pPoolSizes = &pool_size;
-		pool_info.maxSets = static_cast<uint32_t>( swap_chain_images_.size() );
+	/// \brief --instances copies of the demo mesh in a square grid around
+	/// the origin, and an instance buffer per frame in flight to draw them
+	void createScene()
+	{
+		uint32_t columns = static_cast<uint32_t>( std::ceil( std::sqrt( double( options_.instances ) ) ) );
+		float spacing = 1.25f * ( mesh_corners_[7].x - mesh_corners_[0].x );
+		float center = 0.5f * ( columns - 1 );
+		scene_instances_.clear();
+		for ( uint32_t i = 0; i < options_.instances; ++i )
+		{
+			glm::vec3 position( ( i % columns - center ) * spacing, ( i / columns - center ) * spacing, 0.0f );
+			scene_instances_.push_back( glm::translate( glm::mat4( 1.0f ), position ) );
+		}
 
-		if ( auto status = vkCreateDescriptorPool( device_,
-												   &pool_info,
-												   nullptr,
-												   &descriptor_pool_ );
-			 status != VK_SUCCESS )
+		draw_queue_.init( &worker_pool_, kCameraFar );
+		for ( auto & buffer : instance_buffers_ )
 		{
-			throw std::runtime_error( "Failed to create descriptor pool!" );
+			buffer = createBuffer( scene_instances_.size() * sizeof( glm::mat4 ),
+								   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+								   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+								   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
 		}
 	}
 
-	void createDescriptorSets()
+	/// \brief Vertex or index buffer of the geometry pool. Copies move
+	/// ranges within it and into its replacement when it is resized.
+	BufferAllocation createGeometryBuffer( bool indices, uint32_t capacity )
 	{
-		std::vector<VkDescriptorSetLayout> layouts( swap_chain_images_.size(),
-													descriptor_set_layout_ );
-		VkDescriptorSetAllocateInfo alloc_info = {};
-		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		alloc_info.descriptorPool = descriptor_pool_;
-		alloc_info.descriptorSetCount = static_cast<uint32_t>( swap_chain_images_.size() );
-		alloc_info.pSetLayouts = layouts.data();
+		return createBuffer( VkDeviceSize( capacity ) * ( indices ? sizeof( GeometryPool::Index ) : sizeof( Vertex ) ),
+							 ( indices ? VK_BUFFER_USAGE_INDEX_BUFFER_BIT : VK_BUFFER_USAGE_VERTEX_BUFFER_BIT )
+							 | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+							 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+	}
 
-		descriptor_sets_.resize( swap_chain_images_.size() );
-		if ( auto status = vkAllocateDescriptorSets( device_,
-													 &alloc_info,
-													 descriptor_sets_.data() );
-			 status != VK_SUCCESS )
+	/// \brief Room for a mesh in the geometry pool, which doubles until it
+	/// fits. The defragmenter shrinks it again once it empties.
+	uint32_t reserveMesh( uint32_t vertex_count, uint32_t index_count, const std::vector<MeshLod> & lods )
+	{
+		for ( ;; )
 		{
-			throw std::runtime_error( "Failed to allocate descriptor sets!" );
+			uint32_t id = geometry_pool_.add( vertex_count, index_count, lods );
+			if ( id != GeometryPool::kInvalid )
+			{
+				return id;
+			}
+
+			// only the arena that is out of room grows
+			const auto & vertex_ranges = geometry_pool_.vertexRanges();
+			const auto & index_ranges = geometry_pool_.indexRanges();
+			uint32_t vertex_capacity = vertex_ranges.capacity() * ( vertex_ranges.largestFree() < vertex_count ? 2 : 1 );
+			uint32_t index_capacity = index_ranges.capacity() * ( index_ranges.largestFree() < index_count ? 2 : 1 );
+			VkDeviceSize vertex_bytes = VkDeviceSize( vertex_ranges.usedEnd() ) * sizeof( Vertex );
+			VkDeviceSize index_bytes = VkDeviceSize( index_ranges.usedEnd() ) * sizeof( GeometryPool::Index );
+			auto old = geometry_pool_.resize( createGeometryBuffer( false, vertex_capacity ),
+											  createGeometryBuffer( true, index_capacity ) );
+			if ( vertex_bytes > 0 )
+			{
+				copyBuffer( old.first.buffer, geometry_pool_.vertexBuffer(), vertex_bytes );
+			}
+			if ( index_bytes > 0 )
+			{
+				copyBuffer( old.second.buffer, geometry_pool_.indexBuffer(), index_bytes );
+			}
+			retire( old.first );
+			retire( old.second );
 		}
+	}
 
-		for ( size_t i = 0; i < swap_chain_images_.size(); ++i )
+	/// \brief Smaller capacity for an arena once its used end is down to a
+	/// quarter of it, twice the used end rounded up from the initial size
+	static uint32_t shrunkCapacity( const RangeAllocator & ranges, uint32_t initial )
+	{
+		if ( ranges.capacity() <= initial || VkDeviceSize( ranges.usedEnd() ) * 4 > ranges.capacity() )
 		{
-			VkDescriptorBufferInfo buffer_info = {};
-			buffer_info.buffer = uniform_buffers_[i];
-			buffer_info.offset = 0;
-			buffer_info.range = sizeof( UniformBufferObject );
+			return ranges.capacity();
+		}
+		uint32_t capacity = initial;
+		while ( capacity < ranges.usedEnd() * 2 )
+		{
+			capacity *= 2;
+		}
+		return capacity;
+	}
+
+	/// \brief One incremental step of geometry pool defragmentation,
+	/// recorded ahead of the main pass. Moves ranges down into holes within
+	/// --defrag-budget and kDefragBytesPerFrame, the meshes draw from their
+	/// new place this frame. Once nothing more moves, a mostly empty pool
+	/// shrinks and its old memory is released. Old ranges and buffers go
+	/// back once the frames in flight are done with them.
+	///
+	/// Draws bind the pool per command buffer and no descriptor points
+	/// into it, the patched mesh offsets are all that changes.
+	void recordDefragmentation( VkCommandBuffer command_buffer )
+	{
+		if ( options_.defrag_budget <= 0.0 )
+		{
+			return;
+		}
 
-			VkWriteDescriptorSet descriptor_write = {};
-			descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptor_write.dstSet = descriptor_sets_[i];
-			descriptor_write.dstBinding = 0;
-			descriptor_write.dstArrayElement = 0;
-			descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptor_write.descriptorCount = 1;
-			descriptor_write.pBufferInfo = &buffer_info;
-			descriptor_write.pImageInfo = nullptr;
-			descriptor_write.pTexelBufferView = nullptr;
+		auto start = std::chrono::steady_clock::now();
+		auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double, std::milli>( options_.defrag_budget ) );
+		auto moves = geometry_pool_.compact( kDefragBytesPerFrame, deadline );
+
+		const auto & vertex_ranges = geometry_pool_.vertexRanges();
+		const auto & index_ranges = geometry_pool_.indexRanges();
+		uint32_t vertex_capacity = shrunkCapacity( vertex_ranges, kGeometryPoolVertices );
+		uint32_t index_capacity = shrunkCapacity( index_ranges, kGeometryPoolIndices );
+		bool shrink = geometry_pool_.settled()
+			&& ( vertex_capacity < vertex_ranges.capacity() || index_capacity < index_ranges.capacity() );
+		if ( moves.empty() && !shrink )
+		{
+			defrag_seconds_ += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+			return;
+		}
 
-			vkUpdateDescriptorSets( device_, 1, &descriptor_write, 0, nullptr );
+		// Earlier frames' copies of these ranges, and their vertex reads of
+		// the ranges about to be written
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier( command_buffer,
+							  VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+							  VK_PIPELINE_STAGE_TRANSFER_BIT,
+							  0, 1, &barrier, 0, nullptr, 0, nullptr );
+
+		if ( shrink )
+		{
+			VkBufferCopy vertex_copy = { 0, 0, VkDeviceSize( vertex_ranges.usedEnd() ) * sizeof( Vertex ) };
+			VkBufferCopy index_copy = { 0, 0, VkDeviceSize( index_ranges.usedEnd() ) * sizeof( GeometryPool::Index ) };
+			auto old = geometry_pool_.resize( createGeometryBuffer( false, vertex_capacity ),
+											  createGeometryBuffer( true, index_capacity ) );
+			if ( vertex_copy.size > 0 )
+			{
+				vkCmdCopyBuffer( command_buffer, old.first.buffer, geometry_pool_.vertexBuffer(), 1, &vertex_copy );
+			}
+			if ( index_copy.size > 0 )
+			{
+				vkCmdCopyBuffer( command_buffer, old.second.buffer, geometry_pool_.indexBuffer(), 1, &index_copy );
+			}
+			defrag_moved_bytes_ += vertex_copy.size + index_copy.size;
+			defrag_released_bytes_ += old.first.size + old.second.size - VkDeviceSize( vertex_capacity ) * sizeof( Vertex )
+				- VkDeviceSize( index_capacity ) * sizeof( GeometryPool::Index );
+			retire( old.first );
+			retire( old.second );
+		}
+		else
+		{
+			std::vector<VkBufferCopy> vertex_copies, index_copies;
+			for ( const auto & move : moves )
+			{
+				( move.indices ? index_copies : vertex_copies ).push_back( move.copy );
+				defrag_moved_bytes_ += move.copy.size;
+				deletion_queue_.push( frame_sync_.nextPoint( QueueTrack::kGraphics ), [this, move]() {
+					geometry_pool_.release( move );
+				} );
+			}
+			if ( !vertex_copies.empty() )
+			{
+				vkCmdCopyBuffer( command_buffer, geometry_pool_.vertexBuffer(), geometry_pool_.vertexBuffer(),
+								 static_cast<uint32_t>( vertex_copies.size() ), vertex_copies.data() );
+			}
+			if ( !index_copies.empty() )
+			{
+				vkCmdCopyBuffer( command_buffer, geometry_pool_.indexBuffer(), geometry_pool_.indexBuffer(),
+								 static_cast<uint32_t>( index_copies.size() ), index_copies.data() );
+			}
+			defrag_moves_ += moves.size();
 		}
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		vkCmdPipelineBarrier( command_buffer,
+							  VK_PIPELINE_STAGE_TRANSFER_BIT,
+							  VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+							  0, 1, &barrier, 0, nullptr, 0, nullptr );
+		defrag_seconds_ += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
 	}
 
-	void initVulkan() {
-		createInstance();
-		setupDebugCallback();
-		createSurface();
-		pickPhysicalDevice();
-		createLogicalDevice();
-		createSwapChain();
-		createImageViews();
-		createRenderPass();
-		createDescriptorSetLayout();
-		createGraphicsPipeline();
-		createFramebuffers();
-		createCommandPool();
-		createVertexBuffer();
-		createIndexBuffer();
-		createUniformBuffer();
-		createDescriptorPool();
-		createDescriptorSets();
-		createCommandBuffers();
-		createSyncObjects();
+	void printDefragStats( const char * label ) const
+	{
+		auto mb = []( VkDeviceSize bytes ) { return bytes / ( 1024.0 * 1024.0 ); };
+		std::cout << label << defrag_moves_ << " ranges moved, " << mb( defrag_moved_bytes_ ) << " MB copied, "
+			<< mb( defrag_released_bytes_ ) << " MB released, "
+			<< defrag_seconds_ * 1e3 / std::max<uint64_t>( draw_frames_, 1 ) << " ms a frame" << std::endl;
 	}
 
-	void mainLoop() {
-		while ( !glfwWindowShouldClose( window_ ) )
+	/// \brief Copy a mesh into the geometry pool through a staging buffer
+	uint32_t addMesh( const MeshContainer & mesh )
+	{
+		uint32_t id = reserveMesh( mesh.vertexCount(), mesh.indexCount(), mesh.lods() );
+		uploadToBuffer( geometry_pool_.vertexBuffer(), geometry_pool_.vertexByteOffset( id ),
+						mesh.vertexData(), mesh.vertexDataSize() );
+		uploadToBuffer( geometry_pool_.indexBuffer(), geometry_pool_.indexByteOffset( id ),
+						mesh.indexData(), mesh.indexDataSize() );
+		return id;
+	}
+
+	/// \brief Give a mesh's range back once the frames in flight are done
+	/// drawing it, without a device wide stall
+	void removeMesh( uint32_t id )
+	{
+		deletion_queue_.push( frame_sync_.nextPoint( QueueTrack::kGraphics ), [this, id]() {
+			geometry_pool_.remove( id );
+		} );
+	}
+
+	void createDescriptorPool()
+	{
+		// Long lived sets come from descriptor_allocator_, per-frame
+		// transient sets from the allocator of the frame being recorded.
+		descriptor_allocator_.init( device_, &descriptor_stats_ );
+		for ( auto & allocator : frame_descriptor_allocators_ )
 		{
-			glfwPollEvents();
-			drawFrame();
+			allocator.init( device_, &descriptor_stats_ );
 		}
-
-		vkDeviceWaitIdle( device_ );
 	}
 
-	void updateUniformBuffer(uint32_t current_image)
+	void createCompute()
 	{
-		static auto start_time = std::chrono::high_resolution_clock::now();
-		auto current_time = std::chrono::high_resolution_clock::now();
-		float time = std::chrono::duration<float, std::chrono::seconds::period>( current_time - start_time ).count();
+		bool async = queue_indices_.compute_family != queue_indices_.graphics_family;
+		compute_.init( device_,
+					   compute_queue_,
+					   queue_indices_.compute_family.value(),
+					   async,
+					   &frame_sync_,
+					   &descriptor_layout_cache_,
+					   &pipeline_layout_cache_,
+					   &descriptor_stats_ );
+
+		auto counters = createBuffer( MipGenerator::kCounterSlots * sizeof( uint32_t ),
+									  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+									  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+									  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+		void * data;
+		vkMapMemory( device_, counters.memory, 0, counters.size, 0, &data );
+		memset( data, 0, counters.size );
+		vkUnmapMemory( device_, counters.memory );
+		mip_generator_.init( device_, compute_, std::move( counters ) );
 
-		UniformBufferObject ubo = {};
-		ubo.model = glm::rotate( glm::mat4( 1.0f ),
-								 time * glm::radians( 90.0f ),
-								 glm::vec3( 0.0f, 0.0f, 1.0f ) );
+		std::cout << "Compute queue: family " << compute_.queueFamily()
+			<< ( async ? " (async)" : " (shared with graphics)" ) << std::endl;
+	}
 
-		ubo.view = glm::lookAt( glm::vec3( 2.0f, 2.0f, 2.0f ),
-								glm::vec3( 0.0f, 0.0f, 0.0f ),
-								glm::vec3( 0.0f, 0.0f, 1.0f ) );
+	void createParticles()
+	{
+		if ( options_.particle_count == 0 )
+		{
+			return;
+		}
 
-		ubo.proj = glm::perspective( glm::radians( 45.0f ),
-									 swap_chain_extent_.width / (float)swap_chain_extent_.height,
-									 0.1f, 10.0f );
+		std::vector<uint32_t> families = { queue_indices_.graphics_family.value() };
+		if ( compute_.isAsync() )
+		{
+			families.push_back( compute_.queueFamily() );
+		}
 
-		ubo.proj[1][1] *= -1; // Opengl -> vulkan
-		void *data;
-		vkMapMemory( device_,
-					 uniform_buffers_memory_[current_image],
-					 0, sizeof( ubo ), 0, &data );
+		std::array<BufferAllocation, 2> state;
+		for ( auto & buffer : state )
+		{
+			buffer = createBuffer( VkDeviceSize( options_.particle_count ) * sizeof( Particle ),
+								   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+								   | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+								   | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+								   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+								   families );
+		}
+		particles_.init( compute_, options_.particle_count, std::move( state ) );
 
-		memcpy( data, &ubo, sizeof( ubo ) );
-		vkUnmapMemory( device_, uniform_buffers_memory_[current_image] );
+		std::cout << "Particles: " << particles_.count() << std::endl;
 	}
 
-	void drawFrame()
+	void createFramePacer()
 	{
-		vkWaitForFences( device_,
-						 1,
-						 &in_flight_fences_[current_frame_],
-						 VK_TRUE,
-						 std::numeric_limits<uint64_t>::max() );
+		frame_pacer_.init( device_, options_.pacing, options_.fps_cap, present_wait_ );
+	}
 
-		uint32_t image_index;
+	void createCapture()
+	{
+		if ( options_.capture.empty() )
+		{
+			return;
+		}
+
+		CaptureConfig config;
+		config.format = options_.capture_format;
+		config.target = options_.capture;
+		capture_.init( physical_device_, device_, &frame_sync_, swap_chain_extent_, swap_chain_image_format_, config );
+
+		if ( config.format == CaptureFormat::kPipe )
+		{
+			std::cout << "Capture: rgba " << swap_chain_extent_.width << "x" << swap_chain_extent_.height
+				<< " frames to " << config.target << std::endl;
+		}
+	}
+
+	/// \brief Generated on first run with its LOD chain, stands in for an
+	/// offline asset build
+	void prepareMeshAssets()
+	{
+		const std::string path = besideExecutable( kDemoMeshPath );
+		bool valid = false;
+		try
+		{
+			valid = MeshContainer( path ).vertexStride() == sizeof( Vertex );
+		}
+		catch ( const std::runtime_error & )
+		{
+			// missing, truncated or written by an older build
+		}
+
+		if ( !valid )
+		{
+			auto grid = makeGridMesh( kDemoMeshResolution );
+			auto levels = buildLodChain( simplifyVertices( grid.vertices ), grid.indices );
+			writeMeshContainer( path,
+								grid.vertices.data(),
+								static_cast<uint32_t>( grid.vertices.size() ),
+								sizeof( Vertex ),
+								2,
+								levels );
+		}
+	}
+
+	/// \brief Generated on first run, stands in for an offline asset build
+	void prepareTextureAssets()
+	{
+		const std::string path = besideExecutable( kDemoTexturePath );
+		try
+		{
+			TextureContainer container( path );
+		}
+		catch ( const std::runtime_error & )
+		{
+			// missing, or written by an older build
+			writeCheckerTexture( path, 2048 );
+		}
+	}
+
+	void createTextures()
+	{
+		const std::string path = besideExecutable( kDemoTexturePath );
+
+		StreamingConfig config;
+		config.budget = options_.texture_budget;
+		config.transcode_format = chooseTranscodeFormat( physical_device_, false );
+		config.transcode_alpha_format = chooseTranscodeFormat( physical_device_, true );
+		std::cout << "Texture format: " << formatName( config.transcode_format )
+			<< ", " << formatName( config.transcode_alpha_format ) << " with alpha"
+			<< " (" << simdLevelName( detectSimdLevel() ) << " transcoder)" << std::endl;
+
+		texture_streamer_.init( physical_device_,
+								device_,
+								graphics_queue_,
+								queue_indices_.graphics_family.value(),
+								&frame_sync_,
+								&deletion_queue_,
+								&worker_pool_,
+								isDeviceExtensionEnabled( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME ),
+								config );
+		demo_texture_ = texture_streamer_.addTexture( path );
+		materials_ = { demo_texture_ };
+	}
+
+	void createPerDrawRings()
+	{
+		if ( per_draw_path_ != PerDrawPath::kDynamicUniform )
+		{
+			return;
+		}
+
+		for ( size_t i = 0; i < kMaxFramesInFlight; ++i )
+		{
+			VkBuffer buffer;
+			VkDeviceMemory memory;
+			createBuffer( kPerDrawRingSize,
+						  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+						  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+						  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						  buffer,
+						  memory );
+			per_draw_rings_[i].init( device_,
+									 buffer,
+									 memory,
+									 kPerDrawRingSize,
+									 device_caps_.properties.limits.minUniformBufferOffsetAlignment );
+
+			VkDescriptorBufferInfo buffer_info = {};
+			buffer_info.buffer = buffer;
+			buffer_info.offset = 0;
+			buffer_info.range = sizeof( PerDrawData );
+
+			bool built = DescriptorBuilder( descriptor_layout_cache_, descriptor_allocator_ )
+				.bindBuffer( 0, buffer_info, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT )
+				.build( per_draw_sets_[i] );
+
+			if ( !built )
+			{
+				throw std::runtime_error( "Failed to allocate per draw descriptor set!" );
+			}
+		}
+	}
+
+	/// \brief Critical path on this thread, independent work on
+	/// worker_pool_ once the device exists, compute and particles after the
+	/// first frame. The async steps only touch their own members until
+	/// they are joined, and nothing that is traced or uses a queue runs
+	/// off this thread, so the trace order doesn't change run to run.
+	void initVulkan() {
+		startup_.init( &worker_pool_ );
+
+		startup_.run( "instance", [this]() {
+			createInstance();
+			setupDebugCallback();
+			createSurface();
+		} );
+		startup_.run( "device", [this]() {
+			pickPhysicalDevice();
+			createLogicalDevice();
+			createFramePacer();
+			configureRenderTargets();
+		} );
+
+		startup_.async( "shaders", [this]() { loadShaders(); } );
+		startup_.async( "texture assets", [this]() { prepareTextureAssets(); } );
+		startup_.async( "mesh assets", [this]() { prepareMeshAssets(); } );
+
+		startup_.run( "swapchain", [this]() {
+			createSwapChain();
+			createImageViews();
+			createRenderPass();
+			createRenderTargets();
+		} );
+
+		startup_.join( "shaders" );
+		startup_.run( "layouts", [this]() {
+			createDescriptorSetLayout();
+			createPipelineLayout();
+			createPipelineManager();
+		} );
+
+		// Compile while the buffers upload, the particle pipeline isn't
+		// needed until after the first frame
+		startup_.async( "pipeline", [this]() {
+			graphics_pipeline_ = pipeline_manager_.getBlocking( basePipelineState() );
+		} );
+		startup_.async( "particle pipeline", [this]() {
+			particle_pipeline_ = pipeline_manager_.getBlocking( particlePipelineState() );
+		} );
+		startup_.async( "overlay pipeline", [this]() {
+			hud_pipeline_ = pipeline_manager_.getBlocking( hudPipelineState() );
+		} );
+
+		startup_.join( "mesh assets" );
+		startup_.run( "buffers", [this]() {
+			createFramebuffers();
+			createCommandPool();
+			createMeshBuffers();
+			createScene();
+			createUniformBuffer();
+			createDescriptorPool();
+			createPerDrawRings();
+			createCommandBuffers();
+			createSyncObjects();
+		} );
+
+		startup_.join( "texture assets" );
+		startup_.run( "textures", [this]() { createTextures(); } );
+		startup_.run( "capture", [this]() { createCapture(); } );
+		startup_.join( "pipeline" );
+
+		startup_.defer( "compute and particles", [this]() {
+			startup_.join( "particle pipeline" );
+			createCompute();
+			createParticles();
+		} );
+		startup_.defer( "overlay", [this]() {
+			startup_.join( "overlay pipeline" );
+			createOverlay();
+		} );
+	}
+
+	void pollEvents()
+	{
+		if ( !options_.headless )
+		{
+			glfwPollEvents();
+		}
+	}
+
+	void mainLoop() {
+		for ( uint32_t frame = 0; options_.frames == 0 || frame < options_.frames; ++frame )
+		{
+			if ( !options_.headless && glfwWindowShouldClose( window_ ) )
+			{
+				break;
+			}
+			frame_pacer_.beginFrame( options_.headless ? VK_NULL_HANDLE : swap_chain_ );
+			pollEvents();
+			if ( options_.idle && !waitForDamage() )
+			{
+				break;
+			}
+			drawFrame();
+		}
+
+		vkDeviceWaitIdle( device_ );
+	}
+
+	/// \brief --idle: block in glfwWaitEventsTimeout until the next frame
+	/// would change something, false when the window is closing
+	bool waitForDamage()
+	{
+		bool waited = false;
+		while ( !damage_.damaged() && !frame_buffer_resized_ && !sceneAnimating() )
+		{
+			if ( glfwWindowShouldClose( window_ ) )
+			{
+				return false;
+			}
+			damage_.idled();
+			// the timeout only bounds a missed wakeup, events end the wait
+			glfwWaitEventsTimeout( kIdleTimeout );
+			waited = true;
+		}
+
+		// time spent idle doesn't move the animation
+		if ( waited )
+		{
+			last_frame_time_ = std::chrono::high_resolution_clock::now();
+		}
+		return true;
+	}
+
+	/// \brief The next frame differs from the last even without events
+	bool sceneAnimating() const
+	{
+		return !animation_paused_ || texture_settling_;
+	}
+
+	/// \brief --idle: what this frame changes on screen. The camera covers
+	/// the whole view, as do the particles while they move, the mesh only
+	/// its old and new bounds.
+	void trackDamage()
+	{
+		auto ubo = cameraUniforms();
+		damage_.watch( ubo );
+		if ( particles_.enabled() && !animation_paused_ )
+		{
+			damage_.invalidate();
+		}
+		if ( hud_.visible() )
+		{
+			damage_.add( hud_.bounds() );
+		}
+
+		for ( size_t i = 0; i < scene_instances_.size(); ++i )
+		{
+			InstanceDamageState object = {};
+			object.model = scene_root_.model * scene_instances_[i];
+			object.texture = texture_streamer_.view( demo_texture_ );
+			object.lod = selectDrawLod( object.model );
+			damage_.object( static_cast<uint32_t>( i ), object, meshBounds( ubo, object.model ) );
+		}
+	}
+
+	/// \brief Screen bounds of the mesh's bounding box, the whole extent
+	/// when it crosses the camera plane
+	VkRect2D meshBounds( const UniformBufferObject & ubo, const glm::mat4 & model ) const
+	{
+		float x0 = std::numeric_limits<float>::max(), y0 = x0;
+		float x1 = -x0, y1 = -x0;
+		for ( const auto & corner : mesh_corners_ )
+		{
+			glm::vec4 clip = ubo.proj * ubo.view * model * glm::vec4( corner, 1.0f );
+			if ( clip.w <= 0.0f )
+			{
+				return { { 0, 0 }, swap_chain_extent_ };
+			}
+			x0 = std::min( x0, clip.x / clip.w );
+			x1 = std::max( x1, clip.x / clip.w );
+			y0 = std::min( y0, clip.y / clip.w );
+			y1 = std::max( y1, clip.y / clip.w );
+		}
+
+		// NDC to pixels, plus a pixel for rasterization rounding
+		auto to_pixel = []( float ndc, uint32_t size ) { return ( ndc * 0.5f + 0.5f ) * size; };
+		int32_t left = static_cast<int32_t>( std::floor( to_pixel( x0, swap_chain_extent_.width ) ) ) - 1;
+		int32_t top = static_cast<int32_t>( std::floor( to_pixel( y0, swap_chain_extent_.height ) ) ) - 1;
+		int32_t right = static_cast<int32_t>( std::ceil( to_pixel( x1, swap_chain_extent_.width ) ) ) + 1;
+		int32_t bottom = static_cast<int32_t>( std::ceil( to_pixel( y1, swap_chain_extent_.height ) ) ) + 1;
+		return { { left, top }, { static_cast<uint32_t>( right - left ), static_cast<uint32_t>( bottom - top ) } };
+	}
+
+	UniformBufferObject cameraUniforms() const
+	{
+		UniformBufferObject ubo = {};
+
+		ubo.view = glm::lookAt( kCameraEye,
+								glm::vec3( 0.0f, 0.0f, 0.0f ),
+								glm::vec3( 0.0f, 0.0f, 1.0f ) );
+
+		ubo.proj = glm::perspective( glm::radians( kCameraFov ),
+									 swap_chain_extent_.width / (float)swap_chain_extent_.height,
+									 0.1f, kCameraFar );
+
+		ubo.proj[1][1] *= -1; // Opengl -> vulkan
+		return ubo;
+	}
+
+	/// \brief Camera for the frame slot, the GPU is done with its last use
+	void updateUniformBuffer()
+	{
+		float time = static_cast<float>( frame_time_ );
+
+		scene_root_.model = glm::rotate( glm::mat4( 1.0f ),
+										 time * glm::radians( 90.0f ),
+										 glm::vec3( 0.0f, 0.0f, 1.0f ) );
+
+		UniformBufferObject ubo = cameraUniforms();
+		void *data;
+		vkMapMemory( device_,
+					 uniform_buffers_[current_frame_].memory,
+					 0, sizeof( ubo ), 0, &data );
+
+		memcpy( data, &ubo, sizeof( ubo ) );
+		vkUnmapMemory( device_, uniform_buffers_[current_frame_].memory );
+	}
+
+	/// \brief Update, record and submit the frame into image_index, the
+	/// swapchain semaphores are empty with --headless
+	void submitFrame( uint32_t image_index,
+					  const std::vector<std::pair<VkSemaphore, VkPipelineStageFlags>> & binary_waits,
+					  const std::vector<VkSemaphore> & binary_signals )
+	{
+		// Replay sets the clock itself, on a fixed step
+		if ( !trace_.replaying() )
+		{
+			auto now = std::chrono::high_resolution_clock::now();
+			frame_dt_ = animation_paused_ ? 0.0f : std::chrono::duration<float>( now - last_frame_time_ ).count();
+			frame_time_ += frame_dt_;
+			last_frame_time_ = now;
+		}
+		trace_.record( TraceOp::kDrawFrame, { static_cast<uint64_t>( frame_dt_ * 1e6f ) } );
+
+		// Wall time for the overlay's graph, paused or replaying
+		auto hud_now = std::chrono::steady_clock::now();
+		hud_.frame( std::chrono::duration<double>( hud_now - last_hud_frame_ ).count() );
+		last_hud_frame_ = hud_now;
+
+		updateUniformBuffer();
+
+		// Streaming batches go ahead of this frame on the same queue. Still
+		// settling while each update brings in a finer mip.
+		VkImageView streamed_view = texture_streamer_.view( demo_texture_ );
+		texture_streamer_.touch( demo_texture_ );
+		texture_streamer_.update();
+		texture_settling_ = texture_streamer_.residentMip( demo_texture_ ) > 0
+			&& texture_streamer_.view( demo_texture_ ) != streamed_view;
+
+		// Runs on the compute queue while the previous frame renders,
+		// paused frames redraw the last step without waiting
+		std::vector<SyncWait> frame_waits;
+		bool particles_stepped = false;
+		if ( particles_.enabled() && !animation_paused_ )
+		{
+			particles_.simulate( std::min( frame_dt_, 1.0f / 30.0f ) );
+			frame_waits.push_back( particles_.drawWait() );
+			particles_stepped = true;
+		}
+
+		if ( options_.idle )
+		{
+			trackDamage();
+		}
+
+		vkResetCommandBuffer( command_buffers_[current_frame_], 0 );
+		recordCommandBuffer( command_buffers_[current_frame_], image_index );
+
+		frame_points_[current_frame_] = frame_sync_.submit(
+			graphics_queue_,
+			QueueTrack::kGraphics,
+			{ command_buffers_[current_frame_] },
+			frame_waits,
+			binary_waits,
+			binary_signals,
+			particles_stepped );
+		if ( particles_.enabled() )
+		{
+			particles_.drawn( frame_points_[current_frame_], particles_stepped );
+		}
+		if ( capture_.enabled() )
+		{
+			capture_.submitted( frame_points_[current_frame_] );
+		}
+	}
+
+	void drawFrame()
+	{
+		frame_sync_.wait( frame_points_[current_frame_] );
+		deletion_queue_.collect( frame_sync_ );
+		capture_.collect();
+		gpu_timer_.collect( static_cast<uint32_t>( current_frame_ ) );
+
+		// GPU is done with this frame slot, recycle its transient sets
+		frame_descriptor_allocators_[current_frame_].resetPools();
+		per_draw_rings_[current_frame_].reset();
+
+		// Offscreen images stand in for the swapchain, one per frame slot
+		if ( options_.headless )
+		{
+			submitFrame( static_cast<uint32_t>( current_frame_ ), {}, {} );
+			current_frame_ = ( current_frame_+ 1 ) % kMaxFramesInFlight;
+			startup_.firstFrame();
+			return;
+		}
+
+		uint32_t image_index;
 		VkResult result = vkAcquireNextImageKHR( device_,
 												 swap_chain_,
 												 std::numeric_limits<uint64_t>::max(),
@@ -1372,36 +2845,15 @@ private:
 			throw std::runtime_error( "Failed to aquire swapchain image!" );
 		}
 
-		updateUniformBuffer( image_index );
-		
-		VkSubmitInfo submit_info = {};
-		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-		VkSemaphore wait_semaphores[ ] = { image_available_semaphores_[current_frame_] };
-		VkPipelineStageFlags wait_stages[ ] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		submit_info.waitSemaphoreCount = 1;
-		submit_info.pWaitSemaphores = wait_semaphores;
-		submit_info.pWaitDstStageMask = wait_stages;
-		submit_info.commandBufferCount = 1;
-		submit_info.pCommandBuffers = &command_buffers_[image_index];
-
 		VkSemaphore signal_semaphores[ ] = { render_finished_semaphores_[current_frame_] };
-		submit_info.signalSemaphoreCount = 1;
-		submit_info.pSignalSemaphores = signal_semaphores;
-
-		vkResetFences( device_, 1, &in_flight_fences_[current_frame_] );
-
-		if ( auto status = vkQueueSubmit( graphics_queue_,
-										  1,
-										  &submit_info,
-										  in_flight_fences_[current_frame_]);
-			 status != VK_SUCCESS )
-		{
-			throw std::runtime_error( "Failed to submit draw command buffer! Status: " + status );
-		}
+		submitFrame( image_index,
+					 { { image_available_semaphores_[current_frame_], VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT } },
+					 { render_finished_semaphores_[current_frame_] } );
 
 		VkPresentInfoKHR present_info = {};
 		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		present_info.pNext = frame_pacer_.presentChain(
+			damage_.presentRegions( nullptr, options_.idle && isDeviceExtensionEnabled( VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME ) ) );
 		present_info.waitSemaphoreCount = 1;
 		present_info.pWaitSemaphores = signal_semaphores;
 
@@ -1413,10 +2865,874 @@ private:
 		present_info.pResults = nullptr;
 
 		vkQueuePresentKHR( present_queue_, &present_info );
-
-		vkQueueWaitIdle( present_queue_ );
+		frame_pacer_.presented();
+		damage_.drawn();
 
 		current_frame_ = ( current_frame_+ 1 ) % kMaxFramesInFlight;
+		startup_.firstFrame();
+	}
+
+	void benchmarkDescriptors()
+	{
+		constexpr size_t kIterations = 100000;
+		constexpr size_t kSetsPerFrame = 256;
+
+		auto & frame_allocator = frame_descriptor_allocators_[0];
+		runBenchmark( "descriptor alloc (per-frame pools)", kIterations, [&]( size_t i ) {
+			if ( i % kSetsPerFrame == 0 )
+				frame_allocator.resetPools();
+
+			VkDescriptorSet set;
+			if ( !frame_allocator.allocate( &set, descriptor_set_layout_ ) )
+				throw std::runtime_error( "Descriptor benchmark allocation failed!" );
+		} );
+		frame_allocator.resetPools();
+
+		VkDescriptorSetLayoutBinding binding = {};
+		binding.binding = 0;
+		binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		binding.descriptorCount = 1;
+		binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = 1;
+		layout_info.pBindings = &binding;
+		runBenchmark( "descriptor layout cache lookup", kIterations, [&]( size_t ) {
+			descriptor_layout_cache_.createDescriptorLayout( layout_info );
+		} );
+
+		VkDescriptorBufferInfo buffer_info = {};
+		buffer_info.buffer = uniform_buffers_[0].buffer;
+		buffer_info.offset = 0;
+		buffer_info.range = sizeof( UniformBufferObject );
+		runBenchmark( "descriptor set cache hit", kIterations, [&]( size_t ) {
+			VkDescriptorSet set;
+			DescriptorBuilder( descriptor_layout_cache_, descriptor_allocator_, &descriptor_set_cache_ )
+				.bindBuffer( 0, buffer_info, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT )
+				.build( set );
+		} );
+
+		std::cout << "Descriptor stats:"
+			<< "\n\tallocations: " << descriptor_stats_.allocations
+			<< " (" << static_cast<uint64_t>( descriptor_stats_.allocationsPerSecond() ) << " sets/s)"
+			<< "\n\tpools created: " << descriptor_stats_.pools_created
+			<< "\n\tpool resets: " << descriptor_stats_.pool_resets
+			<< "\n\tlayout cache hits/misses: " << descriptor_stats_.layout_cache_hits
+			<< "/" << descriptor_stats_.layout_cache_misses
+			<< "\n\tset cache hits/misses: " << descriptor_stats_.set_cache_hits
+			<< "/" << descriptor_stats_.set_cache_misses
+			<< "\n\tpipeline layout cache hits/misses: " << descriptor_stats_.pipeline_layout_cache_hits
+			<< "/" << descriptor_stats_.pipeline_layout_cache_misses << std::endl;
+	}
+
+	/// \brief Replace a buffer every frame, freeing the old one either
+	/// through the deletion queue or after vkDeviceWaitIdle
+	void benchmarkDeferredDeletion()
+	{
+		constexpr size_t kFrames = 500;
+		constexpr VkDeviceSize kBufferSize = 64 * 1024;
+
+		// Each frame writes a new buffer on the GPU, the one before is
+		// freed while that frame may still be in flight
+		auto churn = [&]( bool deferred ) {
+			BufferAllocation streamed;
+			auto result = runBenchmark( deferred ? "buffer churn (deferred deletion)" : "buffer churn (device wait idle)",
+										kFrames,
+										[&]( size_t ) {
+				auto next = createBuffer( kBufferSize,
+										  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+										  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+										  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+				churn_buffer_ = next.buffer;
+
+				pollEvents();
+				drawFrame();
+
+				if ( deferred )
+				{
+					retire( streamed );
+				}
+				else
+				{
+					vkDeviceWaitIdle( device_ );
+					streamed.reset();
+				}
+				streamed = std::move( next );
+			} );
+			churn_buffer_ = VK_NULL_HANDLE;
+			vkDeviceWaitIdle( device_ );
+			streamed.reset();
+			deletion_queue_.collect( frame_sync_ );
+			std::cout << "\t" << result.opsPerSecond() << " frames/s" << std::endl;
+		};
+
+		churn( false );
+		churn( true );
+	}
+
+	/// \brief Render while every cull / winding / blend / topology
+	/// permutation compiles in the background, frames draw with the
+	/// default pipeline until their variant is ready
+	void benchmarkPipelineVariants()
+	{
+		constexpr size_t kFrames = 300;
+
+		std::vector<PipelineState> variants;
+		for ( VkCullModeFlags cull_mode : { VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT } )
+		for ( auto front_face : { VK_FRONT_FACE_COUNTER_CLOCKWISE, VK_FRONT_FACE_CLOCKWISE } )
+		for ( bool blend_enable : { false, true } )
+		for ( auto topology : { VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP } )
+		{
+			auto state = basePipelineState();
+			state.cull_mode = cull_mode;
+			state.front_face = front_face;
+			state.blend_enable = blend_enable;
+			if ( blend_enable )
+				state.frag_constants.set( static_cast<uint32_t>( TriFragConstant::kAlpha ), 0.5f );
+			state.topology = topology;
+			variants.push_back( state );
+		}
+
+		auto default_pipeline = graphics_pipeline_;
+		LatencyHistogram frame_times;
+		size_t fallback_frames = 0;
+
+		runBenchmark( "pipeline variants (async compile)", kFrames, [&]( size_t i ) {
+			auto frame_start = std::chrono::high_resolution_clock::now();
+			pollEvents();
+
+			graphics_pipeline_ = pipeline_manager_.request( variants[i % variants.size()], default_pipeline );
+			if ( graphics_pipeline_ == default_pipeline )
+				fallback_frames++;
+			drawFrame();
+
+			frame_times.record( std::chrono::high_resolution_clock::now() - frame_start );
+		} );
+
+		pipeline_manager_.waitIdle();
+		graphics_pipeline_ = default_pipeline;
+
+		std::cout << "\t" << variants.size() << " variants, "
+			<< pipeline_manager_.readyCount() << " ready, "
+			<< fallback_frames << " frames drew the fallback, "
+			<< worker_pool_.threadCount() << " compile threads" << std::endl;
+		pipeline_manager_.compileLatency().print( "pipeline compile" );
+		frame_times.print( "frame time" );
+	}
+
+	void benchmarkReflection()
+	{
+		constexpr size_t kIterations = 100000;
+
+		auto reflect = [&]( const char * name, const uint32_t * words, size_t word_count ) {
+			auto result = runBenchmark( name, kIterations, [&]( size_t ) {
+				reflectSpirv( words, word_count );
+			} );
+			double bytes = static_cast<double>( word_count * sizeof( uint32_t ) ) * kIterations;
+			std::cout << "\t" << bytes / result.seconds / ( 1024.0 * 1024.0 ) << " MB/s" << std::endl;
+		};
+		reflect( "spirv reflect (tri.vert)", kTriVertSpv, std::size( kTriVertSpv ) );
+		reflect( "spirv reflect (tri.frag)", kTriFragSpv, std::size( kTriFragSpv ) );
+
+		runBenchmark( "spirv reflection cache hit", kIterations, [&]( size_t ) {
+			reflection_cache_.get( vert_shader_.hash, vert_shader_.words, vert_shader_.word_count );
+		} );
+
+		runBenchmark( "pipeline layout cache hit", kIterations, [&]( size_t ) {
+			pipeline_layout_cache_.createPipelineLayout( set_layouts_, push_constant_ranges_ );
+		} );
+
+		std::cout << "Reflection cache hits/misses: " << reflection_cache_.hits()
+			<< "/" << reflection_cache_.misses()
+			<< ", pipeline layouts: " << pipeline_layout_cache_.size() << std::endl;
+	}
+
+	/// \brief Stream a set of textures under a tight budget, a window of
+	/// "visible" textures slides across them so mips are evicted and reloaded
+	void benchmarkTextureStreaming()
+	{
+		constexpr uint32_t kTextures = 12;
+		constexpr uint32_t kVisible = 3;
+		constexpr size_t kFrames = 600;
+
+		TextureStreamer streamer;
+		StreamingConfig config;
+		config.budget = 32ull * 1024 * 1024;
+		config.recent_frames = 1;
+		config.transcode_format = chooseTranscodeFormat( physical_device_, false );
+		config.transcode_alpha_format = chooseTranscodeFormat( physical_device_, true );
+
+		streamer.init( physical_device_,
+					   device_,
+					   graphics_queue_,
+					   queue_indices_.graphics_family.value(),
+					   &frame_sync_,
+					   &deletion_queue_,
+					   &worker_pool_,
+					   isDeviceExtensionEnabled( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME ),
+					   config );
+
+		std::vector<uint32_t> ids;
+		for ( uint32_t i = 0; i < kTextures; ++i )
+		{
+			ids.push_back( streamer.addTexture( besideExecutable( kDemoTexturePath ) ) );
+		}
+
+		runBenchmark( "texture streaming update", kFrames, [&]( size_t frame ) {
+			uint32_t first = static_cast<uint32_t>( frame / 40 ) % kTextures;
+			for ( uint32_t i = 0; i < kVisible; ++i )
+			{
+				streamer.touch( ids[( first + i ) % kTextures] );
+			}
+			streamer.update();
+
+			// stands in for the frame that samples them, old images retire against it
+			frame_sync_.submit( graphics_queue_, QueueTrack::kGraphics, {}, {} );
+			deletion_queue_.collect( frame_sync_ );
+		} );
+
+		vkDeviceWaitIdle( device_ );
+		deletion_queue_.collect( frame_sync_ );
+		streamer.printStats();
+		streamer.cleanup();
+	}
+
+	/// \brief Transcode the demo texture's top mip with every kernel,
+	/// single threaded and across worker_pool_
+	void benchmarkTranscode()
+	{
+		constexpr size_t kIterations = 8;
+
+		TextureContainer container( besideExecutable( kDemoTexturePath ) );
+		const auto & mip = container.mip( 0 );
+		double megapixels = double( mip.width ) * mip.height / 1e6;
+
+		const VkFormat formats[] = {
+			VK_FORMAT_BC1_RGB_UNORM_BLOCK,
+			VK_FORMAT_BC3_UNORM_BLOCK,
+			VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK,
+			VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK
+		};
+		const SimdLevel levels[] = { SimdLevel::kScalar, SimdLevel::kSSE2, SimdLevel::kAVX2 };
+
+		for ( auto format : formats )
+		{
+			std::vector<uint8_t> output( imageByteSize( format, mip.width, mip.height ) );
+			for ( auto level : levels )
+			{
+				if ( level > detectSimdLevel() )
+					continue;
+
+				for ( auto pool : { static_cast<ThreadPool*>( nullptr ), &worker_pool_ } )
+				{
+					std::string name = std::string( "transcode " ) + formatName( format ) + " "
+						+ simdLevelName( level ) + ( pool ? " mt" : " 1t" );
+					auto result = runBenchmark( name, kIterations, [&]( size_t ) {
+						transcodeRgba8( container.mipData( 0 ), mip.width, mip.height,
+										format, output.data(), pool, level );
+					} );
+					std::cout << "\t" << megapixels * kIterations / result.seconds << " MP/s" << std::endl;
+				}
+
+				// ETC has no SIMD kernel, one pass is enough
+				if ( format == VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK || format == VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK )
+					break;
+			}
+		}
+	}
+
+	void createImage( uint32_t width,
+					  uint32_t height,
+					  uint32_t mip_count,
+					  VkImageUsageFlags usage,
+					  UniqueImage & image,
+					  UniqueDeviceMemory & memory )
+	{
+		VkImageCreateInfo image_info = {};
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+		image_info.extent = { width, height, 1 };
+		image_info.mipLevels = mip_count;
+		image_info.arrayLayers = 1;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_info.usage = usage;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if ( auto status = vkCreateImage( device_, &image_info, nullptr, image.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create image! Status: " + std::to_string( status ) );
+		}
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements( device_, image, &requirements );
+
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = findMemoryType( requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+
+		if ( auto status = vkAllocateMemory( device_, &alloc_info, nullptr, memory.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to allocate image memory! Status: " + std::to_string( status ) );
+		}
+		vkBindImageMemory( device_, image, memory, 0 );
+	}
+
+	/// \brief Full mip chain with spd.comp on the compute queue against
+	/// a blit per level on the graphics queue, submit to completion
+	void benchmarkMipGeneration()
+	{
+		constexpr size_t kIterations = 50;
+
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandPool = command_pool_;
+		alloc_info.commandBufferCount = 1;
+
+		VkCommandBuffer blit_commands;
+		vkAllocateCommandBuffers( device_, &alloc_info, &blit_commands );
+
+		VkCommandBufferBeginInfo begin = {};
+		begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		for ( uint32_t size : { 1024u, 2048u, 4096u } )
+		{
+			uint32_t mip_count = 1;
+			while ( ( size >> mip_count ) > 0 )
+				mip_count++;
+
+			// mip 0 contents don't change the cost, both start from UNDEFINED
+			UniqueImage spd_image, blit_image;
+			UniqueDeviceMemory spd_memory, blit_memory;
+			createImage( size, size, mip_count, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+						 spd_image, spd_memory );
+			createImage( size, size, mip_count,
+						 VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+						 blit_image, blit_memory );
+
+			std::string suffix = " " + std::to_string( size ) + "^2";
+			auto spd = runBenchmark( "mip chain spd.comp" + suffix, kIterations, [&]( size_t ) {
+				auto & batch = compute_.begin();
+				mip_generator_.generate( batch, spd_image, size, size, mip_count,
+										 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+				frame_sync_.wait( compute_.submit( batch ) );
+			} );
+
+			auto blit = runBenchmark( "mip chain vkCmdBlitImage" + suffix, kIterations, [&]( size_t ) {
+				vkResetCommandBuffer( blit_commands, 0 );
+				vkBeginCommandBuffer( blit_commands, &begin );
+
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = blit_image;
+				barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				vkCmdPipelineBarrier( blit_commands,
+									  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+									  0, 0, nullptr, 0, nullptr, 1, &barrier );
+				MipGenerator::recordBlitChain( blit_commands, blit_image, size, size, mip_count,
+											   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+
+				vkEndCommandBuffer( blit_commands );
+				frame_sync_.wait( frame_sync_.submit( graphics_queue_, QueueTrack::kGraphics, { blit_commands }, {} ) );
+			} );
+
+			std::cout << "\tspd.comp " << blit.seconds / spd.seconds << "x the blit chain ("
+				<< ( compute_.isAsync() ? "async compute" : "graphics queue" ) << ")" << std::endl;
+		}
+
+		vkFreeCommandBuffers( device_, command_pool_, 1, &blit_commands );
+	}
+
+	void benchmarkParticles()
+	{
+		constexpr size_t kIterations = 100;
+
+		std::vector<uint32_t> families = { queue_indices_.graphics_family.value() };
+		if ( compute_.isAsync() )
+		{
+			families.push_back( compute_.queueFamily() );
+		}
+
+		for ( uint32_t count : { 1u << 20, 1u << 22 } )
+		{
+			std::array<BufferAllocation, 2> state;
+			for ( auto & buffer : state )
+			{
+				buffer = createBuffer( VkDeviceSize( count ) * sizeof( Particle ),
+									   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+									   | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+									   | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+									   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+									   families );
+			}
+
+			ParticleSystem particles;
+			particles.init( compute_, count, std::move( state ) );
+			auto result = runBenchmark( "particle step " + std::to_string( count >> 20 ) + "M", kIterations, [&]( size_t ) {
+				frame_sync_.wait( particles.simulate( 1.0f / 60.0f ) );
+			} );
+			std::cout << "\t" << double( count ) * kIterations / result.seconds / 1e6 << " M particles/s ("
+				<< ( compute_.isAsync() ? "async compute" : "graphics queue" ) << ")" << std::endl;
+			particles.cleanup();
+		}
+	}
+
+	/// \brief Drive drawFrame from a trace, headless on a fixed timestep and
+	/// as fast as the device goes
+	void replayTrace()
+	{
+		constexpr float kStep = 1.0f / 60.0f;
+
+		LatencyHistogram frame_times;
+		TraceRecord record;
+		uint64_t frames = 0;
+		double recorded_seconds = 0.0;
+		auto start = std::chrono::high_resolution_clock::now();
+		while ( trace_.nextDriver( record ) )
+		{
+			if ( record.op == TraceOp::kResize )
+			{
+				offscreen_extent_ = { static_cast<uint32_t>( record.args.at( 0 ) ),
+									  static_cast<uint32_t>( record.args.at( 1 ) ) };
+				recreateSwapChain();
+				continue;
+			}
+
+			recorded_seconds += record.args.at( 0 ) / 1e6;
+			frame_dt_ = kStep;
+			frame_time_ = frames * double( kStep );
+
+			auto frame_start = std::chrono::high_resolution_clock::now();
+			drawFrame();
+			frame_times.record( std::chrono::high_resolution_clock::now() - frame_start );
+			frames++;
+		}
+		vkDeviceWaitIdle( device_ );
+		double seconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+
+		std::cout << "Replayed " << frames << " frames in " << seconds << " s, "
+			<< frames / seconds << " fps (recorded at "
+			<< ( recorded_seconds > 0.0 ? frames / recorded_seconds : 0.0 ) << " fps)" << std::endl;
+		frame_times.print( "replay frame time" );
+		std::cout << "Trace: " << trace_.checked() << " calls checked, "
+			<< trace_.mismatches() << " mismatched" << std::endl;
+		if ( trace_.mismatches() > 0 )
+		{
+			std::cout << "Warning: buffer and command buffer calls differ from the recording,"
+				<< " frame times may not be comparable" << std::endl;
+		}
+	}
+
+	/// \brief LOD chain build speed for a few grid sizes, then the
+	/// triangles a scene of demo meshes spread out from the camera draws
+	/// with LODs picked at --lod-error, against all of them at full detail
+	void benchmarkLod()
+	{
+		for ( uint32_t resolution : { 32u, 64u, 128u } )
+		{
+			auto grid = makeGridMesh( resolution );
+			auto input = simplifyVertices( grid.vertices );
+			std::vector<LodLevel> levels;
+			auto result = runBenchmark( "lod chain build " + std::to_string( resolution ) + "x" + std::to_string( resolution ),
+										4, [&]( size_t ) { levels = buildLodChain( input, grid.indices ); } );
+			std::cout << "\t" << grid.indices.size() / 3 * result.opsPerSecond() / 1e6 << " M source triangles/s, "
+				<< levels.size() << " levels down to " << levels.back().indices.size() / 3
+				<< " triangles at error " << levels.back().error << std::endl;
+		}
+
+		constexpr size_t kObjects = 4096;
+		constexpr float kNear = 1.0f;
+		constexpr float kFar = 64.0f;
+		constexpr float kViewportHeight = 1080.0f;
+		float pixels_per_unit = kViewportHeight / ( 2.0f * std::tan( glm::radians( kCameraFov ) * 0.5f ) );
+		float max_pixels = options_.lod_error > 0.0f ? options_.lod_error : 1.0f;
+
+		// the same spread every run, denser close to the camera
+		std::vector<float> distances( kObjects );
+		for ( size_t i = 0; i < kObjects; ++i )
+		{
+			float t = ( i + 0.5f ) / kObjects;
+			distances[i] = kNear + ( kFar - kNear ) * t * t;
+		}
+
+		uint64_t triangles = 0;
+		runBenchmark( "lod selection", kObjects, [&]( size_t i ) {
+			triangles += mesh_lods_[selectLod( mesh_lods_, distances[i], pixels_per_unit, max_pixels )].index_count / 3;
+		} );
+		uint64_t full = uint64_t( mesh_lods_[0].index_count / 3 ) * kObjects;
+		std::cout << "\t" << kObjects << " objects " << kNear << " to " << kFar << " units away at "
+			<< kViewportHeight << "p, " << max_pixels << " px error: " << triangles << " of " << full
+			<< " triangles (" << 100.0 * triangles / full << "%)" << std::endl;
+	}
+
+	/// \brief Transient attachment memory at the swapchain extent for every
+	/// sample count the device supports, and what recreating them costs
+	void benchmarkMsaa()
+	{
+		constexpr size_t kIterations = 20;
+
+		for ( uint32_t requested : { 1u, 2u, 4u, 8u } )
+		{
+			auto samples = chooseSampleCount( device_caps_.properties.limits, requested );
+			if ( samples != requested )
+			{
+				continue;
+			}
+
+			RenderTargets targets;
+			targets.init( device_, device_caps_.memory );
+			runBenchmark( "render targets " + std::to_string( requested ) + "x create", kIterations, [&]( size_t ) {
+				targets.create( swap_chain_extent_, swap_chain_image_format_, depth_format_, samples );
+			} );
+			targets.printMemory( "\t" );
+		}
+	}
+
+	/// \brief Resize churn on each path: the render pass path recreates its
+	/// render pass, the attachments and a framebuffer per swapchain image,
+	/// dynamic rendering only the attachments
+	void benchmarkRenderPaths()
+	{
+		constexpr size_t kResizes = 100;
+
+		// smaller than the swapchain so its views fit every framebuffer
+		auto extent_for = [&]( size_t i ) {
+			uint32_t shrink = static_cast<uint32_t>( i % 8 ) * 16;
+			return VkExtent2D{ swap_chain_extent_.width - std::min( shrink, swap_chain_extent_.width - 1 ),
+							   swap_chain_extent_.height - std::min( shrink, swap_chain_extent_.height - 1 ) };
+		};
+
+		RenderTargets targets;
+		targets.init( device_, device_caps_.memory );
+		runBenchmark( "resize (render pass)", kResizes, [&]( size_t i ) {
+			auto extent = extent_for( i );
+			VkRenderPass render_pass = makeRenderPass();
+			targets.create( extent, swap_chain_image_format_, depth_format_, msaa_samples_ );
+			std::vector<VkFramebuffer> framebuffers;
+			for ( auto image_view : swap_chain_image_views_ )
+			{
+				framebuffers.push_back( makeFramebuffer( render_pass, targets, image_view, extent ) );
+			}
+			for ( auto framebuffer : framebuffers )
+			{
+				vkDestroyFramebuffer( device_, framebuffer, nullptr );
+			}
+			vkDestroyRenderPass( device_, render_pass, nullptr );
+		} );
+
+		if ( !dynamic_rendering_ )
+		{
+			std::cout << "\tno dynamic rendering to compare with" << std::endl;
+			return;
+		}
+		runBenchmark( "resize (dynamic rendering)", kResizes, [&]( size_t i ) {
+			targets.create( extent_for( i ), swap_chain_image_format_, depth_format_, msaa_samples_ );
+		} );
+	}
+
+	/// \brief Mesh add / remove churn through the pool's free-lists, then
+	/// recording the same draws three ways: rebinding the buffers per mesh
+	/// as if each had its own, pooled with one bind, and pooled merged into
+	/// one indirect draw
+	void benchmarkGeometryPool()
+	{
+		constexpr size_t kChurn = 20000;
+		constexpr size_t kLiveMeshes = 2048;
+		constexpr size_t kDraws = 4096;
+		constexpr size_t kRecordings = 50;
+
+		// ranges only, nothing is uploaded or drawn
+		std::vector<uint32_t> live;
+		uint32_t seed = 1;
+		auto next_random = [&]() {
+			seed = seed * 1664525u + 1013904223u;
+			return seed >> 8;
+		};
+		size_t full = 0;
+		runBenchmark( "geometry pool add/remove", kChurn, [&]( size_t ) {
+			if ( live.size() >= kLiveMeshes )
+			{
+				size_t victim = next_random() % live.size();
+				geometry_pool_.remove( live[victim] );
+				live[victim] = live.back();
+				live.pop_back();
+			}
+			uint32_t vertex_count = 64 + next_random() % 512;
+			uint32_t index_count = vertex_count * 3 / 2;
+			uint32_t id = geometry_pool_.add( vertex_count, index_count, { MeshLod{ 0, index_count, 0.0f } } );
+			if ( id == GeometryPool::kInvalid )
+			{
+				full++;
+				return;
+			}
+			live.push_back( id );
+		} );
+		geometry_pool_.printStats( "\t" );
+		std::cout << "\t" << full << " adds found no block" << std::endl;
+		for ( auto id : live )
+		{
+			geometry_pool_.remove( id );
+		}
+
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandPool = command_pool_;
+		alloc_info.commandBufferCount = 1;
+
+		VkCommandBuffer command_buffer;
+		vkAllocateCommandBuffers( device_, &alloc_info, &command_buffer );
+
+		VkCommandBufferBeginInfo begin = {};
+		begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		auto indirect = createBuffer( kDraws * sizeof( VkDrawIndexedIndirectCommand ),
+									  VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+									  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+									  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+		VkDrawIndexedIndirectCommand * commands;
+		vkMapMemory( device_, indirect.memory, 0, indirect.size, 0, reinterpret_cast<void **>( &commands ) );
+
+		const auto & demo = geometry_pool_.mesh( demo_mesh_ );
+		auto lod_for = [&]( size_t i ) { return static_cast<uint32_t>( i % demo.lods.size() ); };
+
+		// Recorded, never submitted. Transient sets and per draw data come
+		// from the current frame slot, recycled once the GPU is past it.
+		frame_sync_.wait( frame_points_[current_frame_] );
+		frame_descriptor_allocators_[current_frame_].resetPools();
+		per_draw_rings_[current_frame_].reset();
+
+		auto record = [&]( const std::string & name, const std::function<void()> & draws ) {
+			auto result = runBenchmark( name, kRecordings, [&]( size_t ) {
+				vkResetCommandBuffer( command_buffer, 0 );
+				vkBeginCommandBuffer( command_buffer, &begin );
+				beginMainPass( command_buffer, 0 );
+				bindSceneState( command_buffer );
+				vkCmdBindPipeline( command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline_ );
+				bindMaterial( command_buffer, 0 );
+				bindPerDraw( command_buffer, scene_root_ );
+				draws();
+				endMainPass( command_buffer, 0 );
+				vkEndCommandBuffer( command_buffer );
+			} );
+			std::cout << "\t" << kDraws * result.opsPerSecond() / 1e6 << " M draws/s" << std::endl;
+		};
+
+		record( "record " + std::to_string( kDraws ) + " draws (rebind per mesh)", [&]() {
+			for ( size_t i = 0; i < kDraws; ++i )
+			{
+				const auto & lod = demo.lods[lod_for( i )];
+				VkBuffer vertex_buffers[] = { geometry_pool_.vertexBuffer() };
+				VkDeviceSize offsets[] = { geometry_pool_.vertexByteOffset( demo_mesh_ ) };
+				vkCmdBindVertexBuffers( command_buffer, 0, 1, vertex_buffers, offsets );
+				vkCmdBindIndexBuffer( command_buffer, geometry_pool_.indexBuffer(),
+									  geometry_pool_.indexByteOffset( demo_mesh_ ), GeometryPool::kIndexType );
+				vkCmdDrawIndexed( command_buffer, lod.index_count, 1, lod.first_index - demo.first_index, 0, 0 );
+			}
+		} );
+		record( "record " + std::to_string( kDraws ) + " draws (pooled)", [&]() {
+			for ( size_t i = 0; i < kDraws; ++i )
+			{
+				geometry_pool_.draw( command_buffer, demo_mesh_, lod_for( i ) );
+			}
+		} );
+		record( "record " + std::to_string( kDraws ) + " draws (pooled, indirect)", [&]() {
+			for ( size_t i = 0; i < kDraws; ++i )
+			{
+				commands[i] = geometry_pool_.drawCommand( demo_mesh_, lod_for( i ) );
+			}
+			if ( multi_draw_indirect_ )
+			{
+				vkCmdDrawIndexedIndirect( command_buffer, indirect.buffer, 0,
+										  static_cast<uint32_t>( kDraws ), sizeof( VkDrawIndexedIndirectCommand ) );
+				return;
+			}
+			for ( size_t i = 0; i < kDraws; ++i )
+			{
+				vkCmdDrawIndexedIndirect( command_buffer, indirect.buffer, i * sizeof( VkDrawIndexedIndirectCommand ),
+										  1, sizeof( VkDrawIndexedIndirectCommand ) );
+			}
+		} );
+		if ( !multi_draw_indirect_ )
+		{
+			std::cout << "\tno multiDrawIndirect, one indirect command per draw" << std::endl;
+		}
+
+		vkUnmapMemory( device_, indirect.memory );
+		vkFreeCommandBuffers( device_, command_pool_, 1, &command_buffer );
+	}
+
+	/// \brief Sort and batch throughput of the draw queue on the pool and
+	/// on one thread, then the binds a scene of random packets needs in
+	/// submission order against sorted and instanced
+	void benchmarkDrawQueue()
+	{
+		constexpr uint32_t kPipelines = 4;
+		constexpr uint32_t kMaterials = 256;
+		constexpr uint32_t kMeshes = 1024;
+		constexpr uint32_t kLods = 4;
+
+		auto fill = [&]( DrawQueue & queue, size_t count ) {
+			uint32_t seed = 1;
+			auto next_random = [&]() {
+				seed = seed * 1664525u + 1013904223u;
+				return seed >> 8;
+			};
+			queue.clear();
+			for ( size_t i = 0; i < count; ++i )
+			{
+				DrawPacket packet;
+				packet.transform = glm::mat4( 1.0f );
+				packet.pipeline = next_random() % kPipelines;
+				packet.material = next_random() % kMaterials;
+				packet.mesh = next_random() % kMeshes;
+				packet.lod = next_random() % kLods;
+				packet.depth = ( next_random() & 0xffff ) / 65536.0f * kCameraFar;
+				queue.submit( packet );
+			}
+		};
+
+		for ( size_t count : { size_t( 1 ) << 12, size_t( 1 ) << 16, size_t( 1 ) << 20 } )
+		{
+			for ( bool pooled : { false, true } )
+			{
+				DrawQueue queue;
+				queue.init( pooled ? &worker_pool_ : nullptr, kCameraFar );
+				double sort_seconds = 0.0;
+				size_t iterations = std::max<size_t>( 4, ( size_t( 1 ) << 22 ) / count );
+				auto result = runBenchmark( "draw queue " + std::to_string( count ) + ( pooled ? " packets (pool)" : " packets (one thread)" ),
+											iterations, [&]( size_t ) {
+					fill( queue, count );
+					queue.build();
+					sort_seconds += queue.sortSeconds();
+				} );
+				std::cout << "\t" << count * result.opsPerSecond() / 1e6 << " M packets/s submitted and batched, sorted at "
+					<< count * iterations / sort_seconds / 1e6 << " M keys/s" << std::endl;
+			}
+		}
+
+		DrawQueue queue;
+		queue.init( &worker_pool_, kCameraFar );
+		for ( bool sorted : { false, true } )
+		{
+			fill( queue, size_t( 1 ) << 16 );
+			queue.build( sorted );
+			auto stats = queue.stateChanges();
+			std::cout << "\t" << ( sorted ? "sorted:   " : "unsorted: " ) << stats.packets << " packets in " << stats.draws
+				<< " draws, " << stats.pipeline_binds << " pipeline and " << stats.material_binds << " material binds" << std::endl;
+		}
+	}
+
+	/// \brief Fragment the geometry pool with a burst of meshes that
+	/// grows it, remove three in four again, then draw frames while the
+	/// defragmenter compacts the pool and releases what it grew by
+	void benchmarkDefragmentation()
+	{
+		constexpr size_t kMeshes = 4096;
+		constexpr size_t kFrames = 300;
+
+		if ( options_.defrag_budget <= 0.0 )
+		{
+			std::cout << "defragmentation disabled by --defrag-budget 0" << std::endl;
+			return;
+		}
+
+		// ranges only, never drawn, so they go without waiting for frames
+		uint32_t seed = 1;
+		auto next_random = [&]() {
+			seed = seed * 1664525u + 1013904223u;
+			return seed >> 8;
+		};
+		std::vector<uint32_t> meshes;
+		for ( size_t i = 0; i < kMeshes; ++i )
+		{
+			uint32_t vertex_count = 64 + next_random() % 1024;
+			uint32_t index_count = vertex_count * 3 / 2;
+			meshes.push_back( reserveMesh( vertex_count, index_count, { MeshLod{ 0, index_count, 0.0f } } ) );
+		}
+		for ( auto id : meshes )
+		{
+			if ( next_random() % 4 != 0 )
+			{
+				geometry_pool_.remove( id );
+			}
+		}
+		geometry_pool_.printStats( "\tfragmented: " );
+
+		auto moves = defrag_moves_;
+		auto moved = defrag_moved_bytes_;
+		auto released = defrag_released_bytes_;
+		auto seconds = defrag_seconds_;
+		size_t settled_frame = 0;
+		runBenchmark( "frames while defragmenting", kFrames, [&]( size_t frame ) {
+			pollEvents();
+			drawFrame();
+			if ( !settled_frame && geometry_pool_.settled() )
+			{
+				settled_frame = frame + 1;
+			}
+		} );
+		vkDeviceWaitIdle( device_ );
+		deletion_queue_.collect( frame_sync_ );
+
+		geometry_pool_.printStats( "\tcompacted: " );
+		auto mb = []( VkDeviceSize bytes ) { return bytes / ( 1024.0 * 1024.0 ); };
+		std::cout << "\t" << ( settled_frame ? "settled after " + std::to_string( settled_frame ) : "not settled after " + std::to_string( kFrames ) )
+			<< " frames, " << defrag_moves_ - moves << " ranges moved, " << mb( defrag_moved_bytes_ - moved ) << " MB copied, "
+			<< mb( defrag_released_bytes_ - released ) << " MB released, "
+			<< ( defrag_seconds_ - seconds ) * 1e3 / kFrames << " ms a frame" << std::endl;
+	}
+
+	/// \brief CPU cost of building the overlay, text, graph and all,
+	/// against its 0.1 ms budget
+	void benchmarkHud()
+	{
+		constexpr size_t kIterations = 10000;
+
+		for ( uint32_t i = 0; i < PerfHud::kHistory; ++i )
+		{
+			hud_.frame( ( 14.0 + i % 7 ) / 1000.0 );
+		}
+		auto result = runBenchmark( "overlay build", kIterations, [&]( size_t ) {
+			buildHud();
+		} );
+		std::cout << "\t" << result.nsPerOp() / 1e3 << " us for " << hud_.vertices().size()
+			<< " vertices, budget 100 us" << std::endl;
+	}
+
+	void runBenchmarks()
+	{
+		benchmarkDescriptors();
+		benchmarkDeferredDeletion();
+		benchmarkPipelineVariants();
+		benchmarkReflection();
+		benchmarkTranscode();
+		benchmarkMipGeneration();
+		benchmarkParticles();
+		benchmarkTextureStreaming();
+		benchmarkLod();
+		benchmarkMsaa();
+		benchmarkRenderPaths();
+		benchmarkGeometryPool();
+		benchmarkDrawQueue();
+		benchmarkDefragmentation();
+		benchmarkHud();
+
+		vkDeviceWaitIdle( device_ );
 	}
 
 	void cleanupSwapChain()
@@ -1431,40 +3747,131 @@ private:
 							  static_cast<uint32_t>( command_buffers_.size() ),
 							  command_buffers_.data() );
 
-		vkDestroyPipeline( device_, graphics_pipeline_, nullptr );
-		vkDestroyPipelineLayout( device_, pipeline_layout_, nullptr );
 		vkDestroyRenderPass( device_, render_pass_, nullptr );
+		render_targets_.destroy();
 
 		for ( auto image_view : swap_chain_image_views_ )
 		{
 			vkDestroyImageView( device_, image_view, nullptr );
 		}
 
-		vkDestroySwapchainKHR( device_, swap_chain_, nullptr );
+		if ( options_.headless )
+		{
+			swap_chain_images_.clear();
+			offscreen_images_.clear();
+			offscreen_memory_.clear();
+		}
+		else
+		{
+			vkDestroySwapchainKHR( device_, swap_chain_, nullptr );
+		}
 	}
 
 	void cleanup() {
+		if ( !options_.benchmark && !options_.headless )
+		{
+			frame_pacer_.printStats();
+		}
+		if ( options_.idle )
+		{
+			damage_.printStats();
+		}
+		if ( !options_.benchmark )
+		{
+			render_targets_.printMemory( "Render targets: " );
+			geometry_pool_.printStats( "Geometry: " );
+			printDefragStats( "Defragmentation: " );
+		}
+		if ( draw_frames_ > 0 )
+		{
+			double frames = static_cast<double>( draw_frames_ );
+			std::cout << "Draw queue: per frame " << draw_stats_.packets / frames << " packets in "
+				<< draw_stats_.draws / frames << " draws, " << draw_stats_.pipeline_binds / frames << " pipeline, "
+				<< draw_stats_.material_binds / frames << " material and " << draw_stats_.buffer_binds / frames
+				<< " buffer binds, sorted at " << draw_stats_.packets / std::max( sort_seconds_, 1e-9 ) / 1e6
+				<< " M packets/s" << std::endl;
+		}
+		std::cout << "Frame sync: " << ( frame_sync_.usesTimeline() ? "timeline semaphores" : "fences" ) << ", "
+			<< frame_sync_.hostWaits() << " host waits";
+		if ( draw_frames_ > 0 )
+		{
+			std::cout << " (" << double( frame_sync_.hostWaits() ) / draw_frames_ << " a frame)";
+		}
+		std::cout << ", " << frame_sync_.objectCount() << " sync objects" << std::endl;
+		if ( lod_full_triangles_ > 0 )
+		{
+			std::cout << "LOD: drew " << lod_triangles_ << " of " << lod_full_triangles_ << " full detail triangles ("
+				<< 100.0 * lod_triangles_ / lod_full_triangles_ << "%)" << std::endl;
+		}
+		if ( hud_frames_ > 0 )
+		{
+			std::cout << "Overlay: " << hud_seconds_ * 1e3 / hud_frames_ << " ms CPU a frame over " << hud_frames_ << " frames";
+			if ( gpu_timer_.samples() > 0 )
+			{
+				std::cout << ", GPU ms";
+				for ( uint32_t scope = 0; scope < uint32_t( GpuScope::kCount ); ++scope )
+				{
+					std::cout << ( scope ? ", " : " " ) << kGpuScopeNames[scope] << " " << gpu_timer_.averageMilliseconds( scope );
+				}
+			}
+			std::cout << std::endl;
+		}
+
+		if ( capture_.enabled() )
+		{
+			capture_.cleanup();
+			capture_.printStats();
+		}
+
+		pipeline_manager_.waitIdle();
 		cleanupSwapChain();
 
-		vkDestroyDescriptorPool( device_, descriptor_pool_, nullptr );
-		vkDestroyDescriptorSetLayout( device_, descriptor_set_layout_, nullptr );
+		pipeline_manager_.cleanup();
+		pipeline_layout_cache_.cleanup();
 
-		for ( size_t i = 0; i < swap_chain_images_.size(); ++i )
+		if ( per_draw_path_ == PerDrawPath::kDynamicUniform )
 		{
-			vkDestroyBuffer( device_, uniform_buffers_[i], nullptr );
-			vkFreeMemory( device_, uniform_buffers_memory_[i], nullptr );
+			for ( auto & ring : per_draw_rings_ )
+			{
+				ring.cleanup();
+			}
 		}
 
-		vkDestroyBuffer( device_, vertex_buffer_, nullptr );
-		vkFreeMemory( device_, vertex_buffer_memory_, nullptr );
-		vkDestroyBuffer( device_, index_buffer_, nullptr );
-		vkFreeMemory( device_, index_buffer_memory_, nullptr );
+		descriptor_allocator_.cleanup();
+		for ( auto & allocator : frame_descriptor_allocators_ )
+		{
+			allocator.cleanup();
+		}
+		descriptor_layout_cache_.cleanup();
+
+		for ( const auto & buffer : uniform_buffers_ )
+		{
+			VkBuffer handle = buffer.buffer;
+			descriptor_set_cache_.forget( reinterpret_cast<uintptr_t>( handle ) );
+		}
+		uniform_buffers_.clear();
+		geometry_pool_.cleanup();
+		for ( auto & buffer : instance_buffers_ )
+		{
+			buffer.reset();
+		}
+		for ( auto & buffer : hud_vertex_buffers_ )
+		{
+			buffer.reset();
+		}
+		gpu_timer_.cleanup();
+		texture_streamer_.cleanup();
+		mip_generator_.cleanup();
+		particles_.cleanup();
+		compute_.cleanup();
+
+		deletion_queue_.flush();
+		frame_sync_.cleanup();
 
 		for ( size_t i = 0; i < kMaxFramesInFlight; ++i )
 		{
 			vkDestroySemaphore( device_, render_finished_semaphores_[i], nullptr );
 			vkDestroySemaphore( device_, image_available_semaphores_[i], nullptr );
-			vkDestroyFence( device_, in_flight_fences_[i], nullptr );
 		}
 
 		vkDestroyCommandPool( device_, command_pool_, nullptr );
@@ -1474,13 +3881,21 @@ private:
 		if ( kEnableValidationLayers )
 		{
 			DestroyDebugUtilsMessengerEXT( instance_, callback_, nullptr );
+			debug_messenger_.stop();
+			debug_messenger_.printStats();
 		}
 
-		vkDestroySurfaceKHR( instance_, surface_, nullptr );
+		if ( !options_.headless )
+		{
+			vkDestroySurfaceKHR( instance_, surface_, nullptr );
+		}
 		vkDestroyInstance( instance_, nullptr );
 
-		glfwDestroyWindow( window_ );
-		glfwTerminate();
+		if ( !options_.headless )
+		{
+			glfwDestroyWindow( window_ );
+			glfwTerminate();
+		}
 	}
 
 	GLFWwindow * window_;
@@ -1490,13 +3905,18 @@ private:
 	VkSurfaceKHR surface_;
 	VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
 	VkDevice device_;
+	std::vector<const char*> enabled_device_extensions_;
+	DeviceCaps device_caps_;
+	QueueFamilyIndices queue_indices_;
 
 	/// Debug callback
 	VkDebugUtilsMessengerEXT callback_;
+	DebugMessenger debug_messenger_;
 
 	/// Queues
 	VkQueue graphics_queue_;
 	VkQueue present_queue_;
+	VkQueue compute_queue_;
 
 	/// Swapchain
 	VkSwapchainKHR swap_chain_;
@@ -1505,15 +3925,30 @@ private:
 	VkExtent2D swap_chain_extent_;
 	std::vector<VkImageView> swap_chain_image_views_;
 
-	/// Graphics pipeline
-	VkShaderModule vert_shader_module_;
-	VkShaderModule frag_shader_module_;
+	/// Graphics pipeline, variants are owned by pipeline_manager_
+	ShaderCode vert_shader_;
+	ShaderCode frag_shader_;
+	ReflectionCache reflection_cache_;
+	const ShaderReflection * vert_reflection_ = nullptr;
+	const ShaderReflection * frag_reflection_ = nullptr;
 
-	VkRenderPass render_pass_;
+	/// Null with dynamic rendering, as are the framebuffers
+	VkRenderPass render_pass_ = VK_NULL_HANDLE;
+	bool dynamic_rendering_ = false;
+	PFN_vkCmdBeginRenderingKHR cmd_begin_rendering_ = nullptr;
+	PFN_vkCmdEndRenderingKHR cmd_end_rendering_ = nullptr;
+
+	/// Depth and the multisampled colour, recreated with the swapchain
+	VkFormat depth_format_ = VK_FORMAT_UNDEFINED;
+	VkSampleCountFlagBits msaa_samples_ = VK_SAMPLE_COUNT_1_BIT;
+	RenderTargets render_targets_;
 
 	VkDescriptorSetLayout descriptor_set_layout_;
-	VkPipelineLayout pipeline_layout_;
-	VkPipeline graphics_pipeline_;
+	VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+	VkPipeline graphics_pipeline_ = VK_NULL_HANDLE;
+
+	ThreadPool worker_pool_;
+	PipelineManager pipeline_manager_;
 
 	VkCommandPool command_pool_;
 
@@ -1522,25 +3957,263 @@ private:
 
 	std::vector<VkSemaphore> image_available_semaphores_;
 	std::vector<VkSemaphore> render_finished_semaphores_;
-	std::vector<VkFence> in_flight_fences_;
 	size_t current_frame_ = 0;
 
+	/// Frame sync, frame_points_ is what each frame slot last submitted
+	bool timeline_semaphores_ = false;
+	FrameSync frame_sync_;
+	std::array<SyncPoint, kMaxFramesInFlight> frame_points_ = {};
+	DeletionQueue deletion_queue_;
+	VkBuffer churn_buffer_ = VK_NULL_HANDLE; // written by each frame of the --bench buffer churn
+
 	bool frame_buffer_resized_ = false;
 
-	VkBuffer vertex_buffer_;
-	VkDeviceMemory vertex_buffer_memory_;
-	VkBuffer index_buffer_;
-	VkDeviceMemory index_buffer_memory_;
+	/// Every mesh is sub-allocated from the pool's two buffers
+	static constexpr uint32_t kGeometryPoolVertices = 1u << 20;
+	static constexpr uint32_t kGeometryPoolIndices = 1u << 22;
+	GeometryPool geometry_pool_;
+	bool multi_draw_indirect_ = false;
+
+	/// Defragmentation, see recordDefragmentation()
+	static constexpr VkDeviceSize kDefragBytesPerFrame = 4 * 1024 * 1024;
+	uint64_t defrag_moves_ = 0;
+	VkDeviceSize defrag_moved_bytes_ = 0;
+	VkDeviceSize defrag_released_bytes_ = 0;
+	double defrag_seconds_ = 0.0;
+
+	/// Demo mesh, every LOD shares its vertices and indexes its own range
+	/// of its indices
+	static constexpr const char * kDemoMeshPath = "grid.vmsh";
+	static constexpr uint32_t kDemoMeshResolution = 64;
+	uint32_t demo_mesh_ = GeometryPool::kInvalid;
+	std::vector<MeshLod> mesh_lods_;
+	std::vector<glm::vec3> mesh_corners_; // bounding box
+	uint64_t lod_triangles_ = 0;
+	uint64_t lod_full_triangles_ = 0;
+
+	/// Camera, fixed
+	inline static const glm::vec3 kCameraEye = glm::vec3( 2.0f, 2.0f, 2.0f );
+	static constexpr float kCameraFov = 45.0f; // vertical, degrees
+	static constexpr float kCameraFar = 10.0f;
+
+	std::vector<BufferAllocation> uniform_buffers_;
+
+	/// Descriptors
+	DescriptorStats descriptor_stats_;
+	DescriptorLayoutCache descriptor_layout_cache_;
+	PipelineLayoutCache pipeline_layout_cache_;
+	std::vector<VkDescriptorSetLayout> set_layouts_;
+	std::vector<VkPushConstantRange> push_constant_ranges_;
+	DescriptorSetCache descriptor_set_cache_;
+	DescriptorAllocator descriptor_allocator_;
+	std::array<DescriptorAllocator, kMaxFramesInFlight> frame_descriptor_allocators_;
+
+	/// --headless render targets, swap_chain_images_ points at these
+	VkExtent2D offscreen_extent_ = { kWidth, kHeight };
+	std::vector<UniqueImage> offscreen_images_;
+	std::vector<UniqueDeviceMemory> offscreen_memory_;
+
+	/// Frame clock, wall time unless a trace is replaying
+	std::chrono::high_resolution_clock::time_point start_time_ = std::chrono::high_resolution_clock::now();
+	std::chrono::high_resolution_clock::time_point last_frame_time_ = start_time_;
+	double frame_time_ = 0.0; // seconds since start
+	float frame_dt_ = 0.0f;
+
+	/// --record-trace / --replay-trace
+	Trace trace_;
+
+	/// --idle, what the next frame changes and the animation pause
+	static constexpr double kIdleTimeout = 0.5; // seconds
+	DamageTracker damage_;
+	bool animation_paused_ = false;
+	bool texture_settling_ = false;
+
+	/// Present mode, frame limiter and latency
+	bool present_wait_ = false;
+	FramePacer frame_pacer_;
+
+	/// Frame capture, only enabled with --capture
+	FrameCapture capture_;
+
+	/// Compute
+	ComputeContext compute_;
+	MipGenerator mip_generator_;
+
+	/// Particles, simulated on compute_ and drawn in the main pass
+	ParticleSystem particles_;
+	ShaderCode particle_vert_shader_;
+	ShaderCode particle_frag_shader_;
+	const ShaderReflection * particle_vert_reflection_ = nullptr;
+	const ShaderReflection * particle_frag_reflection_ = nullptr;
+	std::vector<VkDescriptorSetLayout> particle_set_layouts_;
+	VkPipelineLayout particle_pipeline_layout_ = VK_NULL_HANDLE;
+	VkPipeline particle_pipeline_ = VK_NULL_HANDLE;
+
+	/// Textures
+	TextureStreamer texture_streamer_;
+	static constexpr const char * kDemoTexturePath = "checker.vtex";
+	uint32_t demo_texture_ = 0;
+
+	/// Per draw data
+	PerDrawPath per_draw_path_ = PerDrawPath::kPushConstants;
+	VkDescriptorSetLayout per_draw_set_layout_ = VK_NULL_HANDLE;
+	std::array<DynamicUniformRing, kMaxFramesInFlight> per_draw_rings_;
+	std::array<VkDescriptorSet, kMaxFramesInFlight> per_draw_sets_ = {};
+	/// Scene: copies of the demo mesh placed by their instance transforms,
+	/// all turning with the root transform
+	PerDrawData scene_root_ = { glm::mat4( 1.0f ) };
+	std::vector<glm::mat4> scene_instances_;
+	std::vector<uint32_t> materials_; // texture per material id
+	DrawQueue draw_queue_;
+	std::array<BufferAllocation, kMaxFramesInFlight> instance_buffers_;
+	DrawStats draw_stats_;
+	uint64_t draw_frames_ = 0;
+	double sort_seconds_ = 0.0;
+	DrawStats frame_draw_stats_; // the frame being recorded
+	uint64_t frame_triangles_ = 0;
+
+	/// Performance overlay, --hud and F1, drawn last in the main pass
+	PerfHud hud_;
+	GpuTimer gpu_timer_;
+	ShaderCode hud_vert_shader_;
+	ShaderCode hud_frag_shader_;
+	const ShaderReflection * hud_vert_reflection_ = nullptr;
+	VkPipelineLayout hud_pipeline_layout_ = VK_NULL_HANDLE;
+	VkPipeline hud_pipeline_ = VK_NULL_HANDLE;
+	std::array<BufferAllocation, kMaxFramesInFlight> hud_vertex_buffers_;
+	std::chrono::steady_clock::time_point last_hud_frame_ = std::chrono::steady_clock::now();
+	double hud_seconds_ = 0.0; // CPU, building and recording
+	double hud_last_ms_ = 0.0;
+	uint64_t hud_frames_ = 0;
+
+	AppOptions options_;
+
+	/// Last, its async steps refer to everything above
+	StartupScheduler startup_;
+};
 
-	std::vector<VkBuffer> uniform_buffers_;
-	std::vector<VkDeviceMemory> uniform_buffers_memory_;
+AppOptions parseOptions( int argc, char ** argv )
+{
+	AppOptions options;
+	for ( int i = 1; i < argc; ++i )
+	{
+		std::string arg = argv[i];
+		if ( arg == "--bench" )
+		{
+			options.benchmark = true;
+		}
+		else if ( arg == "--texture-budget" && i + 1 < argc )
+		{
+			options.texture_budget = std::stoull( argv[++i] ) * 1024 * 1024;
+		}
+		else if ( arg == "--particles" && i + 1 < argc )
+		{
+			options.particle_count = static_cast<uint32_t>( std::stoul( argv[++i] ) );
+		}
+		else if ( arg == "--headless" )
+		{
+			options.headless = true;
+		}
+		else if ( arg == "--verbose-validation" )
+		{
+			options.verbose_validation = true;
+		}
+		else if ( arg == "--no-device-cache" )
+		{
+			options.device_cache = false;
+		}
+		else if ( arg == "--idle" )
+		{
+			options.idle = true;
+		}
+		else if ( arg == "--frames" && i + 1 < argc )
+		{
+			options.frames = static_cast<uint32_t>( std::stoul( argv[++i] ) );
+		}
+		else if ( arg == "--capture" && i + 1 < argc )
+		{
+			options.capture = argv[++i];
+		}
+		else if ( arg == "--capture-format" && i + 1 < argc )
+		{
+			options.capture_format = parseCaptureFormat( argv[++i] );
+		}
+		else if ( arg == "--pacing" && i + 1 < argc )
+		{
+			options.pacing = parsePacingPolicy( argv[++i] );
+		}
+		else if ( arg == "--fps" && i + 1 < argc )
+		{
+			options.fps_cap = std::stod( argv[++i] );
+			options.pacing = PacingPolicy::kCapped;
+		}
+		else if ( arg == "--render-pass" )
+		{
+			options.dynamic_rendering = false;
+		}
+		else if ( arg == "--msaa" && i + 1 < argc )
+		{
+			options.msaa = static_cast<uint32_t>( std::stoul( argv[++i] ) );
+		}
+		else if ( arg == "--lod-error" && i + 1 < argc )
+		{
+			options.lod_error = std::stof( argv[++i] );
+		}
+		else if ( arg == "--instances" && i + 1 < argc )
+		{
+			options.instances = std::max( 1u, static_cast<uint32_t>( std::stoul( argv[++i] ) ) );
+		}
+		else if ( arg == "--defrag-budget" && i + 1 < argc )
+		{
+			options.defrag_budget = std::stod( argv[++i] );
+		}
+		else if ( arg == "--per-draw" && i + 1 < argc )
+		{
+			options.per_draw = parsePerDrawPath( argv[++i] );
+		}
+		else if ( arg == "--hud" )
+		{
+			options.hud = true;
+		}
+		else if ( arg == "--record-trace" && i + 1 < argc )
+		{
+			options.record_trace = argv[++i];
+		}
+		else if ( arg == "--replay-trace" && i + 1 < argc )
+		{
+			options.replay_trace = argv[++i];
+			options.headless = true;
+		}
+		else
+		{
+			throw std::runtime_error( "Unknown option: " + arg );
+		}
+	}
 
-	VkDescriptorPool descriptor_pool_;
-	std::vector<VkDescriptorSet> descriptor_sets_;
-};
+	// nothing would ever close the loop
+	if ( options.headless && options.frames == 0 && !options.benchmark && options.replay_trace.empty() )
+	{
+		throw std::runtime_error( "--headless needs --frames <count>!" );
+	}
+	// no window events to wait for
+	if ( options.headless )
+	{
+		options.idle = false;
+	}
+	return options;
+}
+
+int main( int argc, char ** argv ) {
+	AppOptions options;
+	try {
+		options = parseOptions( argc, argv );
+	}
+	catch ( const std::exception& e ) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
 
-int main() {
-	HelloTriangleApplication app;
+	HelloTriangleApplication app( options );
 
 	try {
 		app.run();
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// \brief name in the directory of the running executable, so generated
+/// assets don't depend on the working directory. Falls back to name
+/// when the executable's path can't be found.
+inline std::string besideExecutable( const std::string & name )
+{
+	std::string path;
+#ifdef _WIN32
+	char buffer[MAX_PATH];
+	DWORD length = GetModuleFileNameA( nullptr, buffer, MAX_PATH );
+	if ( length > 0 && length < MAX_PATH )
+	{
+		path.assign( buffer, length );
+	}
+#else
+	char buffer[4096];
+	ssize_t length = readlink( "/proc/self/exe", buffer, sizeof( buffer ) );
+	if ( length > 0 && static_cast<size_t>( length ) < sizeof( buffer ) )
+	{
+		path.assign( buffer, static_cast<size_t>( length ) );
+	}
+#endif
+	size_t slash = path.find_last_of( "/\\" );
+	if ( slash == std::string::npos )
+	{
+		return name;
+	}
+	return path.substr( 0, slash + 1 ) + name;
+}
+
+/// \brief Read-only memory mapping of a whole file. Pages are faulted in
+/// by the OS as they are touched, so only mips actually uploaded are read.
+class MappedFile {
+public:
+	MappedFile() = default;
+
+	explicit MappedFile( const std::string & path )
+	{
+#ifdef _WIN32
+		file_ = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+							 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if ( file_ == INVALID_HANDLE_VALUE )
+		{
+			throw std::runtime_error( "Failed to open file! " + path );
+		}
+
+		LARGE_INTEGER size;
+		if ( !GetFileSizeEx( file_, &size ) )
+		{
+			close();
+			throw std::runtime_error( "Failed to stat file! " + path );
+		}
+		size_ = static_cast<size_t>( size.QuadPart );
+
+		mapping_ = CreateFileMappingA( file_, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		if ( mapping_ == nullptr )
+		{
+			close();
+			throw std::runtime_error( "Failed to map file! " + path );
+		}
+		data_ = static_cast<const uint8_t*>( MapViewOfFile( mapping_, FILE_MAP_READ, 0, 0, 0 ) );
+#else
+		int fd = open( path.c_str(), O_RDONLY );
+		if ( fd < 0 )
+		{
+			throw std::runtime_error( "Failed to open file! " + path );
+		}
+
+		struct stat info;
+		if ( fstat( fd, &info ) != 0 )
+		{
+			::close( fd );
+			throw std::runtime_error( "Failed to stat file! " + path );
+		}
+		size_ = static_cast<size_t>( info.st_size );
+
+		void * mapped = mmap( nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0 );
+		::close( fd );
+		data_ = mapped == MAP_FAILED ? nullptr : static_cast<const uint8_t*>( mapped );
+#endif
+		if ( data_ == nullptr )
+		{
+			close();
+			throw std::runtime_error( "Failed to map file! " + path );
+		}
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	MappedFile( const MappedFile & ) = delete;
+	MappedFile & operator=( const MappedFile & ) = delete;
+
+	MappedFile( MappedFile && other ) noexcept
+	{
+		*this = std::move( other );
+	}
+
+	MappedFile & operator=( MappedFile && other ) noexcept
+	{
+		if ( this != &other )
+		{
+			close();
+			data_ = other.data_;
+			size_ = other.size_;
+			other.data_ = nullptr;
+			other.size_ = 0;
+#ifdef _WIN32
+			file_ = other.file_;
+			mapping_ = other.mapping_;
+			other.file_ = INVALID_HANDLE_VALUE;
+			other.mapping_ = nullptr;
+#endif
+		}
+		return *this;
+	}
+
+	const uint8_t * data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	void close()
+	{
+#ifdef _WIN32
+		if ( data_ )
+			UnmapViewOfFile( data_ );
+		if ( mapping_ )
+			CloseHandle( mapping_ );
+		if ( file_ != INVALID_HANDLE_VALUE )
+			CloseHandle( file_ );
+		mapping_ = nullptr;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if ( data_ )
+			munmap( const_cast<uint8_t*>( data_ ), size_ );
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+	const uint8_t * data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+#endif
+};
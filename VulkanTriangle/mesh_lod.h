@@ -0,0 +1,708 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/// \brief Vertices as the simplifier sees them. Each vertex starts with
+/// its position, every float after it is an attribute scaled by its weight
+/// into the same error space, so a weight of 1 treats an attribute unit
+/// like a unit of distance.
+struct SimplifyVertices {
+	const float * data = nullptr;
+	size_t count = 0;
+	size_t stride = 0; // floats per vertex
+	size_t position_components = 3; // 2 or 3, a missing z is 0
+	std::vector<float> attribute_weights; // stride - position_components of them
+};
+
+/// \brief Edge collapse simplification with generalized quadric error
+/// (Garland and Heckbert 1998), position and attributes in one quadric.
+///
+/// Collapses are half edge, a vertex moves onto a neighbour, so every
+/// level indexes the original vertices and a LOD chain shares one vertex
+/// buffer. Boundary vertices only slide along the boundary and a plane
+/// quadric perpendicular to each boundary edge keeps the outline. Quadrics
+/// accumulate across simplify() calls, so coarser levels are measured
+/// against the original surface, not the level before.
+class MeshSimplifier {
+public:
+	MeshSimplifier( const SimplifyVertices & vertices, std::vector<uint32_t> indices )
+		: count_( vertices.count ),
+		  dims_( 3 + vertices.stride - vertices.position_components ),
+		  indices_( std::move( indices ) )
+	{
+		if ( vertices.position_components < 2 || vertices.position_components > 3
+			 || vertices.attribute_weights.size() != vertices.stride - vertices.position_components
+			 || indices_.size() % 3 != 0 )
+		{
+			throw std::runtime_error( "Bad simplifier input!" );
+		}
+
+		points_.assign( count_ * dims_, 0.0 );
+		for ( size_t v = 0; v < count_; ++v )
+		{
+			const float * src = vertices.data + v * vertices.stride;
+			double * point = &points_[v * dims_];
+			for ( size_t i = 0; i < vertices.position_components; ++i )
+			{
+				point[i] = src[i];
+			}
+			for ( size_t i = 0; i < vertices.attribute_weights.size(); ++i )
+			{
+				point[3 + i] = double( src[vertices.position_components + i] ) * vertices.attribute_weights[i];
+			}
+		}
+
+		quadric_size_ = dims_ * ( dims_ + 1 ) / 2 + dims_ + 2;
+		quadrics_.assign( count_ * quadric_size_, 0.0 );
+		for ( size_t t = 0; t < indices_.size(); t += 3 )
+		{
+			addTriangleQuadric( indices_[t], indices_[t + 1], indices_[t + 2] );
+		}
+		addBoundaryQuadrics();
+	}
+
+	/// \brief Collapse edges until at most target_index_count indices are
+	/// left, or nothing else goes without exceeding max_error. False when
+	/// no edge could be collapsed.
+	bool simplify( size_t target_index_count, float max_error = std::numeric_limits<float>::max() )
+	{
+		double max_cost = double( max_error ) * max_error;
+		bool progress = false;
+
+		while ( indices_.size() > target_index_count )
+		{
+			buildAdjacency();
+			auto candidates = collectCollapses();
+			if ( candidates.empty() )
+			{
+				break;
+			}
+			std::sort( candidates.begin(), candidates.end(),
+					   []( const Collapse & a, const Collapse & b ) { return a.cost < b.cost; } );
+
+			// Roughly one triangle goes per boundary collapse and two per
+			// interior one. Collapses much dearer than the cheapest set that
+			// reaches the target are left to a later pass, where they
+			// compete with edges the locks kept out of this one.
+			size_t remove = ( indices_.size() - target_index_count + 2 ) / 3;
+			double pass_limit = candidates[std::min( candidates.size() - 1, remove / 2 )].cost * 1.5;
+
+			std::vector<uint8_t> locked( count_, 0 );
+			remap_.resize( count_ );
+			for ( uint32_t v = 0; v < count_; ++v )
+			{
+				remap_[v] = v;
+			}
+
+			size_t removed = 0;
+			for ( const auto & collapse : candidates )
+			{
+				if ( collapse.cost > max_cost || ( removed > 0 && collapse.cost > pass_limit ) )
+				{
+					break;
+				}
+				if ( locked[collapse.from] || locked[collapse.to] || flips( collapse.from, collapse.to ) )
+				{
+					continue;
+				}
+
+				// the triangles around from change shape, nothing else that
+				// touches them may collapse this pass
+				for ( uint32_t i = tri_offsets_[collapse.from]; i < tri_offsets_[collapse.from + 1]; ++i )
+				{
+					const uint32_t * tri = &indices_[tris_[i] * 3];
+					removed += ( tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to ) ? 1 : 0;
+					locked[tri[0]] = locked[tri[1]] = locked[tri[2]] = 1;
+				}
+
+				remap_[collapse.from] = collapse.to;
+				addQuadric( collapse.to, collapse.from );
+				error_ = std::max( error_, collapse.cost );
+				progress = true;
+
+				if ( removed >= remove )
+				{
+					break;
+				}
+			}
+
+			if ( removed == 0 )
+			{
+				break;
+			}
+			applyRemap();
+		}
+		return progress;
+	}
+
+	const std::vector<uint32_t> & indices() const { return indices_; }
+
+	/// \brief Largest collapse error so far, RMS distance in position units
+	float error() const { return static_cast<float>( std::sqrt( error_ ) ); }
+
+private:
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+
+	struct Edge {
+		uint32_t a;
+		uint32_t b; // a < b
+		bool operator<( const Edge & other ) const { return a != other.a ? a < other.a : b < other.b; }
+		bool operator==( const Edge & other ) const { return a == other.a && b == other.b; }
+	};
+
+	/// Packed quadric layout: upper triangle of A, then b, then c, then the
+	/// weight the error is normalized by
+	double * quadric( uint32_t v ) { return &quadrics_[size_t( v ) * quadric_size_]; }
+	const double * quadric( uint32_t v ) const { return &quadrics_[size_t( v ) * quadric_size_]; }
+	const double * point( uint32_t v ) const { return &points_[size_t( v ) * dims_]; }
+
+	void addQuadric( uint32_t to, uint32_t from )
+	{
+		double * dst = quadric( to );
+		const double * src = quadric( from );
+		for ( size_t i = 0; i < quadric_size_; ++i )
+		{
+			dst[i] += src[i];
+		}
+	}
+
+	/// \brief vT A v + 2 bT v + c over the sum of weights, the weighted
+	/// mean squared distance
+	double cost( uint32_t q0, uint32_t q1, const double * v ) const
+	{
+		const double * qs[2] = { quadric( q0 ), quadric( q1 ) };
+		double error = 0.0;
+		double weight = 0.0;
+		for ( const double * q : qs )
+		{
+			const double * a = q;
+			for ( size_t i = 0; i < dims_; ++i )
+			{
+				error += *a++ * v[i] * v[i];
+				for ( size_t j = i + 1; j < dims_; ++j )
+				{
+					error += 2.0 * *a++ * v[i] * v[j];
+				}
+			}
+			for ( size_t i = 0; i < dims_; ++i )
+			{
+				error += 2.0 * a[i] * v[i];
+			}
+			error += a[dims_];
+			weight += a[dims_ + 1];
+		}
+		return weight > 0.0 ? std::max( 0.0, error / weight ) : 0.0;
+	}
+
+	/// \brief Squared distance to the triangle's plane through all the
+	/// dimensions, weighted by its area
+	void addTriangleQuadric( uint32_t i0, uint32_t i1, uint32_t i2 )
+	{
+		const double * p = point( i0 );
+		const double * q = point( i1 );
+		const double * r = point( i2 );
+
+		std::vector<double> e1( dims_ ), e2( dims_ );
+		double l1 = 0.0;
+		for ( size_t i = 0; i < dims_; ++i )
+		{
+			e1[i] = q[i] - p[i];
+			l1 += e1[i] * e1[i];
+		}
+		l1 = std::sqrt( l1 );
+		if ( l1 < 1e-12 )
+		{
+			return;
+		}
+
+		double d = 0.0;
+		for ( size_t i = 0; i < dims_; ++i )
+		{
+			e1[i] /= l1;
+			e2[i] = r[i] - p[i];
+			d += e2[i] * e1[i];
+		}
+		double l2 = 0.0;
+		for ( size_t i = 0; i < dims_; ++i )
+		{
+			e2[i] -= d * e1[i];
+			l2 += e2[i] * e2[i];
+		}
+		l2 = std::sqrt( l2 );
+		if ( l2 < 1e-12 )
+		{
+			return;
+		}
+
+		double pe1 = 0.0, pe2 = 0.0, pp = 0.0;
+		for ( size_t i = 0; i < dims_; ++i )
+		{
+			e2[i] /= l2;
+			pe1 += p[i] * e1[i];
+			pe2 += p[i] * e2[i];
+			pp += p[i] * p[i];
+		}
+
+		double area = 0.5 * l1 * l2;
+		std::vector<double> q_tri( quadric_size_ );
+		double * a = q_tri.data();
+		for ( size_t i = 0; i < dims_; ++i )
+		{
+			for ( size_t j = i; j < dims_; ++j )
+			{
+				*a++ = area * ( ( i == j ? 1.0 : 0.0 ) - e1[i] * e1[j] - e2[i] * e2[j] );
+			}
+		}
+		for ( size_t i = 0; i < dims_; ++i )
+		{
+			a[i] = area * ( pe1 * e1[i] + pe2 * e2[i] - p[i] );
+		}
+		a[dims_] = area * ( pp - pe1 * pe1 - pe2 * pe2 );
+		a[dims_ + 1] = area;
+
+		for ( uint32_t v : { i0, i1, i2 } )
+		{
+			double * dst = quadric( v );
+			for ( size_t i = 0; i < quadric_size_; ++i )
+			{
+				dst[i] += q_tri[i];
+			}
+		}
+	}
+
+	/// \brief Edges used by one triangle, with a position only plane
+	/// through the edge and perpendicular to its triangle
+	void addBoundaryQuadrics()
+	{
+		boundary_.assign( count_, 0 );
+		std::vector<Edge> edges;
+		edges.reserve( indices_.size() );
+		for ( size_t t = 0; t < indices_.size(); t += 3 )
+		{
+			for ( size_t k = 0; k < 3; ++k )
+			{
+				uint32_t a = indices_[t + k], b = indices_[t + ( k + 1 ) % 3];
+				edges.push_back( { std::min( a, b ), std::max( a, b ) } );
+			}
+		}
+		std::sort( edges.begin(), edges.end() );
+
+		for ( size_t t = 0; t < indices_.size(); t += 3 )
+		{
+			const double * p[3] = { point( indices_[t] ), point( indices_[t + 1] ), point( indices_[t + 2] ) };
+			double normal[3];
+			cross( p[0], p[1], p[2], normal );
+
+			for ( size_t k = 0; k < 3; ++k )
+			{
+				uint32_t a = indices_[t + k], b = indices_[t + ( k + 1 ) % 3];
+				Edge edge = { std::min( a, b ), std::max( a, b ) };
+				auto range = std::equal_range( edges.begin(), edges.end(), edge );
+				if ( range.second - range.first != 1 )
+				{
+					continue;
+				}
+				boundary_[a] = boundary_[b] = 1;
+
+				const double * pa = p[k];
+				const double * pb = p[( k + 1 ) % 3];
+				double dir[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+				double m[3] = { dir[1] * normal[2] - dir[2] * normal[1],
+								dir[2] * normal[0] - dir[0] * normal[2],
+								dir[0] * normal[1] - dir[1] * normal[0] };
+				double m_length = std::sqrt( m[0] * m[0] + m[1] * m[1] + m[2] * m[2] );
+				if ( m_length < 1e-12 )
+				{
+					continue;
+				}
+				for ( double & c : m )
+				{
+					c /= m_length;
+				}
+
+				double weight = kBoundaryWeight * ( dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2] );
+				double dist = m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2];
+				for ( uint32_t v : { a, b } )
+				{
+					double * q = quadric( v );
+					for ( size_t i = 0; i < 3; ++i )
+					{
+						for ( size_t j = i; j < 3; ++j )
+						{
+							q[i * dims_ - i * ( i - 1 ) / 2 + ( j - i )] += weight * m[i] * m[j];
+						}
+					}
+					double * b_vec = q + dims_ * ( dims_ + 1 ) / 2;
+					for ( size_t i = 0; i < 3; ++i )
+					{
+						b_vec[i] -= weight * dist * m[i];
+					}
+					b_vec[dims_] += weight * dist * dist;
+					b_vec[dims_ + 1] += weight;
+				}
+			}
+		}
+	}
+
+	/// \brief Triangles around each vertex, CSR in tri_offsets_ / tris_
+	void buildAdjacency()
+	{
+		tri_offsets_.assign( count_ + 1, 0 );
+		for ( uint32_t v : indices_ )
+		{
+			tri_offsets_[v + 1]++;
+		}
+		for ( size_t v = 0; v < count_; ++v )
+		{
+			tri_offsets_[v + 1] += tri_offsets_[v];
+		}
+		tris_.resize( indices_.size() );
+		std::vector<uint32_t> fill( tri_offsets_.begin(), tri_offsets_.end() - 1 );
+		for ( size_t i = 0; i < indices_.size(); ++i )
+		{
+			tris_[fill[indices_[i]]++] = static_cast<uint32_t>( i / 3 );
+		}
+	}
+
+	/// \brief The cheaper direction of every edge that may collapse. A
+	/// boundary vertex only moves along a boundary edge.
+	std::vector<Collapse> collectCollapses() const
+	{
+		std::vector<std::pair<Edge, uint32_t>> edges;
+		edges.reserve( indices_.size() );
+		for ( size_t t = 0; t < indices_.size(); t += 3 )
+		{
+			for ( size_t k = 0; k < 3; ++k )
+			{
+				uint32_t a = indices_[t + k], b = indices_[t + ( k + 1 ) % 3];
+				edges.push_back( { { std::min( a, b ), std::max( a, b ) }, 1 } );
+			}
+		}
+		std::sort( edges.begin(), edges.end(),
+				   []( const auto & x, const auto & y ) { return x.first < y.first; } );
+
+		std::vector<Collapse> collapses;
+		collapses.reserve( edges.size() / 2 );
+		for ( size_t i = 0; i < edges.size(); )
+		{
+			size_t j = i + 1;
+			while ( j < edges.size() && edges[j].first == edges[i].first )
+			{
+				++j;
+			}
+			bool boundary_edge = j - i == 1;
+			uint32_t a = edges[i].first.a, b = edges[i].first.b;
+			i = j;
+
+			constexpr double kNever = std::numeric_limits<double>::infinity();
+			double a_to_b = ( !boundary_[a] || boundary_edge ) ? cost( a, b, point( b ) ) : kNever;
+			double b_to_a = ( !boundary_[b] || boundary_edge ) ? cost( a, b, point( a ) ) : kNever;
+			if ( a_to_b == kNever && b_to_a == kNever )
+			{
+				continue;
+			}
+			collapses.push_back( a_to_b <= b_to_a ? Collapse{ a, b, a_to_b } : Collapse{ b, a, b_to_a } );
+		}
+		return collapses;
+	}
+
+	/// \brief Moving from onto to would fold a triangle over or turn it
+	/// edge on
+	bool flips( uint32_t from, uint32_t to ) const
+	{
+		for ( uint32_t i = tri_offsets_[from]; i < tri_offsets_[from + 1]; ++i )
+		{
+			const uint32_t * tri = &indices_[tris_[i] * 3];
+			if ( tri[0] == to || tri[1] == to || tri[2] == to )
+			{
+				continue; // degenerates and goes away
+			}
+
+			const double * before[3] = { point( tri[0] ), point( tri[1] ), point( tri[2] ) };
+			const double * after[3] = { before[0], before[1], before[2] };
+			for ( size_t k = 0; k < 3; ++k )
+			{
+				if ( tri[k] == from )
+				{
+					after[k] = point( to );
+				}
+			}
+
+			double n0[3], n1[3];
+			cross( before[0], before[1], before[2], n0 );
+			cross( after[0], after[1], after[2], n1 );
+			double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+			double len = std::sqrt( ( n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2] )
+									* ( n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2] ) );
+			if ( dot <= kMinNormalCosine * len )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void applyRemap()
+	{
+		size_t write = 0;
+		for ( size_t t = 0; t < indices_.size(); t += 3 )
+		{
+			uint32_t a = remap_[indices_[t]], b = remap_[indices_[t + 1]], c = remap_[indices_[t + 2]];
+			if ( a == b || b == c || c == a )
+			{
+				continue;
+			}
+			indices_[write++] = a;
+			indices_[write++] = b;
+			indices_[write++] = c;
+		}
+		indices_.resize( write );
+	}
+
+	/// \brief Normal of the positions, the first three dimensions
+	static void cross( const double * p0, const double * p1, const double * p2, double * out )
+	{
+		double u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		double v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		out[0] = u[1] * v[2] - u[2] * v[1];
+		out[1] = u[2] * v[0] - u[0] * v[2];
+		out[2] = u[0] * v[1] - u[1] * v[0];
+	}
+
+	static constexpr double kBoundaryWeight = 10.0;
+	static constexpr double kMinNormalCosine = 0.25; // about 75 degrees of rotation
+
+	size_t count_;
+	size_t dims_;
+	size_t quadric_size_ = 0;
+	std::vector<uint32_t> indices_;
+	std::vector<double> points_;
+	std::vector<double> quadrics_;
+	std::vector<uint8_t> boundary_;
+	std::vector<uint32_t> remap_;
+	std::vector<uint32_t> tri_offsets_;
+	std::vector<uint32_t> tris_;
+	double error_ = 0.0; // squared
+};
+
+/// \brief One level of a LOD chain being built or written out
+struct LodLevel {
+	std::vector<uint32_t> indices;
+	float error; // object space, 0 for the source mesh
+};
+
+constexpr size_t kMaxLods = 8;
+constexpr size_t kMinLodTriangles = 8;
+
+/// \brief The mesh itself, then levels at about half the triangles of
+/// the one before until the mesh stops shrinking or kMaxLods is reached
+inline std::vector<LodLevel> buildLodChain( const SimplifyVertices & vertices, const std::vector<uint32_t> & indices )
+{
+	std::vector<LodLevel> levels;
+	levels.push_back( { indices, 0.0f } );
+
+	MeshSimplifier simplifier( vertices, indices );
+	while ( levels.size() < kMaxLods && levels.back().indices.size() / 3 > kMinLodTriangles )
+	{
+		size_t previous = levels.back().indices.size();
+		size_t target = std::max( kMinLodTriangles * 3, previous / 6 * 3 );
+		simplifier.simplify( target );
+
+		// a level that barely shrank isn't worth its index space
+		if ( simplifier.indices().size() > previous * 3 / 4 )
+		{
+			break;
+		}
+		levels.push_back( { simplifier.indices(), simplifier.error() } );
+	}
+	return levels;
+}
+
+/// On disk layout of a .vmsh file: MeshHeader, lod_count MeshLod entries
+/// finest first, then the vertices and the 16 bit indices of every LOD
+/// back to back at the offsets the header gives. A LOD is drawn with its
+/// first_index and index_count against the one index buffer.
+struct MeshHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t vertex_stride; // bytes
+	uint32_t vertex_count;
+	uint32_t index_count; // all LODs
+	uint32_t lod_count;
+	float bounds_min[3];
+	float bounds_max[3];
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+};
+
+struct MeshLod {
+	uint32_t first_index;
+	uint32_t index_count;
+	float error; // object space, projected at runtime to pick a LOD
+};
+
+constexpr char kMeshMagic[4] = { 'V', 'M', 'S', 'H' };
+constexpr uint32_t kMeshVersion = 1;
+
+/// \brief Memory mapped .vmsh file with a pre-built LOD chain
+class MeshContainer {
+public:
+	explicit MeshContainer( const std::string & path )
+		: file_( path )
+	{
+		if ( file_.size() < sizeof( MeshHeader ) )
+		{
+			throw std::runtime_error( "Truncated mesh! " + path );
+		}
+
+		memcpy( &header_, file_.data(), sizeof( header_ ) );
+		if ( memcmp( header_.magic, kMeshMagic, sizeof( kMeshMagic ) ) != 0
+			 || header_.version != kMeshVersion
+			 || header_.lod_count == 0 )
+		{
+			throw std::runtime_error( "Not a mesh container! " + path );
+		}
+
+		size_t table_end = sizeof( MeshHeader ) + header_.lod_count * sizeof( MeshLod );
+		if ( file_.size() < table_end
+			 || header_.vertex_offset + vertexDataSize() > file_.size()
+			 || header_.index_offset + indexDataSize() > file_.size() )
+		{
+			throw std::runtime_error( "Truncated mesh! " + path );
+		}
+
+		lods_.resize( header_.lod_count );
+		memcpy( lods_.data(), file_.data() + sizeof( MeshHeader ), header_.lod_count * sizeof( MeshLod ) );
+		for ( const auto & lod : lods_ )
+		{
+			if ( uint64_t( lod.first_index ) + lod.index_count > header_.index_count )
+			{
+				throw std::runtime_error( "Mesh LOD out of bounds! " + path );
+			}
+		}
+	}
+
+	uint32_t vertexStride() const { return header_.vertex_stride; }
+	uint32_t vertexCount() const { return header_.vertex_count; }
+	uint32_t indexCount() const { return header_.index_count; }
+	const float * boundsMin() const { return header_.bounds_min; }
+	const float * boundsMax() const { return header_.bounds_max; }
+	const std::vector<MeshLod> & lods() const { return lods_; }
+
+	const uint8_t * vertexData() const { return file_.data() + header_.vertex_offset; }
+	size_t vertexDataSize() const { return size_t( header_.vertex_count ) * header_.vertex_stride; }
+	const uint8_t * indexData() const { return file_.data() + header_.index_offset; }
+	size_t indexDataSize() const { return size_t( header_.index_count ) * sizeof( uint16_t ); }
+
+private:
+	MappedFile file_;
+	MeshHeader header_;
+	std::vector<MeshLod> lods_;
+};
+
+/// \brief vertices is vertex_count interleaved vertices of stride bytes,
+/// position_components floats of position first for the bounds
+inline void writeMeshContainer( const std::string & path,
+								const void * vertices,
+								uint32_t vertex_count,
+								uint32_t stride,
+								size_t position_components,
+								const std::vector<LodLevel> & levels )
+{
+	if ( vertex_count > std::numeric_limits<uint16_t>::max() + 1u )
+	{
+		throw std::runtime_error( "Too many vertices for 16 bit indices! " + path );
+	}
+
+	MeshHeader header = {};
+	memcpy( header.magic, kMeshMagic, sizeof( kMeshMagic ) );
+	header.version = kMeshVersion;
+	header.vertex_stride = stride;
+	header.vertex_count = vertex_count;
+	header.lod_count = static_cast<uint32_t>( levels.size() );
+
+	auto bytes = static_cast<const uint8_t *>( vertices );
+	for ( size_t i = 0; i < 3; ++i )
+	{
+		header.bounds_min[i] = vertex_count > 0 ? std::numeric_limits<float>::max() : 0.0f;
+		header.bounds_max[i] = vertex_count > 0 ? -std::numeric_limits<float>::max() : 0.0f;
+	}
+	for ( uint32_t v = 0; v < vertex_count; ++v )
+	{
+		for ( size_t i = 0; i < 3; ++i )
+		{
+			float value = 0.0f;
+			if ( i < position_components )
+			{
+				memcpy( &value, bytes + size_t( v ) * stride + i * sizeof( float ), sizeof( float ) );
+			}
+			header.bounds_min[i] = std::min( header.bounds_min[i], value );
+			header.bounds_max[i] = std::max( header.bounds_max[i], value );
+		}
+	}
+
+	std::vector<MeshLod> lods;
+	std::vector<uint16_t> indices;
+	for ( const auto & level : levels )
+	{
+		lods.push_back( { static_cast<uint32_t>( indices.size() ), static_cast<uint32_t>( level.indices.size() ), level.error } );
+		for ( uint32_t index : level.indices )
+		{
+			indices.push_back( static_cast<uint16_t>( index ) );
+		}
+	}
+	header.index_count = static_cast<uint32_t>( indices.size() );
+
+	// 16 byte aligned so staging copies straight from the mapping are too
+	uint64_t table_end = sizeof( MeshHeader ) + lods.size() * sizeof( MeshLod );
+	header.vertex_offset = ( table_end + 15 ) & ~uint64_t( 15 );
+	header.index_offset = ( header.vertex_offset + uint64_t( vertex_count ) * stride + 15 ) & ~uint64_t( 15 );
+
+	std::ofstream file( path, std::ios::binary | std::ios::trunc );
+	if ( !file.is_open() )
+	{
+		throw std::runtime_error( "Failed to write mesh! " + path );
+	}
+
+	auto pad_to = [&]( uint64_t offset ) {
+		std::vector<char> padding( offset - static_cast<uint64_t>( file.tellp() ), 0 );
+		file.write( padding.data(), padding.size() );
+	};
+	file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+	file.write( reinterpret_cast<const char*>( lods.data() ), lods.size() * sizeof( MeshLod ) );
+	pad_to( header.vertex_offset );
+	file.write( reinterpret_cast<const char*>( vertices ), size_t( vertex_count ) * stride );
+	pad_to( header.index_offset );
+	file.write( reinterpret_cast<const char*>( indices.data() ), indices.size() * sizeof( uint16_t ) );
+}
+
+/// \brief Coarsest LOD whose error stays within max_pixels on screen at
+/// distance. pixels_per_unit is the viewport height over 2 tan( fovy / 2 ),
+/// an object space error e then covers e * pixels_per_unit / distance.
+inline uint32_t selectLod( const std::vector<MeshLod> & lods, float distance, float pixels_per_unit, float max_pixels )
+{
+	uint32_t lod = 0;
+	for ( uint32_t i = 1; i < lods.size(); ++i )
+	{
+		if ( lods[i].error * pixels_per_unit > max_pixels * distance )
+		{
+			break;
+		}
+		lod = i;
+	}
+	return lod;
+}
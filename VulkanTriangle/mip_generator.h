@@ -0,0 +1,255 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "compute.h"
+#include "shaders.h"
+#include "vk_handle.h"
+
+/// \brief Full mip chains in one compute dispatch, see spd.comp.
+///
+/// The usual approach is a vkCmdBlitImage per level with a barrier
+/// between each, which serialises the GPU on every level and needs a
+/// graphics queue. spd.comp instead has each group reduce a 64x64 tile
+/// through six levels in shared memory, and the last group to finish
+/// does the remaining levels. recordBlitChain() is kept for comparison
+/// and for formats spd.comp can't write.
+class MipGenerator {
+public:
+	static constexpr uint32_t kMaxMips = 13;
+	static constexpr uint32_t kMaxExtent = 4096;
+	static constexpr uint32_t kCounterSlots = 256;
+	static_assert( kMaxMips <= ComputeContext::kStorageImagesPerSet, "SPD sets must fit the batch descriptor pools" );
+
+	/// \brief counters must be a host visible storage buffer of at least
+	/// kCounterSlots uints, zeroed, it is owned from here on
+	void init( VkDevice device, ComputeContext & compute, BufferAllocation counters )
+	{
+		device_ = device;
+		kernel_ = &compute.createKernel( "spd", ShaderCode::fromWords( kSpdCompSpv ) );
+		counters_ = std::move( counters );
+	}
+
+	/// \brief Record generation of mips 1..mip_count-1 from mip 0.
+	///
+	/// The image must be VK_FORMAT_R8G8B8A8_UNORM with storage usage and
+	/// owned by the compute queue family. Mip 0 is read in level0_layout,
+	/// every level ends up in final_layout.
+	void generate( ComputeBatch & batch,
+				   VkImage image,
+				   uint32_t width,
+				   uint32_t height,
+				   uint32_t mip_count,
+				   VkImageLayout level0_layout,
+				   VkImageLayout final_layout )
+	{
+		if ( width > kMaxExtent || height > kMaxExtent || mip_count > kMaxMips )
+		{
+			throw std::runtime_error( "Image too large for single pass mip generation!" );
+		}
+
+		std::vector<VkDescriptorImageInfo> level_infos;
+		for ( uint32_t level = 0; level < mip_count; ++level )
+		{
+			VkImageViewCreateInfo view_info = {};
+			view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			view_info.image = image;
+			view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+			view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			view_info.subresourceRange.baseMipLevel = level;
+			view_info.subresourceRange.levelCount = 1;
+			view_info.subresourceRange.baseArrayLayer = 0;
+			view_info.subresourceRange.layerCount = 1;
+
+			UniqueImageView view;
+			if ( auto status = vkCreateImageView( device_, &view_info, nullptr, view.replace( device_ ) );
+				 status != VK_SUCCESS )
+			{
+				throw std::runtime_error( "Failed to create mip view! Status: " + std::to_string( status ) );
+			}
+
+			VkDescriptorImageInfo info = {};
+			info.imageView = view;
+			info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			level_infos.push_back( info );
+			batch.keep( std::move( view ) );
+		}
+		// spd.comp never writes past mip_count, the rest only need to be valid
+		level_infos.resize( kMaxMips, level_infos.back() );
+
+		VkDescriptorBufferInfo counter_info = {};
+		counter_info.buffer = counters_.buffer;
+		counter_info.offset = 0;
+		counter_info.range = kCounterSlots * sizeof( uint32_t );
+
+		VkDescriptorSet set;
+		bool built = batch.bindings()
+			.bindImages( 0, level_infos, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT )
+			.bindBuffer( 1, counter_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT )
+			.build( set );
+		if ( !built )
+		{
+			throw std::runtime_error( "Failed to allocate mip generation descriptor set!" );
+		}
+
+		auto command_buffer = batch.commandBuffer();
+		VkImageMemoryBarrier to_general[2] = {};
+		for ( auto & barrier : to_general )
+		{
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = 1;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		}
+		// mip 0 keeps its contents, the rest are overwritten
+		to_general[0].oldLayout = level0_layout;
+		to_general[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		to_general[0].subresourceRange.baseMipLevel = 0;
+		to_general[0].subresourceRange.levelCount = 1;
+		to_general[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		to_general[1].subresourceRange.baseMipLevel = 1;
+		to_general[1].subresourceRange.levelCount = mip_count - 1;
+
+		vkCmdPipelineBarrier( command_buffer,
+							  VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							  0, 0, nullptr, 0, nullptr,
+							  mip_count > 1 ? 2 : 1, to_general );
+
+		struct {
+			uint32_t mip_count;
+			uint32_t counter;
+			uint32_t group_count;
+		} params;
+		uint32_t groups_x = ( width + 63 ) / 64;
+		uint32_t groups_y = ( height + 63 ) / 64;
+		params.mip_count = mip_count;
+		params.counter = next_counter_;
+		params.group_count = groups_x * groups_y;
+		next_counter_ = ( next_counter_ + 1 ) % kCounterSlots;
+
+		batch.dispatch( *kernel_, set, &params, sizeof( params ), groups_x, groups_y );
+
+		VkImageMemoryBarrier to_final = to_general[0];
+		to_final.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		to_final.newLayout = final_layout;
+		to_final.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		to_final.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		to_final.subresourceRange.levelCount = mip_count;
+
+		// the counter slot is reused kCounterSlots dispatches later
+		VkMemoryBarrier counter_barrier = {};
+		counter_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		counter_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		counter_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		vkCmdPipelineBarrier( command_buffer,
+							  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+							  0, 1, &counter_barrier, 0, nullptr, 1, &to_final );
+	}
+
+	/// \brief The blit per level equivalent, needs a graphics queue and
+	/// blit support for the format. Mip 0 must be in TRANSFER_DST_OPTIMAL,
+	/// every level ends up in final_layout.
+	static void recordBlitChain( VkCommandBuffer command_buffer,
+								 VkImage image,
+								 uint32_t width,
+								 uint32_t height,
+								 uint32_t mip_count,
+								 VkImageLayout final_layout )
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.subresourceRange.levelCount = 1;
+
+		int32_t mip_width = static_cast<int32_t>( width );
+		int32_t mip_height = static_cast<int32_t>( height );
+		for ( uint32_t level = 1; level < mip_count; ++level )
+		{
+			// source level: written by the previous blit (or the caller)
+			barrier.subresourceRange.baseMipLevel = level - 1;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier( command_buffer,
+								  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+								  0, 0, nullptr, 0, nullptr, 1, &barrier );
+
+			// destination level: nothing to keep
+			barrier.subresourceRange.baseMipLevel = level;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier( command_buffer,
+								  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+								  0, 0, nullptr, 0, nullptr, 1, &barrier );
+
+			VkImageBlit blit = {};
+			blit.srcOffsets[1] = { mip_width, mip_height, 1 };
+			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.srcSubresource.mipLevel = level - 1;
+			blit.srcSubresource.layerCount = 1;
+			mip_width = std::max( mip_width / 2, 1 );
+			mip_height = std::max( mip_height / 2, 1 );
+			blit.dstOffsets[1] = { mip_width, mip_height, 1 };
+			blit.dstSubresource = blit.srcSubresource;
+			blit.dstSubresource.mipLevel = level;
+
+			vkCmdBlitImage( command_buffer,
+							image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+							image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							1, &blit, VK_FILTER_LINEAR );
+		}
+
+		// all but the last level are TRANSFER_SRC now
+		VkImageMemoryBarrier to_final[2] = { barrier, barrier };
+		to_final[0].subresourceRange.baseMipLevel = 0;
+		to_final[0].subresourceRange.levelCount = mip_count - 1;
+		to_final[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		to_final[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		to_final[1].subresourceRange.baseMipLevel = mip_count - 1;
+		to_final[1].subresourceRange.levelCount = 1;
+		to_final[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		to_final[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		for ( auto & final_barrier : to_final )
+		{
+			final_barrier.newLayout = final_layout;
+			final_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		}
+
+		uint32_t first = mip_count > 1 ? 0 : 1;
+		vkCmdPipelineBarrier( command_buffer,
+							  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+							  0, 0, nullptr, 0, nullptr, 2 - first, to_final + first );
+	}
+
+	void cleanup()
+	{
+		counters_.reset();
+	}
+
+private:
+	VkDevice device_ = VK_NULL_HANDLE;
+	const ComputeKernel * kernel_ = nullptr;
+	BufferAllocation counters_;
+	uint32_t next_counter_ = 0;
+};
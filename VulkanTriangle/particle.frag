@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location=0) in vec4 fragColor;
+layout(location=1) in vec2 fragCorner;
+
+layout(location=0) out vec4 outColor;
+
+void main()
+{
+	float falloff = max(0.0, 1.0 - dot(fragCorner, fragCorner));
+	outColor = vec4(fragColor.rgb, fragColor.a * falloff);
+}
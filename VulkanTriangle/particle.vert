@@ -0,0 +1,31 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding=0) uniform UniformBufferObject {
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+// Per instance, read straight from the simulation's storage buffer
+layout(location=0) in vec2 inPosition;
+layout(location=1) in vec4 inColor;
+
+layout(location=0) out vec4 fragColor;
+layout(location=1) out vec2 fragCorner;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+const float kSize = 0.006;
+
+void main()
+{
+	// 4 vertex strip, a view facing quad around the particle
+	vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1) * 2.0 - 1.0;
+	vec4 view_pos = ubo.view * vec4(inPosition, 0.0, 1.0);
+	view_pos.xy += corner * kSize;
+	gl_Position = ubo.proj * view_pos;
+	fragColor = inColor;
+	fragCorner = corner;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "compute.h"
+#include "frame_sync.h"
+#include "shaders.h"
+#include "spirv_reflect.h"
+#include "vk_handle.h"
+
+/// \brief Matches Particle in particles.comp (std430)
+struct Particle {
+	float pos[2];
+	float vel[2];
+	float color[4]; // alpha is the remaining life
+};
+
+/// \brief GPU particles, simulated on the compute queue and drawn
+/// instanced straight from the state buffers.
+///
+/// State ping-pongs between two buffers. The step for frame N reads what
+/// frame N-1 drew and writes the buffer frame N-2 drew, so it only waits
+/// on frame N-2 and runs alongside the graphics work of frame N-1. The
+/// frame's draw then waits on the step at vertex input. Nothing is read
+/// back on the CPU. Frames that don't step, while paused, redraw the
+/// current state without waiting on compute.
+class ParticleSystem {
+public:
+	static constexpr uint32_t kGroupSize = 256; // local_size_x in particles.comp
+
+	/// \brief Both buffers need storage, vertex and transfer dst usage,
+	/// shared between the compute and graphics families (concurrent
+	/// sharing when they differ), they are owned from here on
+	void init( ComputeContext & compute, uint32_t count, std::array<BufferAllocation, 2> state )
+	{
+		compute_ = &compute;
+		count_ = count;
+		state_ = std::move( state );
+		kernel_ = &compute.createKernel( "particles", ShaderCode::fromWords( kParticlesCompSpv ) );
+
+		// All dead, the first step respawns them with staggered lifetimes
+		auto & batch = compute.begin();
+		for ( auto & buffer : state_ )
+		{
+			vkCmdFillBuffer( batch.commandBuffer(), buffer.buffer, 0, VK_WHOLE_SIZE, 0 );
+		}
+		last_step_ = compute.submit( batch );
+	}
+
+	/// \brief Instanced vertex input for particle.vert, checked against
+	/// its reflection
+	static void vertexInput( const ShaderReflection & reflection,
+							 uint32_t binding,
+							 VkVertexInputBindingDescription & binding_desc,
+							 std::vector<VkVertexInputAttributeDescription> & attributes )
+	{
+		const VkVertexInputAttributeDescription expected[] = {
+			{ 0, binding, VK_FORMAT_R32G32_SFLOAT, offsetof( Particle, pos ) },
+			{ 1, binding, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof( Particle, color ) }
+		};
+
+		if ( reflection.inputs.size() != 2 )
+		{
+			throw std::runtime_error( "Particle doesn't match the particle.vert inputs!" );
+		}
+		for ( size_t i = 0; i < reflection.inputs.size(); ++i )
+		{
+			if ( reflection.inputs[i].location != expected[i].location
+				 || reflection.inputs[i].format != expected[i].format )
+			{
+				throw std::runtime_error( "Particle doesn't match the particle.vert inputs!" );
+			}
+		}
+
+		attributes.assign( std::begin( expected ), std::end( expected ) );
+		binding_desc = {};
+		binding_desc.binding = binding;
+		binding_desc.stride = sizeof( Particle );
+		binding_desc.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	}
+
+	/// \brief Submit one step to the compute queue, returns its point.
+	/// Call before the frame that draws it is submitted.
+	SyncPoint simulate( float dt )
+	{
+		uint32_t target = 1 - current_;
+
+		auto & batch = compute_->begin();
+		auto cmd = batch.commandBuffer();
+
+		// the previous step's writes are this step's reads, same queue
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier( cmd,
+							  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+							  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							  0, 1, &barrier, 0, nullptr, 0, nullptr );
+
+		VkDescriptorBufferInfo src_info = { state_[current_].buffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorBufferInfo dst_info = { state_[target].buffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorSet set;
+		bool built = batch.bindings()
+			.bindBuffer( 0, src_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT )
+			.bindBuffer( 1, dst_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT )
+			.build( set );
+		if ( !built )
+		{
+			throw std::runtime_error( "Failed to allocate particle descriptor set!" );
+		}
+
+		struct {
+			float dt;
+			uint32_t step;
+			uint32_t count;
+		} params = { dt, static_cast<uint32_t>( steps_ ), count_ };
+		batch.dispatch( *kernel_, set, &params, sizeof( params ), ( count_ + kGroupSize - 1 ) / kGroupSize, 1 );
+
+		// target was last drawn two frames ago, the graphics queue must
+		// be done reading it before it is overwritten. A frame that didn't
+		// step has no semaphore to wait on, the host waits for it instead.
+		std::vector<SyncWait> waits;
+		if ( draw_waitable_[target] )
+		{
+			waits.push_back( { last_draw_[target], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT } );
+		}
+		else
+		{
+			compute_->frameSync().wait( last_draw_[target] );
+		}
+		last_step_ = compute_->submit( batch, waits, true );
+		current_ = target;
+		steps_++;
+		return last_step_;
+	}
+
+	/// \brief Wait for the submit of the frame that stepped, so vertex
+	/// fetch sees the step. Only one frame may wait on each step.
+	SyncWait drawWait() const
+	{
+		return { last_step_, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
+	}
+
+	/// \brief Record the draw, the caller binds a pipeline using vertexInput()
+	void draw( VkCommandBuffer cmd ) const
+	{
+		VkBuffer buffers[] = { state_[current_].buffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers( cmd, 0, 1, buffers, offsets );
+		vkCmdDraw( cmd, 4, count_, 0, 0 );
+	}
+
+	/// \brief The graphics submit that drew the current state. Frames
+	/// that stepped must be submitted GPU waitable and pass waitable.
+	void drawn( const SyncPoint & point, bool waitable )
+	{
+		last_draw_[current_] = point;
+		draw_waitable_[current_] = waitable;
+	}
+
+	uint32_t count() const { return count_; }
+	uint64_t steps() const { return steps_; }
+	bool enabled() const { return count_ > 0; }
+
+	/// \brief The device must be idle
+	void cleanup()
+	{
+		for ( auto & buffer : state_ )
+		{
+			buffer.reset();
+		}
+		count_ = 0;
+	}
+
+private:
+	ComputeContext * compute_ = nullptr;
+	const ComputeKernel * kernel_ = nullptr;
+	std::array<BufferAllocation, 2> state_;
+	std::array<SyncPoint, 2> last_draw_ = {};
+	std::array<bool, 2> draw_waitable_ = {};
+	SyncPoint last_step_;
+	uint32_t current_ = 0;
+	uint32_t count_ = 0;
+	uint64_t steps_ = 0;
+};
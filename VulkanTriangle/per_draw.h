@@ -0,0 +1,110 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/// \brief Data that changes per draw, matches PerDraw in tri.vert / tri_ubo.vert
+struct PerDrawData {
+	glm::mat4 model;
+};
+
+/// \brief How per draw data reaches the vertex shader
+enum class PerDrawPath {
+	kPushConstants, // vkCmdPushConstants, no descriptor traffic
+	kDynamicUniform // DynamicUniformRing + dynamic offset on set 1
+};
+
+inline PerDrawPath parsePerDrawPath( const std::string & name )
+{
+	if ( name == "push" ) return PerDrawPath::kPushConstants;
+	if ( name == "ubo" ) return PerDrawPath::kDynamicUniform;
+	throw std::runtime_error( "Unknown per draw path: " + name );
+}
+
+inline const char * perDrawPathName( PerDrawPath path )
+{
+	return path == PerDrawPath::kPushConstants ? "push constants" : "dynamic uniform ring";
+}
+
+/// Push constants are the fast path, the dynamic UBO ring only kicks
+/// in for payloads the device can't push, or when preferred asks for it.
+inline PerDrawPath choosePerDrawPath( const VkPhysicalDeviceLimits & limits,
+									  size_t payload_size,
+									  PerDrawPath preferred = PerDrawPath::kPushConstants )
+{
+	return preferred == PerDrawPath::kPushConstants && payload_size <= limits.maxPushConstantsSize
+		? PerDrawPath::kPushConstants
+		: PerDrawPath::kDynamicUniform;
+}
+
+/// \brief Linear allocator over a persistently mapped, host coherent
+/// uniform buffer. One ring per frame in flight, reset once the
+/// frame's fence has signalled.
+class DynamicUniformRing {
+public:
+	void init( VkDevice device,
+			   VkBuffer buffer,
+			   VkDeviceMemory memory,
+			   VkDeviceSize size,
+			   VkDeviceSize min_alignment )
+	{
+		device_ = device;
+		buffer_ = buffer;
+		memory_ = memory;
+		size_ = size;
+		alignment_ = min_alignment > 0 ? min_alignment : 1;
+		head_ = 0;
+
+		if ( auto status = vkMapMemory( device_, memory_, 0, size_, 0, &mapped_ );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to map dynamic uniform ring!" );
+		}
+	}
+
+	/// \brief Copy data into the ring, returns the dynamic offset to bind
+	uint32_t push( const void * data, size_t size )
+	{
+		VkDeviceSize offset = ( head_ + alignment_ - 1 ) & ~( alignment_ - 1 );
+		if ( offset + size > size_ )
+		{
+			throw std::runtime_error( "Dynamic uniform ring overflow!" );
+		}
+
+		memcpy( static_cast<char*>( mapped_ ) + offset, data, size );
+		head_ = offset + size;
+		return static_cast<uint32_t>( offset );
+	}
+
+	void reset() { head_ = 0; }
+
+	void cleanup()
+	{
+		if ( mapped_ )
+		{
+			vkUnmapMemory( device_, memory_ );
+			mapped_ = nullptr;
+		}
+		vkDestroyBuffer( device_, buffer_, nullptr );
+		vkFreeMemory( device_, memory_, nullptr );
+	}
+
+	VkBuffer buffer() const { return buffer_; }
+	VkDeviceSize used() const { return head_; }
+
+private:
+	VkDevice device_ = VK_NULL_HANDLE;
+	VkBuffer buffer_ = VK_NULL_HANDLE;
+	VkDeviceMemory memory_ = VK_NULL_HANDLE;
+	VkDeviceSize size_ = 0;
+	VkDeviceSize alignment_ = 1;
+	VkDeviceSize head_ = 0;
+	void * mapped_ = nullptr;
+};
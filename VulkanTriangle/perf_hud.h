@@ -0,0 +1,476 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "spirv_reflect.h"
+#include "vk_handle.h"
+
+/// \brief Matches the hud.vert inputs. Position is already in NDC, cell
+/// is the position within the 5x7 glyph and mask its lit pixels, bit
+/// row * 5 + column. Solid quads are cell 0 with bit 0 set.
+struct HudVertex {
+	float pos[2];
+	float cell[2];
+	uint32_t color; // RGBA8, alpha blended
+	uint32_t mask[2];
+};
+
+/// \brief Timestamps between the scopes of a frame, one range of queries
+/// per frame in flight. A frame's results are read back when its slot
+/// comes round again, so they are never waited on.
+class GpuTimer {
+public:
+	/// \brief Timing is off when the queue has no valid timestamp bits
+	void init( VkDevice device, float timestamp_period, uint32_t valid_bits, uint32_t scope_count, uint32_t frames )
+	{
+		device_ = device;
+		scope_count_ = scope_count;
+		if ( valid_bits == 0 || timestamp_period <= 0.0f )
+		{
+			return;
+		}
+		period_ = timestamp_period;
+		valid_mask_ = valid_bits >= 64 ? ~0ull : ( 1ull << valid_bits ) - 1;
+
+		VkQueryPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		pool_info.queryCount = frames * queriesPerFrame();
+		if ( auto status = vkCreateQueryPool( device_, &pool_info, nullptr, query_pool_.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create timestamp query pool! Status: " + std::to_string( status ) );
+		}
+		recorded_.assign( frames, false );
+		smoothed_.assign( scope_count_, 0.0 );
+		totals_.assign( scope_count_, 0.0 );
+	}
+
+	bool supported() const { return static_cast<bool>( query_pool_ ); }
+
+	/// \brief Reset the frame's queries and stamp its start, outside a
+	/// render pass. mark() then ends each scope in order.
+	void begin( VkCommandBuffer command_buffer, uint32_t frame )
+	{
+		if ( !supported() )
+		{
+			return;
+		}
+		frame_ = frame;
+		next_scope_ = 0;
+		vkCmdResetQueryPool( command_buffer, query_pool_, frame * queriesPerFrame(), queriesPerFrame() );
+		vkCmdWriteTimestamp( command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool_, frame * queriesPerFrame() );
+		active_ = true;
+	}
+
+	/// \brief End scope, once the work recorded so far is done. Does
+	/// nothing in frames begin() wasn't called for.
+	void mark( VkCommandBuffer command_buffer, uint32_t scope )
+	{
+		if ( !active_ || scope != next_scope_ )
+		{
+			return;
+		}
+		vkCmdWriteTimestamp( command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool_,
+							 frame_ * queriesPerFrame() + 1 + scope );
+		next_scope_++;
+		if ( next_scope_ == scope_count_ )
+		{
+			recorded_[frame_] = true;
+			active_ = false;
+		}
+	}
+
+	/// \brief Read the frame slot's last results, its submit must be done
+	void collect( uint32_t frame )
+	{
+		if ( !supported() || !recorded_[frame] )
+		{
+			return;
+		}
+		recorded_[frame] = false;
+
+		std::array<uint64_t, kMaxQueries> stamps;
+		auto status = vkGetQueryPoolResults( device_, query_pool_, frame * queriesPerFrame(), queriesPerFrame(),
+											 queriesPerFrame() * sizeof( uint64_t ), stamps.data(), sizeof( uint64_t ),
+											 VK_QUERY_RESULT_64_BIT );
+		if ( status != VK_SUCCESS )
+		{
+			return;
+		}
+
+		for ( uint32_t scope = 0; scope < scope_count_; ++scope )
+		{
+			uint64_t ticks = ( ( stamps[scope + 1] & valid_mask_ ) - ( stamps[scope] & valid_mask_ ) ) & valid_mask_;
+			double ms = ticks * double( period_ ) / 1e6;
+			smoothed_[scope] = samples_ == 0 ? ms : smoothed_[scope] + ( ms - smoothed_[scope] ) * kSmoothing;
+			totals_[scope] += ms;
+		}
+		samples_++;
+	}
+
+	/// \brief Recent time of a scope, smoothed over a few frames
+	double milliseconds( uint32_t scope ) const { return samples_ > 0 ? smoothed_[scope] : 0.0; }
+	double averageMilliseconds( uint32_t scope ) const { return samples_ > 0 ? totals_[scope] / samples_ : 0.0; }
+	uint64_t samples() const { return samples_; }
+
+	void cleanup()
+	{
+		query_pool_.reset();
+	}
+
+private:
+	static constexpr uint32_t kMaxQueries = 16;
+	static constexpr double kSmoothing = 0.1;
+
+	uint32_t queriesPerFrame() const
+	{
+		if ( scope_count_ + 1 > kMaxQueries )
+		{
+			throw std::runtime_error( "Too many GPU timer scopes!" );
+		}
+		return scope_count_ + 1;
+	}
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	UniqueQueryPool query_pool_;
+	float period_ = 0.0f; // ns per tick
+	uint64_t valid_mask_ = 0;
+	uint32_t scope_count_ = 0;
+	uint32_t frame_ = 0;
+	uint32_t next_scope_ = 0;
+	bool active_ = false;
+	std::vector<bool> recorded_;
+	std::vector<double> smoothed_;
+	std::vector<double> totals_;
+	uint64_t samples_ = 0;
+};
+
+/// \brief Performance overlay: a panel of text lines and a frame time
+/// graph, built on the CPU into one vertex stream drawn with one draw.
+///
+/// Glyphs aren't sampled from a font texture, each glyph quad carries its
+/// 5x7 bitmap in the vertices and hud.frag tests the bit under the
+/// fragment. Text, bars and the panel then share a pipeline with no
+/// descriptors, and a line of text costs six vertices a character.
+class PerfHud {
+public:
+	static constexpr uint32_t kHistory = 128; // frame times in the graph
+	static constexpr uint32_t kMaxVertices = 8192;
+	static constexpr uint32_t kGlyphWidth = 5;
+	static constexpr uint32_t kGlyphHeight = 7;
+	static constexpr float kScale = 2.0f; // pixels per glyph pixel
+	static constexpr float kMargin = 8.0f;
+	static constexpr float kPadding = 6.0f;
+	static constexpr float kGraphHeight = 64.0f;
+	static constexpr uint32_t kColumns = 44; // panel width in characters
+
+	PerfHud()
+	{
+		buildFont();
+		vertices_.reserve( kMaxVertices );
+	}
+
+	bool visible() const { return visible_; }
+	void setVisible( bool visible ) { visible_ = visible; }
+	void toggle() { visible_ = !visible_; }
+
+	/// \brief Add a frame's wall time to the graph
+	void frame( double seconds )
+	{
+		history_[history_next_] = static_cast<float>( seconds * 1000.0 );
+		history_next_ = ( history_next_ + 1 ) % kHistory;
+		history_count_ = std::min( history_count_ + 1, kHistory );
+	}
+
+	double averageFrameMilliseconds() const
+	{
+		double total = 0.0;
+		for ( uint32_t i = 0; i < history_count_; ++i )
+		{
+			total += history_[i];
+		}
+		return history_count_ > 0 ? total / history_count_ : 0.0;
+	}
+
+	double maxFrameMilliseconds() const
+	{
+		float longest = 0.0f;
+		for ( uint32_t i = 0; i < history_count_; ++i )
+		{
+			longest = std::max( longest, history_[i] );
+		}
+		return longest;
+	}
+
+	/// \brief Start a new overlay for a target of extent. The panel quad
+	/// goes first so everything after blends over it.
+	void begin( VkExtent2D extent )
+	{
+		extent_ = extent;
+		vertices_.clear();
+		lines_ = 0;
+		has_graph_ = false;
+		quad( 0.0f, 0.0f, 0.0f, 0.0f, kPanelColor );
+	}
+
+	/// \brief Append a line of text, lower case prints as upper case and
+	/// characters without a glyph as blanks
+	void text( const char * line, uint32_t color = kTextColor )
+	{
+		float x = kMargin + kPadding;
+		float y = kMargin + kPadding + lines_ * kLineHeight * kScale;
+		for ( const char * c = line; *c && x < kMargin + kPadding + kColumns * kAdvance * kScale; ++c )
+		{
+			uint64_t mask = font_[static_cast<unsigned char>( *c ) & 0x7f];
+			if ( mask != 0 )
+			{
+				glyph( x, y, mask, color );
+			}
+			x += kAdvance * kScale;
+		}
+		lines_++;
+	}
+
+	/// \brief Bars of the recent frame times, oldest on the left, scaled so
+	/// budget_ms is half the height and marked with a line
+	void graph( double budget_ms )
+	{
+		float left = kMargin + kPadding;
+		float bottom = graphTop() + kGraphHeight;
+		float width = kColumns * kAdvance * kScale;
+		float bar = width / kHistory;
+		float full_ms = static_cast<float>( 2.0 * budget_ms );
+
+		for ( uint32_t i = 0; i < history_count_; ++i )
+		{
+			// history_next_ is the oldest once the ring is full
+			uint32_t index = history_count_ < kHistory ? i : ( history_next_ + i ) % kHistory;
+			float ms = history_[index];
+			float height = std::min( ms / full_ms, 1.0f ) * kGraphHeight;
+			uint32_t color = ms <= budget_ms ? kGoodColor : ms <= 2.0 * budget_ms ? kSlowColor : kMissColor;
+			quad( left + i * bar, bottom - height, left + ( i + 1 ) * bar - 1.0f, bottom, color );
+		}
+		quad( left, bottom - 0.5f * kGraphHeight, left + width, bottom - 0.5f * kGraphHeight + 1.0f, kBudgetColor );
+		has_graph_ = true;
+	}
+
+	/// \brief Size the panel to what was added
+	void end()
+	{
+		VkRect2D rect = bounds();
+		setQuad( 0, float( rect.offset.x ), float( rect.offset.y ),
+				 float( rect.offset.x + int32_t( rect.extent.width ) ), float( rect.offset.y + int32_t( rect.extent.height ) ),
+				 kPanelColor );
+	}
+
+	const std::vector<HudVertex> & vertices() const { return vertices_; }
+
+	/// \brief Pixels the overlay covers, for damage tracking
+	VkRect2D bounds() const
+	{
+		float width = kColumns * kAdvance * kScale + 2.0f * kPadding;
+		float height = graphTop() + ( has_graph_ ? kGraphHeight : 0.0f ) + kPadding - kMargin;
+		return { { int32_t( kMargin ), int32_t( kMargin ) }, { uint32_t( width ), uint32_t( height ) } };
+	}
+
+	/// \brief Vertex input for hud.vert, checked against its reflection.
+	/// Colour is a vec4 there, fed from RGBA8.
+	static void vertexInput( const ShaderReflection & reflection,
+							 uint32_t binding,
+							 VkVertexInputBindingDescription & binding_desc,
+							 std::vector<VkVertexInputAttributeDescription> & attributes )
+	{
+		const VkFormat reflected[] = {
+			VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32_UINT
+		};
+		const VkVertexInputAttributeDescription expected[] = {
+			{ 0, binding, VK_FORMAT_R32G32_SFLOAT, offsetof( HudVertex, pos ) },
+			{ 1, binding, VK_FORMAT_R32G32_SFLOAT, offsetof( HudVertex, cell ) },
+			{ 2, binding, VK_FORMAT_R8G8B8A8_UNORM, offsetof( HudVertex, color ) },
+			{ 3, binding, VK_FORMAT_R32G32_UINT, offsetof( HudVertex, mask ) }
+		};
+
+		if ( reflection.inputs.size() != 4 )
+		{
+			throw std::runtime_error( "HudVertex doesn't match the hud.vert inputs!" );
+		}
+		for ( size_t i = 0; i < reflection.inputs.size(); ++i )
+		{
+			if ( reflection.inputs[i].location != expected[i].location
+				 || reflection.inputs[i].format != reflected[i] )
+			{
+				throw std::runtime_error( "HudVertex doesn't match the hud.vert inputs!" );
+			}
+		}
+
+		attributes.assign( std::begin( expected ), std::end( expected ) );
+		binding_desc = {};
+		binding_desc.binding = binding;
+		binding_desc.stride = sizeof( HudVertex );
+		binding_desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	}
+
+private:
+	static constexpr float kAdvance = 6.0f; // glyph pixels a character
+	static constexpr float kLineHeight = 9.0f;
+	// 0xAABBGGRR, RGBA in memory
+	static constexpr uint32_t kPanelColor = 0xb0000000;
+	static constexpr uint32_t kTextColor = 0xffffffff;
+	static constexpr uint32_t kGoodColor = 0xff40d040;
+	static constexpr uint32_t kSlowColor = 0xff20c0e0;
+	static constexpr uint32_t kMissColor = 0xff3030e0;
+	static constexpr uint32_t kBudgetColor = 0x80ffffff;
+
+	float graphTop() const
+	{
+		return kMargin + kPadding + lines_ * kLineHeight * kScale + kPadding;
+	}
+
+	void glyph( float x, float y, uint64_t mask, uint32_t color )
+	{
+		emit( x, y, x + kGlyphWidth * kScale, y + kGlyphHeight * kScale,
+			  float( kGlyphWidth ), float( kGlyphHeight ), mask, color );
+	}
+
+	void quad( float x0, float y0, float x1, float y1, uint32_t color )
+	{
+		emit( x0, y0, x1, y1, 0.0f, 0.0f, 1, color );
+	}
+
+	/// \brief Two triangles, dropped once the vertex budget is used up
+	void emit( float x0, float y0, float x1, float y1, float cell_w, float cell_h, uint64_t mask, uint32_t color )
+	{
+		if ( vertices_.size() + 6 > kMaxVertices )
+		{
+			return;
+		}
+		vertices_.resize( vertices_.size() + 6 );
+		writeQuad( &vertices_[vertices_.size() - 6], x0, y0, x1, y1, cell_w, cell_h, mask, color );
+	}
+
+	void setQuad( size_t first, float x0, float y0, float x1, float y1, uint32_t color )
+	{
+		writeQuad( &vertices_[first], x0, y0, x1, y1, 0.0f, 0.0f, 1, color );
+	}
+
+	void writeQuad( HudVertex * out, float x0, float y0, float x1, float y1,
+					float cell_w, float cell_h, uint64_t mask, uint32_t color ) const
+	{
+		// Pixels to NDC, y down as in the viewport
+		float sx = 2.0f / extent_.width, sy = 2.0f / extent_.height;
+		float l = x0 * sx - 1.0f, r = x1 * sx - 1.0f;
+		float t = y0 * sy - 1.0f, b = y1 * sy - 1.0f;
+		uint32_t lo = static_cast<uint32_t>( mask ), hi = static_cast<uint32_t>( mask >> 32 );
+
+		const HudVertex corners[4] = {
+			{ { l, t }, { 0.0f, 0.0f }, color, { lo, hi } },
+			{ { r, t }, { cell_w, 0.0f }, color, { lo, hi } },
+			{ { l, b }, { 0.0f, cell_h }, color, { lo, hi } },
+			{ { r, b }, { cell_w, cell_h }, color, { lo, hi } }
+		};
+		out[0] = corners[0];
+		out[1] = corners[2];
+		out[2] = corners[1];
+		out[3] = corners[1];
+		out[4] = corners[2];
+		out[5] = corners[3];
+	}
+
+	/// \brief Rows top down, bit 4 the leftmost column, into masks by
+	/// character. Lower case shares the upper case glyphs.
+	void buildFont()
+	{
+		struct Glyph {
+			char c;
+			uint8_t rows[kGlyphHeight];
+		};
+		static const Glyph kGlyphs[] = {
+			{ '0', { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e } },
+			{ '1', { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+			{ '2', { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f } },
+			{ '3', { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e } },
+			{ '4', { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 } },
+			{ '5', { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e } },
+			{ '6', { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e } },
+			{ '7', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+			{ '8', { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e } },
+			{ '9', { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c } },
+			{ 'A', { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+			{ 'B', { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e } },
+			{ 'C', { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e } },
+			{ 'D', { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c } },
+			{ 'E', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f } },
+			{ 'F', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 } },
+			{ 'G', { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f } },
+			{ 'H', { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+			{ 'I', { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+			{ 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c } },
+			{ 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+			{ 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f } },
+			{ 'M', { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+			{ 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+			{ 'O', { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+			{ 'P', { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 } },
+			{ 'Q', { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d } },
+			{ 'R', { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 } },
+			{ 'S', { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e } },
+			{ 'T', { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+			{ 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+			{ 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 } },
+			{ 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a } },
+			{ 'X', { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 } },
+			{ 'Y', { 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04 } },
+			{ 'Z', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f } },
+			{ '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c } },
+			{ ':', { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 } },
+			{ '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+			{ '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+			{ '-', { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 } },
+			{ '+', { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 } },
+			{ '=', { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 } },
+			{ '(', { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 } },
+			{ ')', { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 } }
+		};
+
+		font_.fill( 0 );
+		for ( const auto & glyph : kGlyphs )
+		{
+			uint64_t mask = 0;
+			for ( uint32_t row = 0; row < kGlyphHeight; ++row )
+			{
+				for ( uint32_t column = 0; column < kGlyphWidth; ++column )
+				{
+					if ( glyph.rows[row] & ( 0x10 >> column ) )
+					{
+						mask |= 1ull << ( row * kGlyphWidth + column );
+					}
+				}
+			}
+			font_[static_cast<unsigned char>( glyph.c )] = mask;
+			if ( glyph.c >= 'A' && glyph.c <= 'Z' )
+			{
+				font_[static_cast<unsigned char>( glyph.c - 'A' + 'a' )] = mask;
+			}
+		}
+	}
+
+	bool visible_ = false;
+	std::array<uint64_t, 128> font_;
+	std::array<float, kHistory> history_ = {};
+	uint32_t history_next_ = 0;
+	uint32_t history_count_ = 0;
+	VkExtent2D extent_ = { 1, 1 };
+	std::vector<HudVertex> vertices_;
+	uint32_t lines_ = 0;
+	bool has_graph_ = false;
+};
@@ -0,0 +1,555 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hash_util.h"
+#include "latency_histogram.h"
+#include "thread_pool.h"
+#include "vk_handle.h"
+
+/// \brief Embedded SPIR-V (see shaders.h), hashed once at startup
+struct ShaderCode {
+	const uint32_t * words = nullptr;
+	size_t word_count = 0;
+	uint64_t hash = 0;
+
+	template <size_t N>
+	static ShaderCode fromWords( const uint32_t ( &words )[N] )
+	{
+		ShaderCode shader;
+		shader.words = words;
+		shader.word_count = N;
+		shader.hash = hashBytes( words, sizeof( words ) );
+		return shader;
+	}
+
+	bool operator==( const ShaderCode & other ) const
+	{
+		return word_count == other.word_count
+			&& ( words == other.words || memcmp( words, other.words, word_count * sizeof( uint32_t ) ) == 0 );
+	}
+};
+
+/// \brief Specialization constant values for one shader stage, every
+/// constant is 32 bits (VkBool32, int, uint or float)
+struct SpecializationConstants {
+	std::vector<VkSpecializationMapEntry> entries;
+	std::vector<uint32_t> data;
+
+	template <typename T>
+	void set( uint32_t constant_id, T value )
+	{
+		static_assert( sizeof( T ) == sizeof( uint32_t ), "Specialization constants are 32 bit" );
+		uint32_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+
+		for ( const auto & entry : entries )
+		{
+			if ( entry.constantID == constant_id )
+			{
+				data[entry.offset / sizeof( uint32_t )] = bits;
+				return;
+			}
+		}
+
+		VkSpecializationMapEntry entry = {};
+		entry.constantID = constant_id;
+		entry.offset = static_cast<uint32_t>( data.size() * sizeof( uint32_t ) );
+		entry.size = sizeof( uint32_t );
+		entries.push_back( entry );
+		data.push_back( bits );
+	}
+
+	/// \brief Info for pSpecializationInfo, null when nothing is set
+	const VkSpecializationInfo * info( VkSpecializationInfo & storage ) const
+	{
+		if ( entries.empty() )
+		{
+			return nullptr;
+		}
+
+		storage.mapEntryCount = static_cast<uint32_t>( entries.size() );
+		storage.pMapEntries = entries.data();
+		storage.dataSize = data.size() * sizeof( uint32_t );
+		storage.pData = data.data();
+		return &storage;
+	}
+
+	bool operator==( const SpecializationConstants & other ) const
+	{
+		if ( entries.size() != other.entries.size() || data != other.data )
+			return false;
+
+		for ( size_t i = 0; i < entries.size(); ++i )
+		{
+			if ( entries[i].constantID != other.entries[i].constantID
+				 || entries[i].offset != other.entries[i].offset )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void hash( size_t & seed ) const
+	{
+		for ( const auto & entry : entries )
+		{
+			hashCombine( seed, entry.constantID );
+			hashCombine( seed, data[entry.offset / sizeof( uint32_t )] );
+		}
+	}
+};
+
+/// \brief Key for render pass compatibility, pipelines built against one
+/// render pass are usable with any other that has the same attachments
+inline size_t renderPassKey( const std::vector<VkFormat> & color_formats,
+							  VkFormat depth_format,
+							  VkSampleCountFlagBits samples )
+{
+	size_t seed = 0;
+	for ( auto format : color_formats )
+	{
+		hashCombine( seed, static_cast<int>( format ) );
+	}
+	hashCombine( seed, static_cast<int>( depth_format ) );
+	hashCombine( seed, static_cast<int>( samples ) );
+	return seed;
+}
+
+/// \brief Everything that goes into a graphics pipeline. Viewport and
+/// scissor are dynamic so pipelines survive swapchain resizes.
+struct PipelineState {
+	ShaderCode vert;
+	ShaderCode frag;
+	SpecializationConstants vert_constants;
+	SpecializationConstants frag_constants;
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	bool blend_enable = false;
+	bool depth_test = true;
+	bool depth_write = true;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+
+	/// Only used at creation time, render_pass_key is what gets hashed.
+	/// Without a render pass the pipeline is built for dynamic rendering
+	/// against the attachment formats instead.
+	VkRenderPass render_pass = VK_NULL_HANDLE;
+	std::vector<VkFormat> color_formats;
+	VkFormat depth_format = VK_FORMAT_UNDEFINED;
+	size_t render_pass_key = 0;
+
+	size_t hash() const
+	{
+		size_t seed = 0;
+		hashCombine( seed, vert.hash );
+		hashCombine( seed, frag.hash );
+		vert_constants.hash( seed );
+		frag_constants.hash( seed );
+		for ( const auto & binding : bindings )
+		{
+			hashCombine( seed, binding.binding );
+			hashCombine( seed, binding.stride );
+			hashCombine( seed, static_cast<int>( binding.inputRate ) );
+		}
+		for ( const auto & attribute : attributes )
+		{
+			hashCombine( seed, attribute.location );
+			hashCombine( seed, attribute.binding );
+			hashCombine( seed, static_cast<int>( attribute.format ) );
+			hashCombine( seed, attribute.offset );
+		}
+		hashCombine( seed, static_cast<int>( topology ) );
+		hashCombine( seed, static_cast<int>( polygon_mode ) );
+		hashCombine( seed, cull_mode );
+		hashCombine( seed, static_cast<int>( front_face ) );
+		hashCombine( seed, blend_enable );
+		hashCombine( seed, depth_test );
+		hashCombine( seed, depth_write );
+		hashCombine( seed, static_cast<int>( samples ) );
+		hashCombine( seed, reinterpret_cast<uintptr_t>( layout ) );
+		hashCombine( seed, render_pass == VK_NULL_HANDLE );
+		hashCombine( seed, render_pass_key );
+		return seed;
+	}
+
+	/// \brief Same pipeline, compares everything hash() takes in. The
+	/// render pass handle only counts as with or without one.
+	bool operator==( const PipelineState & other ) const
+	{
+		auto same_binding = []( const VkVertexInputBindingDescription & a, const VkVertexInputBindingDescription & b ) {
+			return a.binding == b.binding && a.stride == b.stride && a.inputRate == b.inputRate;
+		};
+		auto same_attribute = []( const VkVertexInputAttributeDescription & a, const VkVertexInputAttributeDescription & b ) {
+			return a.location == b.location && a.binding == b.binding && a.format == b.format && a.offset == b.offset;
+		};
+
+		return vert == other.vert
+			&& frag == other.frag
+			&& vert_constants == other.vert_constants
+			&& frag_constants == other.frag_constants
+			&& std::equal( bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(), same_binding )
+			&& std::equal( attributes.begin(), attributes.end(), other.attributes.begin(), other.attributes.end(), same_attribute )
+			&& topology == other.topology
+			&& polygon_mode == other.polygon_mode
+			&& cull_mode == other.cull_mode
+			&& front_face == other.front_face
+			&& blend_enable == other.blend_enable
+			&& depth_test == other.depth_test
+			&& depth_write == other.depth_write
+			&& samples == other.samples
+			&& layout == other.layout
+			&& ( render_pass == VK_NULL_HANDLE ) == ( other.render_pass == VK_NULL_HANDLE )
+			&& color_formats == other.color_formats
+			&& depth_format == other.depth_format
+			&& render_pass_key == other.render_pass_key;
+	}
+};
+
+struct PipelineStateHash {
+	size_t operator()( const PipelineState & state ) const { return state.hash(); }
+};
+
+/// \brief Builds pipeline variants on worker threads through one shared
+/// VkPipelineCache.
+///
+/// request() never blocks: it hands back the variant if it is ready and
+/// the caller's fallback otherwise, queueing a compile the first time a
+/// state is seen. The cache is loaded from and saved to disk so the
+/// next run starts warm.
+class PipelineManager {
+public:
+	void init( VkDevice device, ThreadPool * pool, const std::string & cache_path )
+	{
+		device_ = device;
+		pool_ = pool;
+		cache_path_ = cache_path;
+
+		std::vector<char> initial_data;
+		std::ifstream file( cache_path_, std::ios::ate | std::ios::binary );
+		if ( file.is_open() )
+		{
+			initial_data.resize( static_cast<size_t>( file.tellg() ) );
+			file.seekg( 0 );
+			file.read( initial_data.data(), initial_data.size() );
+		}
+
+		VkPipelineCacheCreateInfo cache_info = {};
+		cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cache_info.initialDataSize = initial_data.size();
+		cache_info.pInitialData = initial_data.empty() ? nullptr : initial_data.data();
+
+		if ( vkCreatePipelineCache( device_, &cache_info, nullptr, &cache_ ) != VK_SUCCESS )
+		{
+			// stale or foreign cache file, start cold
+			cache_info.initialDataSize = 0;
+			cache_info.pInitialData = nullptr;
+			if ( auto status = vkCreatePipelineCache( device_, &cache_info, nullptr, &cache_ );
+				 status != VK_SUCCESS )
+			{
+				throw std::runtime_error( "Failed to create pipeline cache! Status: " + std::to_string( status ) );
+			}
+		}
+	}
+
+	/// \brief The pipeline for state if it has been built, fallback otherwise
+	VkPipeline request( const PipelineState & state, VkPipeline fallback )
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		auto it = entries_.find( state );
+		if ( it != entries_.end() )
+		{
+			return it->second.pipeline ? it->second.pipeline.get() : fallback;
+		}
+
+		entries_[state].pending = true;
+		pool_->submit( [this, state]() { compileAsync( state ); } );
+		return fallback;
+	}
+
+	/// \brief Build state on the calling thread if it isn't already
+	/// available, waits for an in-flight compile of the same state
+	VkPipeline getBlocking( const PipelineState & state )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		auto it = entries_.find( state );
+		if ( it != entries_.end() )
+		{
+			// entries are never erased before cleanup(), it stays valid
+			auto & existing = it->second;
+			compiled_.wait( lock, [&]() { return !existing.pending; } );
+			if ( !existing.pipeline )
+			{
+				throw std::runtime_error( "Failed to create graphics pipeline!" );
+			}
+			return existing.pipeline;
+		}
+
+		entries_[state].pending = true;
+		lock.unlock();
+
+		UniquePipeline pipeline;
+		try
+		{
+			pipeline = compile( state );
+		}
+		catch ( ... )
+		{
+			lock.lock();
+			entries_[state].pending = false;
+			compiled_.notify_all();
+			throw;
+		}
+
+		lock.lock();
+		auto & entry = entries_[state];
+		entry.pipeline = std::move( pipeline );
+		entry.pending = false;
+		compiled_.notify_all();
+		return entry.pipeline;
+	}
+
+	/// \brief Wait for queued compiles, call before destroying anything a
+	/// pending PipelineState refers to (render pass, layout)
+	void waitIdle()
+	{
+		pool_->waitIdle();
+	}
+
+	void cleanup()
+	{
+		waitIdle();
+		saveCache();
+
+		entries_.clear();
+		vkDestroyPipelineCache( device_, cache_, nullptr );
+		cache_ = VK_NULL_HANDLE;
+	}
+
+	size_t readyCount()
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		size_t ready = 0;
+		for ( const auto & entry : entries_ )
+		{
+			if ( entry.second.pipeline )
+				ready++;
+		}
+		return ready;
+	}
+
+	const LatencyHistogram & compileLatency() const { return compile_latency_; }
+
+private:
+	struct Entry {
+		UniquePipeline pipeline;
+		bool pending = false; // failed compiles stay with a null pipeline
+	};
+
+	void compileAsync( const PipelineState & state )
+	{
+		UniquePipeline pipeline;
+		try
+		{
+			pipeline = compile( state );
+		}
+		catch ( const std::exception & e )
+		{
+			std::cerr << e.what() << std::endl;
+		}
+
+		std::lock_guard<std::mutex> lock( mutex_ );
+		auto & entry = entries_[state];
+		entry.pipeline = std::move( pipeline );
+		entry.pending = false;
+		compiled_.notify_all();
+	}
+
+	UniqueShaderModule createShaderModule( const ShaderCode & shader )
+	{
+		VkShaderModuleCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		create_info.codeSize = shader.word_count * sizeof( uint32_t );
+		create_info.pCode = shader.words;
+
+		UniqueShaderModule shader_module;
+		if ( auto status = vkCreateShaderModule( device_, &create_info, nullptr, shader_module.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create shader module! Status: " + std::to_string( status ) );
+		}
+		return shader_module;
+	}
+
+	UniquePipeline compile( const PipelineState & state )
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		auto vert_module = createShaderModule( state.vert );
+		auto frag_module = createShaderModule( state.frag );
+
+		VkSpecializationInfo vert_specialization = {};
+		VkSpecializationInfo frag_specialization = {};
+
+		VkPipelineShaderStageCreateInfo shader_stages[2] = {};
+		shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shader_stages[0].module = vert_module;
+		shader_stages[0].pName = "main";
+		shader_stages[0].pSpecializationInfo = state.vert_constants.info( vert_specialization );
+		shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shader_stages[1].module = frag_module;
+		shader_stages[1].pName = "main";
+		shader_stages[1].pSpecializationInfo = state.frag_constants.info( frag_specialization );
+
+		VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertex_input_info.vertexBindingDescriptionCount = static_cast<uint32_t>( state.bindings.size() );
+		vertex_input_info.pVertexBindingDescriptions = state.bindings.data();
+		vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>( state.attributes.size() );
+		vertex_input_info.pVertexAttributeDescriptions = state.attributes.data();
+
+		VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+		input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		input_assembly.topology = state.topology;
+		input_assembly.primitiveRestartEnable = VK_FALSE;
+
+		// set with vkCmdSetViewport / vkCmdSetScissor
+		VkPipelineViewportStateCreateInfo viewport_state = {};
+		viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewport_state.viewportCount = 1;
+		viewport_state.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo rasterizer = {};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.depthClampEnable = VK_FALSE;
+		rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		rasterizer.polygonMode = state.polygon_mode;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = state.cull_mode;
+		rasterizer.frontFace = state.front_face;
+		rasterizer.depthBiasEnable = VK_FALSE;
+
+		VkPipelineMultisampleStateCreateInfo multisampling = {};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.sampleShadingEnable = VK_FALSE;
+		multisampling.rasterizationSamples = state.samples;
+		multisampling.minSampleShading = 1.0f;
+
+		VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+		depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depth_stencil.depthTestEnable = state.depth_test ? VK_TRUE : VK_FALSE;
+		depth_stencil.depthWriteEnable = state.depth_write ? VK_TRUE : VK_FALSE;
+		depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+		VkPipelineColorBlendAttachmentState color_blend_attachment = {};
+		color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		color_blend_attachment.blendEnable = state.blend_enable ? VK_TRUE : VK_FALSE;
+		color_blend_attachment.srcColorBlendFactor = state.blend_enable ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		color_blend_attachment.dstColorBlendFactor = state.blend_enable ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+		color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+		color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+		VkPipelineColorBlendStateCreateInfo color_blending = {};
+		color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		color_blending.logicOpEnable = VK_FALSE;
+		color_blending.logicOp = VK_LOGIC_OP_COPY;
+		color_blending.attachmentCount = 1;
+		color_blending.pAttachments = &color_blend_attachment;
+
+		VkDynamicState dynamic_states[ ] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamic_state = {};
+		dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamic_state.dynamicStateCount = 2;
+		dynamic_state.pDynamicStates = dynamic_states;
+
+		VkPipelineRenderingCreateInfoKHR rendering_info = {};
+		rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+		rendering_info.colorAttachmentCount = static_cast<uint32_t>( state.color_formats.size() );
+		rendering_info.pColorAttachmentFormats = state.color_formats.data();
+		rendering_info.depthAttachmentFormat = state.depth_format;
+
+		VkGraphicsPipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipeline_info.pNext = state.render_pass == VK_NULL_HANDLE ? &rendering_info : nullptr;
+		pipeline_info.stageCount = 2;
+		pipeline_info.pStages = shader_stages;
+		pipeline_info.pVertexInputState = &vertex_input_info;
+		pipeline_info.pInputAssemblyState = &input_assembly;
+		pipeline_info.pViewportState = &viewport_state;
+		pipeline_info.pRasterizationState = &rasterizer;
+		pipeline_info.pMultisampleState = &multisampling;
+		pipeline_info.pDepthStencilState = &depth_stencil;
+		pipeline_info.pColorBlendState = &color_blending;
+		pipeline_info.pDynamicState = &dynamic_state;
+		pipeline_info.layout = state.layout;
+		pipeline_info.renderPass = state.render_pass;
+		pipeline_info.subpass = 0;
+		pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+		pipeline_info.basePipelineIndex = -1;
+
+		UniquePipeline pipeline;
+		if ( auto status = vkCreateGraphicsPipelines( device_,
+													  cache_,
+													  1,
+													  &pipeline_info,
+													  nullptr,
+													  pipeline.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create graphics pipeline! Status: " + std::to_string( status ) );
+		}
+
+		compile_latency_.record( std::chrono::high_resolution_clock::now() - start );
+		return pipeline;
+	}
+
+	void saveCache()
+	{
+		size_t size = 0;
+		if ( vkGetPipelineCacheData( device_, cache_, &size, nullptr ) != VK_SUCCESS || size == 0 )
+		{
+			return;
+		}
+
+		std::vector<char> data( size );
+		if ( vkGetPipelineCacheData( device_, cache_, &size, data.data() ) != VK_SUCCESS )
+		{
+			return;
+		}
+
+		std::ofstream file( cache_path_, std::ios::binary | std::ios::trunc );
+		file.write( data.data(), size );
+	}
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	ThreadPool * pool_ = nullptr;
+	VkPipelineCache cache_ = VK_NULL_HANDLE;
+	std::string cache_path_;
+
+	std::mutex mutex_;
+	std::condition_variable compiled_;
+	std::unordered_map<PipelineState, Entry, PipelineStateHash> entries_;
+	LatencyHistogram compile_latency_;
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "vk_handle.h"
+
+/// \brief First of the usual depth formats the device can render to
+inline VkFormat chooseDepthFormat( VkPhysicalDevice physical_device )
+{
+	for ( auto format : { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM } )
+	{
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties( physical_device, format, &props );
+		if ( props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT )
+		{
+			return format;
+		}
+	}
+	throw std::runtime_error( "No supported depth format!" );
+}
+
+/// \brief Highest count up to requested that colour and depth both
+/// support, 1 always is
+inline VkSampleCountFlagBits chooseSampleCount( const VkPhysicalDeviceLimits & limits, uint32_t requested )
+{
+	VkSampleCountFlags supported = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+	for ( uint32_t count = 64; count > 1; count /= 2 )
+	{
+		if ( count <= requested && ( supported & count ) )
+		{
+			return static_cast<VkSampleCountFlagBits>( count );
+		}
+	}
+	return VK_SAMPLE_COUNT_1_BIT;
+}
+
+/// \brief The attachments a frame renders into besides the swapchain
+/// image: depth, and with MSAA the multisampled colour the subpass
+/// resolves into the swapchain image.
+///
+/// Neither is stored after the render pass, so both are transient and go
+/// in lazily allocated memory where the device has it. On tile based GPUs
+/// they then live in tile memory only and never get physical pages.
+class RenderTargets {
+public:
+	void init( VkDevice device, const VkPhysicalDeviceMemoryProperties & memory_props )
+	{
+		device_ = device;
+		memory_props_ = memory_props;
+	}
+
+	void create( VkExtent2D extent, VkFormat color_format, VkFormat depth_format, VkSampleCountFlagBits samples )
+	{
+		destroy();
+		samples_ = samples;
+		if ( samples_ != VK_SAMPLE_COUNT_1_BIT )
+		{
+			createAttachment( extent, color_format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT, color_ );
+		}
+		createAttachment( extent, depth_format, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, depth_ );
+	}
+
+	void destroy()
+	{
+		color_ = {};
+		depth_ = {};
+	}
+
+	bool multisampled() const { return samples_ != VK_SAMPLE_COUNT_1_BIT; }
+	VkSampleCountFlagBits samples() const { return samples_; }
+	VkImage colorImage() const { return color_.image; }
+	VkImage depthImage() const { return depth_.image; }
+	VkImageView colorView() const { return color_.view; }
+	VkImageView depthView() const { return depth_.view; }
+
+	/// \brief What the attachments would take fully backed
+	VkDeviceSize requiredBytes() const { return color_.size + depth_.size; }
+
+	/// \brief What the driver actually backs, lazily allocated memory only
+	/// gets pages once something spills out of tile memory
+	VkDeviceSize committedBytes() const
+	{
+		VkDeviceSize total = 0;
+		for ( const auto * attachment : { &color_, &depth_ } )
+		{
+			if ( !attachment->memory )
+			{
+				continue;
+			}
+			if ( !attachment->lazy )
+			{
+				total += attachment->size;
+				continue;
+			}
+			VkDeviceSize committed = 0;
+			vkGetDeviceMemoryCommitment( device_, attachment->memory, &committed );
+			total += committed;
+		}
+		return total;
+	}
+
+	bool lazilyAllocated() const { return depth_.lazy && ( !color_.memory || color_.lazy ); }
+
+	void printMemory( const char * label ) const
+	{
+		std::cout << label << samples_ << "x, " << requiredBytes() / ( 1024.0 * 1024.0 ) << " MB of attachments";
+		if ( lazilyAllocated() )
+		{
+			std::cout << ", lazily allocated, " << committedBytes() / ( 1024.0 * 1024.0 ) << " MB committed";
+		}
+		std::cout << std::endl;
+	}
+
+private:
+	/// Members reset in order, the view goes before its image
+	struct Attachment {
+		UniqueImageView view;
+		UniqueImage image;
+		UniqueDeviceMemory memory;
+		VkDeviceSize size = 0;
+		bool lazy = false;
+	};
+
+	void createAttachment( VkExtent2D extent,
+						   VkFormat format,
+						   VkImageUsageFlags usage,
+						   VkImageAspectFlags aspect,
+						   Attachment & attachment )
+	{
+		VkImageCreateInfo image_info = {};
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.format = format;
+		image_info.extent = { extent.width, extent.height, 1 };
+		image_info.mipLevels = 1;
+		image_info.arrayLayers = 1;
+		image_info.samples = samples_;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_info.usage = usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if ( auto status = vkCreateImage( device_, &image_info, nullptr, attachment.image.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create render target! Status: " + std::to_string( status ) );
+		}
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements( device_, attachment.image, &requirements );
+
+		uint32_t type = findMemoryType( requirements.memoryTypeBits,
+										VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT );
+		attachment.lazy = type != UINT32_MAX;
+		if ( !attachment.lazy )
+		{
+			type = findMemoryType( requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+		}
+		if ( type == UINT32_MAX )
+		{
+			throw std::runtime_error( "No memory type for render target!" );
+		}
+
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = type;
+		if ( auto status = vkAllocateMemory( device_, &alloc_info, nullptr, attachment.memory.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to allocate render target memory! Status: " + std::to_string( status ) );
+		}
+		vkBindImageMemory( device_, attachment.image, attachment.memory, 0 );
+		attachment.size = requirements.size;
+
+		VkImageViewCreateInfo view_info = {};
+		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		view_info.image = attachment.image;
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.format = format;
+		view_info.subresourceRange.aspectMask = aspect;
+		view_info.subresourceRange.levelCount = 1;
+		view_info.subresourceRange.layerCount = 1;
+		if ( auto status = vkCreateImageView( device_, &view_info, nullptr, attachment.view.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create render target view! Status: " + std::to_string( status ) );
+		}
+	}
+
+	uint32_t findMemoryType( uint32_t type_filter, VkMemoryPropertyFlags props ) const
+	{
+		for ( uint32_t i = 0; i < memory_props_.memoryTypeCount; ++i )
+		{
+			if ( ( type_filter & ( 1u << i ) ) && ( memory_props_.memoryTypes[i].propertyFlags & props ) == props )
+			{
+				return i;
+			}
+		}
+		return UINT32_MAX;
+	}
+
+	VkDevice device_ = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memory_props_ = {};
+	VkSampleCountFlagBits samples_ = VK_SAMPLE_COUNT_1_BIT;
+	Attachment color_;
+	Attachment depth_;
+};
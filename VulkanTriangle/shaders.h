@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+// SPIR-V compiled by compile.bat (pre-build step) or compile.sh, embedded
+// so startup doesn't read shader files from the working directory.
+
+constexpr uint32_t kTriVertSpv[] =
+#include "generated/tri_vert.inc"
+;
+
+/// tri.vert with PerDraw in a dynamic uniform buffer, see PerDrawPath
+constexpr uint32_t kTriUboVertSpv[] =
+#include "generated/tri_ubo_vert.inc"
+;
+
+constexpr uint32_t kTriFragSpv[] =
+#include "generated/tri_frag.inc"
+;
+
+/// Single pass mip chain generation, see MipGenerator
+constexpr uint32_t kSpdCompSpv[] =
+#include "generated/spd_comp.inc"
+;
+
+/// GPU particles, see ParticleSystem
+constexpr uint32_t kParticlesCompSpv[] =
+#include "generated/particles_comp.inc"
+;
+
+constexpr uint32_t kParticleVertSpv[] =
+#include "generated/particle_vert.inc"
+;
+
+constexpr uint32_t kParticleFragSpv[] =
+#include "generated/particle_frag.inc"
+;
+
+/// Performance overlay, see PerfHud
+constexpr uint32_t kHudVertSpv[] =
+#include "generated/hud_vert.inc"
+;
+
+constexpr uint32_t kHudFragSpv[] =
+#include "generated/hud_frag.inc"
+;
+
+/// tri.frag specialization constants, constant_id is the index
+enum class TriFragConstant : uint32_t {
+	kAlpha = 0 // float, output alpha for blended variants
+};
@@ -0,0 +1,548 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+/// \brief One descriptor a shader declares
+struct ReflectedBinding {
+	uint32_t set = 0;
+	uint32_t binding = 0;
+	VkDescriptorType type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uint32_t count = 1;
+};
+
+/// \brief One vertex shader input
+struct ReflectedInput {
+	uint32_t location = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t size = 0; // bytes
+};
+
+/// \brief What a single shader stage needs from its pipeline layout
+struct ShaderReflection {
+	VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+	std::vector<ReflectedBinding> bindings;
+	std::vector<ReflectedInput> inputs; // vertex stage only, sorted by location
+	uint32_t push_constant_offset = 0;
+	uint32_t push_constant_size = 0; // 0 when the stage has no push constants
+};
+
+namespace spirv {
+
+constexpr uint32_t kMagic = 0x07230203;
+constexpr size_t kHeaderWords = 5;
+
+enum Op : uint32_t {
+	kOpEntryPoint = 15,
+	kOpTypeInt = 21,
+	kOpTypeFloat = 22,
+	kOpTypeVector = 23,
+	kOpTypeMatrix = 24,
+	kOpTypeImage = 25,
+	kOpTypeSampler = 26,
+	kOpTypeSampledImage = 27,
+	kOpTypeArray = 28,
+	kOpTypeRuntimeArray = 29,
+	kOpTypeStruct = 30,
+	kOpTypePointer = 32,
+	kOpConstant = 43,
+	kOpSpecConstant = 50,
+	kOpFunction = 54,
+	kOpVariable = 59,
+	kOpDecorate = 71,
+	kOpMemberDecorate = 72,
+};
+
+enum Decoration : uint32_t {
+	kDecorationBlock = 2,
+	kDecorationBufferBlock = 3,
+	kDecorationArrayStride = 6,
+	kDecorationMatrixStride = 7,
+	kDecorationBuiltIn = 11,
+	kDecorationLocation = 30,
+	kDecorationBinding = 33,
+	kDecorationDescriptorSet = 34,
+	kDecorationOffset = 35,
+};
+
+enum StorageClass : uint32_t {
+	kStorageUniformConstant = 0,
+	kStorageInput = 1,
+	kStorageUniform = 2,
+	kStoragePushConstant = 9,
+	kStorageStorageBuffer = 12,
+};
+
+constexpr uint32_t kNone = ~0u;
+
+struct Id {
+	uint32_t op = 0;
+	// type operands, meaning depends on op
+	uint32_t a = 0;
+	uint32_t b = 0;
+	uint32_t c = 0;
+	std::vector<uint32_t> members;
+	std::vector<uint32_t> member_offsets;
+	std::vector<uint32_t> member_matrix_strides;
+
+	uint32_t constant = 0;
+	uint32_t set = kNone;
+	uint32_t binding = kNone;
+	uint32_t location = kNone;
+	uint32_t array_stride = 0;
+	bool block = false;
+	bool buffer_block = false;
+	bool builtin = false;
+};
+
+/// \brief Walks the instruction stream once, only the instructions that
+/// affect the pipeline layout are looked at
+class Parser {
+public:
+	Parser( const uint32_t * words, size_t word_count )
+		: words_( words ), word_count_( word_count )
+	{
+		if ( word_count_ < kHeaderWords || words_[0] != kMagic )
+		{
+			throw std::runtime_error( "Invalid SPIR-V module!" );
+		}
+		ids_.resize( words_[3] );
+	}
+
+	ShaderReflection reflect()
+	{
+		ShaderReflection reflection;
+		std::vector<uint32_t> variables;
+
+		for ( size_t i = kHeaderWords; i < word_count_; )
+		{
+			uint32_t count = words_[i] >> 16;
+			uint32_t op = words_[i] & 0xffff;
+			if ( count == 0 || i + count > word_count_ )
+			{
+				throw std::runtime_error( "Truncated SPIR-V module!" );
+			}
+			const uint32_t * ins = words_ + i;
+			i += count;
+
+			switch ( op )
+			{
+			case kOpEntryPoint:
+				reflection.stage = executionModelStage( ins[1] );
+				break;
+			case kOpDecorate:
+				decorate( id( ins[1] ), ins[2], count > 3 ? ins[3] : 0 );
+				break;
+			case kOpMemberDecorate:
+				memberDecorate( id( ins[1] ), ins[2], ins[3], count > 4 ? ins[4] : 0 );
+				break;
+			case kOpTypeInt:
+			case kOpTypeFloat:
+			case kOpTypeVector:
+			case kOpTypeMatrix:
+			case kOpTypeArray:
+			case kOpTypeRuntimeArray:
+			case kOpTypeSampler:
+			case kOpTypeSampledImage:
+			case kOpTypePointer:
+			{
+				auto & type = id( ins[1] );
+				type.op = op;
+				type.a = count > 2 ? ins[2] : 0;
+				type.b = count > 3 ? ins[3] : 0;
+				break;
+			}
+			case kOpTypeImage:
+			{
+				auto & type = id( ins[1] );
+				type.op = op;
+				type.a = ins[3]; // Dim
+				type.b = ins[7]; // Sampled
+				break;
+			}
+			case kOpTypeStruct:
+			{
+				auto & type = id( ins[1] );
+				type.op = op;
+				type.members.assign( ins + 2, ins + count );
+				break;
+			}
+			case kOpConstant:
+			case kOpSpecConstant:
+				id( ins[2] ).constant = ins[3];
+				break;
+			case kOpVariable:
+			{
+				auto & variable = id( ins[2] );
+				variable.op = op;
+				variable.a = ins[1]; // pointer type
+				variable.b = ins[3]; // storage class
+				variables.push_back( ins[2] );
+				break;
+			}
+			case kOpFunction:
+				// declarations are done, nothing past here affects the layout
+				i = word_count_;
+				break;
+			default:
+				break;
+			}
+		}
+
+		for ( auto variable_id : variables )
+		{
+			reflectVariable( variable_id, reflection );
+		}
+
+		std::sort( reflection.inputs.begin(), reflection.inputs.end(),
+				   []( const auto & a, const auto & b ) { return a.location < b.location; } );
+		return reflection;
+	}
+
+private:
+	Id & id( uint32_t index )
+	{
+		if ( index >= ids_.size() )
+		{
+			throw std::runtime_error( "SPIR-V id out of bounds!" );
+		}
+		return ids_[index];
+	}
+
+	static VkShaderStageFlagBits executionModelStage( uint32_t model )
+	{
+		switch ( model )
+		{
+		case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+		case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+		case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+		case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+		case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+		case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+		default: throw std::runtime_error( "Unsupported SPIR-V execution model!" );
+		}
+	}
+
+	void decorate( Id & target, uint32_t decoration, uint32_t value )
+	{
+		switch ( decoration )
+		{
+		case kDecorationBlock: target.block = true; break;
+		case kDecorationBufferBlock: target.buffer_block = true; break;
+		case kDecorationArrayStride: target.array_stride = value; break;
+		case kDecorationBuiltIn: target.builtin = true; break;
+		case kDecorationLocation: target.location = value; break;
+		case kDecorationBinding: target.binding = value; break;
+		case kDecorationDescriptorSet: target.set = value; break;
+		default: break;
+		}
+	}
+
+	void memberDecorate( Id & target, uint32_t member, uint32_t decoration, uint32_t value )
+	{
+		if ( decoration != kDecorationOffset && decoration != kDecorationMatrixStride )
+		{
+			return;
+		}
+
+		auto & values = decoration == kDecorationOffset ? target.member_offsets : target.member_matrix_strides;
+		if ( values.size() <= member )
+		{
+			values.resize( member + 1, 0 );
+		}
+		values[member] = value;
+	}
+
+	/// \brief Size in bytes of a type as laid out in a buffer block
+	uint32_t typeSize( uint32_t type_id, uint32_t matrix_stride = 0 )
+	{
+		const auto & type = id( type_id );
+		switch ( type.op )
+		{
+		case kOpTypeInt:
+		case kOpTypeFloat:
+			return type.a / 8;
+		case kOpTypeVector:
+			return type.b * typeSize( type.a );
+		case kOpTypeMatrix:
+			return type.b * ( matrix_stride ? matrix_stride : typeSize( type.a ) );
+		case kOpTypeArray:
+		{
+			uint32_t stride = type.array_stride ? type.array_stride : typeSize( type.a );
+			return id( type.b ).constant * stride;
+		}
+		case kOpTypeStruct:
+		{
+			uint32_t size = 0;
+			for ( size_t m = 0; m < type.members.size(); ++m )
+			{
+				uint32_t offset = m < type.member_offsets.size() ? type.member_offsets[m] : 0;
+				uint32_t stride = m < type.member_matrix_strides.size() ? type.member_matrix_strides[m] : 0;
+				size = std::max( size, offset + typeSize( type.members[m], stride ) );
+			}
+			return size;
+		}
+		default:
+			return 0;
+		}
+	}
+
+	VkFormat inputFormat( uint32_t type_id )
+	{
+		const auto & type = id( type_id );
+		uint32_t components = 1;
+		const Id * scalar = &type;
+		if ( type.op == kOpTypeVector )
+		{
+			components = type.b;
+			scalar = &id( type.a );
+		}
+
+		if ( scalar->a != 32 )
+		{
+			throw std::runtime_error( "Only 32 bit vertex inputs are supported!" );
+		}
+
+		static const VkFormat kFloatFormats[ ] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+		static const VkFormat kIntFormats[ ] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+		static const VkFormat kUintFormats[ ] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+		if ( components < 1 || components > 4 )
+		{
+			throw std::runtime_error( "Unsupported vertex input width!" );
+		}
+		if ( scalar->op == kOpTypeFloat )
+			return kFloatFormats[components - 1];
+		return scalar->b ? kIntFormats[components - 1] : kUintFormats[components - 1];
+	}
+
+	void reflectVariable( uint32_t variable_id, ShaderReflection & reflection )
+	{
+		const auto & variable = id( variable_id );
+		const auto & pointer = id( variable.a );
+		uint32_t storage = variable.b;
+		uint32_t type_id = pointer.b;
+
+		if ( storage == kStorageInput )
+		{
+			if ( reflection.stage != VK_SHADER_STAGE_VERTEX_BIT
+				 || variable.builtin
+				 || variable.location == kNone )
+			{
+				return;
+			}
+
+			ReflectedInput input;
+			input.location = variable.location;
+			input.format = inputFormat( type_id );
+			input.size = typeSize( type_id );
+			reflection.inputs.push_back( input );
+			return;
+		}
+
+		if ( storage == kStoragePushConstant )
+		{
+			const auto & block = id( type_id );
+			uint32_t offset = block.member_offsets.empty()
+				? 0
+				: *std::min_element( block.member_offsets.begin(), block.member_offsets.end() );
+			reflection.push_constant_offset = offset;
+			reflection.push_constant_size = typeSize( type_id ) - offset;
+			return;
+		}
+
+		if ( storage != kStorageUniformConstant
+			 && storage != kStorageUniform
+			 && storage != kStorageStorageBuffer )
+		{
+			return;
+		}
+
+		ReflectedBinding binding;
+		binding.set = variable.set == kNone ? 0 : variable.set;
+		binding.binding = variable.binding == kNone ? 0 : variable.binding;
+
+		// arrays of descriptors
+		const Id * type = &id( type_id );
+		while ( type->op == kOpTypeArray || type->op == kOpTypeRuntimeArray )
+		{
+			binding.count *= type->op == kOpTypeArray ? id( type->b ).constant : 1;
+			type = &id( type->a );
+		}
+
+		switch ( type->op )
+		{
+		case kOpTypeStruct:
+			binding.type = storage == kStorageStorageBuffer || type->buffer_block
+				? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+				: VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			break;
+		case kOpTypeSampledImage:
+			binding.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			break;
+		case kOpTypeSampler:
+			binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+			break;
+		case kOpTypeImage:
+		{
+			constexpr uint32_t kDimBuffer = 5;
+			constexpr uint32_t kDimSubpassData = 6;
+			bool storage_image = type->b == 2;
+			if ( type->a == kDimSubpassData )
+				binding.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			else if ( type->a == kDimBuffer )
+				binding.type = storage_image ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			else
+				binding.type = storage_image ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			break;
+		}
+		default:
+			return;
+		}
+
+		reflection.bindings.push_back( binding );
+	}
+
+	const uint32_t * words_;
+	size_t word_count_;
+	std::vector<Id> ids_;
+};
+
+} // namespace spirv
+
+/// \brief Reflect one SPIR-V module, throws on malformed input
+inline ShaderReflection reflectSpirv( const uint32_t * words, size_t word_count )
+{
+	return spirv::Parser( words, word_count ).reflect();
+}
+
+/// \brief Set layouts and push constant range for a set of stages
+struct PipelineLayoutDesc {
+	std::vector<std::vector<VkDescriptorSetLayoutBinding>> sets; // indexed by set number
+	std::vector<VkPushConstantRange> push_constants;
+};
+
+/// \brief Union of every stage's bindings. Stages that share a binding
+/// share the layout entry, push constants collapse into one range
+/// visible to every stage that declares them.
+inline PipelineLayoutDesc mergeReflections( const std::vector<const ShaderReflection*> & stages )
+{
+	PipelineLayoutDesc desc;
+	VkPushConstantRange push_range = {};
+	uint32_t push_end = 0;
+
+	for ( const auto * stage : stages )
+	{
+		for ( const auto & reflected : stage->bindings )
+		{
+			if ( desc.sets.size() <= reflected.set )
+			{
+				desc.sets.resize( reflected.set + 1 );
+			}
+
+			auto & set = desc.sets[reflected.set];
+			auto it = std::find_if( set.begin(), set.end(),
+									[&]( const auto & b ) { return b.binding == reflected.binding; } );
+			if ( it != set.end() )
+			{
+				if ( it->descriptorType != reflected.type || it->descriptorCount != reflected.count )
+				{
+					throw std::runtime_error( "Shader stages disagree on a descriptor binding!" );
+				}
+				it->stageFlags |= stage->stage;
+				continue;
+			}
+
+			VkDescriptorSetLayoutBinding binding = {};
+			binding.binding = reflected.binding;
+			binding.descriptorType = reflected.type;
+			binding.descriptorCount = reflected.count;
+			binding.stageFlags = stage->stage;
+			set.push_back( binding );
+		}
+
+		if ( stage->push_constant_size > 0 )
+		{
+			uint32_t end = stage->push_constant_offset + stage->push_constant_size;
+			push_range.offset = push_range.stageFlags
+				? std::min( push_range.offset, stage->push_constant_offset )
+				: stage->push_constant_offset;
+			push_end = std::max( push_end, end );
+			push_range.stageFlags |= stage->stage;
+		}
+	}
+
+	if ( push_range.stageFlags )
+	{
+		push_range.size = push_end - push_range.offset;
+		desc.push_constants.push_back( push_range );
+	}
+	return desc;
+}
+
+/// \brief Packed vertex input for a single interleaved binding, in
+/// location order. Only the inputs from first_location up to end_location
+/// go in the binding, their attributes are appended.
+inline void reflectedVertexInput( const ShaderReflection & reflection,
+								  uint32_t binding,
+								  VkVertexInputBindingDescription & binding_desc,
+								  std::vector<VkVertexInputAttributeDescription> & attributes,
+								  uint32_t first_location = 0,
+								  uint32_t end_location = UINT32_MAX,
+								  VkVertexInputRate input_rate = VK_VERTEX_INPUT_RATE_VERTEX )
+{
+	uint32_t offset = 0;
+	for ( const auto & input : reflection.inputs )
+	{
+		if ( input.location < first_location || input.location >= end_location )
+		{
+			continue;
+		}
+
+		VkVertexInputAttributeDescription attribute = {};
+		attribute.binding = binding;
+		attribute.location = input.location;
+		attribute.format = input.format;
+		attribute.offset = offset;
+		attributes.push_back( attribute );
+		offset += input.size;
+	}
+
+	binding_desc = {};
+	binding_desc.binding = binding;
+	binding_desc.stride = offset;
+	binding_desc.inputRate = input_rate;
+}
+
+/// \brief Reflection results keyed by shader hash, so shaders shared by
+/// many pipelines are parsed once
+class ReflectionCache {
+public:
+	const ShaderReflection & get( uint64_t shader_hash, const uint32_t * words, size_t word_count )
+	{
+		if ( auto it = cache_.find( shader_hash ); it != cache_.end() )
+		{
+			hits_++;
+			return it->second;
+		}
+
+		misses_++;
+		return cache_[shader_hash] = reflectSpirv( words, word_count );
+	}
+
+	void clear() { cache_.clear(); }
+
+	size_t hits() const { return hits_; }
+	size_t misses() const { return misses_; }
+
+private:
+	std::unordered_map<uint64_t, ShaderReflection> cache_;
+	size_t hits_ = 0;
+	size_t misses_ = 0;
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+/// \brief Phased startup with a timing report.
+///
+/// run() steps are on the critical path and run on the calling thread.
+/// async() steps run on the worker pool alongside them and are joined by
+/// name where their results are needed. defer() steps wait for the first
+/// frame. Every step is timed from construction, so the report shows what
+/// overlapped and what the first frame waited on.
+class StartupScheduler {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	StartupScheduler() : start_( Clock::now() ) {}
+
+	StartupScheduler( const StartupScheduler & ) = delete;
+	StartupScheduler & operator=( const StartupScheduler & ) = delete;
+
+	/// \brief Async steps still running were never joined, wait so they
+	/// don't outlive what they refer to
+	~StartupScheduler()
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		done_.wait( lock, [this]() {
+			return std::all_of( steps_.begin(), steps_.end(), []( const auto & step ) { return step->done; } );
+		} );
+	}
+
+	void init( ThreadPool * pool )
+	{
+		pool_ = pool;
+	}
+
+	void run( const std::string & name, const std::function<void()> & step )
+	{
+		auto & timing = addStep( name, "main" );
+		auto start = Clock::now();
+		try
+		{
+			step();
+		}
+		catch ( ... )
+		{
+			complete( timing, start, nullptr );
+			throw;
+		}
+		complete( timing, start, nullptr );
+	}
+
+	/// \brief The step must not touch anything the critical path uses
+	/// until it is joined
+	void async( const std::string & name, std::function<void()> step )
+	{
+		auto * timing = &addStep( name, "worker" );
+		pool_->submit( [this, timing, step = std::move( step )]() {
+			std::exception_ptr error;
+			auto start = Clock::now();
+			try
+			{
+				step();
+			}
+			catch ( ... )
+			{
+				error = std::current_exception();
+			}
+
+			complete( *timing, start, error );
+		} );
+	}
+
+	/// \brief Wait for an async step, rethrows what it threw
+	void join( const std::string & name )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		auto it = std::find_if( steps_.begin(), steps_.end(), [&]( const auto & step ) { return step->name == name; } );
+		if ( it == steps_.end() )
+		{
+			throw std::runtime_error( "Unknown startup step " + name );
+		}
+
+		auto & step = **it;
+		auto wait_start = Clock::now();
+		done_.wait( lock, [&]() { return step.done; } );
+		step.joined_wait = Clock::now() - wait_start;
+		if ( step.error )
+		{
+			std::rethrow_exception( std::exchange( step.error, nullptr ) );
+		}
+	}
+
+	void defer( const std::string & name, std::function<void()> step )
+	{
+		deferred_.push_back( { name, std::move( step ) } );
+	}
+
+	/// \brief Call once a frame is submitted, the first call records the
+	/// time to first frame and runs the deferred steps
+	void firstFrame()
+	{
+		if ( first_frame_ != Clock::time_point() )
+		{
+			return;
+		}
+		first_frame_ = Clock::now();
+		finish();
+	}
+
+	/// \brief Run what is still deferred and print the report, for paths
+	/// that never draw a frame. Only the first call does anything.
+	void finish()
+	{
+		if ( finished_ )
+		{
+			return;
+		}
+		finished_ = true;
+
+		for ( auto & step : deferred_ )
+		{
+			run( step.first, step.second );
+		}
+		deferred_.clear();
+		printReport();
+	}
+
+	void printReport() const
+	{
+		auto ms = [this]( Clock::time_point t ) {
+			return std::chrono::duration<double, std::milli>( t - start_ ).count();
+		};
+
+		if ( first_frame_ != Clock::time_point() )
+		{
+			std::cout << "Startup: " << ms( first_frame_ ) << " ms to first frame" << std::endl;
+		}
+		else
+		{
+			std::cout << "Startup: no frame drawn" << std::endl;
+		}
+
+		std::lock_guard<std::mutex> lock( mutex_ );
+		std::vector<const Step *> sorted;
+		for ( const auto & step : steps_ )
+		{
+			sorted.push_back( step.get() );
+		}
+		std::sort( sorted.begin(), sorted.end(), []( const Step * a, const Step * b ) { return a->start < b->start; } );
+
+		for ( const auto * step : sorted )
+		{
+			if ( !step->done )
+			{
+				std::cout << "\t" << step->thread << "  " << step->name << " (still running)" << std::endl;
+				continue;
+			}
+			std::cout << "\t" << std::fixed << std::setprecision( 1 )
+				<< std::setw( 8 ) << ms( step->start ) << " ms +"
+				<< std::setw( 7 ) << std::chrono::duration<double, std::milli>( step->end - step->start ).count() << " ms  "
+				<< std::setw( 6 ) << step->thread << "  " << step->name;
+			if ( step->joined_wait > Clock::duration::zero() )
+			{
+				std::cout << " (joined, waited "
+					<< std::chrono::duration<double, std::milli>( step->joined_wait ).count() << " ms)";
+			}
+			if ( first_frame_ != Clock::time_point() && step->start >= first_frame_ )
+			{
+				std::cout << " (deferred)";
+			}
+			std::cout << std::defaultfloat << std::endl;
+		}
+	}
+
+private:
+	struct Step {
+		std::string name;
+		const char * thread = "";
+		Clock::time_point start;
+		Clock::time_point end;
+		Clock::duration joined_wait = Clock::duration::zero();
+		std::exception_ptr error;
+		bool done = false;
+	};
+
+	void complete( Step & step, Clock::time_point start, std::exception_ptr error )
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		step.start = start;
+		step.end = Clock::now();
+		step.error = error;
+		step.done = true;
+		done_.notify_all();
+	}
+
+	Step & addStep( const std::string & name, const char * thread )
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		steps_.push_back( std::make_unique<Step>() );
+		steps_.back()->name = name;
+		steps_.back()->thread = thread;
+		return *steps_.back();
+	}
+
+	ThreadPool * pool_ = nullptr;
+	Clock::time_point start_;
+	Clock::time_point first_frame_;
+	bool finished_ = false;
+
+	mutable std::mutex mutex_;
+	std::condition_variable done_;
+	std::vector<std::unique_ptr<Step>> steps_;
+	std::vector<std::pair<std::string, std::function<void()>>> deferred_;
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/// On disk layout of a .vtex file: TextureHeader, mip_count TextureMip
+/// entries finest first, then the mip data at the offsets they give.
+struct TextureHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t format; // VkFormat
+	uint32_t width;
+	uint32_t height;
+	uint32_t mip_count;
+	uint32_t flags; // TextureFlags
+};
+
+enum TextureFlags : uint32_t {
+	kTextureHasAlpha = 1 // some texel's alpha is below 255
+};
+
+struct TextureMip {
+	uint64_t offset;
+	uint64_t size;
+	uint32_t width;
+	uint32_t height;
+};
+
+constexpr char kTextureMagic[4] = { 'V', 'T', 'E', 'X' };
+constexpr uint32_t kTextureVersion = 2;
+
+/// \brief Memory mapped .vtex file with a pre-built mip chain
+class TextureContainer {
+public:
+	explicit TextureContainer( const std::string & path )
+		: file_( path )
+	{
+		if ( file_.size() < sizeof( TextureHeader ) )
+		{
+			throw std::runtime_error( "Truncated texture! " + path );
+		}
+
+		memcpy( &header_, file_.data(), sizeof( header_ ) );
+		if ( memcmp( header_.magic, kTextureMagic, sizeof( kTextureMagic ) ) != 0
+			 || header_.version != kTextureVersion
+			 || header_.mip_count == 0 )
+		{
+			throw std::runtime_error( "Not a texture container! " + path );
+		}
+
+		size_t table_end = sizeof( TextureHeader ) + header_.mip_count * sizeof( TextureMip );
+		if ( file_.size() < table_end )
+		{
+			throw std::runtime_error( "Truncated texture! " + path );
+		}
+
+		mips_.resize( header_.mip_count );
+		memcpy( mips_.data(), file_.data() + sizeof( TextureHeader ), header_.mip_count * sizeof( TextureMip ) );
+		for ( const auto & mip : mips_ )
+		{
+			if ( mip.offset + mip.size > file_.size() )
+			{
+				throw std::runtime_error( "Texture mip out of bounds! " + path );
+			}
+		}
+	}
+
+	VkFormat format() const { return static_cast<VkFormat>( header_.format ); }
+	uint32_t width() const { return header_.width; }
+	uint32_t height() const { return header_.height; }
+	uint32_t mipCount() const { return header_.mip_count; }
+	bool hasAlpha() const { return ( header_.flags & kTextureHasAlpha ) != 0; }
+	const TextureMip & mip( uint32_t level ) const { return mips_[level]; }
+	const uint8_t * mipData( uint32_t level ) const { return file_.data() + mips_[level].offset; }
+
+private:
+	MappedFile file_;
+	TextureHeader header_;
+	std::vector<TextureMip> mips_;
+};
+
+/// \brief One mip level of an uncompressed image being written out
+struct TextureLevel {
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint8_t> data;
+};
+
+inline void writeTextureContainer( const std::string & path, VkFormat format, const std::vector<TextureLevel> & levels )
+{
+	TextureHeader header = {};
+	memcpy( header.magic, kTextureMagic, sizeof( kTextureMagic ) );
+	header.version = kTextureVersion;
+	header.format = static_cast<uint32_t>( format );
+	header.width = levels.front().width;
+	header.height = levels.front().height;
+	header.mip_count = static_cast<uint32_t>( levels.size() );
+	if ( format == VK_FORMAT_R8G8B8A8_UNORM )
+	{
+		for ( const auto & level : levels )
+		{
+			for ( size_t t = 3; t < level.data.size() && !( header.flags & kTextureHasAlpha ); t += 4 )
+			{
+				if ( level.data[t] != 255 )
+					header.flags |= kTextureHasAlpha;
+			}
+		}
+	}
+
+	std::vector<TextureMip> mips( levels.size() );
+	uint64_t offset = sizeof( TextureHeader ) + levels.size() * sizeof( TextureMip );
+	for ( size_t i = 0; i < levels.size(); ++i )
+	{
+		offset = ( offset + 15 ) & ~uint64_t( 15 ); // keeps staging copies aligned
+		mips[i].offset = offset;
+		mips[i].size = levels[i].data.size();
+		mips[i].width = levels[i].width;
+		mips[i].height = levels[i].height;
+		offset += mips[i].size;
+	}
+
+	std::ofstream file( path, std::ios::binary | std::ios::trunc );
+	if ( !file.is_open() )
+	{
+		throw std::runtime_error( "Failed to write texture! " + path );
+	}
+
+	file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+	file.write( reinterpret_cast<const char*>( mips.data() ), mips.size() * sizeof( TextureMip ) );
+	for ( size_t i = 0; i < levels.size(); ++i )
+	{
+		std::vector<char> padding( mips[i].offset - static_cast<uint64_t>( file.tellp() ), 0 );
+		file.write( padding.data(), padding.size() );
+		file.write( reinterpret_cast<const char*>( levels[i].data.data() ), levels[i].data.size() );
+	}
+}
+
+/// \brief Full RGBA8 mip chain by 2x2 box filtering down to 1x1
+inline std::vector<TextureLevel> buildMipChainRgba8( TextureLevel base )
+{
+	std::vector<TextureLevel> levels;
+	levels.push_back( std::move( base ) );
+
+	while ( levels.back().width > 1 || levels.back().height > 1 )
+	{
+		const auto & src = levels.back();
+		TextureLevel dst;
+		dst.width = std::max( 1u, src.width / 2 );
+		dst.height = std::max( 1u, src.height / 2 );
+		dst.data.resize( size_t( dst.width ) * dst.height * 4 );
+
+		for ( uint32_t y = 0; y < dst.height; ++y )
+		{
+			for ( uint32_t x = 0; x < dst.width; ++x )
+			{
+				uint32_t x0 = std::min( x * 2, src.width - 1 ), x1 = std::min( x * 2 + 1, src.width - 1 );
+				uint32_t y0 = std::min( y * 2, src.height - 1 ), y1 = std::min( y * 2 + 1, src.height - 1 );
+				for ( uint32_t c = 0; c < 4; ++c )
+				{
+					uint32_t sum = src.data[( size_t( y0 ) * src.width + x0 ) * 4 + c]
+						+ src.data[( size_t( y0 ) * src.width + x1 ) * 4 + c]
+						+ src.data[( size_t( y1 ) * src.width + x0 ) * 4 + c]
+						+ src.data[( size_t( y1 ) * src.width + x1 ) * 4 + c];
+					dst.data[( size_t( y ) * dst.width + x ) * 4 + c] = static_cast<uint8_t>( ( sum + 2 ) / 4 );
+				}
+			}
+		}
+		levels.push_back( std::move( dst ) );
+	}
+	return levels;
+}
+
+/// \brief Checkerboard test texture, each mip is tinted so streaming is visible
+inline void writeCheckerTexture( const std::string & path, uint32_t size )
+{
+	TextureLevel base;
+	base.width = size;
+	base.height = size;
+	base.data.resize( size_t( size ) * size * 4 );
+	for ( uint32_t y = 0; y < size; ++y )
+	{
+		for ( uint32_t x = 0; x < size; ++x )
+		{
+			bool light = ( ( x / 32 ) + ( y / 32 ) ) % 2 == 0;
+			auto * texel = &base.data[( size_t( y ) * size + x ) * 4];
+			texel[0] = texel[1] = texel[2] = light ? 230 : 40;
+			texel[3] = 255;
+		}
+	}
+
+	auto levels = buildMipChainRgba8( std::move( base ) );
+	for ( size_t i = 1; i < levels.size(); ++i )
+	{
+		// coarser mips shift towards red
+		uint32_t keep = 8 - static_cast<uint32_t>( std::min<size_t>( i, 6 ) );
+		for ( size_t t = 0; t < levels[i].data.size(); t += 4 )
+		{
+			levels[i].data[t + 1] = static_cast<uint8_t>( levels[i].data[t + 1] * keep / 8 );
+			levels[i].data[t + 2] = static_cast<uint8_t>( levels[i].data[t + 2] * keep / 8 );
+		}
+	}
+	writeTextureContainer( path, VK_FORMAT_R8G8B8A8_UNORM, levels );
+}
@@ -0,0 +1,716 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "block_compress.h"
+#include "frame_sync.h"
+#include "texture_container.h"
+#include "vk_handle.h"
+
+struct StreamingConfig {
+	VkDeviceSize budget = 64ull * 1024 * 1024;
+	VkDeviceSize upload_bytes_per_update = 4ull * 1024 * 1024;
+	uint32_t mip_tail_size = 64;  // levels this size or smaller are never evicted
+	uint64_t recent_frames = 60;  // only textures touched this recently stream in
+	VkFormat transcode_format = VK_FORMAT_UNDEFINED; // RGBA8 containers are uploaded in this format
+	VkFormat transcode_alpha_format = VK_FORMAT_UNDEFINED; // ... or this one when they have alpha
+};
+
+struct StreamingStats {
+	uint64_t bytes_uploaded = 0;
+	uint64_t mips_uploaded = 0;
+	uint64_t mips_evicted = 0;
+	uint64_t rebuilds = 0;
+	uint64_t budget_misses = 0; // upgrades deferred for lack of memory
+	std::chrono::nanoseconds staging_time{ 0 };
+	uint64_t pixels_transcoded = 0;
+	std::chrono::nanoseconds transcode_time{ 0 };
+};
+
+/// \brief Streams mip chains from memory mapped .vtex containers.
+///
+/// Each texture always keeps its mip tail resident. update() moves
+/// recently touched textures one level finer per call, coarse to fine,
+/// within an upload budget per call. When the memory budget is hit the
+/// finest level of the least recently used texture is dropped first.
+/// Changing residency rebuilds the image with the new level range:
+/// levels already on the GPU are copied across, the rest come from the
+/// container through a staging buffer, and the old image is retired
+/// through the DeletionQueue once the frame being recorded is done.
+///
+/// With VK_EXT_memory_budget the budget also shrinks to what the
+/// driver says the device local heap has left, so oversubscribed scenes
+/// drop detail instead of failing allocations.
+///
+/// RGBA8 containers can be block compressed on the way into the staging
+/// buffer, see StreamingConfig::transcode_format. Containers flagged
+/// with alpha use transcode_alpha_format instead.
+class TextureStreamer {
+public:
+	static constexpr uint32_t kNotResident = ~0u;
+
+	void init( VkPhysicalDevice physical_device,
+			   VkDevice device,
+			   VkQueue queue,
+			   uint32_t queue_family,
+			   FrameSync * frame_sync,
+			   DeletionQueue * deletion_queue,
+			   ThreadPool * transcode_pool,
+			   bool memory_budget_ext,
+			   const StreamingConfig & config )
+	{
+		physical_device_ = physical_device;
+		device_ = device;
+		queue_ = queue;
+		frame_sync_ = frame_sync;
+		deletion_queue_ = deletion_queue;
+		transcode_pool_ = transcode_pool;
+		memory_budget_ext_ = memory_budget_ext;
+		config_ = config;
+		budget_ = config.budget;
+		start_time_ = std::chrono::high_resolution_clock::now();
+
+		vkGetPhysicalDeviceMemoryProperties( physical_device_, &memory_properties_ );
+
+		VkCommandPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.queueFamilyIndex = queue_family;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		if ( auto status = vkCreateCommandPool( device_, &pool_info, nullptr, &command_pool_ );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create streaming command pool! Status: " + std::to_string( status ) );
+		}
+
+		VkSamplerCreateInfo sampler_info = {};
+		sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		sampler_info.magFilter = VK_FILTER_LINEAR;
+		sampler_info.minFilter = VK_FILTER_LINEAR;
+		sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		sampler_info.minLod = 0.0f;
+		sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+		if ( auto status = vkCreateSampler( device_, &sampler_info, nullptr, &sampler_ );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create texture sampler! Status: " + std::to_string( status ) );
+		}
+
+		refreshBudget();
+	}
+
+	/// \brief Map a container and make its mip tail resident, returns the id
+	uint32_t addTexture( const std::string & path )
+	{
+		Texture texture;
+		texture.container = std::make_unique<TextureContainer>( path );
+		texture.format = texture.container->format();
+		if ( texture.format == VK_FORMAT_R8G8B8A8_UNORM )
+		{
+			VkFormat transcode_format = texture.container->hasAlpha() ? config_.transcode_alpha_format
+																	  : config_.transcode_format;
+			if ( transcode_format != VK_FORMAT_UNDEFINED )
+				texture.format = transcode_format;
+		}
+
+		// first level that fits in the tail, keeping at least the last level
+		uint32_t mip_count = texture.container->mipCount();
+		texture.tail_mip = mip_count - 1;
+		while ( texture.tail_mip > 0 )
+		{
+			const auto & mip = texture.container->mip( texture.tail_mip - 1 );
+			if ( std::max( mip.width, mip.height ) > config_.mip_tail_size )
+				break;
+			texture.tail_mip--;
+		}
+
+		textures_.push_back( std::move( texture ) );
+		uint32_t id = static_cast<uint32_t>( textures_.size() - 1 );
+
+		if ( !rebuild( textures_[id], textures_[id].tail_mip ) )
+		{
+			throw std::runtime_error( "Failed to allocate texture mip tail! " + path );
+		}
+		flushBatch();
+		return id;
+	}
+
+	/// \brief Mark a texture as used by the frame being recorded
+	void touch( uint32_t id )
+	{
+		textures_[id].last_used = frame_;
+	}
+
+	/// \brief Stream and evict, call once per frame before recording
+	void update()
+	{
+		if ( memory_budget_ext_ && frame_ % 30 == 0 )
+		{
+			refreshBudget();
+		}
+
+		// the budget may have shrunk under us
+		while ( resident_bytes_ > budget_ && evictOne( kNotResident, frame_ ) )
+		{
+		}
+
+		std::vector<uint32_t> candidates;
+		for ( uint32_t id = 0; id < textures_.size(); ++id )
+		{
+			const auto & texture = textures_[id];
+			if ( texture.resident_mip > 0
+				 && texture.evicted_frame != frame_
+				 && texture.last_used + config_.recent_frames >= frame_ )
+			{
+				candidates.push_back( id );
+			}
+		}
+		// most recently used first, coarsest first on ties
+		std::sort( candidates.begin(), candidates.end(), [this]( uint32_t a, uint32_t b ) {
+			if ( textures_[a].last_used != textures_[b].last_used )
+				return textures_[a].last_used > textures_[b].last_used;
+			return textures_[a].resident_mip > textures_[b].resident_mip;
+		} );
+
+		VkDeviceSize uploaded = 0;
+		for ( auto id : candidates )
+		{
+			auto & texture = textures_[id];
+			uint32_t next = texture.resident_mip - 1;
+			VkDeviceSize upload_size = uploadSize( texture, next );
+			if ( uploaded > 0 && uploaded + upload_size > config_.upload_bytes_per_update )
+			{
+				break;
+			}
+
+			VkDeviceSize needed = estimateSize( texture, next );
+			while ( resident_bytes_ - texture.memory_size + needed > budget_
+					&& evictOne( id, texture.last_used ) )
+			{
+			}
+			if ( resident_bytes_ - texture.memory_size + needed > budget_ || !rebuild( texture, next ) )
+			{
+				stats_.budget_misses++;
+				continue;
+			}
+			uploaded += upload_size;
+		}
+
+		flushBatch();
+		frame_++;
+	}
+
+	VkImageView view( uint32_t id ) const { return textures_[id].view; }
+	VkSampler sampler() const { return sampler_; }
+	uint32_t residentMip( uint32_t id ) const { return textures_[id].resident_mip; }
+	size_t textureCount() const { return textures_.size(); }
+	VkDeviceSize residentBytes() const { return resident_bytes_; }
+	VkDeviceSize budget() const { return budget_; }
+	const StreamingStats & stats() const { return stats_; }
+
+	/// \brief Change the configured budget, evicts on the next update()
+	void setBudget( VkDeviceSize budget )
+	{
+		config_.budget = budget;
+		budget_ = budget;
+		refreshBudget();
+	}
+
+	void printStats() const
+	{
+		const double kMiB = 1024.0 * 1024.0;
+		double staging_seconds = std::chrono::duration<double>( stats_.staging_time ).count();
+		double run_seconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start_time_ ).count();
+
+		std::printf( "Texture streaming: %zu textures, %.1f / %.1f MiB resident (%s budget)\n",
+					 textures_.size(), resident_bytes_ / kMiB, budget_ / kMiB,
+					 memory_budget_ext_ ? "VK_EXT_memory_budget" : "fixed" );
+		std::printf( "\tuploaded %.1f MiB in %llu mips, %.0f MiB/s staging, %.1f MiB/s over %.1f s\n",
+					 stats_.bytes_uploaded / kMiB,
+					 static_cast<unsigned long long>( stats_.mips_uploaded ),
+					 staging_seconds > 0.0 ? stats_.bytes_uploaded / kMiB / staging_seconds : 0.0,
+					 run_seconds > 0.0 ? stats_.bytes_uploaded / kMiB / run_seconds : 0.0,
+					 run_seconds );
+		if ( stats_.pixels_transcoded > 0 )
+		{
+			double transcode_seconds = std::chrono::duration<double>( stats_.transcode_time ).count();
+			std::printf( "\ttranscoded %.1f MP to %s/%s, %.1f MP/s (%s)\n",
+						 stats_.pixels_transcoded / 1e6,
+						 formatName( config_.transcode_format ),
+						 formatName( config_.transcode_alpha_format ),
+						 transcode_seconds > 0.0 ? stats_.pixels_transcoded / 1e6 / transcode_seconds : 0.0,
+						 simdLevelName( detectSimdLevel() ) );
+		}
+		std::printf( "\t%llu rebuilds, %llu mips evicted, %llu upgrades deferred by budget\n",
+					 static_cast<unsigned long long>( stats_.rebuilds ),
+					 static_cast<unsigned long long>( stats_.mips_evicted ),
+					 static_cast<unsigned long long>( stats_.budget_misses ) );
+		for ( size_t i = 0; i < textures_.size(); ++i )
+		{
+			const auto & texture = textures_[i];
+			std::printf( "\t[%zu] mip %u/%u resident, %.1f MiB\n",
+						 i, texture.resident_mip, texture.container->mipCount(),
+						 texture.memory_size / kMiB );
+		}
+	}
+
+	/// \brief Destroy everything, the device must be idle
+	void cleanup()
+	{
+		textures_.clear();
+		resident_bytes_ = 0;
+		vkDestroySampler( device_, sampler_, nullptr );
+		vkDestroyCommandPool( device_, command_pool_, nullptr );
+		submitted_.clear();
+		free_command_buffers_.clear();
+	}
+
+private:
+	struct Texture {
+		std::unique_ptr<TextureContainer> container;
+		UniqueImage image;
+		UniqueDeviceMemory memory;
+		UniqueImageView view;
+		VkDeviceSize memory_size = 0;
+		uint32_t resident_mip = kNotResident; // finest level on the GPU
+		uint32_t tail_mip = 0;                // levels from here on are never evicted
+		VkFormat format = VK_FORMAT_UNDEFINED; // on the GPU, may differ from the container
+		uint64_t last_used = 0;
+		uint64_t evicted_frame = ~0ull;
+	};
+
+	void refreshBudget()
+	{
+		budget_ = config_.budget;
+		if ( !memory_budget_ext_ )
+		{
+			return;
+		}
+
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT heap_budget = {};
+		heap_budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2 properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties.pNext = &heap_budget;
+		vkGetPhysicalDeviceMemoryProperties2( physical_device_, &properties );
+
+		// what the largest device local heap has left, counting our own usage as ours
+		VkDeviceSize available = 0;
+		const auto & memory = properties.memoryProperties;
+		for ( uint32_t i = 0; i < memory.memoryHeapCount; ++i )
+		{
+			if ( !( memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ) )
+				continue;
+
+			VkDeviceSize others = heap_budget.heapUsage[i] > resident_bytes_ ? heap_budget.heapUsage[i] - resident_bytes_ : 0;
+			VkDeviceSize left = heap_budget.heapBudget[i] > others ? heap_budget.heapBudget[i] - others : 0;
+			available = std::max( available, left );
+		}
+
+		// leave headroom for the rest of the app
+		budget_ = std::min( budget_, available / 10 * 9 );
+	}
+
+	uint32_t findMemoryType( uint32_t type_filter, VkMemoryPropertyFlags props ) const
+	{
+		for ( uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i )
+		{
+			if ( ( type_filter & ( 1 << i ) )
+				 && ( memory_properties_.memoryTypes[i].propertyFlags & props ) == props )
+			{
+				return i;
+			}
+		}
+		return kNotResident;
+	}
+
+	/// \brief Bytes of level as uploaded, after any transcoding
+	VkDeviceSize uploadSize( const Texture & texture, uint32_t level ) const
+	{
+		const auto & mip = texture.container->mip( level );
+		return imageByteSize( texture.format, mip.width, mip.height );
+	}
+
+	/// \brief Approximate memory for levels [base, mipCount), drivers pad optimal tiling a little
+	VkDeviceSize estimateSize( const Texture & texture, uint32_t base ) const
+	{
+		VkDeviceSize size = 0;
+		for ( uint32_t level = base; level < texture.container->mipCount(); ++level )
+		{
+			size += uploadSize( texture, level );
+		}
+		return size;
+	}
+
+	/// \brief Drop the finest level of the least recently used texture
+	/// other than skip that was last used before before_frame
+	bool evictOne( uint32_t skip, uint64_t before_frame )
+	{
+		Texture * victim = nullptr;
+		for ( uint32_t id = 0; id < textures_.size(); ++id )
+		{
+			auto & texture = textures_[id];
+			if ( id == skip
+				 || texture.resident_mip >= texture.tail_mip
+				 || texture.last_used >= before_frame )
+			{
+				continue;
+			}
+			if ( victim == nullptr || texture.last_used < victim->last_used )
+			{
+				victim = &texture;
+			}
+		}
+
+		if ( victim == nullptr || !rebuild( *victim, victim->resident_mip + 1 ) )
+		{
+			return false;
+		}
+		victim->evicted_frame = frame_;
+		stats_.mips_evicted++;
+		return true;
+	}
+
+	VkCommandBuffer batchCommandBuffer()
+	{
+		if ( batch_ != VK_NULL_HANDLE )
+		{
+			return batch_;
+		}
+
+		while ( !submitted_.empty() && frame_sync_->isComplete( submitted_.front().first ) )
+		{
+			free_command_buffers_.push_back( submitted_.front().second );
+			submitted_.pop_front();
+		}
+
+		if ( free_command_buffers_.empty() )
+		{
+			VkCommandBufferAllocateInfo alloc_info = {};
+			alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			alloc_info.commandPool = command_pool_;
+			alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			alloc_info.commandBufferCount = 1;
+
+			VkCommandBuffer command_buffer;
+			if ( auto status = vkAllocateCommandBuffers( device_, &alloc_info, &command_buffer );
+				 status != VK_SUCCESS )
+			{
+				throw std::runtime_error( "Failed to allocate streaming command buffer! Status: " + std::to_string( status ) );
+			}
+			free_command_buffers_.push_back( command_buffer );
+		}
+
+		batch_ = free_command_buffers_.back();
+		free_command_buffers_.pop_back();
+		vkResetCommandBuffer( batch_, 0 );
+
+		VkCommandBufferBeginInfo begin = {};
+		begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer( batch_, &begin );
+		return batch_;
+	}
+
+	/// \brief Submit everything recorded since the last flush. Same queue as
+	/// the frames, so the barriers in the batch order it before their reads.
+	void flushBatch()
+	{
+		if ( batch_ == VK_NULL_HANDLE )
+		{
+			return;
+		}
+
+		vkEndCommandBuffer( batch_ );
+		auto point = frame_sync_->submit( queue_, QueueTrack::kTransfer, { batch_ }, {} );
+		submitted_.push_back( { point, batch_ } );
+		batch_ = VK_NULL_HANDLE;
+
+		for ( auto & staging : batch_staging_ )
+		{
+			staging.retire( *deletion_queue_, point );
+		}
+		batch_staging_.clear();
+	}
+
+	static void imageBarrier( VkCommandBuffer command_buffer,
+							  VkImage image,
+							  uint32_t level_count,
+							  VkImageLayout old_layout,
+							  VkImageLayout new_layout,
+							  VkAccessFlags src_access,
+							  VkAccessFlags dst_access,
+							  VkPipelineStageFlags src_stage,
+							  VkPipelineStageFlags dst_stage )
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = old_layout;
+		barrier.newLayout = new_layout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = level_count;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = src_access;
+		barrier.dstAccessMask = dst_access;
+
+		vkCmdPipelineBarrier( command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier );
+	}
+
+	/// \brief Recreate texture's image holding levels [new_base, mipCount).
+	/// Returns false, leaving the texture as it was, if memory runs out.
+	bool rebuild( Texture & texture, uint32_t new_base )
+	{
+		const auto & container = *texture.container;
+		uint32_t level_count = container.mipCount() - new_base;
+		const auto & base_mip = container.mip( new_base );
+
+		VkImageCreateInfo image_info = {};
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.format = texture.format;
+		image_info.extent = { base_mip.width, base_mip.height, 1 };
+		image_info.mipLevels = level_count;
+		image_info.arrayLayers = 1;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		UniqueImage image;
+		if ( vkCreateImage( device_, &image_info, nullptr, image.replace( device_ ) ) != VK_SUCCESS )
+		{
+			return false;
+		}
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements( device_, image, &requirements );
+
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = findMemoryType( requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+
+		UniqueDeviceMemory memory;
+		if ( alloc_info.memoryTypeIndex == kNotResident
+			 || vkAllocateMemory( device_, &alloc_info, nullptr, memory.replace( device_ ) ) != VK_SUCCESS )
+		{
+			// out of device memory: stay at the current residency and cap
+			// the budget so we stop asking
+			budget_ = std::min( budget_, resident_bytes_ );
+			return false;
+		}
+		vkBindImageMemory( device_, image, memory, 0 );
+
+		auto command_buffer = batchCommandBuffer();
+		imageBarrier( command_buffer, image, level_count,
+					  VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					  0, VK_ACCESS_TRANSFER_WRITE_BIT,
+					  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT );
+
+		bool has_old = texture.image && texture.resident_mip != kNotResident;
+		if ( has_old )
+		{
+			imageBarrier( command_buffer, texture.image, container.mipCount() - texture.resident_mip,
+						  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						  0, VK_ACCESS_TRANSFER_READ_BIT,
+						  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT );
+		}
+
+		// levels that have to come from the container
+		uint32_t upload_end = has_old ? std::max( new_base, std::min( texture.resident_mip, container.mipCount() ) ) : container.mipCount();
+		VkDeviceSize staging_size = 0;
+		for ( uint32_t level = new_base; level < upload_end; ++level )
+		{
+			staging_size = ( staging_size + 15 ) & ~VkDeviceSize( 15 );
+			staging_size += uploadSize( texture, level );
+		}
+
+		if ( staging_size > 0 )
+		{
+			auto staging = createStagingBuffer( staging_size );
+			auto copy_start = std::chrono::high_resolution_clock::now();
+
+			uint8_t * mapped;
+			vkMapMemory( device_, staging.memory, 0, staging_size, 0, reinterpret_cast<void**>( &mapped ) );
+			VkDeviceSize offset = 0;
+			std::vector<VkBufferImageCopy> regions;
+			for ( uint32_t level = new_base; level < upload_end; ++level )
+			{
+				const auto & mip = container.mip( level );
+				VkDeviceSize size = uploadSize( texture, level );
+				offset = ( offset + 15 ) & ~VkDeviceSize( 15 );
+				if ( texture.format == container.format() )
+				{
+					memcpy( mapped + offset, container.mipData( level ), size );
+				}
+				else
+				{
+					// straight into the mapped staging memory, no intermediate copy
+					auto transcode_start = std::chrono::high_resolution_clock::now();
+					transcodeRgba8( container.mipData( level ), mip.width, mip.height,
+									texture.format, mapped + offset, transcode_pool_ );
+					stats_.transcode_time += std::chrono::high_resolution_clock::now() - transcode_start;
+					stats_.pixels_transcoded += uint64_t( mip.width ) * mip.height;
+				}
+
+				VkBufferImageCopy region = {};
+				region.bufferOffset = offset;
+				region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.imageSubresource.mipLevel = level - new_base;
+				region.imageSubresource.baseArrayLayer = 0;
+				region.imageSubresource.layerCount = 1;
+				region.imageExtent = { mip.width, mip.height, 1 };
+				regions.push_back( region );
+
+				offset += size;
+				stats_.bytes_uploaded += size;
+				stats_.mips_uploaded++;
+			}
+			vkUnmapMemory( device_, staging.memory );
+			stats_.staging_time += std::chrono::high_resolution_clock::now() - copy_start;
+
+			vkCmdCopyBufferToImage( command_buffer, staging.buffer, image,
+									VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+									static_cast<uint32_t>( regions.size() ), regions.data() );
+			batch_staging_.push_back( std::move( staging ) );
+		}
+
+		if ( has_old )
+		{
+			std::vector<VkImageCopy> regions;
+			for ( uint32_t level = std::max( new_base, texture.resident_mip ); level < container.mipCount(); ++level )
+			{
+				const auto & mip = container.mip( level );
+				VkImageCopy region = {};
+				region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.srcSubresource.mipLevel = level - texture.resident_mip;
+				region.srcSubresource.layerCount = 1;
+				region.dstSubresource = region.srcSubresource;
+				region.dstSubresource.mipLevel = level - new_base;
+				region.extent = { mip.width, mip.height, 1 };
+				regions.push_back( region );
+			}
+			vkCmdCopyImage( command_buffer,
+							texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+							image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							static_cast<uint32_t>( regions.size() ), regions.data() );
+		}
+
+		imageBarrier( command_buffer, image, level_count,
+					  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					  VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+					  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT );
+
+		VkImageViewCreateInfo view_info = {};
+		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		view_info.image = image;
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.format = texture.format;
+		view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		view_info.subresourceRange.baseMipLevel = 0;
+		view_info.subresourceRange.levelCount = level_count;
+		view_info.subresourceRange.baseArrayLayer = 0;
+		view_info.subresourceRange.layerCount = 1;
+
+		UniqueImageView view;
+		if ( auto status = vkCreateImageView( device_, &view_info, nullptr, view.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create texture view! Status: " + std::to_string( status ) );
+		}
+
+		// the frame being recorded is the last one that can see the old image
+		auto last_use = frame_sync_->nextPoint( QueueTrack::kGraphics );
+		texture.view.retire( *deletion_queue_, last_use );
+		texture.image.retire( *deletion_queue_, last_use );
+		texture.memory.retire( *deletion_queue_, last_use );
+
+		resident_bytes_ = resident_bytes_ - texture.memory_size + requirements.size;
+		texture.image = std::move( image );
+		texture.memory = std::move( memory );
+		texture.view = std::move( view );
+		texture.memory_size = requirements.size;
+		texture.resident_mip = new_base;
+		stats_.rebuilds++;
+		return true;
+	}
+
+	BufferAllocation createStagingBuffer( VkDeviceSize size )
+	{
+		VkBufferCreateInfo buffer_info = {};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.size = size;
+		buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		BufferAllocation staging;
+		if ( auto status = vkCreateBuffer( device_, &buffer_info, nullptr, staging.buffer.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to create staging buffer!" );
+		}
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements( device_, staging.buffer, &requirements );
+
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = findMemoryType( requirements.memoryTypeBits,
+													 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+													 | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+		if ( auto status = vkAllocateMemory( device_, &alloc_info, nullptr, staging.memory.replace( device_ ) );
+			 status != VK_SUCCESS )
+		{
+			throw std::runtime_error( "Failed to allocate staging buffer memory!" );
+		}
+
+		vkBindBufferMemory( device_, staging.buffer, staging.memory, 0 );
+		staging.size = size;
+		return staging;
+	}
+
+	VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
+	VkDevice device_ = VK_NULL_HANDLE;
+	VkQueue queue_ = VK_NULL_HANDLE;
+	FrameSync * frame_sync_ = nullptr;
+	DeletionQueue * deletion_queue_ = nullptr;
+	ThreadPool * transcode_pool_ = nullptr;
+	VkPhysicalDeviceMemoryProperties memory_properties_ = {};
+	bool memory_budget_ext_ = false;
+
+	StreamingConfig config_;
+	VkDeviceSize budget_ = 0;
+	VkDeviceSize resident_bytes_ = 0;
+	uint64_t frame_ = 0;
+
+	VkCommandPool command_pool_ = VK_NULL_HANDLE;
+	VkCommandBuffer batch_ = VK_NULL_HANDLE;
+	std::vector<BufferAllocation> batch_staging_;
+	std::deque<std::pair<SyncPoint, VkCommandBuffer>> submitted_;
+	std::vector<VkCommandBuffer> free_command_buffers_;
+
+	VkSampler sampler_ = VK_NULL_HANDLE;
+	std::vector<Texture> textures_;
+	StreamingStats stats_;
+	std::chrono::high_resolution_clock::time_point start_time_;
+};
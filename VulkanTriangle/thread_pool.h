@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \brief Fixed set of worker threads draining a FIFO of jobs
+class ThreadPool {
+public:
+	explicit ThreadPool( size_t thread_count = 0 )
+	{
+		if ( thread_count == 0 )
+		{
+			// leave the main thread its own core
+			auto hardware_threads = std::thread::hardware_concurrency();
+			thread_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+		}
+
+		for ( size_t i = 0; i < thread_count; ++i )
+		{
+			workers_.emplace_back( [this]() { workerLoop(); } );
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			stopping_ = true;
+		}
+		wake_.notify_all();
+		for ( auto & worker : workers_ )
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool( const ThreadPool & ) = delete;
+	ThreadPool & operator=( const ThreadPool & ) = delete;
+
+	void submit( std::function<void()> job )
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			jobs_.push_back( std::move( job ) );
+		}
+		wake_.notify_one();
+	}
+
+	/// \brief Block until the queue is empty and every worker is idle
+	void waitIdle()
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		idle_.wait( lock, [this]() { return jobs_.empty() && busy_ == 0; } );
+	}
+
+	size_t threadCount() const { return workers_.size(); }
+
+private:
+	void workerLoop()
+	{
+		for ( ;; )
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock( mutex_ );
+				wake_.wait( lock, [this]() { return stopping_ || !jobs_.empty(); } );
+				if ( jobs_.empty() )
+				{
+					return;
+				}
+				job = std::move( jobs_.front() );
+				jobs_.pop_front();
+				busy_++;
+			}
+
+			job();
+
+			{
+				std::lock_guard<std::mutex> lock( mutex_ );
+				busy_--;
+			}
+			idle_.notify_all();
+		}
+	}
+
+	std::vector<std::thread> workers_;
+	std::deque<std::function<void()>> jobs_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable idle_;
+	size_t busy_ = 0;
+	bool stopping_ = false;
+};
+
+/// \brief Run fn( i ) for every i below count on the pool and the calling
+/// thread, return once all have run. The caller takes whatever the workers
+/// haven't picked up yet, so a pool busy with other jobs costs parallelism
+/// but never blocks. waitIdle() would wait for those other jobs too.
+inline void parallelFor( ThreadPool * pool, size_t count, const std::function<void( size_t )> & fn )
+{
+	struct State {
+		std::function<void( size_t )> fn;
+		size_t count = 0;
+		std::atomic<size_t> next{ 0 };
+		std::atomic<size_t> done{ 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	// Workers that start late only touch the shared state and find nothing left
+	auto state = std::make_shared<State>();
+	state->fn = fn;
+	state->count = count;
+	auto work = [state]() {
+		for ( size_t i = state->next++; i < state->count; i = state->next++ )
+		{
+			state->fn( i );
+			if ( ++state->done == state->count )
+			{
+				std::lock_guard<std::mutex> lock( state->mutex );
+				state->finished.notify_all();
+			}
+		}
+	};
+
+	size_t helpers = pool && count > 1 ? std::min( pool->threadCount(), count - 1 ) : 0;
+	for ( size_t i = 0; i < helpers; ++i )
+	{
+		pool->submit( work );
+	}
+	work();
+
+	std::unique_lock<std::mutex> lock( state->mutex );
+	state->finished.wait( lock, [&]() { return state->done == state->count; } );
+}
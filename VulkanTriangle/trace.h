@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/// \brief Renderer calls captured in a trace. Driver ops are replayed,
+/// effect ops are what the driver ops are expected to cause and are
+/// checked against the replay to catch divergence.
+enum class TraceOp : uint8_t {
+	kEnd = 0,
+	// driver ops
+	kDrawFrame = 1,     // recorded frame time in us
+	kResize = 2,        // width, height
+	// effect ops
+	kCreateBuffer = 16, // size, usage, memory properties
+	kCopyBuffer = 17,   // size
+	kCreateCommandBuffers = 18 // count
+};
+
+inline const char * traceOpName( TraceOp op )
+{
+	switch ( op )
+	{
+	case TraceOp::kEnd: return "end";
+	case TraceOp::kDrawFrame: return "drawFrame";
+	case TraceOp::kResize: return "resize";
+	case TraceOp::kCreateBuffer: return "createBuffer";
+	case TraceOp::kCopyBuffer: return "copyBuffer";
+	case TraceOp::kCreateCommandBuffers: return "createCommandBuffers";
+	}
+	return "unknown";
+}
+
+inline bool isTraceDriverOp( TraceOp op )
+{
+	return static_cast<uint8_t>( op ) < static_cast<uint8_t>( TraceOp::kCreateBuffer );
+}
+
+struct TraceRecord {
+	TraceOp op = TraceOp::kEnd;
+	std::vector<uint64_t> args;
+};
+
+/// \brief Records renderer calls to a compact binary trace, or reads one
+/// back for replay.
+///
+/// Layout: "VTRC", u32 version, then per call an op byte, an argument
+/// count byte and the arguments as LEB128 varints, ended by kEnd. A frame
+/// is typically 4 bytes. Replay drives the renderer from the driver ops
+/// on a fixed timestep, and every effect op the replay makes is matched
+/// against the next one in the trace, so a changed call sequence is
+/// reported at the first call that differs. Divergence is only a
+/// warning: traces recorded by older builds still replay their driver
+/// ops.
+class Trace {
+public:
+	/// Version of the file layout. Renderer changes alter the effect ops a
+	/// replay makes, which shows up as divergence, not as a new version.
+	static constexpr uint32_t kVersion = 1;
+
+	void startRecording( const std::string & path )
+	{
+		out_.open( path, std::ios::binary | std::ios::trunc );
+		if ( !out_ )
+		{
+			throw std::runtime_error( "Failed to create trace! " + path );
+		}
+		out_.write( "VTRC", 4 );
+		out_.write( reinterpret_cast<const char *>( &kVersion ), sizeof( kVersion ) );
+		written_ = 8;
+		recording_ = true;
+	}
+
+	void startReplay( const std::string & path )
+	{
+		file_ = MappedFile( path );
+		uint32_t version = 0;
+		if ( file_.size() < 8 || memcmp( file_.data(), "VTRC", 4 ) != 0 )
+		{
+			throw std::runtime_error( "Not a trace! " + path );
+		}
+		memcpy( &version, file_.data() + 4, sizeof( version ) );
+		if ( version == 0 || version > kVersion )
+		{
+			throw std::runtime_error( "Unsupported trace version " + std::to_string( version ) );
+		}
+		cursor_ = 8;
+		replaying_ = true;
+	}
+
+	bool recording() const { return recording_; }
+	bool replaying() const { return replaying_; }
+
+	/// \brief A driver op, only written while recording
+	void record( TraceOp op, std::initializer_list<uint64_t> args )
+	{
+		if ( recording_ )
+		{
+			write( op, args );
+		}
+	}
+
+	/// \brief An effect op: written while recording, matched against the
+	/// trace while replaying
+	void check( TraceOp op, std::initializer_list<uint64_t> args )
+	{
+		if ( recording_ )
+		{
+			write( op, args );
+			return;
+		}
+		if ( !replaying_ )
+		{
+			return;
+		}
+
+		size_t position = cursor_;
+		TraceRecord expected;
+		if ( !isTraceDriverOp( peek() ) )
+		{
+			read( expected );
+		}
+		if ( expected.op != op || !std::equal( args.begin(), args.end(), expected.args.begin(), expected.args.end() ) )
+		{
+			mismatch( position, op, expected );
+		}
+		checked_++;
+	}
+
+	/// \brief Next driver op for the replay loop. Effect ops the replay
+	/// didn't make are skipped and counted. False at the end of the trace.
+	bool nextDriver( TraceRecord & record )
+	{
+		for ( ;; )
+		{
+			size_t position = cursor_;
+			read( record );
+			if ( record.op == TraceOp::kEnd )
+			{
+				return false;
+			}
+			if ( isTraceDriverOp( record.op ) )
+			{
+				return true;
+			}
+			mismatch( position, TraceOp::kEnd, record );
+		}
+	}
+
+	uint64_t checked() const { return checked_; }
+	uint64_t mismatches() const { return mismatches_; }
+	uint64_t bytes() const { return recording_ ? written_ : file_.size(); }
+
+	void finish()
+	{
+		if ( recording_ )
+		{
+			write( TraceOp::kEnd, {} );
+			out_.close();
+			recording_ = false;
+			std::cout << "Trace: " << written_ << " bytes" << std::endl;
+		}
+	}
+
+private:
+	void write( TraceOp op, std::initializer_list<uint64_t> args )
+	{
+		out_.put( static_cast<char>( op ) );
+		out_.put( static_cast<char>( args.size() ) );
+		for ( uint64_t value : args )
+		{
+			do
+			{
+				uint8_t byte = value & 0x7F;
+				value >>= 7;
+				out_.put( static_cast<char>( value ? byte | 0x80 : byte ) );
+				written_++;
+			} while ( value );
+		}
+		written_ += 2;
+	}
+
+	TraceOp peek() const
+	{
+		return cursor_ < file_.size() ? static_cast<TraceOp>( file_.data()[cursor_] ) : TraceOp::kEnd;
+	}
+
+	void read( TraceRecord & record )
+	{
+		record.args.clear();
+		if ( cursor_ + 2 > file_.size() )
+		{
+			record.op = TraceOp::kEnd;
+			return;
+		}
+
+		record.op = static_cast<TraceOp>( file_.data()[cursor_++] );
+		uint8_t count = file_.data()[cursor_++];
+		for ( uint8_t i = 0; i < count; ++i )
+		{
+			uint64_t value = 0;
+			for ( int shift = 0; cursor_ < file_.size(); shift += 7 )
+			{
+				uint8_t byte = file_.data()[cursor_++];
+				value |= uint64_t( byte & 0x7F ) << shift;
+				if ( !( byte & 0x80 ) )
+					break;
+			}
+			record.args.push_back( value );
+		}
+	}
+
+	/// \brief Only the first divergence is printed, the rest follow from it
+	void mismatch( size_t position, TraceOp made, const TraceRecord & expected )
+	{
+		if ( mismatches_++ == 0 )
+		{
+			std::cerr << "Warning: replay diverged at trace offset " << position
+				<< ": made " << traceOpName( made )
+				<< ", trace has " << traceOpName( expected.op )
+				<< ( made == expected.op ? " with other arguments" : "" ) << std::endl;
+		}
+	}
+
+	std::ofstream out_;
+	MappedFile file_;
+	size_t cursor_ = 0;
+	bool recording_ = false;
+	bool replaying_ = false;
+	uint64_t written_ = 0;
+	uint64_t checked_ = 0;
+	uint64_t mismatches_ = 0;
+};
@@ -1,11 +1,18 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Set per pipeline variant, see TriFragConstant
+layout(constant_id=0) const float kAlpha = 1.0;
+
+// Streamed by TextureStreamer, only the resident mips are in the view
+layout(binding=1) uniform sampler2D tex;
+
 layout(location=0) in vec3 fragColor;
+layout(location=1) in vec2 fragUV;
 
 layout(location=0) out vec4 outColor;
 
 void main()
 {
-	outColor = vec4(fragColor, 1.0);
+	outColor = vec4(fragColor * texture(tex, fragUV).rgb, kAlpha);
 }
\ No newline at end of file
@@ -2,15 +2,26 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout(binding=0) uniform UniformBufferObject {
-	mat4 model;
 	mat4 view;
 	mat4 proj;
 } ubo;
 
+layout(push_constant) uniform PerDraw {
+	mat4 model;
+} per_draw;
+
 layout(location=0) in vec2 inPosition;
 layout(location=1) in vec3 inColor;
+layout(location=2) in vec2 inUV;
+
+// Per instance, placed in the scene before the PerDraw transform
+layout(location=3) in vec4 inInstance0;
+layout(location=4) in vec4 inInstance1;
+layout(location=5) in vec4 inInstance2;
+layout(location=6) in vec4 inInstance3;
 
 layout(location=0) out vec3 fragColor;
+layout(location=1) out vec2 fragUV;
 
 out gl_PerVertex {
 	vec4 gl_Position;
@@ -18,6 +29,8 @@ out gl_PerVertex {
 
 void main()
 {
-	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
+	mat4 instance = mat4(inInstance0, inInstance1, inInstance2, inInstance3);
+	gl_Position = ubo.proj * ubo.view * per_draw.model * instance * vec4(inPosition, 0.0, 1.0);
 	fragColor = inColor;
+	fragUV = inUV;
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <utility>
+
+#include "frame_sync.h"
+
+/// \brief Move-only owner of a device child object.
+///
+/// Destroys the handle when it goes out of scope or is reset. Objects
+/// the GPU may still be reading go through retire() instead, which
+/// hands them to a DeletionQueue keyed on the last frame that used them.
+template <typename Handle,
+		  void ( VKAPI_PTR *Destroy )( VkDevice, Handle, const VkAllocationCallbacks* )>
+class UniqueHandle {
+public:
+	UniqueHandle() = default;
+
+	UniqueHandle( VkDevice device, Handle handle )
+		: device_( device ), handle_( handle )
+	{
+	}
+
+	~UniqueHandle()
+	{
+		reset();
+	}
+
+	UniqueHandle( const UniqueHandle & ) = delete;
+	UniqueHandle & operator=( const UniqueHandle & ) = delete;
+
+	UniqueHandle( UniqueHandle && other ) noexcept
+		: device_( other.device_ ), handle_( other.release() )
+	{
+	}
+
+	UniqueHandle & operator=( UniqueHandle && other ) noexcept
+	{
+		if ( this != &other )
+		{
+			reset();
+			device_ = other.device_;
+			handle_ = other.release();
+		}
+		return *this;
+	}
+
+	Handle get() const { return handle_; }
+	operator Handle() const { return handle_; }
+	explicit operator bool() const { return handle_ != VK_NULL_HANDLE; }
+
+	/// \brief Pointer for vkCreate* out parameters, destroys any current handle
+	Handle * replace( VkDevice device )
+	{
+		reset();
+		device_ = device;
+		return &handle_;
+	}
+
+	/// \brief Give up ownership without destroying
+	Handle release()
+	{
+		auto handle = handle_;
+		handle_ = VK_NULL_HANDLE;
+		return handle;
+	}
+
+	void reset()
+	{
+		if ( handle_ != VK_NULL_HANDLE )
+		{
+			Destroy( device_, handle_, nullptr );
+			handle_ = VK_NULL_HANDLE;
+		}
+	}
+
+	/// \brief Destroy once the GPU has passed point, without stalling
+	void retire( DeletionQueue & queue, const SyncPoint & point )
+	{
+		if ( handle_ == VK_NULL_HANDLE )
+		{
+			return;
+		}
+
+		auto device = device_;
+		auto handle = release();
+		queue.push( point, [device, handle]() { Destroy( device, handle, nullptr ); } );
+	}
+
+private:
+	VkDevice device_ = VK_NULL_HANDLE;
+	Handle handle_ = VK_NULL_HANDLE;
+};
+
+using UniqueBuffer = UniqueHandle<VkBuffer, vkDestroyBuffer>;
+using UniqueDeviceMemory = UniqueHandle<VkDeviceMemory, vkFreeMemory>;
+using UniqueImage = UniqueHandle<VkImage, vkDestroyImage>;
+using UniqueImageView = UniqueHandle<VkImageView, vkDestroyImageView>;
+using UniqueSampler = UniqueHandle<VkSampler, vkDestroySampler>;
+using UniquePipeline = UniqueHandle<VkPipeline, vkDestroyPipeline>;
+using UniquePipelineLayout = UniqueHandle<VkPipelineLayout, vkDestroyPipelineLayout>;
+using UniqueShaderModule = UniqueHandle<VkShaderModule, vkDestroyShaderModule>;
+using UniqueFramebuffer = UniqueHandle<VkFramebuffer, vkDestroyFramebuffer>;
+using UniqueRenderPass = UniqueHandle<VkRenderPass, vkDestroyRenderPass>;
+using UniqueQueryPool = UniqueHandle<VkQueryPool, vkDestroyQueryPool>;
+
+/// \brief A buffer and the memory bound to it, retired together
+struct BufferAllocation {
+	UniqueBuffer buffer;
+	UniqueDeviceMemory memory;
+	VkDeviceSize size = 0;
+
+	void reset()
+	{
+		buffer.reset();
+		memory.reset();
+		size = 0;
+	}
+
+	void retire( DeletionQueue & queue, const SyncPoint & point )
+	{
+		buffer.retire( queue, point );
+		memory.retire( queue, point );
+		size = 0;
+	}
+};